@@ -0,0 +1,400 @@
+/********************************************************
+ * ADO.NET 2.0 Data Provider for SQLite Version 3.X
+ *
+ * Released to the public domain, use at your own risk!
+ ********************************************************/
+
+/*
+** Measures what the page codec in "crypt.c" costs.  The same workloads are run
+** against a database without a key and against one with a key, for each page
+** size from 1 KiB to 64 KiB:
+**
+**   insert -- bulk insert of rows into a new database, in one transaction;
+**   scan   -- sequential scan of the whole table;
+**   lookup -- random point lookups by rowid.
+**
+** The page cache is kept small so that nearly every page read goes through the
+** codec.  The number of pages read and written is taken from the cache miss and
+** cache write counters of the connection.  For each run, the pages per second,
+** the megabytes per second, the process CPU time and, for the encrypted runs,
+** the share of that CPU time spent in sqlite3Codec() are reported.  The pager
+** of each encrypted connection calls sqlite3Codec() through BenchTimedCodec(),
+** which adds up the time spent in every call.  The codec only computes, so on
+** this single thread that time is CPU time, apart from the few tens of
+** nanoseconds it takes to read the clock twice per page.
+**
+** Finally, encrypted databases are opened, keyed, read and closed over and over
+** on 1, 2, 4 and 8 threads at once, to show how opening scales with the number
+** of threads, i.e. how much the threads contend in the codec.  This is only
+** meaningful on a machine with at least as many cores as threads.
+**
+** The interop layer is compiled into this program, see the script
+** "Setup/compile-codec-benchmark.sh".
+*/
+
+#include "../win/interop.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#endif
+
+#define BENCH_ROW_SIZE     200                /* Bytes in each row inserted */
+#define BENCH_CACHE_PAGES  16                 /* Size of the page cache, in pages */
+#define BENCH_OPEN_THREADS 8                  /* Most threads opening databases at once */
+#define BENCH_OPEN_SECONDS 2.0                /* How long each number of threads keeps opening */
+
+static const char benchKey[] = "codec benchmark";
+
+typedef struct _BENCHRESULT
+{
+  double        dWall;    /* Elapsed time, in seconds */
+  double        dCpu;     /* Process CPU time, in seconds */
+  double        dCodec;   /* Time spent in sqlite3Codec(), in seconds */
+  sqlite3_int64 nPages;   /* Pages read or written */
+} BENCHRESULT;
+
+/* Time spent in sqlite3Codec() by the connections of BenchOpen() so far.  The
+** workloads run on one thread, so it needs no locking.
+*/
+static double benchCodecTime = 0.0;
+
+/* Returns a monotonic time, in seconds */
+static double BenchWallTime(void)
+{
+#if defined(_WIN32)
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+/* Returns the CPU time used by the process so far, in seconds */
+static double BenchCpuTime(void)
+{
+#if defined(_WIN32)
+  FILETIME ftCreate, ftExit, ftKernel, ftUser;
+  GetProcessTimes(GetCurrentProcess(), &ftCreate, &ftExit, &ftKernel, &ftUser);
+  return ((((sqlite3_uint64)ftKernel.dwHighDateTime << 32) | ftKernel.dwLowDateTime) +
+          (((sqlite3_uint64)ftUser.dwHighDateTime << 32) | ftUser.dwLowDateTime)) / 1e7;
+#else
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+         ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+/* Reports an error and exits if rc is not one of the expected result codes */
+static void BenchCheck(sqlite3 *db, int rc, const char *zWhat)
+{
+  if (rc == SQLITE_OK || rc == SQLITE_ROW || rc == SQLITE_DONE) return;
+
+  fprintf(stderr, "%s failed: %s\n", zWhat, db ? sqlite3_errmsg(db) : sqlite3_errstr(rc));
+  exit(1);
+}
+
+static void BenchExec(sqlite3 *db, const char *zSql)
+{
+  BenchCheck(db, sqlite3_exec(db, zSql, NULL, NULL, NULL), zSql);
+}
+
+/* Calls sqlite3Codec() and adds the time it took to benchCodecTime */
+static void *BenchTimedCodec(void *pArg, void *data, Pgno nPageNum, int nMode)
+{
+  double dStart = BenchWallTime();
+  void *pResult = sqlite3Codec(pArg, data, nPageNum, nMode);
+
+  benchCodecTime += BenchWallTime() - dStart;
+  return pResult;
+}
+
+/* Makes the pager of a keyed connection call the codec through
+** BenchTimedCodec().  Only sqlite3_key() and sqlite3_rekey() install the codec,
+** so it stays installed for the life of the connection.
+*/
+static void BenchTimeCodec(sqlite3 *db)
+{
+  Pager *pPager = sqlite3BtreePager(db->aDb[0].pBt);
+
+  if (pPager->xCodec != sqlite3Codec)
+  {
+    fprintf(stderr, "cannot time the codec\n");
+    exit(1);
+  }
+  pPager->xCodec = BenchTimedCodec;
+}
+
+/* Opens the database, with the benchmark key if bEncrypt is non-zero */
+static sqlite3 *BenchOpen(const char *zFile, int bEncrypt)
+{
+  sqlite3 *db = NULL;
+  char zSql[64];
+
+  BenchCheck(db, sqlite3_open(zFile, &db), "open");
+  if (bEncrypt)
+  {
+    BenchCheck(db, sqlite3_key(db, benchKey, sizeof(benchKey) - 1), "key");
+    BenchTimeCodec(db);
+  }
+
+  sqlite3_snprintf(sizeof(zSql), zSql, "PRAGMA cache_size=%d;", BENCH_CACHE_PAGES);
+  BenchExec(db, zSql);
+  return db;
+}
+
+/* Returns the number of pages read and written by the connection so far */
+static sqlite3_int64 BenchPageCount(sqlite3 *db)
+{
+  int nMiss = 0, nWrite = 0, nHighwater;
+
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &nMiss, &nHighwater, 0);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_WRITE, &nWrite, &nHighwater, 0);
+  return (sqlite3_int64)nMiss + nWrite;
+}
+
+static void BenchStart(BENCHRESULT *pResult, sqlite3 *db)
+{
+  pResult->nPages = -BenchPageCount(db);
+  pResult->dCodec = -benchCodecTime;
+  pResult->dCpu = -BenchCpuTime();
+  pResult->dWall = -BenchWallTime();
+}
+
+static void BenchStop(BENCHRESULT *pResult, sqlite3 *db)
+{
+  pResult->dWall += BenchWallTime();
+  pResult->dCpu += BenchCpuTime();
+  pResult->dCodec += benchCodecTime;
+  pResult->nPages += BenchPageCount(db);
+}
+
+/* Creates the database and inserts nRows rows in one transaction */
+static void BenchInsert(const char *zFile, int bEncrypt, int nPageSize, int nRows, BENCHRESULT *pResult)
+{
+  sqlite3 *db;
+  sqlite3_stmt *pStmt = NULL;
+  char zSql[64];
+  int i;
+
+  remove(zFile);
+  db = BenchOpen(zFile, bEncrypt);
+
+  sqlite3_snprintf(sizeof(zSql), zSql, "PRAGMA page_size=%d;", nPageSize);
+  BenchExec(db, zSql);
+
+  BenchStart(pResult, db);
+  BenchExec(db, "BEGIN; CREATE TABLE t1(id INTEGER PRIMARY KEY, x BLOB);");
+  sqlite3_snprintf(sizeof(zSql), zSql, "INSERT INTO t1 (x) VALUES(randomblob(%d));", BENCH_ROW_SIZE);
+  BenchCheck(db, sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL), "prepare");
+  for (i = 0; i < nRows; i++)
+  {
+    BenchCheck(db, sqlite3_step(pStmt), "insert");
+    sqlite3_reset(pStmt);
+  }
+  sqlite3_finalize(pStmt);
+  BenchExec(db, "COMMIT;");
+  BenchStop(pResult, db);
+
+  sqlite3_close(db);
+}
+
+/* Reads every row of the table */
+static void BenchScan(const char *zFile, int bEncrypt, BENCHRESULT *pResult)
+{
+  sqlite3 *db = BenchOpen(zFile, bEncrypt);
+
+  BenchStart(pResult, db);
+  BenchExec(db, "SELECT SUM(length(x)) FROM t1;");
+  BenchStop(pResult, db);
+
+  sqlite3_close(db);
+}
+
+/* Reads nLookups rows chosen at random */
+static void BenchLookup(const char *zFile, int bEncrypt, int nRows, int nLookups, BENCHRESULT *pResult)
+{
+  sqlite3 *db = BenchOpen(zFile, bEncrypt);
+  sqlite3_stmt *pStmt = NULL;
+  unsigned int r;
+  int i;
+
+  BenchCheck(db, sqlite3_prepare_v2(db, "SELECT x FROM t1 WHERE id=?;", -1, &pStmt, NULL), "prepare");
+
+  BenchStart(pResult, db);
+  for (i = 0; i < nLookups; i++)
+  {
+    sqlite3_randomness(sizeof(r), &r);
+    sqlite3_bind_int(pStmt, 1, (int)(r % (unsigned int)nRows) + 1);
+    BenchCheck(db, sqlite3_step(pStmt), "lookup");
+    sqlite3_reset(pStmt);
+  }
+  BenchStop(pResult, db);
+
+  sqlite3_finalize(pStmt);
+  sqlite3_close(db);
+}
+
+typedef struct _BENCHOPENER
+{
+  const char   *zFile;    /* Database to open */
+  volatile int *pbStop;   /* Set when the thread is to stop */
+  sqlite3_int64 nOpens;   /* Databases opened by the thread */
+} BENCHOPENER;
+
+/* Opens the encrypted database until told to stop.  Reading the schema makes
+** the codec derive the key for each connection.
+*/
+#if defined(_WIN32)
+static DWORD WINAPI BenchOpenThread(LPVOID pArg)
+#else
+static void *BenchOpenThread(void *pArg)
+#endif
+{
+  BENCHOPENER *pOpener = (BENCHOPENER *)pArg;
+
+  while (!*pOpener->pbStop)
+  {
+    sqlite3 *db = NULL;
+
+    BenchCheck(db, sqlite3_open_v2(pOpener->zFile, &db, SQLITE_OPEN_READONLY, NULL), "open");
+    BenchCheck(db, sqlite3_key(db, benchKey, sizeof(benchKey) - 1), "key");
+    BenchExec(db, "SELECT COUNT(*) FROM sqlite_master;");
+    sqlite3_close(db);
+    pOpener->nOpens++;
+  }
+
+  return 0;
+}
+
+/* Returns the number of encrypted databases opened per second by nThreads
+** threads at once
+*/
+static double BenchOpenRate(const char *zFile, int nThreads)
+{
+  BENCHOPENER aOpener[BENCH_OPEN_THREADS];
+#if defined(_WIN32)
+  HANDLE aThread[BENCH_OPEN_THREADS];
+#else
+  pthread_t aThread[BENCH_OPEN_THREADS];
+#endif
+  volatile int bStop = 0;
+  sqlite3_int64 nOpens = 0;
+  double dWall, dStop;
+  int i;
+
+  dWall = BenchWallTime();
+  for (i = 0; i < nThreads; i++)
+  {
+    aOpener[i].zFile = zFile;
+    aOpener[i].pbStop = &bStop;
+    aOpener[i].nOpens = 0;
+#if defined(_WIN32)
+    aThread[i] = CreateThread(NULL, 0, BenchOpenThread, &aOpener[i], 0, NULL);
+    if (!aThread[i])
+#else
+    if (pthread_create(&aThread[i], NULL, BenchOpenThread, &aOpener[i]) != 0)
+#endif
+    {
+      fprintf(stderr, "cannot create thread\n");
+      exit(1);
+    }
+  }
+
+  dStop = dWall + BENCH_OPEN_SECONDS;
+  while (BenchWallTime() < dStop)
+  {
+#if defined(_WIN32)
+    Sleep(10);
+#else
+    usleep(10000);
+#endif
+  }
+  bStop = 1;
+
+  for (i = 0; i < nThreads; i++)
+  {
+#if defined(_WIN32)
+    WaitForSingleObject(aThread[i], INFINITE);
+    CloseHandle(aThread[i]);
+#else
+    pthread_join(aThread[i], NULL);
+#endif
+    nOpens += aOpener[i].nOpens;
+  }
+  dWall = BenchWallTime() - dWall;
+
+  return (double)nOpens / dWall;
+}
+
+static void BenchReport(int nPageSize, const char *zWorkload, int bEncrypt, const BENCHRESULT *pResult)
+{
+  double dWall = pResult->dWall > 0 ? pResult->dWall : 1e-9;
+  double dPages = (double)pResult->nPages;
+
+  printf("%6d  %-7s %-6s %12.0f %10.1f %9.3f", nPageSize, zWorkload,
+         bEncrypt ? "key" : "none", dPages / dWall,
+         dPages * nPageSize / dWall / (1024.0 * 1024.0), pResult->dCpu);
+
+  if (bEncrypt && pResult->dCpu > 0)
+    printf(" %7.1f%%", 100.0 * pResult->dCodec / pResult->dCpu);
+
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  const char *zFile = argc > 1 ? argv[1] : "codecbench.db";
+  int nRows = argc > 2 ? atoi(argv[2]) : 50000;
+  int nLookups = argc > 3 ? atoi(argv[3]) : 20000;
+  int nPageSize;
+  int nThreads;
+  int bEncrypt;
+
+  if (nRows <= 0 || nLookups <= 0)
+  {
+    fprintf(stderr, "usage: %s ?file? ?rows? ?lookups?\n", argv[0]);
+    return 1;
+  }
+
+  printf("%6s  %-7s %-6s %12s %10s %9s %8s\n", "page", "test", "key", "pages/s", "MB/s", "cpu (s)", "codec");
+
+  for (nPageSize = 1024; nPageSize <= 65536; nPageSize *= 2)
+  {
+    for (bEncrypt = 0; bEncrypt < 2; bEncrypt++)
+    {
+      BENCHRESULT insert, scan, lookup;
+
+      BenchInsert(zFile, bEncrypt, nPageSize, nRows, &insert);
+      BenchScan(zFile, bEncrypt, &scan);
+      BenchLookup(zFile, bEncrypt, nRows, nLookups, &lookup);
+
+      BenchReport(nPageSize, "insert", bEncrypt, &insert);
+      BenchReport(nPageSize, "scan", bEncrypt, &scan);
+      BenchReport(nPageSize, "lookup", bEncrypt, &lookup);
+    }
+  }
+
+  /* The last database is encrypted and uses the largest page size, which does
+  ** not matter here because only page 1 is read
+  */
+  printf("\n%7s %12s\n", "threads", "opens/s");
+  for (nThreads = 1; nThreads <= BENCH_OPEN_THREADS; nThreads *= 2)
+    printf("%7d %12.0f\n", nThreads, BenchOpenRate(zFile, nThreads));
+
+  remove(zFile);
+  return 0;
+}
@@ -90,7 +90,9 @@ Original code 2006 June 05 by relicoder.
 */
 
 /* #include "config.h" */
+#if defined(_WIN32)
 #include <windows.h>
+#endif
 
 /* #define COMPILE_SQLITE_EXTENSIONS_AS_LOADABLE_MODULE */
 
@@ -148,56 +150,15 @@ typedef unsigned long int uint32_t;
 typedef signed long long int int64_t;
 typedef unsigned long long int uint64_t;
 
-/*
-** Simple binary tree implementation to use in median, mode and quartile calculations
-** Tree is not necessarily balanced. That would require something like red&black trees of AVL
-*/
-
-typedef int(*cmp_func)(const void *, const void *);
-typedef void(*map_iterator)(void*, int64_t, void*);
-
-typedef struct node{
-  struct node *l;
-  struct node *r;
-  void* data;
-  int64_t count;
-} node;
-
-typedef struct map{
-  node *base;
-  cmp_func cmp;
-  short free;
-} map;
-
-/*
-** creates a map given a comparison function
-*/
-map map_make(cmp_func cmp);
-
-/*
-** inserts the element e into map m
-*/
-void map_insert(map *m, void *e);
-
-/*
-** executes function iter over all elements in the map, in key increasing order
-*/
-void map_iterate(map *m, map_iterator iter, void* p);
-
-/*
-** frees all memory used by a map
-*/
-void map_destroy(map *m);
-
 /*
 ** compares 2 integers
-** to use with map_make
+** to use with qsort
 */
 int int_cmp(const void *a, const void *b);
 
 /*
 ** compares 2 doubles
-** to use with map_make
+** to use with qsort
 */
 int double_cmp(const void *a, const void *b);
 
@@ -1356,25 +1317,37 @@ struct StdevCtx {
   i64 cnt;          /* number of elements */
 };
 
+/*
+** One slot of the hash table used to compute mode()
+*/
+typedef struct ModeSlot ModeSlot;
+struct ModeSlot {
+  i64 key;            /* the value, or the bits of the double value */
+  i64 count;          /* number of occurrences, 0 if the slot is empty */
+};
+
 /*
 ** An instance of the following structure holds the context of a
-** mode() or median() aggregate computation.
-** Depends on structures defined in map.c (see map & map)
+** mode(), median() or quartile aggregate computation.
 ** These aggregate functions only work for integers and floats although
 ** they could be made to work for strings. This is usually considered meaningless.
 ** Only usuall order (for median), no use of collation functions (would this even make sense?)
+**
+** The type of the first non-NULL value decides whether the values are kept
+** as integers or as doubles.  median() and the quartiles keep every value in
+** a[], which is grown by doubling with sqlite3_realloc() and sorted once at
+** the end.  mode() keeps each distinct value once, with its number of
+** occurrences, in aSlot[], an open-addressing hash table with linear probing.
 */
 typedef struct ModeCtx ModeCtx;
 struct ModeCtx {
-  i64 riM;            /* integer value found so far */
-  double rdM;         /* double value found so far */
   i64 cnt;            /* number of elements so far */
-  double pcnt;        /* number of elements smaller than a percentile */
-  i64 mcnt;           /* maximum number of occurrences (for mode) */
-  i64 mn;             /* number of occurrences (for mode and percentiles) */
   i64 is_double;      /* whether the computation is being done for doubles (>0) or integers (=0) */
-  map* m;             /* map structure used for the computation */
-  int done;           /* whether the answer has been found */
+  i64 nAlloc;         /* number of elements allocated in a[] (for percentiles) */
+  void *a;            /* i64 or double elements so far (for percentiles) */
+  i64 nSlot;          /* size of aSlot[], a power of two (for mode) */
+  i64 nUsed;          /* number of distinct values in aSlot[] (for mode) */
+  ModeSlot *aSlot;    /* distinct values and their number of occurrences (for mode) */
 };
 
 /*
@@ -1399,162 +1372,222 @@ static void varianceStep(sqlite3_context *context, int argc, sqlite3_value **arg
 }
 
 /*
-** called for each value received during a calculation of mode of median
+** returns the context of a mode, median or quartile computation, deciding
+** from the first non-NULL value whether integers or doubles are kept, or 0
+** if the value is NULL
 */
-static void modeStep(sqlite3_context *context, int argc, sqlite3_value **argv){
+static ModeCtx *modeContext(sqlite3_context *context, sqlite3_value *value){
   ModeCtx *p;
-  i64 xi=0;
-  double xd=0.0;
-  i64 *iptr;
-  double *dptr;
   int type;
 
-  assert( argc==1 );
-  type = sqlite3_value_numeric_type(argv[0]);
+  type = sqlite3_value_numeric_type(value);
 
   if( type == SQLITE_NULL)
-    return;
+    return 0;
 
   p = sqlite3_aggregate_context(context, sizeof(*p));
 
-  if( 0==(p->m) ){
-    p->m = calloc(1, sizeof(map));
-    if( type==SQLITE_INTEGER ){
-      /* map will be used for integers */
-      *(p->m) = map_make(int_cmp);
-      p->is_double = 0;
-    }else{
-      p->is_double = 1;
-      /* map will be used for doubles */
-      *(p->m) = map_make(double_cmp);
-    }
+  if( p && 0==p->cnt ){
+    p->is_double = type!=SQLITE_INTEGER;
   }
+  return p;
+}
 
-  ++(p->cnt);
+/*
+** returns the hash table key of a value: the integer itself, or the bits of
+** the double, with -0.0 taken to be 0.0 as they compare equal
+*/
+static i64 modeKey(ModeCtx *p, sqlite3_value *value){
+  double xd;
+  i64 key;
 
-  if( 0==p->is_double ){
-    xi = sqlite3_value_int64(argv[0]);
-    iptr = (i64*)calloc(1,sizeof(i64));
-    *iptr = xi;
-    map_insert(p->m, iptr);
-  }else{
-    xd = sqlite3_value_double(argv[0]);
-    dptr = (double*)calloc(1,sizeof(double));
-    *dptr = xd;
-    map_insert(p->m, dptr);
+  if( 0==p->is_double )
+    return sqlite3_value_int64(value);
+
+  xd = sqlite3_value_double(value);
+  if( xd==0.0 )
+    xd = 0.0;
+  memcpy(&key, &xd, sizeof(key));
+  return key;
+}
+
+/*
+** returns the slot of aSlot[] that holds key, or the empty slot where it
+** should be added
+*/
+static ModeSlot *modeLookup(ModeSlot *aSlot, i64 nSlot, i64 key){
+  uint64_t h = (uint64_t)key * 0x9e3779b97f4a7c15ULL;
+  i64 i = (i64)((h ^ (h>>32)) & (uint64_t)(nSlot-1));
+
+  while( aSlot[i].count>0 && aSlot[i].key!=key ){
+    i = (i+1) & (nSlot-1);
   }
+  return &aSlot[i];
 }
 
 /*
-**  Auxiliary function that iterates all elements in a map and finds the mode
-**  (most frequent value)
+** doubles the size of the mode hash table, returns SQLITE_NOMEM if it
+** cannot be allocated
 */
-static void modeIterate(void* e, i64 c, void* pp){
-  i64 ei;
-  double ed;
-  ModeCtx *p = (ModeCtx*)pp;
-
-  if( 0==p->is_double ){
-    ei = *(int*)(e);
-
-	if( p->mcnt==c ){
-      ++p->mn;
-    }else if( p->mcnt<c ){
-      p->riM = ei;
-      p->mcnt = c;
-	  p->mn=1;
-    }
-  }else{
-    ed = *(double*)(e);
-
-	if( p->mcnt==c ){
-      ++p->mn;
-    }else if(p->mcnt<c){
-      p->rdM = ed;
-      p->mcnt = c;
-	  p->mn=1;
+static int modeGrow(ModeCtx *p){
+  i64 nSlot = p->nSlot ? p->nSlot*2 : 16;
+  ModeSlot *aSlot;
+  i64 i;
+
+  if( nSlot*sizeof(ModeSlot) > 0x7fffffff )
+    return SQLITE_NOMEM;
+  aSlot = sqlite3_malloc((int)(nSlot*sizeof(ModeSlot)));
+  if( 0==aSlot )
+    return SQLITE_NOMEM;
+  memset(aSlot, 0, (size_t)(nSlot*sizeof(ModeSlot)));
+
+  for(i=0; i<p->nSlot; i++){
+    if( p->aSlot[i].count>0 ){
+      *modeLookup(aSlot, nSlot, p->aSlot[i].key) = p->aSlot[i];
     }
   }
+  sqlite3_free(p->aSlot);
+  p->aSlot = aSlot;
+  p->nSlot = nSlot;
+  return SQLITE_OK;
 }
 
 /*
-**  Auxiliary function that iterates all elements in a map and finds the median
-**  (the value such that the number of elements smaller is equal the the number of
-**  elements larger)
+** called for each value received during a calculation of mode
 */
-static void medianIterate(void* e, i64 c, void* pp){
-  i64 ei;
-  double ed;
-  double iL;
-  double iR;
-  int il;
-  int ir;
-  ModeCtx *p = (ModeCtx*)pp;
-
-  if(p->done>0)
+static void modeStep(sqlite3_context *context, int argc, sqlite3_value **argv){
+  ModeCtx *p;
+  ModeSlot *pSlot;
+  i64 key;
+
+  assert( argc==1 );
+  p = modeContext(context, argv[0]);
+  if( 0==p )
+    return;
+
+  /* keep the hash table at most half full */
+  if( 2*(p->nUsed+1) > p->nSlot && modeGrow(p) ){
+    sqlite3_result_error_nomem(context);
     return;
+  }
 
-  iL = p->pcnt;
-  iR = p->cnt - p->pcnt;
-  il = p->mcnt + c;
-  ir = p->cnt - p->mcnt;
+  key = modeKey(p, argv[0]);
+  pSlot = modeLookup(p->aSlot, p->nSlot, key);
+  if( 0==pSlot->count ){
+    pSlot->key = key;
+    ++p->nUsed;
+  }
+  ++pSlot->count;
+  ++p->cnt;
+}
 
-  if( il >= iL ){
-    if( ir >= iR ){
-    ++p->mn;
-      if( 0==p->is_double ){
-        ei = *(int*)(e);
-        p->riM += ei;
-      }else{
-        ed = *(double*)(e);
-        p->rdM += ed;
-      }
-    }else{
-      p->done=1;
+/*
+** called for each value received during a calculation of median or quartile
+*/
+static void medianStep(sqlite3_context *context, int argc, sqlite3_value **argv){
+  ModeCtx *p;
+
+  assert( argc==1 );
+  p = modeContext(context, argv[0]);
+  if( 0==p )
+    return;
+
+  if( p->cnt>=p->nAlloc ){
+    i64 n = p->nAlloc*2 + 250;
+    void *a = 0;
+
+    if( n*sizeof(i64) <= 0x7fffffff )
+      a = sqlite3_realloc(p->a, (int)(n*sizeof(i64)));
+    if( 0==a ){
+      sqlite3_result_error_nomem(context);
+      return;
     }
+    p->a = a;
+    p->nAlloc = n;
   }
-  p->mcnt+=c;
+
+  if( 0==p->is_double )
+    ((i64*)p->a)[p->cnt] = sqlite3_value_int64(argv[0]);
+  else
+    ((double*)p->a)[p->cnt] = sqlite3_value_double(argv[0]);
+  ++p->cnt;
 }
 
 /*
-** Returns the mode value
+** Returns the mode value (the most frequent value), or NULL if more than one
+** value is the most frequent
 */
 static void modeFinalize(sqlite3_context *context){
   ModeCtx *p;
+  i64 mcnt = 0;       /* maximum number of occurrences */
+  i64 mn = 0;         /* number of values with that many occurrences */
+  i64 key = 0;
+  i64 i;
+
   p = sqlite3_aggregate_context(context, 0);
-  if( p && p->m ){
-    map_iterate(p->m, modeIterate, p);
-    map_destroy(p->m);
-    free(p->m);
-
-    if( 1==p->mn ){
-      if( 0==p->is_double )
-        sqlite3_result_int64(context, p->riM);
-      else
-        sqlite3_result_double(context, p->rdM);
+  if( p && p->aSlot ){
+    for(i=0; i<p->nSlot; i++){
+      if( p->aSlot[i].count>mcnt ){
+        key = p->aSlot[i].key;
+        mcnt = p->aSlot[i].count;
+        mn = 1;
+      }else if( p->aSlot[i].count>0 && p->aSlot[i].count==mcnt ){
+        ++mn;
+      }
     }
+
+    if( 1==mn ){
+      if( 0==p->is_double ){
+        sqlite3_result_int64(context, key);
+      }else{
+        double xd;
+        memcpy(&xd, &key, sizeof(xd));
+        sqlite3_result_double(context, xd);
+      }
+    }
+    sqlite3_free(p->aSlot);
+    p->aSlot = 0;
   }
 }
 
 /*
 ** auxiliary function for percentiles
+**
+** The result is the average of the distinct values v such that at least pcnt
+** elements are smaller than or equal to v and at least cnt-pcnt elements are
+** larger than or equal to v.  Once the elements are sorted, those are the
+** values at the indexes in [ceil(pcnt)-1, floor(pcnt)]: one element if pcnt
+** is not an integer, two adjacent ones if it is.
 */
-static void _medianFinalize(sqlite3_context *context){
+static void _medianFinalize(sqlite3_context *context, double pcnt){
   ModeCtx *p;
+  i64 i1, i2;
+
   p = (ModeCtx*) sqlite3_aggregate_context(context, 0);
-  if( p && p->m ){
-    p->done=0;
-    map_iterate(p->m, medianIterate, p);
-    map_destroy(p->m);
-    free(p->m);
-
-    if( 0==p->is_double )
-      if( 1==p->mn )
-      	sqlite3_result_int64(context, p->riM);
-      else
-      	sqlite3_result_double(context, p->riM*1.0/p->mn);
-    else
-      sqlite3_result_double(context, p->rdM/p->mn);
+  if( p && p->a ){
+    if( p->cnt>0 ){
+      i2 = (i64)pcnt;
+      i1 = (double)i2==pcnt ? i2-1 : i2;
+      assert( 0<=i1 && i2<p->cnt );
+
+      if( 0==p->is_double ){
+        i64 *a = (i64*)p->a;
+        qsort(a, (size_t)p->cnt, sizeof(i64), int_cmp);
+        if( a[i1]==a[i2] )
+          sqlite3_result_int64(context, a[i1]);
+        else
+          sqlite3_result_double(context, ((double)a[i1]+(double)a[i2])/2);
+      }else{
+        double *a = (double*)p->a;
+        qsort(a, (size_t)p->cnt, sizeof(double), double_cmp);
+        if( a[i1]==a[i2] )
+          sqlite3_result_double(context, a[i1]);
+        else
+          sqlite3_result_double(context, (a[i1]+a[i2])/2);
+      }
+    }
+    sqlite3_free(p->a);
+    p->a = 0;
   }
 }
 
@@ -1565,8 +1598,7 @@ static void medianFinalize(sqlite3_context *context){
   ModeCtx *p;
   p = (ModeCtx*) sqlite3_aggregate_context(context, 0);
   if( p!=0 ){
-    p->pcnt = (p->cnt)/2.0;
-    _medianFinalize(context);
+    _medianFinalize(context, (p->cnt)/2.0);
   }
 }
 
@@ -1577,8 +1609,7 @@ static void lower_quartileFinalize(sqlite3_context *context){
   ModeCtx *p;
   p = (ModeCtx*) sqlite3_aggregate_context(context, 0);
   if( p!=0 ){
-    p->pcnt = (p->cnt)/4.0;
-    _medianFinalize(context);
+    _medianFinalize(context, (p->cnt)/4.0);
   }
 }
 
@@ -1589,8 +1620,7 @@ static void upper_quartileFinalize(sqlite3_context *context){
   ModeCtx *p;
   p = (ModeCtx*) sqlite3_aggregate_context(context, 0);
   if( p!=0 ){
-    p->pcnt = (p->cnt)*3/4.0;
-    _medianFinalize(context);
+    _medianFinalize(context, (p->cnt)*3/4.0);
   }
 }
 
@@ -1784,9 +1814,9 @@ int RegisterExtensionFunctions(sqlite3 *db){
     { "stdev",            1, 0, 0, varianceStep, stdevFinalize  },
     { "variance",         1, 0, 0, varianceStep, varianceFinalize  },
     { "mode",             1, 0, 0, modeStep,     modeFinalize  },
-    { "median",           1, 0, 0, modeStep,     medianFinalize  },
-    { "lower_quartile",   1, 0, 0, modeStep,     lower_quartileFinalize  },
-    { "upper_quartile",   1, 0, 0, modeStep,     upper_quartileFinalize  },
+    { "median",           1, 0, 0, medianStep,   medianFinalize  },
+    { "lower_quartile",   1, 0, 0, medianStep,   lower_quartileFinalize  },
+    { "upper_quartile",   1, 0, 0, medianStep,   upper_quartileFinalize  },
   };
   int i;
 
@@ -1851,79 +1881,6 @@ int sqlite3_extension_init(
 }
 #endif /* COMPILE_SQLITE_EXTENSIONS_AS_LOADABLE_MODULE */
 
-map map_make(cmp_func cmp){
-  map r;
-  r.cmp=cmp;
-  r.base = 0;
-
-  return r;
-}
-
-void* xcalloc(size_t nmemb, size_t size, char* s){
-  void* ret = calloc(nmemb, size);
-  return ret;
-}
-
-void xfree(void* p){
-  free(p);
-}
-
-void node_insert(node** n, cmp_func cmp, void *e){
-  int c;
-  node* nn;
-  if(*n==0){
-    nn = (node*)xcalloc(1,sizeof(node), "for node");
-    nn->data = e;
-    nn->count = 1;
-    *n=nn;
-  }else{
-    c=cmp((*n)->data,e);
-    if(0==c){
-      ++((*n)->count);
-      xfree(e);
-    }else if(c>0){
-      /* put it right here */
-      node_insert(&((*n)->l), cmp, e);
-    }else{
-      node_insert(&((*n)->r), cmp, e);
-    }
-  }
-}
-
-void map_insert(map *m, void *e){
-  node_insert(&(m->base), m->cmp, e);
-}
-
-void node_iterate(node *n, map_iterator iter, void* p){
-  if(n){
-    if(n->l)
-      node_iterate(n->l, iter, p);
-    iter(n->data, n->count, p);
-    if(n->r)
-      node_iterate(n->r, iter, p);
-  }
-}
-
-void map_iterate(map *m, map_iterator iter, void* p){
-  node_iterate(m->base, iter, p);
-}
-
-void node_destroy(node *n){
-  if(0!=n){
-    xfree(n->data);
-    if(n->l)
-      node_destroy(n->l);
-    if(n->r)
-      node_destroy(n->r);
-
-    xfree(n);
-  }
-}
-
-void map_destroy(map *m){
-  node_destroy(m->base);
-}
-
 int int_cmp(const void *a, const void *b){
   int64_t aa = *(int64_t *)(a);
   int64_t bb = *(int64_t *)(b);
@@ -1948,8 +1905,3 @@ int double_cmp(const void *a, const void *b){
     return 1;
 }
 
-void print_elem(void *e, int64_t c, void* p){
-  int ee = *(int*)(e);
-  printf("%d => %lld\n", ee,c);
-}
-
@@ -63,6 +63,7 @@ SQLITE_EXTENSION_INIT1
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 
 /* The following object is the session context for a single percentile()
 ** function.  We have to remember all input Y values until the very end.
@@ -94,6 +95,9 @@ static int sameValue(double a, double b){
   return a>=-0.001 && a<=0.001;
 }
 
+static void percentAppend(sqlite3_context*, Percentile*, sqlite3_value*,
+                          const char*);
+
 /*
 ** The "step" function for percentile(Y,P) is called once for each
 ** input row.
@@ -102,7 +106,6 @@ static void percentStep(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
   Percentile *p;
   double rPct;
   int eType;
-  double y;
   assert( argc==2 );
 
   /* Requirement 3:  P must be a number between 0 and 100 */
@@ -129,22 +132,43 @@ static void percentStep(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
     return;
   }
 
+  percentAppend(pCtx, p, argv[0], "percentile");
+}
+
+/*
+** Add the Y value pY to the values remembered by a percentile() or
+** percentiles() session context.  zFunc is the name of the function,
+** for error messages.
+*/
+static void percentAppend(
+  sqlite3_context *pCtx,
+  Percentile *p,
+  sqlite3_value *pY,
+  const char *zFunc
+){
+  int eType;
+  double y;
+
   /* Ignore rows for which Y is NULL */
-  eType = sqlite3_value_type(argv[0]);
+  eType = sqlite3_value_type(pY);
   if( eType==SQLITE_NULL ) return;
 
   /* If not NULL, then Y must be numeric.  Otherwise throw an error.
   ** Requirement 4 */
   if( eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT ){
-    sqlite3_result_error(pCtx, "1st argument to percentile() is not "
-                               "numeric", -1);
+    char *zMsg = sqlite3_mprintf("1st argument to %s() is not numeric",
+                                 zFunc);
+    sqlite3_result_error(pCtx, zMsg, -1);
+    sqlite3_free(zMsg);
     return;
   }
 
   /* Throw an error if the Y value is infinity or NaN */
-  y = sqlite3_value_double(argv[0]);
+  y = sqlite3_value_double(pY);
   if( isInfinity(y) ){
-    sqlite3_result_error(pCtx, "Inf input to percentile()", -1);
+    char *zMsg = sqlite3_mprintf("Inf input to %s()", zFunc);
+    sqlite3_result_error(pCtx, zMsg, -1);
+    sqlite3_free(zMsg);
     return;
   }
 
@@ -165,14 +189,127 @@ static void percentStep(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
 }
 
 /*
-** Compare to doubles for sorting using qsort()
+** Ranges of no more than this many values are finished with an insertion
+** sort rather than partitioned further.
 */
-static int doubleCmp(const void *pA, const void *pB){
-  double a = *(double*)pA;
-  double b = *(double*)pB;
-  if( a==b ) return 0;
-  if( a<b ) return -1;
-  return +1;
+#define PERCENT_SMALL 16
+
+/*
+** Exchange the values at a[i] and a[j].
+*/
+#define PERCENT_SWAP(a,i,j) \
+  { double t_ = (a)[i]; (a)[i] = (a)[j]; (a)[j] = t_; }
+
+/*
+** Sort the n values in a[] into ascending order using insertion sort.
+** Only used on short arrays.
+*/
+static void percentInsertionSort(double *a, unsigned n){
+  unsigned i, j;
+  for(i=1; i<n; i++){
+    double v = a[i];
+    for(j=i; j>0 && a[j-1]>v; j--) a[j] = a[j-1];
+    a[j] = v;
+  }
+}
+
+/*
+** Partition a[lo..hi] around the value rPivot, which must be one of
+** the values in that range.  On return, the values in a[lo..*pLt-1]
+** are less than rPivot, those in a[*pLt..*pGt] are equal to it and
+** those in a[*pGt+1..hi] are greater.  Keeping the values equal to
+** the pivot together means that heavily duplicated inputs partition
+** just as well as distinct ones.
+**
+** The Y values are never NaN (see (5) above) so the plain comparison
+** operators give a total order.
+*/
+static void percentPartition(
+  double *a,
+  unsigned lo,
+  unsigned hi,
+  double rPivot,
+  unsigned *pLt,
+  unsigned *pGt
+){
+  unsigned lt = lo;
+  unsigned gt = hi;
+  unsigned i = lo;
+  while( i<=gt ){
+    double v = a[i];
+    if( v<rPivot ){
+      PERCENT_SWAP(a, lt, i);
+      lt++;
+      i++;
+    }else if( v>rPivot ){
+      PERCENT_SWAP(a, i, gt);
+      gt--;
+    }else{
+      i++;
+    }
+  }
+  *pLt = lt;
+  *pGt = gt;
+}
+
+static void percentSelect(double *a, unsigned n, unsigned k, int nDepth);
+
+/*
+** Return a pivot for the n values in a[] that is guaranteed to have at
+** least 30% of the values on either side of it: the median of the
+** medians of groups of five.  The group medians are moved to the start
+** of a[] while doing so.
+*/
+static double percentMedianOfMedians(double *a, unsigned n){
+  unsigned i, nGroup = 0;
+  for(i=0; i<n; i+=5){
+    unsigned m = n-i<5 ? n-i : 5;
+    percentInsertionSort(&a[i], m);
+    PERCENT_SWAP(a, nGroup, i+m/2);
+    nGroup++;
+  }
+  percentSelect(a, nGroup, nGroup/2, 0);
+  return a[nGroup/2];
+}
+
+/*
+** Rearrange the n values in a[] so that a[k] holds the value that would
+** be there if a[] were sorted, every value before it is no greater and
+** every value after it is no less.
+**
+** This is an introselect: a quickselect using the median of three
+** values as the pivot, which takes linear time on average.  Once nDepth
+** partitions have been done without finding a[k], the pivots are chosen
+** using percentMedianOfMedians() instead, which bounds the worst case
+** to linear time too.
+*/
+static void percentSelect(double *a, unsigned n, unsigned k, int nDepth){
+  unsigned lo = 0;
+  unsigned hi = n-1;
+  while( hi-lo>=PERCENT_SMALL ){
+    unsigned lt, gt;
+    double rPivot;
+    if( nDepth>0 ){
+      double x = a[lo];
+      double y = a[lo+(hi-lo)/2];
+      double z = a[hi];
+      nDepth--;
+      if( x>y ){ double t = x; x = y; y = t; }
+      if( y>z ) y = x>z ? x : z;
+      rPivot = y;
+    }else{
+      rPivot = percentMedianOfMedians(&a[lo], hi-lo+1);
+    }
+    percentPartition(a, lo, hi, rPivot, &lt, &gt);
+    if( k<lt ){
+      hi = lt-1;
+    }else if( k>gt ){
+      lo = gt+1;
+    }else{
+      return;
+    }
+  }
+  percentInsertionSort(&a[lo], hi-lo+1);
 }
 
 /*
@@ -188,12 +325,24 @@ static void percentFinal(sqlite3_context *pCtx){
   if( p==0 ) return;
   if( p->a==0 ) return;
   if( p->nUsed ){
-    qsort(p->a, p->nUsed, sizeof(double), doubleCmp);
+    unsigned n;
+    int nDepth = 0;
     ix = (p->rPct-1.0)*(p->nUsed-1)*0.01;
     i1 = (unsigned)ix;
     i2 = ix==(double)i1 || i1==p->nUsed-1 ? i1 : i1+1;
+    for(n=p->nUsed; n>1; n>>=1) nDepth += 2;
+    percentSelect(p->a, p->nUsed, i1, nDepth);
     v1 = p->a[i1];
-    v2 = p->a[i2];
+    v2 = v1;
+    if( i2!=i1 ){
+      /* Every value after a[i1] is no less than it, so the next value
+      ** in sorted order is the least of them. */
+      unsigned i;
+      v2 = p->a[i2];
+      for(i=i2+1; i<p->nUsed; i++){
+        if( p->a[i]<v2 ) v2 = p->a[i];
+      }
+    }
     vx = v1 + (v2-v1)*(ix-i1);
     sqlite3_result_double(pCtx, vx);
   }
@@ -201,6 +350,759 @@ static void percentFinal(sqlite3_context *pCtx){
   memset(p, 0, sizeof(*p));
 }
 
+/*
+** The percentiles(Y,P1,P2,...) aggregate returns the same values as
+** percentile(Y,P1), percentile(Y,P2) and so on, as a TEXT value that
+** lists them in the order of the P arguments, separated by commas.  It
+** remembers the Y values only once and finds all the values it needs
+** in one pass over them.
+**
+** The following object is its session context.  It is followed in the
+** same allocation by the nPct values of aPct[] and then the 2*nPct
+** entries of aIdx[].
+*/
+typedef struct Percentiles Percentiles;
+struct Percentiles {
+  Percentile v;        /* The Y values.  v.rPct is not used */
+  int nPct;            /* Number of P arguments */
+  double *aPct;        /* 1.0 more than the value of each P argument */
+  unsigned *aIdx;      /* Scratch space for percentilesFinal() */
+};
+
+/*
+** Rearrange a[lo..hi] so that, for each of the nIdx distinct indexes
+** in aIdx[], which are sorted and in that range, a[aIdx[i]] holds the
+** value that would be there if a[lo..hi] were sorted.  This selects the
+** middle index first, then the rest on either side of it separately, so
+** that the work done is O(N*log(nIdx)) rather than O(N*nIdx).
+*/
+static void percentMultiSelect(
+  double *a,
+  unsigned lo,
+  unsigned hi,
+  const unsigned *aIdx,
+  int nIdx,
+  int nDepth
+){
+  while( nIdx>0 ){
+    int iMid = nIdx/2;
+    unsigned k = aIdx[iMid];
+    assert( lo<=k && k<=hi );
+    percentSelect(&a[lo], hi-lo+1, k-lo, nDepth);
+    if( iMid>0 ){
+      percentMultiSelect(a, lo, k-1, aIdx, iMid, nDepth);
+    }
+    lo = k+1;
+    aIdx += iMid+1;
+    nIdx -= iMid+1;
+  }
+}
+
+/*
+** The "step" function for percentiles(Y,P1,P2,...).
+*/
+static void percentilesStep(
+  sqlite3_context *pCtx,
+  int argc,
+  sqlite3_value **argv
+){
+  Percentiles *p;
+  int nPct = argc-1;
+  int i;
+
+  if( nPct<1 ){
+    sqlite3_result_error(pCtx, "percentiles() requires at least one "
+                               "P argument", -1);
+    return;
+  }
+
+  /* Each P must be a number between 0 and 100 */
+  for(i=1; i<argc; i++){
+    int eType = sqlite3_value_numeric_type(argv[i]);
+    double rPct = sqlite3_value_double(argv[i]);
+    if( (eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT)
+     || rPct<0.0 || rPct>100.0
+    ){
+      char *zMsg = sqlite3_mprintf("argument %d to percentiles() is not "
+                                   "a number between 0.0 and 100.0", i+1);
+      sqlite3_result_error(pCtx, zMsg, -1);
+      sqlite3_free(zMsg);
+      return;
+    }
+  }
+
+  /* Allocate the session context. */
+  p = (Percentiles*)sqlite3_aggregate_context(pCtx,
+           sizeof(*p) + nPct*(sizeof(double) + 2*sizeof(unsigned)));
+  if( p==0 ) return;
+
+  /* Remember the P values.  Throw an error if they are different from
+  ** those of any prior row. */
+  if( p->nPct==0 ){
+    p->nPct = nPct;
+    p->aPct = (double*)&p[1];
+    p->aIdx = (unsigned*)&p->aPct[nPct];
+    for(i=0; i<nPct; i++){
+      p->aPct[i] = sqlite3_value_double(argv[i+1])+1.0;
+    }
+  }else{
+    assert( p->nPct==nPct );
+    for(i=0; i<nPct; i++){
+      if( !sameValue(p->aPct[i], sqlite3_value_double(argv[i+1])+1.0) ){
+        char *zMsg = sqlite3_mprintf("argument %d to percentiles() is not "
+                                     "the same for all input rows", i+2);
+        sqlite3_result_error(pCtx, zMsg, -1);
+        sqlite3_free(zMsg);
+        return;
+      }
+    }
+  }
+
+  percentAppend(pCtx, &p->v, argv[0], "percentiles");
+}
+
+/*
+** Called to compute the final output of percentiles() and to clean
+** up all allocated memory.
+*/
+static void percentilesFinal(sqlite3_context *pCtx){
+  Percentiles *p;
+  unsigned nUsed;
+  int nIdx = 0;
+  int nDepth = 0;
+  int i, j;
+  unsigned n;
+  char *zOut;
+  int nOut = 0;
+
+  p = (Percentiles*)sqlite3_aggregate_context(pCtx, 0);
+  if( p==0 ) return;
+  if( p->v.a==0 ) return;
+  nUsed = p->v.nUsed;
+  if( nUsed ){
+    /* Make a sorted list of the distinct indexes of the values that
+    ** are needed, two for each P, as in percentFinal(). */
+    for(i=0; i<p->nPct; i++){
+      double ix = (p->aPct[i]-1.0)*(nUsed-1)*0.01;
+      unsigned i1 = (unsigned)ix;
+      p->aIdx[nIdx++] = i1;
+      if( ix!=(double)i1 && i1!=nUsed-1 ) p->aIdx[nIdx++] = i1+1;
+    }
+    for(i=1; i<nIdx; i++){
+      unsigned k = p->aIdx[i];
+      for(j=i; j>0 && p->aIdx[j-1]>k; j--) p->aIdx[j] = p->aIdx[j-1];
+      p->aIdx[j] = k;
+    }
+    for(i=j=0; i<nIdx; i++){
+      if( j==0 || p->aIdx[j-1]!=p->aIdx[i] ) p->aIdx[j++] = p->aIdx[i];
+    }
+    nIdx = j;
+
+    for(n=nUsed; n>1; n>>=1) nDepth += 2;
+    percentMultiSelect(p->v.a, 0, nUsed-1, p->aIdx, nIdx, nDepth);
+
+    /* At most 24 bytes for each value and a comma or terminator. */
+    zOut = sqlite3_malloc(p->nPct*25);
+    if( zOut==0 ){
+      sqlite3_result_error_nomem(pCtx);
+    }else{
+      for(i=0; i<p->nPct; i++){
+        double ix = (p->aPct[i]-1.0)*(nUsed-1)*0.01;
+        unsigned i1 = (unsigned)ix;
+        unsigned i2 = ix==(double)i1 || i1==nUsed-1 ? i1 : i1+1;
+        double v1 = p->v.a[i1];
+        double v2 = p->v.a[i2];
+        double vx = v1 + (v2-v1)*(ix-i1);
+        if( i>0 ) zOut[nOut++] = ',';
+        sqlite3_snprintf(p->nPct*25-nOut, &zOut[nOut], "%!.15g", vx);
+        nOut += (int)strlen(&zOut[nOut]);
+      }
+      sqlite3_result_text(pCtx, zOut, nOut, sqlite3_free);
+    }
+  }
+  sqlite3_free(p->v.a);
+  memset(&p->v, 0, sizeof(p->v));
+}
+
+/*
+** The rest of this file implements approximate percentiles that use a
+** fixed amount of memory however many rows there are:
+**
+**   approx_percentile(Y,P)
+**   approx_percentile(Y,P,ACCURACY)
+**
+**        An aggregate that returns an estimate of percentile(Y,P).  The
+**        Y and P arguments are checked as for percentile().  ACCURACY is
+**        an integer between 10 and 10000 that must be the same for all
+**        rows, 100 by default.  Larger values give better estimates but
+**        use more memory: 80*ACCURACY bytes or so for each group.
+**
+**   percentile_sketch(Y)
+**   percentile_sketch(Y,ACCURACY)
+**
+**        An aggregate that returns a BLOB summarizing the Y values, or
+**        NULL if they are all NULL.
+**
+**   percentile_sketch_merge(S)
+**
+**        An aggregate that combines the sketches S, as returned by
+**        percentile_sketch() or percentile_sketch_merge(), into one
+**        sketch of all the values they summarize.  The ACCURACY of the
+**        first sketch is used for the result.  NULL sketches are ignored.
+**
+**   percentile_from_sketch(S,P)
+**
+**        Return the estimate of the P-th percentile of the values
+**        summarized by the sketch S.
+**
+** So sketches can be computed per hour, say, and stored, and the
+** percentiles for any range of hours found later from those without
+** reading the rows again.
+**
+** The summary is a "t-digest" (Ted Dunning, "Computing Extremely Accurate
+** Quantiles Using t-Digests"): a list of centroids, each being the mean
+** and count of a run of adjacent values.  Centroids near the ends of the
+** distribution are kept small, so that extreme percentiles are accurate.
+** New values are appended to the list until it is full and then the
+** whole list is sorted and adjacent centroids combined as far as the
+** ACCURACY allows.  That leaves at most ACCURACY+1 centroids, and the list
+** has room for 5*ACCURACY+1.  The smallest and largest values are kept
+** exactly.  Until the list first fills up the estimates are exact.
+**
+** The format of a sketch is as follows.  All integers are big-endian and
+** the doubles are stored as big-endian 64-bit IEEE 754 values.
+**
+**     4 bytes     DIGEST_MAGIC
+**     4 bytes     ACCURACY
+**     4 bytes     Number of centroids that follow, N
+**     8 bytes     Smallest value
+**     8 bytes     Largest value
+**     16*N bytes  N centroids: an 8-byte double mean and an 8-byte count
+*/
+#define DIGEST_MAGIC             0x54440001  /* "TD" and a version number */
+#define DIGEST_HEADER_SIZE       28          /* Bytes before the centroids */
+#define DIGEST_CENTROID_SIZE     16          /* Bytes for each centroid */
+#define DIGEST_DEFAULT_ACCURACY  100
+#define DIGEST_MIN_ACCURACY      10
+#define DIGEST_MAX_ACCURACY      10000
+#define DIGEST_MAX_COUNT         (((sqlite3_uint64)1)<<53)
+
+/*
+** Number of centroids allocated for a t-digest with the given ACCURACY.
+*/
+#define DIGEST_ALLOC(N)          ((N)*5+1)
+
+/*
+** The i-th centroid of the sketch a[].
+*/
+#define DIGEST_CENTROID(a,i) \
+  (&(a)[DIGEST_HEADER_SIZE+(i)*DIGEST_CENTROID_SIZE])
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/* One centroid of a t-digest */
+typedef struct DigestCentroid DigestCentroid;
+struct DigestCentroid {
+  double rMean;             /* Mean of the values in the centroid */
+  sqlite3_uint64 nCount;    /* Number of values in the centroid */
+};
+
+/* The session context for approx_percentile(), percentile_sketch() and
+** percentile_sketch_merge(), and the sketch for percentile_from_sketch().
+*/
+typedef struct Digest Digest;
+struct Digest {
+  int nAccuracy;            /* The ACCURACY, or 0 before the first row */
+  unsigned nAlloc;          /* Number of slots allocated for a[] */
+  unsigned nUsed;           /* Number of slots actually used in a[] */
+  sqlite3_uint64 nTotal;    /* Number of values summarized */
+  double rMin;              /* Smallest value, if nTotal>0 */
+  double rMax;              /* Largest value, if nTotal>0 */
+  double rPct;              /* 1.0 more than P, for approx_percentile() */
+  DigestCentroid *a;        /* Array of centroids, in no particular order */
+};
+
+/*
+** Compare two centroids by mean, for sorting using qsort()
+*/
+static int digestCmp(const void *pA, const void *pB){
+  double a = ((const DigestCentroid*)pA)->rMean;
+  double b = ((const DigestCentroid*)pB)->rMean;
+  if( a==b ) return 0;
+  if( a<b ) return -1;
+  return +1;
+}
+
+/*
+** Free the memory used by a t-digest and zero it.
+*/
+static void digestReset(Digest *p){
+  sqlite3_free(p->a);
+  memset(p, 0, sizeof(*p));
+}
+
+/*
+** Allocate the centroids of a t-digest that has not been used yet.
+** Return SQLITE_OK or SQLITE_NOMEM.
+*/
+static int digestInit(Digest *p, int nAccuracy){
+  assert( p->nAccuracy==0 && p->a==0 );
+  assert( nAccuracy>=DIGEST_MIN_ACCURACY && nAccuracy<=DIGEST_MAX_ACCURACY );
+  p->a = sqlite3_malloc(sizeof(DigestCentroid)*DIGEST_ALLOC(nAccuracy));
+  if( p->a==0 ) return SQLITE_NOMEM;
+  p->nAccuracy = nAccuracy;
+  p->nAlloc = DIGEST_ALLOC(nAccuracy);
+  return SQLITE_OK;
+}
+
+/*
+** The scale function k1 of the t-digest paper, and its inverse.  Two
+** adjacent centroids are combined only if the quantiles they cover
+** together span no more than one unit of k1.
+*/
+static double digestScale(int nAccuracy, double q){
+  if( q>=1.0 ) return nAccuracy/4.0;
+  return nAccuracy/(2.0*M_PI)*asin(2.0*q-1.0);
+}
+static double digestScaleInverse(int nAccuracy, double k){
+  if( k>=nAccuracy/4.0 ) return 1.0;
+  return (sin(k*2.0*M_PI/nAccuracy)+1.0)/2.0;
+}
+
+/*
+** Sort the centroids of a t-digest and then combine adjacent ones as
+** far as the ACCURACY allows.
+*/
+static void digestCompress(Digest *p){
+  DigestCentroid *a = p->a;
+  double rTotal = (double)p->nTotal;
+  double q0 = 0.0;                  /* Quantile at the start of a[iOut] */
+  double qLimit;                    /* Largest quantile a[iOut] may reach */
+  unsigned iOut = 0;
+  unsigned i;
+
+  if( p->nUsed<2 ) return;
+  qsort(a, p->nUsed, sizeof(a[0]), digestCmp);
+  qLimit = digestScaleInverse(p->nAccuracy,
+                              digestScale(p->nAccuracy, q0)+1.0);
+  for(i=1; i<p->nUsed; i++){
+    sqlite3_uint64 n = a[iOut].nCount + a[i].nCount;
+    if( q0+n/rTotal<=qLimit ){
+      a[iOut].rMean += (a[i].rMean-a[iOut].rMean)*a[i].nCount/(double)n;
+      a[iOut].nCount = n;
+    }else{
+      q0 += a[iOut].nCount/rTotal;
+      qLimit = digestScaleInverse(p->nAccuracy,
+                                  digestScale(p->nAccuracy, q0)+1.0);
+      a[++iOut] = a[i];
+    }
+  }
+  p->nUsed = iOut+1;
+  assert( p->nUsed<=(unsigned)p->nAccuracy+2 );
+}
+
+/*
+** Add nCount values whose mean is rMean to a t-digest.  The caller
+** must update rMin and rMax.
+*/
+static void digestAdd(Digest *p, double rMean, sqlite3_uint64 nCount){
+  if( p->nUsed>=p->nAlloc ) digestCompress(p);
+  assert( p->nUsed<p->nAlloc );
+  p->a[p->nUsed].rMean = rMean;
+  p->a[p->nUsed].nCount = nCount;
+  p->nUsed++;
+  p->nTotal += nCount;
+}
+
+/*
+** Return the estimate of the rPct-th percentile of the values in a
+** t-digest, which must not be empty.
+**
+** The values of each centroid are taken to be centered on its mean,
+** which is where the middle one would be if the values were sorted, and
+** the estimate is interpolated between the means of the two centroids
+** on either side of the wanted position, or the smallest or largest
+** value at the ends.  That is what percentile() does when the centroids
+** each hold one value.
+*/
+static double digestQuantile(Digest *p, double rPct){
+  double ix = rPct*(p->nTotal-1)*0.01;  /* Wanted position */
+  double rPrev = 0.0;                   /* Position of the previous value */
+  double vPrev = p->rMin;               /* The previous value */
+  double rStart = 0.0;                  /* Position of the first in a[i] */
+  unsigned i;
+
+  assert( p->nTotal>0 );
+  if( ix<=0.0 ) return p->rMin;
+  if( ix>=(double)(p->nTotal-1) ) return p->rMax;
+  qsort(p->a, p->nUsed, sizeof(p->a[0]), digestCmp);
+  for(i=0; i<p->nUsed; i++){
+    double rMid = rStart + (p->a[i].nCount-1)*0.5;
+    if( ix<=rMid ){
+      if( ix==rMid || rMid<=rPrev ) return p->a[i].rMean;
+      return vPrev + (p->a[i].rMean-vPrev)*(ix-rPrev)/(rMid-rPrev);
+    }
+    rPrev = rMid;
+    vPrev = p->a[i].rMean;
+    rStart += (double)p->a[i].nCount;
+  }
+  return vPrev + (p->rMax-vPrev)*(ix-rPrev)/(rStart-1.0-rPrev);
+}
+
+/*
+** Read and write the big-endian integers of a sketch
+*/
+static unsigned digestGet32(const unsigned char *a){
+  return ((unsigned)a[0]<<24) | ((unsigned)a[1]<<16)
+       | ((unsigned)a[2]<<8) | (unsigned)a[3];
+}
+static sqlite3_uint64 digestGet64(const unsigned char *a){
+  return ((sqlite3_uint64)digestGet32(a)<<32) | digestGet32(&a[4]);
+}
+static double digestGetDouble(const unsigned char *a){
+  sqlite3_uint64 u = digestGet64(a);
+  double r;
+  memcpy(&r, &u, sizeof(r));
+  return r;
+}
+static void digestPut32(unsigned char *a, unsigned v){
+  a[0] = (unsigned char)(v>>24);
+  a[1] = (unsigned char)(v>>16);
+  a[2] = (unsigned char)(v>>8);
+  a[3] = (unsigned char)v;
+}
+static void digestPut64(unsigned char *a, sqlite3_uint64 v){
+  digestPut32(a, (unsigned)(v>>32));
+  digestPut32(&a[4], (unsigned)v);
+}
+static void digestPutDouble(unsigned char *a, double r){
+  sqlite3_uint64 u;
+  memcpy(&u, &r, sizeof(u));
+  digestPut64(a, u);
+}
+
+/*
+** Check that pVal is a sketch.  Return its ACCURACY if it is, or 0 if
+** not.
+*/
+static int digestSketchAccuracy(sqlite3_value *pVal){
+  const unsigned char *a;
+  int n;
+  unsigned nAccuracy, nCentroid, i;
+  sqlite3_uint64 nTotal = 0;
+  double rMin, rMax;
+
+  if( sqlite3_value_type(pVal)!=SQLITE_BLOB ) return 0;
+  a = (const unsigned char*)sqlite3_value_blob(pVal);
+  n = sqlite3_value_bytes(pVal);
+  if( a==0 || n<DIGEST_HEADER_SIZE ) return 0;
+  if( digestGet32(a)!=DIGEST_MAGIC ) return 0;
+  nAccuracy = digestGet32(&a[4]);
+  if( nAccuracy<DIGEST_MIN_ACCURACY || nAccuracy>DIGEST_MAX_ACCURACY ){
+    return 0;
+  }
+  nCentroid = digestGet32(&a[8]);
+  if( nCentroid==0 || nCentroid>DIGEST_ALLOC(nAccuracy) ) return 0;
+  if( n!=DIGEST_HEADER_SIZE+DIGEST_CENTROID_SIZE*(int)nCentroid ) return 0;
+  rMin = digestGetDouble(&a[12]);
+  rMax = digestGetDouble(&a[20]);
+  if( isInfinity(rMin) || isInfinity(rMax) || rMin>rMax ) return 0;
+  for(i=0; i<nCentroid; i++){
+    const unsigned char *aCentroid = DIGEST_CENTROID(a, i);
+    double rMean = digestGetDouble(aCentroid);
+    sqlite3_uint64 nCount = digestGet64(&aCentroid[8]);
+    if( isInfinity(rMean) || rMean<rMin || rMean>rMax ) return 0;
+    if( nCount==0 || nCount>DIGEST_MAX_COUNT-nTotal ) return 0;
+    nTotal += nCount;
+  }
+  return (int)nAccuracy;
+}
+
+/*
+** Add the values summarized by the sketch pVal, which has been checked
+** by digestSketchAccuracy(), to a t-digest.  Return SQLITE_OK, or
+** SQLITE_TOOBIG if there would be too many values for the counts to
+** stay exact.
+*/
+static int digestAddSketch(Digest *p, sqlite3_value *pVal){
+  const unsigned char *a = (const unsigned char*)sqlite3_value_blob(pVal);
+  unsigned nCentroid = digestGet32(&a[8]);
+  double rMin = digestGetDouble(&a[12]);
+  double rMax = digestGetDouble(&a[20]);
+  unsigned i;
+
+  if( p->nTotal==0 || rMin<p->rMin ) p->rMin = rMin;
+  if( p->nTotal==0 || rMax>p->rMax ) p->rMax = rMax;
+  for(i=0; i<nCentroid; i++){
+    const unsigned char *aCentroid = DIGEST_CENTROID(a, i);
+    sqlite3_uint64 nCount = digestGet64(&aCentroid[8]);
+    if( nCount>DIGEST_MAX_COUNT-p->nTotal ) return SQLITE_TOOBIG;
+    digestAdd(p, digestGetDouble(aCentroid), nCount);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Return the ACCURACY argument of function zFunc, or 0 after setting
+** an error if it is not valid.  pVal is NULL if the argument was not
+** given.
+*/
+static int digestAccuracyArg(
+  sqlite3_context *pCtx,
+  sqlite3_value *pVal,
+  const char *zFunc
+){
+  sqlite3_int64 n;
+  if( pVal==0 ) return DIGEST_DEFAULT_ACCURACY;
+  n = sqlite3_value_int64(pVal);
+  if( sqlite3_value_numeric_type(pVal)!=SQLITE_INTEGER
+   || n<DIGEST_MIN_ACCURACY || n>DIGEST_MAX_ACCURACY
+  ){
+    char *zMsg = sqlite3_mprintf("ACCURACY argument to %s() is not an "
+                                 "integer between %d and %d", zFunc,
+                                 DIGEST_MIN_ACCURACY, DIGEST_MAX_ACCURACY);
+    sqlite3_result_error(pCtx, zMsg, -1);
+    sqlite3_free(zMsg);
+    return 0;
+  }
+  return (int)n;
+}
+
+/*
+** Return the P argument of function zFunc, or -1.0 after setting an
+** error if it is not a number between 0 and 100.
+*/
+static double digestPercentArg(
+  sqlite3_context *pCtx,
+  sqlite3_value *pVal,
+  const char *zFunc
+){
+  int eType = sqlite3_value_numeric_type(pVal);
+  double rPct = sqlite3_value_double(pVal);
+  if( (eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT)
+   || rPct<0.0 || rPct>100.0
+  ){
+    char *zMsg = sqlite3_mprintf("2nd argument to %s() is not a number "
+                                 "between 0.0 and 100.0", zFunc);
+    sqlite3_result_error(pCtx, zMsg, -1);
+    sqlite3_free(zMsg);
+    return -1.0;
+  }
+  return rPct;
+}
+
+/*
+** The part of the "step" function shared by approx_percentile(Y,...) and
+** percentile_sketch(Y,...): allocate the session context on the first
+** row, check that ACCURACY is the same as for prior rows, then add Y to
+** the t-digest unless it is NULL.  Return the session context, or NULL
+** if there was an error.
+*/
+static Digest *digestStepValue(
+  sqlite3_context *pCtx,
+  sqlite3_value *pY,
+  sqlite3_value *pAccuracy,
+  const char *zFunc
+){
+  Digest *p;
+  int nAccuracy;
+  int eType;
+  double y;
+
+  nAccuracy = digestAccuracyArg(pCtx, pAccuracy, zFunc);
+  if( nAccuracy==0 ) return 0;
+
+  p = (Digest*)sqlite3_aggregate_context(pCtx, sizeof(*p));
+  if( p==0 ) return 0;
+  if( p->nAccuracy==0 ){
+    if( digestInit(p, nAccuracy) ){
+      sqlite3_result_error_nomem(pCtx);
+      return 0;
+    }
+  }else if( p->nAccuracy!=nAccuracy ){
+    char *zMsg = sqlite3_mprintf("ACCURACY argument to %s() is not the "
+                                 "same for all input rows", zFunc);
+    sqlite3_result_error(pCtx, zMsg, -1);
+    sqlite3_free(zMsg);
+    return 0;
+  }
+
+  /* Ignore rows for which Y is NULL.  Otherwise Y must be a number
+  ** other than an infinity, as for percentile(). */
+  eType = sqlite3_value_type(pY);
+  if( eType==SQLITE_NULL ) return p;
+  if( eType!=SQLITE_INTEGER && eType!=SQLITE_FLOAT ){
+    char *zMsg = sqlite3_mprintf("1st argument to %s() is not numeric",
+                                 zFunc);
+    sqlite3_result_error(pCtx, zMsg, -1);
+    sqlite3_free(zMsg);
+    return 0;
+  }
+  y = sqlite3_value_double(pY);
+  if( isInfinity(y) ){
+    char *zMsg = sqlite3_mprintf("Inf input to %s()", zFunc);
+    sqlite3_result_error(pCtx, zMsg, -1);
+    sqlite3_free(zMsg);
+    return 0;
+  }
+  if( p->nTotal>=DIGEST_MAX_COUNT ){
+    sqlite3_result_error_toobig(pCtx);
+    return 0;
+  }
+  if( p->nTotal==0 || y<p->rMin ) p->rMin = y;
+  if( p->nTotal==0 || y>p->rMax ) p->rMax = y;
+  digestAdd(p, y, 1);
+  return p;
+}
+
+/*
+** The "step" function for approx_percentile(Y,P[,ACCURACY]).
+*/
+static void approxPercentStep(
+  sqlite3_context *pCtx,
+  int argc,
+  sqlite3_value **argv
+){
+  Digest *p;
+  double rPct;
+  assert( argc==2 || argc==3 );
+
+  rPct = digestPercentArg(pCtx, argv[1], "approx_percentile");
+  if( rPct<0.0 ) return;
+  p = digestStepValue(pCtx, argv[0], argc==3 ? argv[2] : 0,
+                      "approx_percentile");
+  if( p==0 ) return;
+
+  /* The P value must be the same for every row, as for percentile() */
+  if( p->rPct==0.0 ){
+    p->rPct = rPct+1.0;
+  }else if( !sameValue(p->rPct,rPct+1.0) ){
+    sqlite3_result_error(pCtx, "2nd argument to approx_percentile() is not "
+                               "the same for all input rows", -1);
+  }
+}
+
+/*
+** The "final" function for approx_percentile(Y,P[,ACCURACY]).
+*/
+static void approxPercentFinal(sqlite3_context *pCtx){
+  Digest *p = (Digest*)sqlite3_aggregate_context(pCtx, 0);
+  if( p==0 ) return;
+  if( p->nTotal ){
+    sqlite3_result_double(pCtx, digestQuantile(p, p->rPct-1.0));
+  }
+  digestReset(p);
+}
+
+/*
+** The "step" function for percentile_sketch(Y[,ACCURACY]).
+*/
+static void sketchStep(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
+  assert( argc==1 || argc==2 );
+  digestStepValue(pCtx, argv[0], argc==2 ? argv[1] : 0, "percentile_sketch");
+}
+
+/*
+** The "step" function for percentile_sketch_merge(S).
+*/
+static void sketchMergeStep(
+  sqlite3_context *pCtx,
+  int argc,
+  sqlite3_value **argv
+){
+  Digest *p;
+  int nAccuracy;
+  assert( argc==1 );
+  (void)argc;
+
+  if( sqlite3_value_type(argv[0])==SQLITE_NULL ) return;
+  nAccuracy = digestSketchAccuracy(argv[0]);
+  if( nAccuracy==0 ){
+    sqlite3_result_error(pCtx, "1st argument to percentile_sketch_merge() "
+                               "is not a percentile sketch", -1);
+    return;
+  }
+  p = (Digest*)sqlite3_aggregate_context(pCtx, sizeof(*p));
+  if( p==0 ) return;
+  if( p->nAccuracy==0 && digestInit(p, nAccuracy) ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  if( digestAddSketch(p, argv[0]) ){
+    sqlite3_result_error_toobig(pCtx);
+  }
+}
+
+/*
+** The "final" function for percentile_sketch() and
+** percentile_sketch_merge().
+*/
+static void sketchFinal(sqlite3_context *pCtx){
+  Digest *p = (Digest*)sqlite3_aggregate_context(pCtx, 0);
+  unsigned char *a;
+  int n;
+  unsigned i;
+
+  if( p==0 ) return;
+  if( p->nTotal ){
+    digestCompress(p);
+    n = DIGEST_HEADER_SIZE + DIGEST_CENTROID_SIZE*p->nUsed;
+    a = sqlite3_malloc(n);
+    if( a==0 ){
+      sqlite3_result_error_nomem(pCtx);
+    }else{
+      digestPut32(a, DIGEST_MAGIC);
+      digestPut32(&a[4], (unsigned)p->nAccuracy);
+      digestPut32(&a[8], p->nUsed);
+      digestPutDouble(&a[12], p->rMin);
+      digestPutDouble(&a[20], p->rMax);
+      for(i=0; i<p->nUsed; i++){
+        unsigned char *aCentroid = DIGEST_CENTROID(a, i);
+        digestPutDouble(aCentroid, p->a[i].rMean);
+        digestPut64(&aCentroid[8], p->a[i].nCount);
+      }
+      sqlite3_result_blob(pCtx, a, n, sqlite3_free);
+    }
+  }
+  digestReset(p);
+}
+
+/*
+** Implementation of the percentile_from_sketch(S,P) function.
+*/
+static void sketchPercentFunc(
+  sqlite3_context *pCtx,
+  int argc,
+  sqlite3_value **argv
+){
+  Digest d;
+  int nAccuracy;
+  double rPct;
+  assert( argc==2 );
+  (void)argc;
+
+  rPct = digestPercentArg(pCtx, argv[1], "percentile_from_sketch");
+  if( rPct<0.0 ) return;
+  if( sqlite3_value_type(argv[0])==SQLITE_NULL ) return;
+  nAccuracy = digestSketchAccuracy(argv[0]);
+  if( nAccuracy==0 ){
+    sqlite3_result_error(pCtx, "1st argument to percentile_from_sketch() "
+                               "is not a percentile sketch", -1);
+    return;
+  }
+  memset(&d, 0, sizeof(d));
+  if( digestInit(&d, nAccuracy) ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  if( digestAddSketch(&d, argv[0])==SQLITE_OK ){
+    sqlite3_result_double(pCtx, digestQuantile(&d, rPct));
+  }
+  digestReset(&d);
+}
+
 
 #ifdef _WIN32
 __declspec(dllexport)
@@ -215,5 +1117,34 @@ int sqlite3_percentile_init(
   (void)pzErrMsg;  /* Unused parameter */
   rc = sqlite3_create_function(db, "percentile", 2, SQLITE_UTF8, 0,
                                0, percentStep, percentFinal);
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(db, "percentiles", -1, SQLITE_UTF8, 0,
+                                 0, percentilesStep, percentilesFinal);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(db, "approx_percentile", 2, SQLITE_UTF8, 0,
+                                 0, approxPercentStep, approxPercentFinal);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(db, "approx_percentile", 3, SQLITE_UTF8, 0,
+                                 0, approxPercentStep, approxPercentFinal);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(db, "percentile_sketch", 1, SQLITE_UTF8, 0,
+                                 0, sketchStep, sketchFinal);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(db, "percentile_sketch", 2, SQLITE_UTF8, 0,
+                                 0, sketchStep, sketchFinal);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(db, "percentile_sketch_merge", 1,
+                                 SQLITE_UTF8, 0, 0, sketchMergeStep,
+                                 sketchFinal);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(db, "percentile_from_sketch", 2,
+                                 SQLITE_UTF8, 0, sketchPercentFunc, 0, 0);
+  }
   return rc;
 }
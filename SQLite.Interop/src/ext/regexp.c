@@ -54,13 +54,58 @@
 ** exhibits exponential behavior.  Note that the X{p,q} operator expands
 ** to p copies of X following by q-p copies of X? and that the size of the
 ** regular expression in the O(N*M) performance bound is computed after
-** this expansion.
+** this expansion.  The exception is when X matches a single character
+** from a class (such as ".", "\d" or "[0-9a-f]") and q is more than a few.
+** Then X{p,q} is kept as one counted repetition that tracks how many times
+** X has matched, so that it costs about as much as X alone.  Neither p nor
+** q may be more than 1000, and an expression that expands to more than
+** 65535 states is rejected as too big.
+**
+** The sets of NFA states reached while matching are cached as the states
+** of a DFA that is built lazily and kept with the compiled expression, so
+** text that only takes transitions seen before costs a table lookup per
+** character.  The DFA is bounded in size and the NFA is simulated directly
+** once that bound is reached.
+**
+** When every match of the expression must contain some run of literal
+** characters (for example "ERROR" in "^[0-9:]* ERROR .*disk"), the longest
+** such run is found when the expression is compiled and the input is first
+** searched for it, using SSE2 or AVX2 where available.  Input that does not
+** contain the literal is rejected without running the NFA at all.
 */
 #include <string.h>
 #include <stdlib.h>
 #include "sqlite3ext.h"
 SQLITE_EXTENSION_INIT1
 
+/*
+** The search for the required literal uses SSE2 on x86 and x64 builds that
+** can assume it, and AVX2 as well if the CPU turns out to support it.  Define
+** RE_OMIT_SIMD to always use the portable search.
+*/
+#if !defined(RE_OMIT_SIMD)
+# if defined(_MSC_VER) && (defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP>=2))
+#  include <intrin.h>
+#  include <emmintrin.h>
+#  define RE_HAVE_SSE2 1
+#  if _MSC_VER>=1800
+#   include <immintrin.h>
+#   define RE_HAVE_AVX2 1
+#   define RE_AVX2_TARGET
+#  endif
+# elif (defined(__GNUC__) || defined(__clang__)) && defined(__SSE2__)
+#  include <cpuid.h>
+#  include <emmintrin.h>
+#  define RE_HAVE_SSE2 1
+#  if defined(__clang__) || __GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=9)
+#   include <immintrin.h>
+#   define RE_HAVE_AVX2 1
+#   define RE_AVX2_TARGET __attribute__((target("avx2")))
+#  endif
+# endif
+#endif
+
 /*
 ** The following #defines change the names of some functions implemented in
 ** this file to prevent name collisions with C-library functions of the
@@ -93,20 +138,97 @@ SQLITE_EXTENSION_INIT1
 #define RE_OP_SPACE      15    /* space:  [ \t\n\r\v\f] */
 #define RE_OP_NOTSPACE   16    /* Not a digit */
 #define RE_OP_BOUNDARY   17    /* Boundary between word and non-word */
+#define RE_OP_REPEAT_INIT 18   /* Start of X{p,q}.  The argument is p */
+#define RE_OP_REPEAT     19    /* X{p,q} matched 1 or more times.  Arg is q */
+#define RE_OP_REPEAT_SLOT 20   /* Where the counts of an RE_OP_REPEAT are */
+
+/* A counted repetition X{p,q} of a single-character X takes the form
+**
+**     RE_OP_REPEAT_INIT   p
+**     RE_OP_REPEAT        q, or -1 if there is no upper bound
+**     RE_OP_REPEAT_SLOT   offset of the counts in ReStateSet.aCount[]
+**     X                   one opcode, or a whole character class
+**
+** The first two are states.  Matching X from RE_OP_REPEAT_INIT moves to
+** RE_OP_REPEAT with a count of 1.  RE_OP_REPEAT keeps a bit for each count
+** that some path through the NFA has reached, and matching X shifts all of
+** them up by one.  Either state continues past X once p or more have been
+** matched.  Without an upper bound, the counts from p up are all the same
+** and kept as p.  Repetitions of at most RE_REPEAT_EXPAND are expanded.
+*/
+#ifndef RE_REPEAT_EXPAND
+# define RE_REPEAT_EXPAND  4
+#endif
+
+/* The largest p or q accepted in '{p,q}' */
+#ifndef RE_REPEAT_MAX
+# define RE_REPEAT_MAX  1000
+#endif
 
 /* Each opcode is a "state" in the NFA */
 typedef unsigned short ReStateNumber;
 
+/* The most states an NFA may have, so that each has a ReStateNumber */
+#define RE_MAX_NSTATE  65535
+
 /* Because this is an NFA and not a DFA, multiple states can be active at
 ** once.  An instance of the following object records all active states in
-** the NFA.  The implementation is optimized for the common case where the
-** number of actives states is small.
+** the NFA.  It is a sparse set:  aState[] lists the states in the order they
+** were added and aIndex[] maps each state to its position in aState[], so
+** that both adding a state and testing for one take constant time.  The
+** entries of aIndex[] for states that are not in the set may hold anything,
+** so the set is emptied just by setting nState to zero.  The counts of an
+** RE_OP_REPEAT state are in aCount[] and only mean anything while the state
+** is in the set.
 */
 typedef struct ReStateSet {
   unsigned nState;            /* Number of current states */
   ReStateNumber *aState;      /* Current states */
+  ReStateNumber *aIndex;      /* Position of each state in aState[] */
+  unsigned *aCount;           /* Counts of the RE_OP_REPEAT states */
 } ReStateSet;
 
+/* The NFA is turned into a DFA lazily, one state and one character at a
+** time, as re_match() runs into transitions it has not seen before.  Each
+** DFA state is a set of NFA states, sorted so that equal sets compare equal,
+** plus whether the previous character was a word character (which only
+** matters for patterns that use \b), plus the counts of the RE_OP_REPEAT
+** states in the set.  Transitions are cached for the
+** characters below RE_DFA_NCHAR.  The DFA stops growing once it uses
+** RE_DFA_MAX_MEMORY bytes, after which re_match() falls back to simulating
+** the NFA whenever it needs a state that is not in the DFA.
+*/
+#ifndef RE_DFA_MAX_MEMORY
+# define RE_DFA_MAX_MEMORY  (512*1024)
+#endif
+#define RE_DFA_NCHAR        128   /* Transitions are cached for c<RE_DFA_NCHAR */
+#define RE_DFA_UNKNOWN        0   /* Transition not computed yet */
+#define RE_DFA_ACCEPT        -1   /* Transition reaches RE_OP_ACCEPT */
+#define RE_DFA_DEAD          -2   /* Transition leaves no active states */
+
+typedef struct ReDfaState ReDfaState;
+struct ReDfaState {
+  int aNext[RE_DFA_NCHAR];    /* RE_DFA_* value or 1 + index of the next state */
+  unsigned iHash;             /* Hash of the state set and bWord */
+  unsigned char bWord;        /* True if the previous character was a word char */
+  unsigned char bAccept;      /* True if the set contains an RE_OP_ACCEPT */
+  unsigned nState;            /* Number of NFA states in aState[] */
+  unsigned *aCount;           /* Counts of the RE_OP_REPEAT states, in order */
+  ReStateNumber aState[1];    /* Sorted NFA states.  Really nState entries */
+};
+
+typedef struct ReDfa ReDfa;
+struct ReDfa {
+  ReDfaState **apState;       /* All DFA states, apState[0] is the start */
+  int nState;                 /* Number of entries in apState[] */
+  int nAlloc;                 /* Slots allocated for apState[] */
+  int *aHash;                 /* Hash table of 1 + index into apState[] */
+  int nHash;                  /* Slots in aHash[], a power of two */
+  int nMemory;                /* Bytes used by the DFA */
+  int bFull;                  /* True once RE_DFA_MAX_MEMORY is reached */
+  int bBoundary;              /* True if the NFA contains RE_OP_BOUNDARY */
+};
+
 /* An input string read one character at a time.
 */
 typedef struct ReInput ReInput;
@@ -116,6 +238,17 @@ struct ReInput {
   int mx;                  /* EOF when i>=mx */
 };
 
+/* Longest literal, in bytes, that re_compile() extracts from an expression.
+** A longer run of literal characters is cut down to its first RE_LIT_MAX
+** bytes, which every match must contain just the same.
+*/
+#define RE_LIT_MAX  32
+
+/* Search z[0..n-1] for the nLit bytes of zLit[].  Return the offset of the
+** first occurrence, or -1 if there is none.
+*/
+typedef int (*ReFindFunc)(const unsigned char*,int,const unsigned char*,int);
+
 /* A compiled NFA (or an NFA that is in the process of being compiled) is
 ** an instance of the following object.
 */
@@ -126,16 +259,23 @@ struct ReCompiled {
   char *aOp;                  /* Operators for the virtual machine */
   int *aArg;                  /* Arguments to each operator */
   unsigned (*xNextChar)(ReInput*);  /* Next character function */
-  unsigned char zInit[12];    /* Initial text to match */
-  int nInit;                  /* Number of characters in zInit */
+  ReFindFunc xFindLit;        /* Search function for zInit[] and zLit[] */
+  unsigned char zInit[RE_LIT_MAX];  /* Initial text to match */
+  int nInit;                  /* Number of bytes in zInit[] */
+  unsigned char zLit[RE_LIT_MAX];   /* Longer text that every match contains */
+  int nLit;                   /* Number of bytes in zLit[] */
   unsigned nState;            /* Number of entries in aOp[] and aArg[] */
   unsigned nAlloc;            /* Slots allocated for aOp[] and aArg[] */
+  ReDfa *pDfa;                /* Lazily built DFA, or NULL */
+  ReStateNumber *aSetSpace;   /* Space for the state sets of large NFAs */
+  int nCountWord;             /* Words of counts in each state set */
 };
 
 /* Add a state to the given state set if it is not already there */
 static void re_add_state(ReStateSet *pSet, int newState){
-  unsigned i;
-  for(i=0; i<pSet->nState; i++) if( pSet->aState[i]==newState ) return;
+  unsigned i = pSet->aIndex[newState];
+  if( i<pSet->nState && pSet->aState[i]==newState ) return;
+  pSet->aIndex[newState] = (ReStateNumber)pSet->nState;
   pSet->aState[pSet->nState++] = newState;
 }
 
@@ -191,13 +331,567 @@ static int re_space_char(int c){
   return c==' ' || c=='\t' || c=='\n' || c=='\r' || c=='\v' || c=='\f';
 }
 
+/*
+** Search functions for the required literal of an expression.  All of them
+** return the offset of the first occurrence of zLit[] in z[0..n-1], or -1.
+** The portable version lets memchr() find candidates for the first byte.
+*/
+static int re_find_literal(
+  const unsigned char *z,
+  int n,
+  const unsigned char *zLit,
+  int nLit
+){
+  const unsigned char *zStart = z;
+  const unsigned char *zLast;
+  if( n<nLit ) return -1;
+  zLast = z + n - nLit;
+  while( z<=zLast ){
+    z = (const unsigned char*)memchr(z, zLit[0], zLast - z + 1);
+    if( z==0 ) break;
+    if( memcmp(z, zLit, nLit)==0 ) return (int)(z - zStart);
+    z++;
+  }
+  return -1;
+}
+
+#if defined(RE_HAVE_SSE2)
+#if defined(_MSC_VER)
+static int re_ctz(unsigned m){
+  unsigned long i;
+  _BitScanForward(&i, m);
+  return (int)i;
+}
+#else
+# define re_ctz(m) __builtin_ctz(m)
+#endif
+
+/* The vector searches compare a block of candidate positions against the
+** first byte of the literal and the same positions moved forward by nLit-1
+** against its last byte.  Only the positions where both compare equal are
+** checked with memcmp(), which for real text and literals of two or more
+** bytes is rarely more than the actual occurrences.  The last few positions,
+** too few to fill a block, are left to re_find_literal().
+*/
+static int re_find_literal_sse2(
+  const unsigned char *z,
+  int n,
+  const unsigned char *zLit,
+  int nLit
+){
+  const __m128i vFirst = _mm_set1_epi8((char)zLit[0]);
+  const __m128i vLast = _mm_set1_epi8((char)zLit[nLit-1]);
+  int i, r;
+  for(i=0; i+nLit-1+16<=n; i+=16){
+    __m128i a = _mm_loadu_si128((const __m128i*)(z+i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(z+i+nLit-1));
+    unsigned m = (unsigned)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, vFirst), _mm_cmpeq_epi8(b, vLast)));
+    while( m ){
+      int j = re_ctz(m);
+      if( memcmp(z+i+j, zLit, nLit)==0 ) return i+j;
+      m &= m-1;
+    }
+  }
+  r = re_find_literal(z+i, n-i, zLit, nLit);
+  return r<0 ? -1 : i+r;
+}
+#endif /* RE_HAVE_SSE2 */
+
+#if defined(RE_HAVE_AVX2)
+static RE_AVX2_TARGET int re_find_literal_avx2(
+  const unsigned char *z,
+  int n,
+  const unsigned char *zLit,
+  int nLit
+){
+  const __m256i vFirst = _mm256_set1_epi8((char)zLit[0]);
+  const __m256i vLast = _mm256_set1_epi8((char)zLit[nLit-1]);
+  int i, r;
+  for(i=0; i+nLit-1+32<=n; i+=32){
+    __m256i a = _mm256_loadu_si256((const __m256i*)(z+i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(z+i+nLit-1));
+    unsigned m = (unsigned)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(a, vFirst),
+                         _mm256_cmpeq_epi8(b, vLast)));
+    while( m ){
+      int j = re_ctz(m);
+      if( memcmp(z+i+j, zLit, nLit)==0 ) return i+j;
+      m &= m-1;
+    }
+  }
+  r = re_find_literal_sse2(z+i, n-i, zLit, nLit);
+  return r<0 ? -1 : i+r;
+}
+
+/* Return true if both the CPU and the operating system support AVX2 */
+static int re_cpu_has_avx2(void){
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if( info[0]<7 ) return 0;
+  __cpuid(info, 1);
+  if( (info[2] & (1<<27))==0 || (info[2] & (1<<28))==0 ) return 0;
+  if( (_xgetbv(0) & 6)!=6 ) return 0;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1<<5))!=0;
+#else
+  unsigned a, b, c, d;
+  if( __get_cpuid_max(0, 0)<7 ) return 0;
+  __cpuid(1, a, b, c, d);
+  if( (c & (1<<27))==0 || (c & (1<<28))==0 ) return 0;
+  __asm__ __volatile__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+  if( (a & 6)!=6 ) return 0;
+  __cpuid_count(7, 0, a, b, c, d);
+  return (b & (1<<5))!=0;
+#endif
+}
+#endif /* RE_HAVE_AVX2 */
+
+/* Return the fastest search function this machine supports.  The choice is
+** made once.  Threads that race to make it all arrive at the same answer.
+*/
+static ReFindFunc re_find_func(void){
+  static ReFindFunc xFind = 0;
+  if( xFind==0 ){
+    ReFindFunc x = re_find_literal;
+#if defined(RE_HAVE_SSE2)
+    x = re_find_literal_sse2;
+#endif
+#if defined(RE_HAVE_AVX2)
+    if( re_cpu_has_avx2() ) x = re_find_literal_avx2;
+#endif
+    xFind = x;
+  }
+  return xFind;
+}
+
+/* Return true if the single-character opcode at aOp[x], which may be a
+** character class, matches c.  Nothing matches the end of input.
+*/
+static int re_char_match(ReCompiled *pRe, int x, int c){
+  if( c==RE_EOF ) return 0;
+  switch( pRe->aOp[x] ){
+    case RE_OP_MATCH:     return pRe->aArg[x]==c;
+    case RE_OP_ANY:       return 1;
+    case RE_OP_WORD:      return re_word_char(c);
+    case RE_OP_NOTWORD:   return !re_word_char(c);
+    case RE_OP_DIGIT:     return re_digit_char(c);
+    case RE_OP_NOTDIGIT:  return !re_digit_char(c);
+    case RE_OP_SPACE:     return re_space_char(c);
+    case RE_OP_NOTSPACE:  return !re_space_char(c);
+    case RE_OP_CC_INC:
+    case RE_OP_CC_EXC: {
+      int j = 1;
+      int n = pRe->aArg[x];
+      int hit = 0;
+      for(j=1; j>0 && j<n; j++){
+        if( pRe->aOp[x+j]==RE_OP_CC_VALUE ){
+          if( pRe->aArg[x+j]==c ){
+            hit = 1;
+            j = -1;
+          }
+        }else{
+          if( pRe->aArg[x+j]<=c && pRe->aArg[x+j+1]>=c ){
+            hit = 1;
+            j = -1;
+          }else{
+            j++;
+          }
+        }
+      }
+      if( pRe->aOp[x]==RE_OP_CC_EXC ) hit = !hit;
+      return hit;
+    }
+  }
+  return 0;
+}
+
+/* Return the highest count kept for the RE_OP_REPEAT at aOp[x] */
+static int re_repeat_max(ReCompiled *pRe, int x){
+  if( pRe->aArg[x]>=0 ) return pRe->aArg[x];
+  return pRe->aArg[x-1]>1 ? pRe->aArg[x-1] : 1;
+}
+
+/* Return the number of words of counts of the RE_OP_REPEAT at aOp[x] */
+static int re_repeat_words(ReCompiled *pRe, int x){
+  return re_repeat_max(pRe, x)/32 + 1;
+}
+
+/* Return the state that follows the repetition whose RE_OP_REPEAT is at
+** aOp[x]
+*/
+static int re_repeat_exit(ReCompiled *pRe, int x){
+  int iOp = x+2;
+  if( pRe->aOp[iOp]==RE_OP_CC_INC || pRe->aOp[iOp]==RE_OP_CC_EXC ){
+    return iOp + pRe->aArg[iOp];
+  }
+  return iOp + 1;
+}
+
+/* Return true if aBits[] holds a count high enough to leave the repetition
+** whose RE_OP_REPEAT is at aOp[x]
+*/
+static int re_repeat_done(ReCompiled *pRe, int x, const unsigned *aBits){
+  int iMin = pRe->aArg[x-1]>1 ? pRe->aArg[x-1] : 1;
+  int nWord = re_repeat_words(pRe, x);
+  int w = iMin/32;
+  unsigned mask = ~0u << (iMin%32);
+  for(; w<nWord; w++){
+    if( aBits[w] & mask ) return 1;
+    mask = ~0u;
+  }
+  return 0;
+}
+
+/* Add the RE_OP_REPEAT at aOp[x] to pSet with the counts in aFrom[] plus
+** one, merging them with any counts it already has there.  If aFrom is
+** NULL, add it with a count of 1.
+*/
+static void re_repeat_add(
+  ReCompiled *pRe,
+  ReStateSet *pSet,
+  int x,
+  const unsigned *aFrom
+){
+  int iMax = re_repeat_max(pRe, x);
+  int nWord = iMax/32 + 1;
+  unsigned *aTo = pSet->aCount + pRe->aArg[x+1];
+  unsigned i = pSet->aIndex[x];
+  int w;
+  if( i>=pSet->nState || pSet->aState[i]!=x ){
+    re_add_state(pSet, x);
+    memset(aTo, 0, nWord*sizeof(aTo[0]));
+  }
+  if( aFrom==0 ){
+    aTo[0] |= 2;
+    return;
+  }
+  for(w=nWord-1; w>0; w--) aTo[w] |= (aFrom[w]<<1) | (aFrom[w-1]>>31);
+  aTo[0] |= aFrom[0]<<1;
+  if( (iMax+1)/32<nWord ) aTo[(iMax+1)/32] &= ~(1u<<((iMax+1)%32));
+  if( pRe->aArg[x]<0 && (aFrom[iMax/32]>>(iMax%32))&1 ){
+    aTo[iMax/32] |= 1u<<(iMax%32);
+  }
+}
+
+/* Advance the NFA by one input character c.  The states reached from the
+** states in pThis are added to pNext.  States that do not consume input
+** (forks, gotos and the like) are added to pThis as they are followed.
+** Return true if an RE_OP_ACCEPT state is reached.
+*/
+static int re_step(
+  ReCompiled *pRe,
+  ReStateSet *pThis,
+  ReStateSet *pNext,
+  int c,
+  int cPrev
+){
+  unsigned int i;
+  pNext->nState = 0;
+  for(i=0; i<pThis->nState; i++){
+    int x = pThis->aState[i];
+    switch( pRe->aOp[x] ){
+      case RE_OP_MATCH: {
+        if( pRe->aArg[x]==c ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_ANY: {
+        if( c!=RE_EOF ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_WORD: {
+        if( re_word_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_NOTWORD: {
+        if( c!=RE_EOF && !re_word_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_DIGIT: {
+        if( re_digit_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_NOTDIGIT: {
+        if( c!=RE_EOF && !re_digit_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_SPACE: {
+        if( re_space_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_NOTSPACE: {
+        if( c!=RE_EOF && !re_space_char(c) ) re_add_state(pNext, x+1);
+        break;
+      }
+      case RE_OP_BOUNDARY: {
+        if( re_word_char(c)!=re_word_char(cPrev) ) re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_ANYSTAR: {
+        re_add_state(pNext, x);
+        re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_FORK: {
+        re_add_state(pThis, x+pRe->aArg[x]);
+        re_add_state(pThis, x+1);
+        break;
+      }
+      case RE_OP_GOTO: {
+        re_add_state(pThis, x+pRe->aArg[x]);
+        break;
+      }
+      case RE_OP_ACCEPT: {
+        return 1;
+      }
+      case RE_OP_CC_INC:
+      case RE_OP_CC_EXC: {
+        if( re_char_match(pRe, x, c) ) re_add_state(pNext, x+pRe->aArg[x]);
+        break;            
+      }
+      case RE_OP_REPEAT_INIT: {
+        if( pRe->aArg[x]==0 ) re_add_state(pThis, re_repeat_exit(pRe, x+1));
+        if( re_char_match(pRe, x+3, c) ) re_repeat_add(pRe, pNext, x+1, 0);
+        break;
+      }
+      case RE_OP_REPEAT: {
+        const unsigned *aBits = pThis->aCount + pRe->aArg[x+1];
+        if( re_repeat_done(pRe, x, aBits) ){
+          re_add_state(pThis, re_repeat_exit(pRe, x));
+        }
+        if( re_char_match(pRe, x+2, c) ) re_repeat_add(pRe, pNext, x, aBits);
+        break;
+      }
+    }
+  }
+  return 0;
+}
+
+/* Free the DFA of a compiled regular expression.
+*/
+static void re_dfa_free(ReDfa *pDfa){
+  if( pDfa ){
+    int i;
+    for(i=0; i<pDfa->nState; i++) sqlite3_free(pDfa->apState[i]);
+    sqlite3_free(pDfa->apState);
+    sqlite3_free(pDfa->aHash);
+    sqlite3_free(pDfa);
+  }
+}
+
+/* Compute the hash of a sorted set of NFA states and their counts.
+*/
+static unsigned re_dfa_hash(ReCompiled *pRe, const ReStateSet *pSet, int bWord){
+  unsigned h = 2166136261u ^ (unsigned)bWord;
+  unsigned i;
+  int w;
+  for(i=0; i<pSet->nState; i++){
+    int x = pSet->aState[i];
+    h = (h ^ x) * 16777619u;
+    if( pRe->aOp[x]==RE_OP_REPEAT ){
+      const unsigned *aBits = pSet->aCount + pRe->aArg[x+1];
+      for(w=re_repeat_words(pRe, x)-1; w>=0; w--){
+        h = (h ^ aBits[w]) * 16777619u;
+      }
+    }
+  }
+  return h;
+}
+
+/* Return the number of words of counts that the states in pSet have */
+static int re_dfa_count_words(ReCompiled *pRe, const ReStateSet *pSet){
+  int nWord = 0;
+  unsigned i;
+  for(i=0; i<pSet->nState; i++){
+    int x = pSet->aState[i];
+    if( pRe->aOp[x]==RE_OP_REPEAT ) nWord += re_repeat_words(pRe, x);
+  }
+  return nWord;
+}
+
+/* Copy the counts of the states in pSet to or from aCount[], in which they
+** follow one another in the order of the states.  If bLoad is true, copy
+** them from aCount[] into pSet.  If aCount is NULL, return true if the
+** counts in pSet are the same as those in aCmp[] instead.
+*/
+static int re_dfa_counts(
+  ReCompiled *pRe,
+  ReStateSet *pSet,
+  unsigned *aCount,
+  const unsigned *aCmp,
+  int bLoad
+){
+  unsigned i;
+  int n = 0;
+  for(i=0; i<pSet->nState; i++){
+    int x = pSet->aState[i];
+    if( pRe->aOp[x]==RE_OP_REPEAT ){
+      unsigned *aBits = pSet->aCount + pRe->aArg[x+1];
+      int nWord = re_repeat_words(pRe, x);
+      if( aCount==0 ){
+        if( memcmp(aBits, &aCmp[n], nWord*sizeof(unsigned)) ) return 0;
+      }else if( bLoad ){
+        memcpy(aBits, &aCount[n], nWord*sizeof(unsigned));
+      }else{
+        memcpy(&aCount[n], aBits, nWord*sizeof(unsigned));
+      }
+      n += nWord;
+    }
+  }
+  return 1;
+}
+
+/* Find the DFA state for the set of NFA states in pSet, adding it to the DFA
+** if it is not there yet.  The set is sorted in place.  Return the index of
+** the DFA state, or -1 if it is not in the DFA and cannot be added.
+*/
+static int re_dfa_state(ReCompiled *pRe, ReStateSet *pSet, int bWord){
+  ReDfa *pDfa = pRe->pDfa;
+  ReDfaState *pNew;
+  unsigned h, i, j;
+  sqlite3_int64 nByte, nStateByte;
+
+  for(i=1; i<pSet->nState; i++){
+    ReStateNumber x = pSet->aState[i];
+    for(j=i; j>0 && pSet->aState[j-1]>x; j--) pSet->aState[j] = pSet->aState[j-1];
+    pSet->aState[j] = x;
+  }
+  for(i=0; i<pSet->nState; i++) pSet->aIndex[pSet->aState[i]] = (ReStateNumber)i;
+  if( !pDfa->bBoundary ) bWord = 0;
+  h = re_dfa_hash(pRe, pSet, bWord);
+  if( pDfa->nHash ){
+    for(i=h&(pDfa->nHash-1); pDfa->aHash[i]; i=(i+1)&(pDfa->nHash-1)){
+      ReDfaState *p = pDfa->apState[pDfa->aHash[i]-1];
+      if( p->iHash==h && p->bWord==bWord && p->nState==pSet->nState
+       && memcmp(p->aState, pSet->aState, pSet->nState*sizeof(ReStateNumber))==0
+       && (pRe->nCountWord==0 || re_dfa_counts(pRe, pSet, 0, p->aCount, 0))
+      ){
+        return pDfa->aHash[i]-1;
+      }
+    }
+  }
+  if( pDfa->bFull ) return -1;
+
+  /* Keep the hash table at most half full and the DFA within budget */
+  nStateByte = sizeof(ReDfaState) + pSet->nState*(sqlite3_int64)sizeof(ReStateNumber);
+  nStateByte = (nStateByte + sizeof(unsigned) - 1) & ~(sqlite3_int64)(sizeof(unsigned)-1);
+  nByte = nStateByte;
+  if( pRe->nCountWord ){
+    nByte += re_dfa_count_words(pRe, pSet)*(sqlite3_int64)sizeof(unsigned);
+  }
+  if( pDfa->nMemory+nByte
+        +(pDfa->nState+(sqlite3_int64)1)*(sizeof(ReDfaState*)+2*sizeof(int))
+        > RE_DFA_MAX_MEMORY ){
+    pDfa->bFull = 1;
+    return -1;
+  }
+  if( pDfa->nState>=pDfa->nAlloc ){
+    int nAlloc = pDfa->nAlloc ? pDfa->nAlloc*2 : 16;
+    ReDfaState **apState;
+    apState = sqlite3_realloc(pDfa->apState, nAlloc*sizeof(apState[0]));
+    if( apState==0 ) return -1;
+    pDfa->apState = apState;
+    pDfa->nAlloc = nAlloc;
+  }
+  if( (pDfa->nState+1)*2>pDfa->nHash ){
+    int nHash = pDfa->nHash ? pDfa->nHash*2 : 32;
+    int *aHash = sqlite3_malloc( nHash*sizeof(int) );
+    int k;
+    if( aHash==0 ) return -1;
+    memset(aHash, 0, nHash*sizeof(int));
+    for(k=0; k<pDfa->nState; k++){
+      for(i=pDfa->apState[k]->iHash&(nHash-1); aHash[i]; i=(i+1)&(nHash-1)){}
+      aHash[i] = k+1;
+    }
+    sqlite3_free(pDfa->aHash);
+    pDfa->aHash = aHash;
+    pDfa->nHash = nHash;
+  }
+  pNew = sqlite3_malloc( (int)nByte );
+  if( pNew==0 ) return -1;
+  memset(pNew->aNext, 0, sizeof(pNew->aNext));
+  pNew->iHash = h;
+  pNew->bWord = (unsigned char)bWord;
+  pNew->bAccept = 0;
+  pNew->nState = pSet->nState;
+  pNew->aCount = (unsigned*)&((char*)pNew)[nStateByte];
+  if( pRe->nCountWord ) re_dfa_counts(pRe, pSet, pNew->aCount, 0, 0);
+  for(i=0; i<pSet->nState; i++){
+    pNew->aState[i] = pSet->aState[i];
+    if( pRe->aOp[pSet->aState[i]]==RE_OP_ACCEPT ) pNew->bAccept = 1;
+  }
+  for(i=h&(pDfa->nHash-1); pDfa->aHash[i]; i=(i+1)&(pDfa->nHash-1)){}
+  pDfa->aHash[i] = pDfa->nState+1;
+  pDfa->apState[pDfa->nState] = pNew;
+  pDfa->nMemory += (int)nByte;
+  return pDfa->nState++;
+}
+
+/* Run the DFA over the input, starting with the NFA states in aStateSet[1]
+** and building the DFA as needed.  Return true or false if the input does or
+** does not match.  If the DFA cannot go on, because it is full or memory
+** runs out, return -1 instead.  In that case, aStateSet[1] holds the NFA
+** states to continue from and *pc the character that was read last.
+*/
+static int re_dfa_match(ReCompiled *pRe, ReInput *pIn, ReStateSet *aStateSet, int *pc){
+  ReDfa *pDfa = pRe->pDfa;
+  ReDfaState *pState;
+  int c = *pc;
+  int cPrev;
+  int iNext;
+
+  if( pDfa==0 ){
+    unsigned i;
+    pDfa = pRe->pDfa = sqlite3_malloc( sizeof(*pDfa) );
+    if( pDfa==0 ) return -1;
+    memset(pDfa, 0, sizeof(*pDfa));
+    for(i=0; i<pRe->nState; i++){
+      if( pRe->aOp[i]==RE_OP_BOUNDARY ) pDfa->bBoundary = 1;
+    }
+  }
+  if( pDfa->nState==0 && re_dfa_state(pRe, &aStateSet[1], 0)<0 ) return -1;
+  pState = pDfa->apState[0];
+
+  for(;;){
+    cPrev = c;
+    c = pRe->xNextChar(pIn);
+    iNext = c<RE_DFA_NCHAR ? pState->aNext[c] : RE_DFA_UNKNOWN;
+    if( iNext==RE_DFA_UNKNOWN ){
+      ReStateSet *pThis = &aStateSet[0];
+      ReStateSet *pNext = &aStateSet[1];
+      unsigned i;
+      pThis->nState = 0;
+      for(i=0; i<pState->nState; i++) re_add_state(pThis, pState->aState[i]);
+      if( pRe->nCountWord ) re_dfa_counts(pRe, pThis, pState->aCount, 0, 1);
+      if( re_step(pRe, pThis, pNext, c, cPrev) ){
+        iNext = RE_DFA_ACCEPT;
+      }else if( pNext->nState==0 ){
+        iNext = RE_DFA_DEAD;
+      }else{
+        iNext = re_dfa_state(pRe, pNext, re_word_char(c));
+        if( iNext<0 ){
+          *pc = c;
+          return -1;
+        }
+        iNext++;
+      }
+      if( c<RE_DFA_NCHAR ) pState->aNext[c] = iNext;
+    }
+    if( iNext==RE_DFA_ACCEPT ) return 1;
+    if( iNext==RE_DFA_DEAD ) return 0;
+    pState = pDfa->apState[iNext-1];
+    if( c==RE_EOF ) return pState->bAccept;
+  }
+}
+
 /* Run a compiled regular expression on the zero-terminated input
 ** string zIn[].  Return true on a match and false if there is no match.
 */
 static int re_match(ReCompiled *pRe, const unsigned char *zIn, int nIn){
   ReStateSet aStateSet[2], *pThis, *pNext;
   ReStateNumber aSpace[100];
-  ReStateNumber *pToFree;
+  ReStateNumber *pSpace;
   unsigned int i = 0;
   unsigned int iSwap = 0;
   int c = RE_EOF+1;
@@ -209,139 +903,94 @@ static int re_match(ReCompiled *pRe, const unsigned char *zIn, int nIn){
   in.i = 0;
   in.mx = nIn>=0 ? nIn : (int)strlen((char const*)zIn);
 
+  /* Input that lacks the required literal cannot match */
+  if( pRe->nLit && pRe->xFindLit(zIn, in.mx, pRe->zLit, pRe->nLit)<0 ){
+    return 0;
+  }
+
   /* Look for the initial prefix match, if there is one. */
   if( pRe->nInit ){
-    unsigned char x = pRe->zInit[0];
-    while( in.i+pRe->nInit<=in.mx 
-     && (zIn[in.i]!=x ||
-         strncmp((const char*)zIn+in.i, (const char*)pRe->zInit, pRe->nInit)!=0)
-    ){
-      in.i++;
-    }
-    if( in.i+pRe->nInit>in.mx ) return 0;
+    int iInit = pRe->xFindLit(zIn, in.mx, pRe->zInit, pRe->nInit);
+    if( iInit<0 ) return 0;
+    in.i = iInit;
   }
 
-  if( pRe->nState<=(sizeof(aSpace)/(sizeof(aSpace[0])*2)) ){
-    pToFree = 0;
-    aStateSet[0].aState = aSpace;
+  /* Each of the two state sets needs two arrays of nState entries, and
+  ** nCountWord words of counts.  Small NFAs without counts use the stack.
+  ** Others use space that is allocated the first time and then kept with
+  ** the compiled expression for the next call, with the counts first.  The
+  ** space is cleared when it is obtained only so that tools checking for
+  ** reads of uninitialized memory stay quiet.
+  */
+  if( pRe->nState<=(sizeof(aSpace)/(sizeof(aSpace[0])*4))
+   && pRe->nCountWord==0
+  ){
+    pSpace = aSpace;
+    memset(aSpace, 0, sizeof(aSpace));
+    aStateSet[0].aCount = aStateSet[1].aCount = 0;
   }else{
-    pToFree = sqlite3_malloc( sizeof(ReStateNumber)*2*pRe->nState );
-    if( pToFree==0 ) return -1;
-    aStateSet[0].aState = pToFree;
+    sqlite3_int64 nByte = sizeof(unsigned)*2*(sqlite3_int64)pRe->nCountWord
+              + sizeof(ReStateNumber)*4*(sqlite3_int64)pRe->nState;
+    if( pRe->aSetSpace==0 ){
+      if( nByte>0x7fffffff ) return -1;
+      pRe->aSetSpace = sqlite3_malloc( (int)nByte );
+      if( pRe->aSetSpace==0 ) return -1;
+      memset(pRe->aSetSpace, 0, nByte);
+    }
+    aStateSet[0].aCount = (unsigned*)pRe->aSetSpace;
+    aStateSet[1].aCount = &aStateSet[0].aCount[pRe->nCountWord];
+    pSpace = (ReStateNumber*)&aStateSet[1].aCount[pRe->nCountWord];
   }
-  aStateSet[1].aState = &aStateSet[0].aState[pRe->nState];
+  aStateSet[0].aState = pSpace;
+  aStateSet[0].aIndex = &pSpace[pRe->nState];
+  aStateSet[1].aState = &pSpace[pRe->nState*2];
+  aStateSet[1].aIndex = &pSpace[pRe->nState*3];
   pNext = &aStateSet[1];
   pNext->nState = 0;
   re_add_state(pNext, 0);
+
+  /* Use the DFA for as long as it can be used, then continue with the NFA */
+  rc = re_dfa_match(pRe, &in, aStateSet, &c);
+  if( rc>=0 ) return rc;
+  rc = 0;
+
   while( c!=RE_EOF && pNext->nState>0 ){
     cPrev = c;
     c = pRe->xNextChar(&in);
     pThis = pNext;
     pNext = &aStateSet[iSwap];
     iSwap = 1 - iSwap;
-    pNext->nState = 0;
-    for(i=0; i<pThis->nState; i++){
-      int x = pThis->aState[i];
-      switch( pRe->aOp[x] ){
-        case RE_OP_MATCH: {
-          if( pRe->aArg[x]==c ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_ANY: {
-          re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_WORD: {
-          if( re_word_char(c) ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_NOTWORD: {
-          if( !re_word_char(c) ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_DIGIT: {
-          if( re_digit_char(c) ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_NOTDIGIT: {
-          if( !re_digit_char(c) ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_SPACE: {
-          if( re_space_char(c) ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_NOTSPACE: {
-          if( !re_space_char(c) ) re_add_state(pNext, x+1);
-          break;
-        }
-        case RE_OP_BOUNDARY: {
-          if( re_word_char(c)!=re_word_char(cPrev) ) re_add_state(pThis, x+1);
-          break;
-        }
-        case RE_OP_ANYSTAR: {
-          re_add_state(pNext, x);
-          re_add_state(pThis, x+1);
-          break;
-        }
-        case RE_OP_FORK: {
-          re_add_state(pThis, x+pRe->aArg[x]);
-          re_add_state(pThis, x+1);
-          break;
-        }
-        case RE_OP_GOTO: {
-          re_add_state(pThis, x+pRe->aArg[x]);
-          break;
-        }
-        case RE_OP_ACCEPT: {
-          rc = 1;
-          goto re_match_end;
-        }
-        case RE_OP_CC_INC:
-        case RE_OP_CC_EXC: {
-          int j = 1;
-          int n = pRe->aArg[x];
-          int hit = 0;
-          for(j=1; j>0 && j<n; j++){
-            if( pRe->aOp[x+j]==RE_OP_CC_VALUE ){
-              if( pRe->aArg[x+j]==c ){
-                hit = 1;
-                j = -1;
-              }
-            }else{
-              if( pRe->aArg[x+j]<=c && pRe->aArg[x+j+1]>=c ){
-                hit = 1;
-                j = -1;
-              }else{
-                j++;
-              }
-            }
-          }
-          if( pRe->aOp[x]==RE_OP_CC_EXC ) hit = !hit;
-          if( hit ) re_add_state(pNext, x+n);
-          break;            
-        }
-      }
-    }
+    if( re_step(pRe, pThis, pNext, c, cPrev) ) return 1;
   }
   for(i=0; i<pNext->nState; i++){
     if( pRe->aOp[pNext->aState[i]]==RE_OP_ACCEPT ){ rc = 1; break; }
   }
-re_match_end:
-  sqlite3_free(pToFree);
   return rc;
 }
 
 /* Resize the opcode and argument arrays for an RE under construction.
+** They are never made larger than RE_MAX_NSTATE entries.  On failure the
+** compile error is set and non-zero is returned.
 */
-static int re_resize(ReCompiled *p, int N){
+static int re_resize(ReCompiled *p, sqlite3_int64 N){
   char *aOp;
   int *aArg;
-  aOp = sqlite3_realloc(p->aOp, N*sizeof(p->aOp[0]));
-  if( aOp==0 ) return 1;
+  if( N>RE_MAX_NSTATE ) N = RE_MAX_NSTATE;
+  if( N<=p->nAlloc ){
+    p->zErr = "REGEXP pattern too big";
+    return 1;
+  }
+  aOp = sqlite3_realloc(p->aOp, (int)N*sizeof(p->aOp[0]));
+  if( aOp==0 ){
+    p->zErr = "out of memory";
+    return 1;
+  }
   p->aOp = aOp;
-  aArg = sqlite3_realloc(p->aArg, N*sizeof(p->aArg[0]));
-  if( aArg==0 ) return 1;
+  aArg = sqlite3_realloc(p->aArg, (int)N*sizeof(p->aArg[0]));
+  if( aArg==0 ){
+    p->zErr = "out of memory";
+    return 1;
+  }
   p->aArg = aArg;
   p->nAlloc = N;
   return 0;
@@ -373,7 +1022,13 @@ static int re_append(ReCompiled *p, int op, int arg){
 ** under construction.
 */
 static void re_copy(ReCompiled *p, int iStart, int N){
-  if( p->nState+N>=p->nAlloc && re_resize(p, p->nAlloc*2+N) ) return;
+  if( p->nState+N>=p->nAlloc ){
+    if( re_resize(p, p->nAlloc*(sqlite3_int64)2+N) ) return;
+    if( p->nState+N>=p->nAlloc ){
+      p->zErr = "REGEXP pattern too big";
+      return;
+    }
+  }
   memcpy(&p->aOp[p->nState], &p->aOp[iStart], N*sizeof(p->aOp[0]));
   memcpy(&p->aArg[p->nState], &p->aArg[iStart], N*sizeof(p->aArg[0]));
   p->nState += N;
@@ -467,6 +1122,28 @@ static const char *re_subcompile_re(ReCompiled *p){
   return 0;
 }
 
+/* Return true if the N opcodes at aOp[iStart] match a single character out
+** of a class of them, which can be repeated with RE_OP_REPEAT.  Single
+** literal characters are left to be expanded, so that they can be part of
+** the literal text found by re_extract_literal().
+*/
+static int re_single_char(ReCompiled *p, int iStart, int N){
+  switch( p->aOp[iStart] ){
+    case RE_OP_ANY:
+    case RE_OP_WORD:
+    case RE_OP_NOTWORD:
+    case RE_OP_DIGIT:
+    case RE_OP_NOTDIGIT:
+    case RE_OP_SPACE:
+    case RE_OP_NOTSPACE:
+      return N==1;
+    case RE_OP_CC_INC:
+    case RE_OP_CC_EXC:
+      return N==p->aArg[iStart];
+  }
+  return 0;
+}
+
 /* Compile an element of regular expression text (anything that can be
 ** an operand to the "|" operator).  Return NULL on success or a pointer
 ** to the error message if there is a problem.
@@ -521,20 +1198,37 @@ static const char *re_subcompile_string(ReCompiled *p){
         int m = 0, n = 0;
         int sz, j;
         if( iPrev<0 ) return "'{m,n}' without operand";
-        while( (c=rePeek(p))>='0' && c<='9' ){ m = m*10 + c - '0'; p->sIn.i++; }
+        while( (c=rePeek(p))>='0' && c<='9' ){
+          m = m*10 + c - '0';
+          if( m>RE_REPEAT_MAX ) return "{m,n} too large";
+          p->sIn.i++;
+        }
         n = m;
         if( c==',' ){
           p->sIn.i++;
           n = 0;
-          while( (c=rePeek(p))>='0' && c<='9' ){ n = n*10 + c-'0'; p->sIn.i++; }
+          while( (c=rePeek(p))>='0' && c<='9' ){
+            n = n*10 + c-'0';
+            if( n>RE_REPEAT_MAX ) return "{m,n} too large";
+            p->sIn.i++;
+          }
         }
         if( c!='}' ) return "unmatched '{'";
         if( n>0 && n<m ) return "n less than m in '{m,n}'";
         p->sIn.i++;
         sz = p->nState - iPrev;
+        if( (n>RE_REPEAT_EXPAND || (n==0 && m>RE_REPEAT_EXPAND))
+         && re_single_char(p, iPrev, sz)
+        ){
+          re_insert(p, iPrev, RE_OP_REPEAT_SLOT, 0);
+          re_insert(p, iPrev, RE_OP_REPEAT, n>0 ? n : -1);
+          re_insert(p, iPrev, RE_OP_REPEAT_INIT, m);
+          break;
+        }
         if( m==0 ){
           if( n==0 ) return "both m and n are zero in '{m,n}'";
           re_insert(p, iPrev, RE_OP_FORK, sz+1);
+          iPrev++;
           n--;
         }else{
           for(j=1; j<m; j++) re_copy(p, iPrev, sz);
@@ -612,12 +1306,171 @@ static const char *re_subcompile_string(ReCompiled *p){
 */
 void re_free(ReCompiled *pRe){
   if( pRe ){
+    re_dfa_free(pRe->pDfa);
+    sqlite3_free(pRe->aSetSpace);
     sqlite3_free(pRe->aOp);
     sqlite3_free(pRe->aArg);
     sqlite3_free(pRe);
   }
 }
 
+/* Return the width of the instruction at aOp[x].  A character class takes
+** one slot for the class and one for each value or range in it.  The slots
+** after an RE_OP_REPEAT, up to the state that follows the repetition, are
+** counted as part of it.
+*/
+static int re_op_width(ReCompiled *p, int x){
+  if( p->aOp[x]==RE_OP_CC_INC || p->aOp[x]==RE_OP_CC_EXC ) return p->aArg[x];
+  if( p->aOp[x]==RE_OP_REPEAT ) return re_repeat_exit(p, x) - x;
+  return 1;
+}
+
+/* Store in aNext[] the states that can follow state x, ignoring what the
+** input is, and return how many there are.
+*/
+static int re_successors(ReCompiled *p, int x, int *aNext){
+  switch( p->aOp[x] ){
+    case RE_OP_ACCEPT:  return 0;
+    case RE_OP_GOTO:    aNext[0] = x+p->aArg[x];  return 1;
+    case RE_OP_CC_INC:
+    case RE_OP_CC_EXC:  aNext[0] = x+p->aArg[x];  return 1;
+    case RE_OP_FORK:    aNext[0] = x+1;  aNext[1] = x+p->aArg[x];  return 2;
+    case RE_OP_ANYSTAR: aNext[0] = x;  aNext[1] = x+1;  return 2;
+    case RE_OP_REPEAT:  aNext[0] = x;  aNext[1] = re_repeat_exit(p, x); return 2;
+    case RE_OP_REPEAT_INIT: {
+      aNext[0] = x+1;
+      if( p->aArg[x]>0 ) return 1;
+      aNext[1] = re_repeat_exit(p, x+1);
+      return 2;
+    }
+    default:            aNext[0] = x+1;  return 1;
+  }
+}
+
+/* Return true if state x matches a single character that the input can
+** only contain as its shortest UTF-8 encoding.  re_next_char() reads some
+** overlong 3-byte sequences as characters between U+0400 and U+07FF, and
+** reads every invalid sequence as U+FFFD, so those cannot be searched for.
+*/
+static int re_literal_state(ReCompiled *p, int x){
+  unsigned c;
+  if( p->aOp[x]!=RE_OP_MATCH ) return 0;
+  c = (unsigned)p->aArg[x];
+  return c!=RE_EOF && (c<0x400 || c>=0x800) && c!=0xfffd && c<=0x10ffff;
+}
+
+/* Write the UTF-8 encoding of c to z[] and return its length in bytes */
+static int re_utf8(unsigned c, unsigned char *z){
+  if( c<0x80 ){
+    z[0] = (unsigned char)c;
+    return 1;
+  }else if( c<0x800 ){
+    z[0] = 0xc0 | (c>>6);
+    z[1] = 0x80 | (c&0x3f);
+    return 2;
+  }else if( c<0x10000 ){
+    z[0] = 0xe0 | (c>>12);
+    z[1] = 0x80 | ((c>>6)&0x3f);
+    z[2] = 0x80 | (c&0x3f);
+    return 3;
+  }
+  z[0] = 0xf0 | (c>>18);
+  z[1] = 0x80 | ((c>>12)&0x3f);
+  z[2] = 0x80 | ((c>>6)&0x3f);
+  z[3] = 0x80 | (c&0x3f);
+  return 4;
+}
+
+/* Return true if every path from state 0 to an RE_OP_ACCEPT passes through
+** state iState.  aStack[] and aSeen[] are scratch space of nState entries.
+*/
+static int re_state_required(
+  ReCompiled *p,
+  int iState,
+  int *aStack,
+  unsigned char *aSeen
+){
+  int n = (int)p->nState;
+  int nStack = 0;
+  int aNext[2], nNext, k;
+  if( iState==0 ) return 1;
+  memset(aSeen, 0, n);
+  aSeen[iState] = 1;
+  aSeen[0] = 1;
+  aStack[nStack++] = 0;
+  while( nStack>0 ){
+    int x = aStack[--nStack];
+    if( p->aOp[x]==RE_OP_ACCEPT ) return 0;
+    nNext = re_successors(p, x, aNext);
+    for(k=0; k<nNext; k++){
+      int y = aNext[k];
+      if( y>=0 && y<n && !aSeen[y] ){
+        aSeen[y] = 1;
+        aStack[nStack++] = y;
+      }
+    }
+  }
+  return 1;
+}
+
+/* Find the runs of literal characters that every match of the compiled
+** expression must contain.  A run is a sequence of RE_OP_MATCH states, each
+** of which but the first can only be reached from the one before it, so that
+** the characters must be consecutive in the input.  The run is required if
+** the first of its states is.
+**
+** If the expression starts with ".*" followed by a run, that run goes into
+** zInit[] and re_match() starts matching where it first occurs.  The longest
+** required run goes into zLit[], but only if it is longer than zInit[].
+**
+** The analysis is an optimization only.  If memory cannot be had for it,
+** the expression is simply matched without a literal.
+*/
+static void re_extract_literal(ReCompiled *p){
+  int n = (int)p->nState;
+  int *aPred, *aStack;
+  unsigned char *aSeen;
+  int aNext[2], nNext, k;
+  int x, y;
+
+  aPred = sqlite3_malloc( n*(2*sizeof(int) + 1) );
+  if( aPred==0 ) return;
+  aStack = &aPred[n];
+  aSeen = (unsigned char*)&aStack[n];
+
+  memset(aPred, 0, n*sizeof(int));
+  for(x=0; x<n; x+=re_op_width(p, x)){
+    nNext = re_successors(p, x, aNext);
+    for(k=0; k<nNext; k++){
+      if( aNext[k]>=0 && aNext[k]<n ) aPred[aNext[k]]++;
+    }
+  }
+
+  x = 0;
+  while( x<n ){
+    unsigned char zLit[RE_LIT_MAX];
+    int nLit = 0;
+    if( !re_literal_state(p, x) ){
+      x += re_op_width(p, x);
+      continue;
+    }
+    for(y=x; y<n && re_literal_state(p, y) && (y==x || aPred[y]==1); y++){
+      if( nLit+4>RE_LIT_MAX ) break;
+      nLit += re_utf8((unsigned)p->aArg[y], &zLit[nLit]);
+    }
+    if( x==1 && p->aOp[0]==RE_OP_ANYSTAR ){
+      memcpy(p->zInit, zLit, nLit);
+      p->nInit = nLit;
+    }else if( nLit>p->nLit && nLit>p->nInit
+           && re_state_required(p, x, aStack, aSeen) ){
+      memcpy(p->zLit, zLit, nLit);
+      p->nLit = nLit;
+    }
+    x = y;
+  }
+  sqlite3_free(aPred);
+}
+
 /*
 ** Compile a textual regular expression in zIn[] into a compiled regular
 ** expression suitable for us by re_match() and return a pointer to the
@@ -627,7 +1480,7 @@ void re_free(ReCompiled *pRe){
 const char *re_compile(ReCompiled **ppRe, const char *zIn, int noCase){
   ReCompiled *pRe;
   const char *zErr;
-  int i, j;
+  int i;
 
   *ppRe = 0;
   pRe = sqlite3_malloc( sizeof(*pRe) );
@@ -665,36 +1518,239 @@ const char *re_compile(ReCompiled **ppRe, const char *zIn, int noCase){
     return "unrecognized character";
   }
 
-  /* The following is a performance optimization.  If the regex begins with
-  ** ".*" (if the input regex lacks an initial "^") and afterwards there are
-  ** one or more matching characters, enter those matching characters into
-  ** zInit[].  The re_match() routine can then search ahead in the input 
-  ** string looking for the initial match without having to run the whole
-  ** regex engine over the string.  Do not worry able trying to match
-  ** unicode characters beyond plane 0 - those are very rare and this is
-  ** just an optimization. */
-  if( pRe->aOp[0]==RE_OP_ANYSTAR ){
-    for(j=0, i=1; j<sizeof(pRe->zInit)-2 && pRe->aOp[i]==RE_OP_MATCH; i++){
-      unsigned x = pRe->aArg[i];
-      if( x<=127 ){
-        pRe->zInit[j++] = x;
-      }else if( x<=0xfff ){
-        pRe->zInit[j++] = 0xc0 | (x>>6);
-        pRe->zInit[j++] = 0x80 | (x&0x3f);
-      }else if( x<=0xffff ){
-        pRe->zInit[j++] = 0xd0 | (x>>12);
-        pRe->zInit[j++] = 0x80 | ((x>>6)&0x3f);
-        pRe->zInit[j++] = 0x80 | (x&0x3f);
-      }else{
-        break;
-      }
+  /* Give each counted repetition its own place for counts in a state set */
+  for(i=0; i<(int)pRe->nState; i+=re_op_width(pRe, i)){
+    if( pRe->aOp[i]==RE_OP_REPEAT ){
+      pRe->aArg[i+1] = pRe->nCountWord;
+      pRe->nCountWord += re_repeat_words(pRe, i);
     }
-    if( j>0 && pRe->zInit[j-1]==0 ) j--;
-    pRe->nInit = j;
+  }
+
+  /* The following is a performance optimization.  Find the literal text
+  ** that every match must contain, so that re_match() can search the input
+  ** for it before running the regex engine over the input.  This is not
+  ** done for case-insensitive expressions, whose input is folded to lower
+  ** case one character at a time as it is read. */
+  if( !noCase ){
+    pRe->xFindLit = re_find_func();
+    re_extract_literal(pRe);
   }
   return pRe->zErr;
 }
 
+/*
+** Each database connection keeps the expressions compiled by regexp() in a
+** cache, so that an expression that is used again, whether by another
+** statement or by a later row whose pattern comes from a column, does not
+** have to be compiled again.  Entries are keyed by the text of the expression
+** and the case flag it was compiled with, and the least recently used entry
+** is dropped once there are more than RE_CACHE_SIZE of them.
+**
+** An entry is reference counted.  The cache holds one reference, and so does
+** each statement that keeps the entry as auxiliary data for a constant
+** pattern, so an entry dropped from the cache lives on until the last
+** statement using it lets go.  The cache itself is shared by the regexp() and
+** regexp_cache_status() functions of the connection and is freed when both
+** of them are.
+*/
+#ifndef RE_CACHE_SIZE
+# define RE_CACHE_SIZE  256
+#endif
+
+typedef struct ReCacheEntry ReCacheEntry;
+struct ReCacheEntry {
+  ReCompiled *pRe;            /* The compiled expression */
+  int nRef;                   /* References to this entry */
+  unsigned iHash;             /* Hash of the pattern and the case flag */
+  int noCase;                 /* Case flag the expression was compiled with */
+  int nPattern;               /* Bytes in zPattern */
+  char *zPattern;             /* Text of the expression */
+  ReCacheEntry *pHashNext;    /* Next entry in the same hash bucket */
+  ReCacheEntry *pLruPrev;     /* Entry used more recently */
+  ReCacheEntry *pLruNext;     /* Entry used less recently */
+};
+
+typedef struct ReCache ReCache;
+struct ReCache {
+  int nRef;                   /* SQL functions using this cache */
+  int nEntry;                 /* Entries in the cache */
+  int nHash;                  /* Slots in aHash[], a power of two */
+  ReCacheEntry **aHash;       /* Hash table of entries */
+  ReCacheEntry *pLruFirst;    /* Most recently used entry */
+  ReCacheEntry *pLruLast;     /* Least recently used entry */
+  sqlite3_int64 nHit;         /* Lookups that found the expression */
+  sqlite3_int64 nMiss;        /* Lookups that had to compile it */
+};
+
+/* Release one reference to a cache entry */
+static void re_cache_entry_release(void *p){
+  ReCacheEntry *pEntry = (ReCacheEntry*)p;
+  if( --pEntry->nRef==0 ){
+    re_free(pEntry->pRe);
+    sqlite3_free(pEntry);
+  }
+}
+
+/* Unlink an entry from the LRU list */
+static void re_cache_lru_remove(ReCache *pCache, ReCacheEntry *pEntry){
+  if( pEntry->pLruPrev ){
+    pEntry->pLruPrev->pLruNext = pEntry->pLruNext;
+  }else{
+    pCache->pLruFirst = pEntry->pLruNext;
+  }
+  if( pEntry->pLruNext ){
+    pEntry->pLruNext->pLruPrev = pEntry->pLruPrev;
+  }else{
+    pCache->pLruLast = pEntry->pLruPrev;
+  }
+}
+
+/* Link an entry in at the front of the LRU list */
+static void re_cache_lru_push(ReCache *pCache, ReCacheEntry *pEntry){
+  pEntry->pLruPrev = 0;
+  pEntry->pLruNext = pCache->pLruFirst;
+  if( pCache->pLruFirst ){
+    pCache->pLruFirst->pLruPrev = pEntry;
+  }else{
+    pCache->pLruLast = pEntry;
+  }
+  pCache->pLruFirst = pEntry;
+}
+
+/* Drop an entry from the cache */
+static void re_cache_remove(ReCache *pCache, ReCacheEntry *pEntry){
+  ReCacheEntry **pp = &pCache->aHash[pEntry->iHash & (pCache->nHash-1)];
+  while( *pp!=pEntry ) pp = &(*pp)->pHashNext;
+  *pp = pEntry->pHashNext;
+  re_cache_lru_remove(pCache, pEntry);
+  pCache->nEntry--;
+  re_cache_entry_release(pEntry);
+}
+
+/* Allocate a new, empty cache with a single reference */
+static ReCache *re_cache_new(void){
+  ReCache *pCache;
+  int nHash = 1;
+  while( nHash<RE_CACHE_SIZE*2 ) nHash *= 2;
+  pCache = sqlite3_malloc( sizeof(*pCache) + nHash*sizeof(ReCacheEntry*) );
+  if( pCache==0 ) return 0;
+  memset(pCache, 0, sizeof(*pCache) + nHash*sizeof(ReCacheEntry*));
+  pCache->nRef = 1;
+  pCache->nHash = nHash;
+  pCache->aHash = (ReCacheEntry**)&pCache[1];
+  return pCache;
+}
+
+/* Release one reference to a cache.  This is the destructor of the SQL
+** functions that use it.
+*/
+static void re_cache_release(void *p){
+  ReCache *pCache = (ReCache*)p;
+  if( --pCache->nRef==0 ){
+    while( pCache->pLruFirst ) re_cache_remove(pCache, pCache->pLruFirst);
+    sqlite3_free(pCache);
+  }
+}
+
+/* Return the entry for the expression zPattern[0..nPattern-1], compiling it
+** and adding it to the cache if it is not there yet.  The entry is only good
+** until the next call, unless the caller adds a reference to it.  On failure
+** return NULL and set *pzErr to the compile error, or to NULL if memory ran
+** out.
+*/
+static ReCacheEntry *re_cache_lookup(
+  ReCache *pCache,
+  const char *zPattern,
+  int nPattern,
+  int noCase,
+  const char **pzErr
+){
+  ReCacheEntry *pEntry;
+  ReCompiled *pRe;
+  unsigned iHash = 2166136261u;
+  int i;
+
+  *pzErr = 0;
+  for(i=0; i<nPattern; i++){
+    iHash = (iHash ^ (unsigned char)zPattern[i]) * 16777619u;
+  }
+  iHash = (iHash ^ (unsigned)noCase) * 16777619u;
+
+  for(pEntry = pCache->aHash[iHash & (pCache->nHash-1)];
+      pEntry;
+      pEntry = pEntry->pHashNext){
+    if( pEntry->iHash==iHash && pEntry->noCase==noCase
+     && pEntry->nPattern==nPattern
+     && memcmp(pEntry->zPattern, zPattern, nPattern)==0
+    ){
+      pCache->nHit++;
+      if( pCache->pLruFirst!=pEntry ){
+        re_cache_lru_remove(pCache, pEntry);
+        re_cache_lru_push(pCache, pEntry);
+      }
+      return pEntry;
+    }
+  }
+
+  pCache->nMiss++;
+  *pzErr = re_compile(&pRe, zPattern, noCase);
+  if( *pzErr ){
+    re_free(pRe);
+    return 0;
+  }
+  if( pRe==0 ) return 0;
+  pEntry = sqlite3_malloc( sizeof(*pEntry) + nPattern + 1 );
+  if( pEntry==0 ){
+    re_free(pRe);
+    return 0;
+  }
+  pEntry->pRe = pRe;
+  pEntry->nRef = 1;
+  pEntry->iHash = iHash;
+  pEntry->noCase = noCase;
+  pEntry->nPattern = nPattern;
+  pEntry->zPattern = (char*)&pEntry[1];
+  memcpy(pEntry->zPattern, zPattern, nPattern+1);
+  pEntry->pHashNext = pCache->aHash[iHash & (pCache->nHash-1)];
+  pCache->aHash[iHash & (pCache->nHash-1)] = pEntry;
+  re_cache_lru_push(pCache, pEntry);
+  pCache->nEntry++;
+  if( pCache->nEntry>RE_CACHE_SIZE ){
+    re_cache_remove(pCache, pCache->pLruLast);
+  }
+  return pEntry;
+}
+
+/*
+** Implementation of the regexp_cache_status(NAME) SQL function.  It returns
+** one of the counters of the compiled expression cache of the connection:
+** 'hits' and 'misses' count the lookups that did and did not find the
+** expression in the cache, 'entries' is the number of expressions it holds
+** and 'size' is the most it can hold.  Calls for a constant pattern after
+** the first call of a statement reuse the expression directly and do not
+** count as lookups.
+*/
+static void re_cache_status_func(
+  sqlite3_context *context, 
+  int argc, 
+  sqlite3_value **argv
+){
+  ReCache *pCache = (ReCache*)sqlite3_user_data(context);
+  const char *zName = (const char*)sqlite3_value_text(argv[0]);
+  if( zName==0 ) return;
+  if( strcmp(zName, "hits")==0 ){
+    sqlite3_result_int64(context, pCache->nHit);
+  }else if( strcmp(zName, "misses")==0 ){
+    sqlite3_result_int64(context, pCache->nMiss);
+  }else if( strcmp(zName, "entries")==0 ){
+    sqlite3_result_int(context, pCache->nEntry);
+  }else if( strcmp(zName, "size")==0 ){
+    sqlite3_result_int(context, RE_CACHE_SIZE);
+  }else{
+    sqlite3_result_error(context, "unknown regexp cache counter", -1);
+  }
+}
+
 /*
 ** Implementation of the regexp() SQL function.  This function implements
 ** the build-in REGEXP operator.  The first argument to the function is the
@@ -709,23 +1765,23 @@ static void re_sql_func(
   int argc, 
   sqlite3_value **argv
 ){
-  ReCompiled *pRe;          /* Compiled regular expression */
+  ReCacheEntry *pEntry;     /* Cache entry of the regular expression */
   const char *zPattern;     /* The regular expression */
   const unsigned char *zStr;/* String being searched */
   const char *zErr;         /* Compile error message */
   int setAux = 0;           /* True to invoke sqlite3_set_auxdata() */
 
-  pRe = sqlite3_get_auxdata(context, 0);
-  if( pRe==0 ){
+  pEntry = sqlite3_get_auxdata(context, 0);
+  if( pEntry==0 ){
     zPattern = (const char*)sqlite3_value_text(argv[0]);
     if( zPattern==0 ) return;
-    zErr = re_compile(&pRe, zPattern, 0);
+    pEntry = re_cache_lookup((ReCache*)sqlite3_user_data(context), zPattern,
+                             sqlite3_value_bytes(argv[0]), 0, &zErr);
     if( zErr ){
-      re_free(pRe);
       sqlite3_result_error(context, zErr, -1);
       return;
     }
-    if( pRe==0 ){
+    if( pEntry==0 ){
       sqlite3_result_error_nomem(context);
       return;
     }
@@ -733,16 +1789,17 @@ static void re_sql_func(
   }
   zStr = (const unsigned char*)sqlite3_value_text(argv[1]);
   if( zStr!=0 ){
-    sqlite3_result_int(context, re_match(pRe, zStr, -1));
+    sqlite3_result_int(context, re_match(pEntry->pRe, zStr, -1));
   }
   if( setAux ){
-    sqlite3_set_auxdata(context, 0, pRe, (void(*)(void*))re_free);
+    pEntry->nRef++;
+    sqlite3_set_auxdata(context, 0, pEntry, re_cache_entry_release);
   }
 }
 
 /*
-** Invoke this routine to register the regexp() function with the
-** SQLite database connection.
+** Invoke this routine to register the regexp() and regexp_cache_status()
+** functions with the SQLite database connection.
 */
 #ifdef _WIN32
 __declspec(dllexport)
@@ -753,8 +1810,20 @@ int sqlite3_regexp_init(
   const sqlite3_api_routines *pApi
 ){
   int rc = SQLITE_OK;
+  ReCache *pCache;
   SQLITE_EXTENSION_INIT2(pApi);
-  rc = sqlite3_create_function(db, "regexp", 2, SQLITE_UTF8, 0,
-                                 re_sql_func, 0, 0);
+  pCache = re_cache_new();
+  if( pCache==0 ) return SQLITE_NOMEM;
+  pCache->nRef++;
+  rc = sqlite3_create_function_v2(db, "regexp", 2, SQLITE_UTF8, pCache,
+                                  re_sql_func, 0, 0, re_cache_release);
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function_v2(db, "regexp_cache_status", 1,
+                                    SQLITE_UTF8, pCache,
+                                    re_cache_status_func, 0, 0,
+                                    re_cache_release);
+  }else{
+    re_cache_release(pCache);
+  }
   return rc;
 }
@@ -8,58 +8,1575 @@
 #ifndef SQLITE_OMIT_DISKIO
 #ifdef SQLITE_HAS_CODEC
 
+#if SQLITE_OS_WIN
 #include <windows.h>
 #include <wincrypt.h>
+#else
+#include <stdint.h>
+
+/*
+** On platforms other than Windows, the small subset of the CryptoAPI used by
+** this codec is provided by the portable SHA-1 and RC4 code below.  The key is
+** derived the same way the Microsoft Enhanced Cryptographic Provider derives a
+** 128-bit RC4 key without salt from a SHA-1 hash (i.e. the first 16 bytes of
+** the hash) and the cipher state is reset after each page, just like calling
+** CryptEncrypt() or CryptDecrypt() with the Final flag set, so the databases
+** are interchangeable with those encrypted on Windows.
+*/
+typedef unsigned int DWORD;
+typedef int BOOL;
+typedef void *LPVOID;
+typedef unsigned char *LPBYTE;
+typedef uintptr_t HCRYPTPROV;
+typedef uintptr_t HCRYPTHASH;
+typedef uintptr_t HCRYPTKEY;
+
+#define TRUE                1
+#define FALSE               0
+#define MAXDWORD            0xffffffff
+#define MS_ENHANCED_PROV    "Microsoft Enhanced Cryptographic Provider v1.0"
+#define PROV_RSA_FULL       1
+#define CRYPT_VERIFYCONTEXT 0xf0000000
+#define CALG_SHA1           0x00008004
+#define CALG_RC4            0x00006801
+#define ZeroMemory(p, n)    memset((p), 0, (n))
+#define CopyMemory(d, s, n) memcpy((d), (s), (n))
+
+#define RC4_KEY_SIZE 16    /* Bytes in the derived key, i.e. 128 bits */
+
+typedef struct _SHA1HASH
+{
+  unsigned int  state[5];     /* Intermediate hash value */
+  sqlite3_uint64 nBytes;      /* Total number of bytes hashed */
+  unsigned char buffer[64];   /* Unprocessed input */
+} SHA1HASH;
+
+typedef struct _RC4KEY
+{
+  unsigned char s[256];       /* Permutation after the key schedule */
+} RC4KEY;
+
+#define SHA1_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void Sha1Transform(unsigned int state[5], const unsigned char *p)
+{
+  unsigned int w[80];
+  unsigned int a, b, c, d, e, t;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = ((unsigned int)p[i * 4] << 24) | ((unsigned int)p[i * 4 + 1] << 16) |
+           ((unsigned int)p[i * 4 + 2] << 8) | (unsigned int)p[i * 4 + 3];
+  for (; i < 80; i++)
+    w[i] = SHA1_ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  a = state[0]; b = state[1]; c = state[2]; d = state[3]; e = state[4];
+
+  for (i = 0; i < 80; i++)
+  {
+    if (i < 20)      t = ((b & c) | (~b & d)) + 0x5a827999;
+    else if (i < 40) t = (b ^ c ^ d) + 0x6ed9eba1;
+    else if (i < 60) t = ((b & c) | (b & d) | (c & d)) + 0x8f1bbcdc;
+    else             t = (b ^ c ^ d) + 0xca62c1d6;
+    t += SHA1_ROL(a, 5) + e + w[i];
+    e = d; d = c; c = SHA1_ROL(b, 30); b = a; a = t;
+  }
+
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+}
+
+static void Sha1Update(SHA1HASH *pHash, const unsigned char *p, DWORD n)
+{
+  DWORD nUsed = (DWORD)(pHash->nBytes & 63);
+
+  pHash->nBytes += n;
+  while (n > 0)
+  {
+    DWORD nCopy = 64 - nUsed;
+    if (nCopy > n) nCopy = n;
+    memcpy(pHash->buffer + nUsed, p, nCopy);
+    nUsed += nCopy;
+    p += nCopy;
+    n -= nCopy;
+    if (nUsed == 64)
+    {
+      Sha1Transform(pHash->state, pHash->buffer);
+      nUsed = 0;
+    }
+  }
+}
+
+static void Sha1Final(SHA1HASH *pHash, unsigned char digest[20])
+{
+  sqlite3_uint64 nBits = pHash->nBytes * 8;
+  unsigned char pad = 0x80;
+  unsigned char length[8];
+  int i;
+
+  for (i = 0; i < 8; i++)
+    length[i] = (unsigned char)(nBits >> (56 - i * 8));
+
+  Sha1Update(pHash, &pad, 1);
+  pad = 0;
+  while ((pHash->nBytes & 63) != 56)
+    Sha1Update(pHash, &pad, 1);
+  Sha1Update(pHash, length, 8);
+
+  for (i = 0; i < 20; i++)
+    digest[i] = (unsigned char)(pHash->state[i / 4] >> (24 - (i % 4) * 8));
+}
+
+static BOOL CryptAcquireContext(HCRYPTPROV *phProv, const char *pszContainer, const char *pszProvider, DWORD dwProvType, DWORD dwFlags)
+{
+  *phProv = 1;
+  return TRUE;
+}
+
+static BOOL CryptCreateHash(HCRYPTPROV hProv, DWORD Algid, HCRYPTKEY hKey, DWORD dwFlags, HCRYPTHASH *phHash)
+{
+  SHA1HASH *pHash = sqlite3_malloc(sizeof(SHA1HASH));
+  if (!pHash) return FALSE;
+
+  ZeroMemory(pHash, sizeof(SHA1HASH));
+  pHash->state[0] = 0x67452301;
+  pHash->state[1] = 0xefcdab89;
+  pHash->state[2] = 0x98badcfe;
+  pHash->state[3] = 0x10325476;
+  pHash->state[4] = 0xc3d2e1f0;
+
+  *phHash = (HCRYPTHASH)pHash;
+  return TRUE;
+}
+
+static BOOL CryptHashData(HCRYPTHASH hHash, const LPBYTE pbData, DWORD dwDataLen, DWORD dwFlags)
+{
+  Sha1Update((SHA1HASH *)hHash, pbData, dwDataLen);
+  return TRUE;
+}
+
+static BOOL CryptDestroyHash(HCRYPTHASH hHash)
+{
+  ZeroMemory((SHA1HASH *)hHash, sizeof(SHA1HASH));
+  sqlite3_free((SHA1HASH *)hHash);
+  return TRUE;
+}
+
+static BOOL CryptDeriveKey(HCRYPTPROV hProv, DWORD Algid, HCRYPTHASH hBaseData, DWORD dwFlags, HCRYPTKEY *phKey)
+{
+  unsigned char digest[20];
+  RC4KEY *pKey = sqlite3_malloc(sizeof(RC4KEY));
+  int i, j;
+
+  if (!pKey) return FALSE;
+
+  Sha1Final((SHA1HASH *)hBaseData, digest);
+
+  for (i = 0; i < 256; i++)
+    pKey->s[i] = (unsigned char)i;
+
+  for (i = 0, j = 0; i < 256; i++)
+  {
+    unsigned char t = pKey->s[i];
+    j = (j + t + digest[i % RC4_KEY_SIZE]) & 0xff;
+    pKey->s[i] = pKey->s[j];
+    pKey->s[j] = t;
+  }
+
+  ZeroMemory(digest, sizeof(digest));
+  *phKey = (HCRYPTKEY)pKey;
+  return TRUE;
+}
+
+static BOOL CryptDuplicateKey(HCRYPTKEY hKey, DWORD *pdwReserved, DWORD dwFlags, HCRYPTKEY *phKey)
+{
+  RC4KEY *pKey = sqlite3_malloc(sizeof(RC4KEY));
+  if (!pKey) return FALSE;
+
+  CopyMemory(pKey, (RC4KEY *)hKey, sizeof(RC4KEY));
+  *phKey = (HCRYPTKEY)pKey;
+  return TRUE;
+}
+
+static BOOL CryptDestroyKey(HCRYPTKEY hKey)
+{
+  ZeroMemory((RC4KEY *)hKey, sizeof(RC4KEY));
+  sqlite3_free((RC4KEY *)hKey);
+  return TRUE;
+}
+
+/* RC4 is symmetric, so encryption and decryption are the same operation.  The
+** cipher always starts over from the saved key schedule (see above).
+*/
+static BOOL CryptDecrypt(HCRYPTKEY hKey, HCRYPTHASH hHash, BOOL Final, DWORD dwFlags, LPBYTE pbData, DWORD *pdwDataLen)
+{
+  unsigned char s[256];
+  unsigned int i = 0, j = 0;
+  DWORD n;
+
+  if (!pbData) return TRUE;
+
+  CopyMemory(s, ((RC4KEY *)hKey)->s, sizeof(s));
+  for (n = 0; n < *pdwDataLen; n++)
+  {
+    unsigned char t;
+    i = (i + 1) & 0xff;
+    t = s[i];
+    j = (j + t) & 0xff;
+    s[i] = s[j];
+    s[j] = t;
+    pbData[n] ^= s[(s[i] + t) & 0xff];
+  }
+
+  ZeroMemory(s, sizeof(s));
+  return TRUE;
+}
+
+static BOOL CryptEncrypt(HCRYPTKEY hKey, HCRYPTHASH hHash, BOOL Final, DWORD dwFlags, LPBYTE pbData, DWORD *pdwDataLen, DWORD dwBufLen)
+{
+  return CryptDecrypt(hKey, hHash, Final, dwFlags, pbData, pdwDataLen);
+}
+#endif
+
+/*
+** The page codec encrypts databases using AES-256 in XTS mode (IEEE 1619), the
+** mode made for disk sectors.  A 512-bit key is derived from the password and a
+** random per-database salt via PBKDF2 with HMAC-SHA-256.  Its first half is the
+** data key and its second half the tweak key.  Each page is a data unit whose
+** tweak is the page number, so every 16 byte block of the database is encrypted
+** differently even when the plaintext is the same.
+**
+** A page is rewritten in place using the same tweak, which is safe in XTS mode,
+** unlike in a stream cipher mode such as counter mode.  An old version of a page
+** left in a rollback journal or a WAL file only shows which of its 16 byte blocks
+** were not changed, never anything about the content of the changed blocks.  A
+** random IV for each write would need bytes reserved at the end of every page,
+** and a password change cannot reserve them in the pages of an existing
+** database, so the mode has to work without them.
+**
+** The first 24 bytes of page 1 are stored unencrypted.  They hold a format
+** marker, including a version number, the number of PBKDF2 iterations and the
+** salt.  This is how databases in the original format, which was RC4 via the
+** CryptoAPI, are told apart and can still be opened, and how the iteration count
+** can be raised without breaking existing databases.  Changing the password of a
+** database converts it to the current format and iteration count.
+**
+** The marker takes the place of the "SQLite format 3" string, which is known to
+** everybody anyway.  The page size, file format numbers and reserved space that
+** follow it are moved into the first bytes of the header reserved for expansion,
+** at offset 72.  The three bytes after those must be 64, 32 and 32, so they are
+** not stored.  This keeps the change counter at offset 24 in the first encrypted
+** block, which matters because the pager tells whether another connection
+** changed the database by comparing the raw bytes 24 to 39 of page 1.  The rest
+** of page 1 is not a whole number of blocks, so its last block uses the
+** ciphertext stealing of IEEE 1619.
+*/
+#define CODEC_FORMAT_UNKNOWN  0   /* Not known until page 1 is read or written */
+#define CODEC_FORMAT_LEGACY   1   /* RC4 via the CryptoAPI */
+#define CODEC_FORMAT_AES      2   /* AES-256 in XTS mode */
+
+#define CODEC_FORMAT_VERSION  2
+#define CODEC_MAGIC_SIZE      4
+#define CODEC_ITERATIONS_OFFSET CODEC_MAGIC_SIZE
+#define CODEC_SALT_OFFSET     (CODEC_ITERATIONS_OFFSET + 4)
+#define CODEC_SALT_SIZE       16
+#define CODEC_HEADER_SIZE     (CODEC_SALT_OFFSET + CODEC_SALT_SIZE)
+#define CODEC_MOVED_OFFSET    72   /* Where bytes 16 to 20 of the SQLite header are kept */
+#define CODEC_MOVED_SIZE      5
+#define CODEC_AES_KEY_SIZE    64   /* The data key and the tweak key */
+#define CODEC_AES_BLOCK_SIZE  16
+
+#ifndef CODEC_KDF_ITERATIONS
+# define CODEC_KDF_ITERATIONS 100000
+#endif
+
+/* Larger iteration counts found in page 1 are not trusted, so that opening a
+** hostile file cannot keep a thread busy deriving a key for hours
+*/
+#ifndef CODEC_KDF_MAX_ITERATIONS
+# define CODEC_KDF_MAX_ITERATIONS 10000000
+#endif
+
+#define CODEC_KDF_VALID(n)    ((n) >= 1 && (n) <= CODEC_KDF_MAX_ITERATIONS)
+
+static const unsigned char codecMagic[CODEC_MAGIC_SIZE] = {
+  'X', 'T', 'S', CODEC_FORMAT_VERSION
+};
+
+static const unsigned char codecSqliteHeader[16] = "SQLite format 3";
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#include <wmmintrin.h>
+#define CODEC_HAVE_AESNI 1
+#define CODEC_AESNI_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && \
+      (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#include <wmmintrin.h>
+#define CODEC_HAVE_AESNI 1
+#define CODEC_AESNI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+/* The expanded AES-256 keys of the XTS mode.  Each schedule is kept as words,
+** for the portable implementation, and as bytes, for AES-NI.
+*/
+typedef struct _CODECAESKEYS
+{
+  unsigned int   aEncrypt[60];                     /* Data key round keys */
+  unsigned int   aDecrypt[60];                     /* Data key round keys for the inverse cipher */
+  unsigned int   aTweak[60];                       /* Tweak key round keys */
+  unsigned char  aEncryptBytes[240];
+  unsigned char  aDecryptBytes[240];
+  unsigned char  aTweakBytes[240];
+} CODECAESKEYS;
+
+typedef struct _CODECKEY
+{
+  HCRYPTKEY      hLegacyKey;                       /* RC4 key for the original format */
+  int            nFormat;                          /* One of the CODEC_FORMAT_* values */
+  int            bDerived;                         /* Non-zero if the AES round keys are valid */
+  unsigned char  salt[CODEC_SALT_SIZE];            /* Salt stored in page 1 */
+  int            nIterations;                      /* PBKDF2 iteration count stored in page 1 */
+  CODECAESKEYS   aes;                              /* AES-256 round keys */
+  unsigned char *pPassword;                        /* Password, needed to derive the AES key */
+  int            nPassword;                        /* Size of the password in bytes */
+  struct _CODECKEY *pNext;                         /* Next key in the list of keys being rekeyed to */
+} CODECKEY, *LPCODECKEY;
+
+static unsigned char aesSbox[256], aesInvSbox[256];
+static unsigned int aesTe0[256], aesTe1[256], aesTe2[256], aesTe3[256];
+static unsigned int aesTd0[256], aesTd1[256], aesTd2[256], aesTd3[256];
+static int aesTablesReady = 0;
+static int aesHardware = 0;
+
+#define AES_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define AES_LOAD32(p) (((unsigned int)(p)[0] << 24) | ((unsigned int)(p)[1] << 16) | \
+                       ((unsigned int)(p)[2] << 8) | (unsigned int)(p)[3])
+#define AES_STORE32(p, v) { (p)[0] = (unsigned char)((v) >> 24); (p)[1] = (unsigned char)((v) >> 16); \
+                            (p)[2] = (unsigned char)((v) >> 8); (p)[3] = (unsigned char)(v); }
+
+#define AES_XTIME(x) ((((x) << 1) ^ (((x) & 0x80) ? 0x1b : 0)) & 0xff)
+
+/* Builds the S-boxes and the encryption and decryption tables and detects AES-NI,
+** along with the SSE2 the AES-NI code uses.  This must be called with the master
+** mutex held.
+*/
+static void AesInitTables(void)
+{
+  unsigned char p = 1, q = 1;
+  int i;
+
+  if (aesTablesReady) return;
+
+  do
+  {
+    unsigned char x;
+    p = (unsigned char)(p ^ (p << 1) ^ ((p & 0x80) ? 0x1b : 0));
+    q ^= (unsigned char)(q << 1);
+    q ^= (unsigned char)(q << 2);
+    q ^= (unsigned char)(q << 4);
+    if (q & 0x80) q ^= 0x09;
+    x = (unsigned char)(q ^ ((q << 1) | (q >> 7)) ^ ((q << 2) | (q >> 6)) ^
+                        ((q << 3) | (q >> 5)) ^ ((q << 4) | (q >> 4)));
+    aesSbox[p] = (unsigned char)(x ^ 0x63);
+  } while (p != 1);
+  aesSbox[0] = 0x63;
+
+  for (i = 0; i < 256; i++)
+    aesInvSbox[aesSbox[i]] = (unsigned char)i;
+
+  for (i = 0; i < 256; i++)
+  {
+    unsigned int s = aesSbox[i];
+    unsigned int s2 = AES_XTIME(s);
+    unsigned int s3 = s2 ^ s;
+    unsigned int d = aesInvSbox[i];
+    unsigned int d2 = AES_XTIME(d);
+    unsigned int d4 = AES_XTIME(d2);
+    unsigned int d8 = AES_XTIME(d4);
+
+    aesTe0[i] = (s2 << 24) | (s << 16) | (s << 8) | s3;
+    aesTe1[i] = AES_ROR(aesTe0[i], 8);
+    aesTe2[i] = AES_ROR(aesTe0[i], 16);
+    aesTe3[i] = AES_ROR(aesTe0[i], 24);
+
+    /* Multiplied by 0e, 09, 0d and 0b, the InvMixColumns coefficients */
+    aesTd0[i] = ((d8 ^ d4 ^ d2) << 24) | ((d8 ^ d) << 16) | ((d8 ^ d4 ^ d) << 8) | (d8 ^ d2 ^ d);
+    aesTd1[i] = AES_ROR(aesTd0[i], 8);
+    aesTd2[i] = AES_ROR(aesTd0[i], 16);
+    aesTd3[i] = AES_ROR(aesTd0[i], 24);
+  }
+
+#if defined(CODEC_HAVE_AESNI)
+  {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    aesHardware = (info[2] & (1 << 25)) != 0 && (info[3] & (1 << 26)) != 0;
+#else
+    unsigned int a, b, c, d;
+    aesHardware = __get_cpuid(1, &a, &b, &c, &d) && (c & (1 << 25)) != 0 && (d & (1 << 26)) != 0;
+#endif
+  }
+#endif
+
+  aesTablesReady = 1;
+}
+
+/* Expands a 256-bit key into the AES round keys */
+static void AesSetKey(unsigned int *w, unsigned char *pBytes, const unsigned char *key)
+{
+  unsigned int rcon = 1;
+  int i;
+
+  for (i = 0; i < 8; i++)
+    w[i] = AES_LOAD32(key + i * 4);
+
+  for (i = 8; i < 60; i++)
+  {
+    unsigned int t = w[i - 1];
+    if ((i & 7) == 0)
+    {
+      t = ((unsigned int)aesSbox[(t >> 16) & 0xff] << 24) | ((unsigned int)aesSbox[(t >> 8) & 0xff] << 16) |
+          ((unsigned int)aesSbox[t & 0xff] << 8) | (unsigned int)aesSbox[t >> 24];
+      t ^= rcon << 24;
+      rcon = AES_XTIME(rcon);
+    }
+    else if ((i & 7) == 4)
+    {
+      t = ((unsigned int)aesSbox[t >> 24] << 24) | ((unsigned int)aesSbox[(t >> 16) & 0xff] << 16) |
+          ((unsigned int)aesSbox[(t >> 8) & 0xff] << 8) | (unsigned int)aesSbox[t & 0xff];
+    }
+    w[i] = w[i - 8] ^ t;
+  }
+
+  for (i = 0; i < 60; i++)
+    AES_STORE32(pBytes + i * 4, w[i]);
+}
+
+/* Derives the round keys of the equivalent inverse cipher from the encryption
+** round keys: the same keys in reverse order, with InvMixColumns applied to all
+** but the first and the last.  These are also the keys AESDEC expects.
+*/
+static void AesSetDecryptKey(const unsigned int *rk, unsigned int *w, unsigned char *pBytes)
+{
+  int r, i;
+
+  for (r = 0; r <= 14; r++)
+  {
+    for (i = 0; i < 4; i++)
+    {
+      unsigned int t = rk[(14 - r) * 4 + i];
+      if (r > 0 && r < 14)
+      {
+        t = aesTd0[aesSbox[t >> 24]] ^ aesTd1[aesSbox[(t >> 16) & 0xff]] ^
+            aesTd2[aesSbox[(t >> 8) & 0xff]] ^ aesTd3[aesSbox[t & 0xff]];
+      }
+      w[r * 4 + i] = t;
+    }
+  }
+
+  for (i = 0; i < 60; i++)
+    AES_STORE32(pBytes + i * 4, w[i]);
+}
+
+/* Expands the data key and the tweak key of the XTS mode */
+static void AesSetKeys(LPCODECKEY pKey, const unsigned char *key)
+{
+  CODECAESKEYS *pAes = &pKey->aes;
+
+  AesSetKey(pAes->aEncrypt, pAes->aEncryptBytes, key);
+  AesSetDecryptKey(pAes->aEncrypt, pAes->aDecrypt, pAes->aDecryptBytes);
+  AesSetKey(pAes->aTweak, pAes->aTweakBytes, key + 32);
+}
+
+/* Encrypts one block using the portable table-driven implementation */
+static void AesEncryptBlock(const unsigned int *rk, const unsigned char *in, unsigned char *out)
+{
+  unsigned int s0, s1, s2, s3, t0, t1, t2, t3;
+  int r;
+
+  s0 = AES_LOAD32(in) ^ rk[0];
+  s1 = AES_LOAD32(in + 4) ^ rk[1];
+  s2 = AES_LOAD32(in + 8) ^ rk[2];
+  s3 = AES_LOAD32(in + 12) ^ rk[3];
+
+  for (r = 1; r < 14; r++)
+  {
+    rk += 4;
+    t0 = aesTe0[s0 >> 24] ^ aesTe1[(s1 >> 16) & 0xff] ^ aesTe2[(s2 >> 8) & 0xff] ^ aesTe3[s3 & 0xff] ^ rk[0];
+    t1 = aesTe0[s1 >> 24] ^ aesTe1[(s2 >> 16) & 0xff] ^ aesTe2[(s3 >> 8) & 0xff] ^ aesTe3[s0 & 0xff] ^ rk[1];
+    t2 = aesTe0[s2 >> 24] ^ aesTe1[(s3 >> 16) & 0xff] ^ aesTe2[(s0 >> 8) & 0xff] ^ aesTe3[s1 & 0xff] ^ rk[2];
+    t3 = aesTe0[s3 >> 24] ^ aesTe1[(s0 >> 16) & 0xff] ^ aesTe2[(s1 >> 8) & 0xff] ^ aesTe3[s2 & 0xff] ^ rk[3];
+    s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+  }
+
+  rk += 4;
+  t0 = ((unsigned int)aesSbox[s0 >> 24] << 24) ^ ((unsigned int)aesSbox[(s1 >> 16) & 0xff] << 16) ^
+       ((unsigned int)aesSbox[(s2 >> 8) & 0xff] << 8) ^ (unsigned int)aesSbox[s3 & 0xff] ^ rk[0];
+  t1 = ((unsigned int)aesSbox[s1 >> 24] << 24) ^ ((unsigned int)aesSbox[(s2 >> 16) & 0xff] << 16) ^
+       ((unsigned int)aesSbox[(s3 >> 8) & 0xff] << 8) ^ (unsigned int)aesSbox[s0 & 0xff] ^ rk[1];
+  t2 = ((unsigned int)aesSbox[s2 >> 24] << 24) ^ ((unsigned int)aesSbox[(s3 >> 16) & 0xff] << 16) ^
+       ((unsigned int)aesSbox[(s0 >> 8) & 0xff] << 8) ^ (unsigned int)aesSbox[s1 & 0xff] ^ rk[2];
+  t3 = ((unsigned int)aesSbox[s3 >> 24] << 24) ^ ((unsigned int)aesSbox[(s0 >> 16) & 0xff] << 16) ^
+       ((unsigned int)aesSbox[(s1 >> 8) & 0xff] << 8) ^ (unsigned int)aesSbox[s2 & 0xff] ^ rk[3];
+
+  AES_STORE32(out, t0);
+  AES_STORE32(out + 4, t1);
+  AES_STORE32(out + 8, t2);
+  AES_STORE32(out + 12, t3);
+}
+
+/* Decrypts one block using the portable table-driven implementation.  The round
+** keys are those of the equivalent inverse cipher, see AesSetDecryptKey().
+*/
+static void AesDecryptBlock(const unsigned int *rk, const unsigned char *in, unsigned char *out)
+{
+  unsigned int s0, s1, s2, s3, t0, t1, t2, t3;
+  int r;
+
+  s0 = AES_LOAD32(in) ^ rk[0];
+  s1 = AES_LOAD32(in + 4) ^ rk[1];
+  s2 = AES_LOAD32(in + 8) ^ rk[2];
+  s3 = AES_LOAD32(in + 12) ^ rk[3];
+
+  for (r = 1; r < 14; r++)
+  {
+    rk += 4;
+    t0 = aesTd0[s0 >> 24] ^ aesTd1[(s3 >> 16) & 0xff] ^ aesTd2[(s2 >> 8) & 0xff] ^ aesTd3[s1 & 0xff] ^ rk[0];
+    t1 = aesTd0[s1 >> 24] ^ aesTd1[(s0 >> 16) & 0xff] ^ aesTd2[(s3 >> 8) & 0xff] ^ aesTd3[s2 & 0xff] ^ rk[1];
+    t2 = aesTd0[s2 >> 24] ^ aesTd1[(s1 >> 16) & 0xff] ^ aesTd2[(s0 >> 8) & 0xff] ^ aesTd3[s3 & 0xff] ^ rk[2];
+    t3 = aesTd0[s3 >> 24] ^ aesTd1[(s2 >> 16) & 0xff] ^ aesTd2[(s1 >> 8) & 0xff] ^ aesTd3[s0 & 0xff] ^ rk[3];
+    s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+  }
+
+  rk += 4;
+  t0 = ((unsigned int)aesInvSbox[s0 >> 24] << 24) ^ ((unsigned int)aesInvSbox[(s3 >> 16) & 0xff] << 16) ^
+       ((unsigned int)aesInvSbox[(s2 >> 8) & 0xff] << 8) ^ (unsigned int)aesInvSbox[s1 & 0xff] ^ rk[0];
+  t1 = ((unsigned int)aesInvSbox[s1 >> 24] << 24) ^ ((unsigned int)aesInvSbox[(s0 >> 16) & 0xff] << 16) ^
+       ((unsigned int)aesInvSbox[(s3 >> 8) & 0xff] << 8) ^ (unsigned int)aesInvSbox[s2 & 0xff] ^ rk[1];
+  t2 = ((unsigned int)aesInvSbox[s2 >> 24] << 24) ^ ((unsigned int)aesInvSbox[(s1 >> 16) & 0xff] << 16) ^
+       ((unsigned int)aesInvSbox[(s0 >> 8) & 0xff] << 8) ^ (unsigned int)aesInvSbox[s3 & 0xff] ^ rk[2];
+  t3 = ((unsigned int)aesInvSbox[s3 >> 24] << 24) ^ ((unsigned int)aesInvSbox[(s2 >> 16) & 0xff] << 16) ^
+       ((unsigned int)aesInvSbox[(s1 >> 8) & 0xff] << 8) ^ (unsigned int)aesInvSbox[s0 & 0xff] ^ rk[3];
+
+  AES_STORE32(out, t0);
+  AES_STORE32(out + 4, t1);
+  AES_STORE32(out + 8, t2);
+  AES_STORE32(out + 12, t3);
+}
+
+/* Multiplies an XTS tweak by the primitive element of GF(2^128), which gives the
+** tweak of the next block.  The tweak is a little-endian number.
+*/
+static void XtsNextTweak(unsigned char *t)
+{
+  unsigned char carry = (unsigned char)(t[15] >> 7);
+  int i;
+
+  for (i = 15; i > 0; i--)
+    t[i] = (unsigned char)((t[i] << 1) | (t[i - 1] >> 7));
+  t[0] = (unsigned char)((t[0] << 1) ^ (carry ? 0x87 : 0));
+}
+
+#if defined(CODEC_HAVE_AESNI)
+/* XTS mode using AES-NI.  Four blocks are encrypted or decrypted at a time so
+** that the latency of the AESENC and AESDEC instructions overlaps.  The tweak is
+** kept in a register and the tweak of the next block is a shift and a
+** conditional reduction away.
+*/
+static CODEC_AESNI_TARGET void AesXtsHardware(LPCODECKEY pKey, Pgno nPageNum, unsigned int iBlock, const unsigned char *pIn, unsigned char *pOut, int nBlocks, int bDecrypt)
+{
+  const unsigned char *pRoundKeys = bDecrypt ? pKey->aes.aDecryptBytes : pKey->aes.aEncryptBytes;
+  const __m128i *kt = (const __m128i *)pKey->aes.aTweakBytes;
+  const __m128i poly = _mm_set_epi32(1, 1, 1, 0x87);
+  __m128i k[15];
+  __m128i t, t0, t1, t2, t3, b0, b1, b2, b3;
+  int r;
+
+  for (r = 0; r < 15; r++)
+    k[r] = _mm_loadu_si128((const __m128i *)(pRoundKeys + r * 16));
+
+  /* The tweak of the page is its number as a 128-bit little-endian value,
+  ** encrypted using the tweak key
+  */
+  t = _mm_xor_si128(_mm_cvtsi32_si128((int)nPageNum), _mm_loadu_si128(kt));
+  for (r = 1; r < 14; r++)
+    t = _mm_aesenc_si128(t, _mm_loadu_si128(kt + r));
+  t = _mm_aesenclast_si128(t, _mm_loadu_si128(kt + 14));
+
+#define XTS_NEXT(t) \
+  t = _mm_xor_si128(_mm_slli_epi32(t, 1), \
+                    _mm_and_si128(_mm_shuffle_epi32(_mm_srai_epi32(t, 31), _MM_SHUFFLE(2, 1, 0, 3)), poly))
+#define XTS_FIRST(b, tb, n) \
+  tb = t; XTS_NEXT(t); \
+  b = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i *)(pIn + (n) * 16)), tb), k[0])
+#define XTS_ROUNDS(op) \
+  for (r = 1; r < 14; r++) \
+  { \
+    b0 = op(b0, k[r]); b1 = op(b1, k[r]); b2 = op(b2, k[r]); b3 = op(b3, k[r]); \
+  }
+#define XTS_LAST(op, b, tb, n) \
+  _mm_storeu_si128((__m128i *)(pOut + (n) * 16), _mm_xor_si128(op(b, k[14]), tb))
+
+  for (; iBlock > 0; iBlock--)
+    XTS_NEXT(t);
+
+  for (; nBlocks >= 4; nBlocks -= 4, pIn += 64, pOut += 64)
+  {
+    XTS_FIRST(b0, t0, 0); XTS_FIRST(b1, t1, 1); XTS_FIRST(b2, t2, 2); XTS_FIRST(b3, t3, 3);
+
+    if (bDecrypt)
+    {
+      XTS_ROUNDS(_mm_aesdec_si128);
+      XTS_LAST(_mm_aesdeclast_si128, b0, t0, 0); XTS_LAST(_mm_aesdeclast_si128, b1, t1, 1);
+      XTS_LAST(_mm_aesdeclast_si128, b2, t2, 2); XTS_LAST(_mm_aesdeclast_si128, b3, t3, 3);
+    }
+    else
+    {
+      XTS_ROUNDS(_mm_aesenc_si128);
+      XTS_LAST(_mm_aesenclast_si128, b0, t0, 0); XTS_LAST(_mm_aesenclast_si128, b1, t1, 1);
+      XTS_LAST(_mm_aesenclast_si128, b2, t2, 2); XTS_LAST(_mm_aesenclast_si128, b3, t3, 3);
+    }
+  }
+
+  for (; nBlocks > 0; nBlocks--, pIn += 16, pOut += 16)
+  {
+    XTS_FIRST(b0, t0, 0);
+    if (bDecrypt)
+    {
+      for (r = 1; r < 14; r++)
+        b0 = _mm_aesdec_si128(b0, k[r]);
+      XTS_LAST(_mm_aesdeclast_si128, b0, t0, 0);
+    }
+    else
+    {
+      for (r = 1; r < 14; r++)
+        b0 = _mm_aesenc_si128(b0, k[r]);
+      XTS_LAST(_mm_aesenclast_si128, b0, t0, 0);
+    }
+  }
+
+#undef XTS_NEXT
+#undef XTS_FIRST
+#undef XTS_ROUNDS
+#undef XTS_LAST
+}
+#endif
+
+/* Encrypts or decrypts nBlocks of the specified page, starting at block iBlock,
+** from pIn into pOut.  The two buffers may be the same.
+*/
+static void AesXts(LPCODECKEY pKey, Pgno nPageNum, unsigned int iBlock, const unsigned char *pIn, unsigned char *pOut, int nBlocks, int bDecrypt)
+{
+  unsigned char tweak[CODEC_AES_BLOCK_SIZE];
+  unsigned char block[CODEC_AES_BLOCK_SIZE];
+  int i;
+
+#if defined(CODEC_HAVE_AESNI)
+  if (aesHardware)
+  {
+    AesXtsHardware(pKey, nPageNum, iBlock, pIn, pOut, nBlocks, bDecrypt);
+    return;
+  }
+#endif
+
+  memset(tweak, 0, sizeof(tweak));
+  tweak[0] = (unsigned char)nPageNum;
+  tweak[1] = (unsigned char)(nPageNum >> 8);
+  tweak[2] = (unsigned char)(nPageNum >> 16);
+  tweak[3] = (unsigned char)(nPageNum >> 24);
+  AesEncryptBlock(pKey->aes.aTweak, tweak, tweak);
+
+  for (; iBlock > 0; iBlock--)
+    XtsNextTweak(tweak);
+
+  for (; nBlocks > 0; nBlocks--, pIn += 16, pOut += 16)
+  {
+    for (i = 0; i < CODEC_AES_BLOCK_SIZE; i++)
+      block[i] = pIn[i] ^ tweak[i];
+
+    if (bDecrypt)
+      AesDecryptBlock(pKey->aes.aDecrypt, block, block);
+    else
+      AesEncryptBlock(pKey->aes.aEncrypt, block, block);
+
+    for (i = 0; i < CODEC_AES_BLOCK_SIZE; i++)
+      pOut[i] = block[i] ^ tweak[i];
+
+    XtsNextTweak(tweak);
+  }
+}
+
+/* Encrypts or decrypts nBytes of the specified page in place, starting at block
+** 1.  When nBytes is not a whole number of blocks, the partial block at the end
+** steals the rest of its ciphertext from the block before it, as in IEEE 1619.
+** The last two blocks then use each other's tweak.
+*/
+static void AesXtsStealing(LPCODECKEY pKey, Pgno nPageNum, unsigned char *pData, int nBytes, int bDecrypt)
+{
+  unsigned int nBlocks = (unsigned int)nBytes / CODEC_AES_BLOCK_SIZE;
+  int nTail = nBytes % CODEC_AES_BLOCK_SIZE;
+  unsigned char *pLast = pData + (nBlocks - 1) * CODEC_AES_BLOCK_SIZE;
+  unsigned char block[CODEC_AES_BLOCK_SIZE];
+  unsigned char c;
+  int i;
+
+  AesXts(pKey, nPageNum, 1, pData, pData, (int)nBlocks - (nTail ? 1 : 0), bDecrypt);
+  if (!nTail) return;
+
+  AesXts(pKey, nPageNum, bDecrypt ? nBlocks + 1 : nBlocks, pLast, block, 1, bDecrypt);
+  for (i = 0; i < nTail; i++)
+  {
+    c = pLast[CODEC_AES_BLOCK_SIZE + i];
+    pLast[CODEC_AES_BLOCK_SIZE + i] = block[i];
+    block[i] = c;
+  }
+  AesXts(pKey, nPageNum, bDecrypt ? nBlocks : nBlocks + 1, block, pLast, 1, bDecrypt);
+  ZeroMemory(block, sizeof(block));
+}
+
+typedef struct _SHA256HASH
+{
+  unsigned int   state[8];    /* Intermediate hash value */
+  sqlite3_uint64 nBytes;      /* Total number of bytes hashed */
+  unsigned char  buffer[64];  /* Unprocessed input */
+} SHA256HASH;
+
+static const unsigned int sha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void Sha256Transform(unsigned int state[8], const unsigned char *p)
+{
+  unsigned int w[64];
+  unsigned int a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = AES_LOAD32(p + i * 4);
+  for (; i < 64; i++)
+    w[i] = (AES_ROR(w[i - 2], 17) ^ AES_ROR(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7] +
+           (AES_ROR(w[i - 15], 7) ^ AES_ROR(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+
+  a = state[0]; b = state[1]; c = state[2]; d = state[3];
+  e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+  for (i = 0; i < 64; i++)
+  {
+    t1 = h + (AES_ROR(e, 6) ^ AES_ROR(e, 11) ^ AES_ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+    t2 = (AES_ROR(a, 2) ^ AES_ROR(a, 13) ^ AES_ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void Sha256Init(SHA256HASH *pHash)
+{
+  static const unsigned int init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(pHash->state, init, sizeof(init));
+  pHash->nBytes = 0;
+}
+
+static void Sha256Update(SHA256HASH *pHash, const unsigned char *p, int n)
+{
+  int nUsed = (int)(pHash->nBytes & 63);
+
+  pHash->nBytes += n;
+  while (n > 0)
+  {
+    int nCopy = 64 - nUsed;
+    if (nCopy > n) nCopy = n;
+    memcpy(pHash->buffer + nUsed, p, nCopy);
+    nUsed += nCopy;
+    p += nCopy;
+    n -= nCopy;
+    if (nUsed == 64)
+    {
+      Sha256Transform(pHash->state, pHash->buffer);
+      nUsed = 0;
+    }
+  }
+}
+
+static void Sha256Final(SHA256HASH *pHash, unsigned char digest[32])
+{
+  sqlite3_uint64 nBits = pHash->nBytes * 8;
+  unsigned char pad = 0x80;
+  unsigned char length[8];
+  int i;
+
+  for (i = 0; i < 8; i++)
+    length[i] = (unsigned char)(nBits >> (56 - i * 8));
+
+  Sha256Update(pHash, &pad, 1);
+  pad = 0;
+  while ((pHash->nBytes & 63) != 56)
+    Sha256Update(pHash, &pad, 1);
+  Sha256Update(pHash, length, 8);
+
+  for (i = 0; i < 8; i++)
+    AES_STORE32(digest + i * 4, pHash->state[i]);
+}
+
+/* Prepares the inner and outer HMAC-SHA-256 states for the specified key */
+static void HmacSha256Init(SHA256HASH *pInner, SHA256HASH *pOuter, const unsigned char *pKey, int nKey)
+{
+  unsigned char block[64];
+  unsigned char digest[32];
+  int i;
+
+  if (nKey > 64)
+  {
+    Sha256Init(pInner);
+    Sha256Update(pInner, pKey, nKey);
+    Sha256Final(pInner, digest);
+    pKey = digest;
+    nKey = 32;
+  }
+
+  memset(block, 0, sizeof(block));
+  memcpy(block, pKey, nKey);
+
+  for (i = 0; i < 64; i++) block[i] ^= 0x36;
+  Sha256Init(pInner);
+  Sha256Update(pInner, block, 64);
+
+  for (i = 0; i < 64; i++) block[i] ^= 0x36 ^ 0x5c;
+  Sha256Init(pOuter);
+  Sha256Update(pOuter, block, 64);
+
+  memset(block, 0, sizeof(block));
+  memset(digest, 0, sizeof(digest));
+}
+
+/* PBKDF2 with HMAC-SHA-256, producing a multiple of 32 bytes of output */
+static void Pbkdf2Sha256(const unsigned char *pPassword, int nPassword, const unsigned char *pSalt, int nSalt, int nIterations, unsigned char *out, int nOut)
+{
+  SHA256HASH inner, outer, h;
+  unsigned char u[32];
+  unsigned char index[4] = { 0, 0, 0, 0 };
+  int i, j;
+
+  HmacSha256Init(&inner, &outer, pPassword, nPassword);
+
+  for (; nOut > 0; nOut -= 32, out += 32)
+  {
+    index[3]++;
+
+    h = inner;
+    Sha256Update(&h, pSalt, nSalt);
+    Sha256Update(&h, index, 4);
+    Sha256Final(&h, u);
+    h = outer;
+    Sha256Update(&h, u, 32);
+    Sha256Final(&h, u);
+    memcpy(out, u, 32);
+
+    for (i = 1; i < nIterations; i++)
+    {
+      h = inner;
+      Sha256Update(&h, u, 32);
+      Sha256Final(&h, u);
+      h = outer;
+      Sha256Update(&h, u, 32);
+      Sha256Final(&h, u);
+      for (j = 0; j < 32; j++) out[j] ^= u[j];
+    }
+  }
+
+  memset(&inner, 0, sizeof(inner));
+  memset(&outer, 0, sizeof(outer));
+  memset(&h, 0, sizeof(h));
+  memset(u, 0, sizeof(u));
+}
+
+/*
+** Deriving a key dominates the cost of opening an encrypted database, and with
+** connection pooling the same password and salt are derived over and over.  The
+** round keys are therefore kept in a small process-wide cache, found by a digest
+** of the password and the salt.  The digest is salted with a random value chosen
+** once per process, so the cache never holds a plain hash of a password.  Each
+** bucket of the cache has its own mutex, so opening databases on many threads
+** does not serialize on the master mutex.  ShutdownKeyCache() wipes everything.
+*/
+#ifndef CODEC_KEY_CACHE_BUCKETS
+#define CODEC_KEY_CACHE_BUCKETS 16
+#endif
+#ifndef CODEC_KEY_CACHE_ENTRIES
+#define CODEC_KEY_CACHE_ENTRIES 4
+#endif
+
+typedef struct _KEYCACHEENTRY
+{
+  unsigned char  digest[32];           /* Salted digest of the password, database salt and iteration count */
+  CODECAESKEYS   aes;                  /* Cached round keys */
+  unsigned int   iLastUsed;            /* Value of the bucket clock when last used */
+  int            bUsed;                /* Non-zero if this entry holds a key */
+} KEYCACHEENTRY;
+
+typedef struct _KEYCACHEBUCKET
+{
+  sqlite3_mutex *pMutex;               /* Protects this bucket */
+  unsigned int   iClock;               /* Incremented each time an entry is used */
+  KEYCACHEENTRY  aEntry[CODEC_KEY_CACHE_ENTRIES];
+} KEYCACHEBUCKET;
+
+static KEYCACHEBUCKET g_aKeyCache[CODEC_KEY_CACHE_BUCKETS];
+static unsigned char g_keyCacheSalt[16];
+static volatile int g_keyCacheReady = 0;
+
+/* InitializeProvider() reads g_keyCacheReady without the master mutex, so the
+** tables and the key cache must be visible to other threads before the flag
+** is, and the reader must see the flag before it looks at them.  volatile only
+** stops the compiler from reordering, not the CPU, e.g. on ARM.
+*/
+#if SQLITE_OS_WIN
+#define CODEC_MEMORY_BARRIER() MemoryBarrier()
+#else
+#define CODEC_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+/* Allocates the mutexes of the key cache and sets its salt.  This must be
+** called with the master mutex held.  The salt is chosen by the caller because
+** sqlite3_randomness() may need the master mutex itself.
+*/
+static void InitializeKeyCache(const unsigned char *pSalt)
+{
+  int i;
+
+  if (g_keyCacheReady) return;
+
+  CopyMemory(g_keyCacheSalt, pSalt, sizeof(g_keyCacheSalt));
+  for (i = 0; i < CODEC_KEY_CACHE_BUCKETS; i++)
+    g_aKeyCache[i].pMutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+
+  /* Publishes the cache and the AES tables, see InitializeProvider() */
+  CODEC_MEMORY_BARRIER();
+  g_keyCacheReady = 1;
+}
+
+/* Wipes the key cache and frees its mutexes.  It is set up again by the next
+** call to InitializeProvider().
+*/
+static void ShutdownKeyCache(void)
+{
+  MUTEX_LOGIC( sqlite3_mutex *pMaster; )
+  int i;
+
+  if (!g_keyCacheReady) return;
+
+  MUTEX_LOGIC( pMaster = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER); )
+  sqlite3_mutex_enter(pMaster);
+
+  if (g_keyCacheReady)
+  {
+    for (i = 0; i < CODEC_KEY_CACHE_BUCKETS; i++)
+    {
+      KEYCACHEBUCKET *pBucket = &g_aKeyCache[i];
+
+      sqlite3_mutex_enter(pBucket->pMutex);
+      ZeroMemory(pBucket->aEntry, sizeof(pBucket->aEntry));
+      pBucket->iClock = 0;
+      sqlite3_mutex_leave(pBucket->pMutex);
+
+      sqlite3_mutex_free(pBucket->pMutex);
+      pBucket->pMutex = NULL;
+    }
+
+    ZeroMemory(g_keyCacheSalt, sizeof(g_keyCacheSalt));
+    g_keyCacheReady = 0;
+  }
+
+  sqlite3_mutex_leave(pMaster);
+}
+
+/* Returns the bucket of the key cache for a digest, or NULL if the cache
+** cannot be used
+*/
+static KEYCACHEBUCKET *KeyCacheBucket(const unsigned char digest[32])
+{
+  KEYCACHEBUCKET *pBucket;
+
+  if (!g_keyCacheReady) return NULL;
+
+  pBucket = &g_aKeyCache[digest[0] % CODEC_KEY_CACHE_BUCKETS];
+  if (!pBucket->pMutex && sqlite3_threadsafe()) return NULL;
+
+  return pBucket;
+}
+
+/* Computes the digest that identifies the password, salt and iteration count of
+** a key in the cache
+*/
+static void KeyCacheDigest(LPCODECKEY pKey, unsigned char digest[32])
+{
+  SHA256HASH hash;
+  unsigned char iterations[4];
+
+  AES_STORE32(iterations, (unsigned int)pKey->nIterations);
+  Sha256Init(&hash);
+  Sha256Update(&hash, g_keyCacheSalt, sizeof(g_keyCacheSalt));
+  Sha256Update(&hash, pKey->salt, CODEC_SALT_SIZE);
+  Sha256Update(&hash, iterations, sizeof(iterations));
+  Sha256Update(&hash, pKey->pPassword, pKey->nPassword);
+  Sha256Final(&hash, digest);
+  ZeroMemory(&hash, sizeof(hash));
+}
+
+/* Copies cached round keys into a key, returning non-zero if they were found */
+static int KeyCacheLookup(LPCODECKEY pKey, const unsigned char digest[32])
+{
+  KEYCACHEBUCKET *pBucket = KeyCacheBucket(digest);
+  int i, bFound = 0;
+
+  if (!pBucket) return 0;
+
+  sqlite3_mutex_enter(pBucket->pMutex);
+  for (i = 0; i < CODEC_KEY_CACHE_ENTRIES; i++)
+  {
+    KEYCACHEENTRY *pEntry = &pBucket->aEntry[i];
+
+    if (pEntry->bUsed && memcmp(pEntry->digest, digest, sizeof(pEntry->digest)) == 0)
+    {
+      CopyMemory(&pKey->aes, &pEntry->aes, sizeof(pKey->aes));
+      pEntry->iLastUsed = ++pBucket->iClock;
+      bFound = 1;
+      break;
+    }
+  }
+  sqlite3_mutex_leave(pBucket->pMutex);
+
+  return bFound;
+}
+
+/* Adds the round keys of a key to the cache, replacing the least recently used
+** entry of its bucket if the bucket is full
+*/
+static void KeyCacheStore(LPCODECKEY pKey, const unsigned char digest[32])
+{
+  KEYCACHEBUCKET *pBucket = KeyCacheBucket(digest);
+  KEYCACHEENTRY *pVictim;
+  int i;
+
+  if (!pBucket) return;
+
+  sqlite3_mutex_enter(pBucket->pMutex);
+  pVictim = &pBucket->aEntry[0];
+  for (i = 0; i < CODEC_KEY_CACHE_ENTRIES; i++)
+  {
+    KEYCACHEENTRY *pEntry = &pBucket->aEntry[i];
+
+    if (!pEntry->bUsed || memcmp(pEntry->digest, digest, sizeof(pEntry->digest)) == 0)
+    {
+      pVictim = pEntry;
+      break;
+    }
+    if ((int)(pEntry->iLastUsed - pVictim->iLastUsed) < 0)
+      pVictim = pEntry;
+  }
+
+  CopyMemory(pVictim->digest, digest, sizeof(pVictim->digest));
+  CopyMemory(&pVictim->aes, &pKey->aes, sizeof(pVictim->aes));
+  pVictim->iLastUsed = ++pBucket->iClock;
+  pVictim->bUsed = 1;
+  sqlite3_mutex_leave(pBucket->pMutex);
+}
+
+/* Derives the AES key from the password, the current salt and iteration count,
+** unless the key cache already has it
+*/
+static void CodecDeriveAesKey(LPCODECKEY pKey)
+{
+  unsigned char key[CODEC_AES_KEY_SIZE];
+  unsigned char digest[32];
+
+  KeyCacheDigest(pKey, digest);
+  if (!KeyCacheLookup(pKey, digest))
+  {
+    Pbkdf2Sha256(pKey->pPassword, pKey->nPassword, pKey->salt, CODEC_SALT_SIZE, pKey->nIterations, key, sizeof(key));
+    AesSetKeys(pKey, key);
+    memset(key, 0, sizeof(key));
+    KeyCacheStore(pKey, digest);
+  }
+  memset(digest, 0, sizeof(digest));
+  pKey->bDerived = TRUE;
+}
+
+/* Switches a key whose format is not known yet to the AES format, using a new
+** random salt and the current iteration count.  This happens when a new
+** database is written for the first time.
+*/
+static void CodecInitAesKey(LPCODECKEY pKey)
+{
+  sqlite3_randomness(CODEC_SALT_SIZE, pKey->salt);
+  pKey->nIterations = CODEC_KDF_ITERATIONS;
+  pKey->nFormat = CODEC_FORMAT_AES;
+  CodecDeriveAesKey(pKey);
+}
+
+/* Switches the key a database is rekeyed to in batches to the AES format.  The
+** rekey record has no room for a salt, so it is derived from the salt of the old
+** key, which stays in page 1 until the last batch.  It is as unique as a random
+** salt and the same again when the rekey is resumed.
+*/
+static void CodecInitRekeyKey(LPCODECKEY pKey, LPCODECKEY pOldKey, int nIterations)
+{
+  static const unsigned char label[] = "rekey";
+  unsigned char digest[32];
+  SHA256HASH hash;
+
+  Sha256Init(&hash);
+  Sha256Update(&hash, label, sizeof(label) - 1);
+  Sha256Update(&hash, pOldKey->salt, CODEC_SALT_SIZE);
+  Sha256Final(&hash, digest);
+  CopyMemory(pKey->salt, digest, CODEC_SALT_SIZE);
+
+  pKey->nIterations = nIterations;
+  pKey->nFormat = CODEC_FORMAT_AES;
+  CodecDeriveAesKey(pKey);
+}
+
+/* Inspects the header of page 1 to determine the format of the database and,
+** for the AES format, derives the key using the salt and iteration count stored
+** there.
+*/
+static void CodecDetectFormat(LPCODECKEY pKey, const unsigned char *pPage1)
+{
+  unsigned int nIterations = AES_LOAD32(pPage1 + CODEC_ITERATIONS_OFFSET);
+
+  if (memcmp(pPage1, codecMagic, CODEC_MAGIC_SIZE) != 0 || !CODEC_KDF_VALID(nIterations))
+  {
+    if (pKey->nFormat == CODEC_FORMAT_UNKNOWN)
+      pKey->nFormat = CODEC_FORMAT_LEGACY;
+    return;
+  }
+
+  pKey->nFormat = CODEC_FORMAT_AES;
+  if (!pKey->bDerived || pKey->nIterations != (int)nIterations ||
+      memcmp(pKey->salt, pPage1 + CODEC_SALT_OFFSET, CODEC_SALT_SIZE) != 0)
+  {
+    memcpy(pKey->salt, pPage1 + CODEC_SALT_OFFSET, CODEC_SALT_SIZE);
+    pKey->nIterations = (int)nIterations;
+    CodecDeriveAesKey(pKey);
+  }
+}
+
+/* Encrypts a page using the AES format from pIn into pOut, which may be the
+** same buffer.
+*/
+static void CodecEncryptAes(LPCODECKEY pKey, Pgno nPageNum, const unsigned char *pIn, unsigned char *pOut, DWORD dwPageSize)
+{
+  if (nPageNum == 1)
+  {
+    if (pOut != pIn)
+      memcpy(pOut + CODEC_HEADER_SIZE, pIn + CODEC_HEADER_SIZE, dwPageSize - CODEC_HEADER_SIZE);
+    memcpy(pOut + CODEC_MOVED_OFFSET, pIn + 16, CODEC_MOVED_SIZE);
+    AesXtsStealing(pKey, nPageNum, pOut + CODEC_HEADER_SIZE, (int)(dwPageSize - CODEC_HEADER_SIZE), FALSE);
+
+    memcpy(pOut, codecMagic, CODEC_MAGIC_SIZE);
+    AES_STORE32(pOut + CODEC_ITERATIONS_OFFSET, (unsigned int)pKey->nIterations);
+    memcpy(pOut + CODEC_SALT_OFFSET, pKey->salt, CODEC_SALT_SIZE);
+  }
+  else
+  {
+    AesXts(pKey, nPageNum, 0, pIn, pOut, dwPageSize / CODEC_AES_BLOCK_SIZE, FALSE);
+  }
+}
+
+/* Decrypts a page using the AES format in place */
+static void CodecDecryptAes(LPCODECKEY pKey, Pgno nPageNum, unsigned char *pData, DWORD dwPageSize)
+{
+  if (nPageNum == 1)
+  {
+    AesXtsStealing(pKey, nPageNum, pData + CODEC_HEADER_SIZE, (int)(dwPageSize - CODEC_HEADER_SIZE), TRUE);
+
+    memcpy(pData, codecSqliteHeader, sizeof(codecSqliteHeader));
+    memcpy(pData + 16, pData + CODEC_MOVED_OFFSET, CODEC_MOVED_SIZE);
+    pData[21] = 64;
+    pData[22] = 32;
+    pData[23] = 32;
+    memset(pData + CODEC_MOVED_OFFSET, 0, CODEC_MOVED_SIZE);
+  }
+  else
+  {
+    AesXts(pKey, nPageNum, 0, pData, pData, dwPageSize / CODEC_AES_BLOCK_SIZE, TRUE);
+  }
+}
+
+/* Extra padding before and after the cryptographic buffer, only needed by
+** ciphers that do not preserve the length of the data
+*/
+#define CRYPT_OFFSET 8
+
+typedef struct _CRYPTBLOCK
+{
+  Pager     *pPager;       /* Pager this cryptblock belongs to */
+  LPCODECKEY pReadKey;     /* Key used to read from the database and write to the journal */
+  LPCODECKEY pWriteKey;    /* Key used to write to the database */
+  DWORD      dwPageSize;   /* Size of pages */
+  LPVOID     pvCrypt;      /* A buffer for encrypting, reused for every page written by the pager */
+  LPBYTE     pbOutput;     /* Where pages are encrypted to, within pvCrypt */
+  DWORD      dwCryptSize;  /* Equal to or greater than dwPageSize.  If larger, the cipher needs padding */
+  Pgno       nRekeyPage;   /* Pages before this one, except page 1, are stored using the write key */
+  Pgno       nRekeyLimit;  /* Pages before this one are written using the write key */
+  BOOL       bRekeying;    /* Non-zero while this connection is rekeying the database */
+  BOOL       bRekeyPending;/* Non-zero if a rekey was interrupted and the new key is not known */
+  BOOL       bRekeyResume; /* Non-zero while RekeyDatabase() reads page 1 to resume a rekey */
+} CRYPTBLOCK, *LPCRYPTBLOCK;
+
+HCRYPTPROV g_hProvider = 0; /* Global instance of the cryptographic provider */
+
+#define SQLITECRYPTERROR_PROVIDER "Cryptographic provider not available"
+#define SQLITECRYPTERROR_RESUME   "Interrupted rekey must be resumed with the same key"
+#define SQLITECRYPTERROR_BATCH    "Unencrypted database cannot be rekeyed in batches"
+#define SQLITECRYPTERROR_LEGACY   "Database in the legacy format cannot be rekeyed in batches"
+
+/*
+** A rekey that is done in batches keeps a record of its progress in page 1, in
+** the last 15 of the bytes of the database header reserved for expansion, so
+** that it can be resumed after being interrupted.  The record holds a marker, the
+** format of the new key, the first page not rewritten yet, a check value for the
+** new key and its iteration count.  The salt of the new key does not fit, see
+** CodecInitRekeyKey().  Page 1 itself keeps using the old key until the last
+** batch, so the record can always be read using the old key.
+*/
+#define CODEC_REKEY_OFFSET    (CODEC_MOVED_OFFSET + CODEC_MOVED_SIZE)
+#define CODEC_REKEY_SIZE      15
+#define CODEC_REKEY_FIRST     2                 /* Page 1 is always rewritten last */
+#define CODEC_REKEY_ALL       ((Pgno)0xffffffff)
+
+static const unsigned char codecRekeyMagic[2] = { 'R', 'K' };
+
+/* Keys databases are being rekeyed to, so that other connections in this
+** process can keep using those databases between the batches of a rekey.
+** Protected by the master mutex.
+*/
+static LPCODECKEY g_pRekeyKeys = NULL;
+
+typedef int (*SQLITEREKEYPROGRESS)(void *, int, int);
+
+/* Needed for re-keying */
+static void * sqlite3pager_get_codecarg(Pager *pPager)
+{
+  return (pPager->xCodec) ? pPager->pCodec: NULL;
+}
+
+void sqlite3_activate_see(const char *info)
+{
+}
+
+/* Create a cryptographic context.  Use the enhanced provider because it is available on
+** most platforms
+*/
+static BOOL InitializeProvider()
+{
+  MUTEX_LOGIC( sqlite3_mutex *pMaster; )
+  unsigned char salt[sizeof(g_keyCacheSalt)];
+
+  /* Only the first call needs the master mutex.  The AES tables are built
+  ** before the key cache is set up, so the flag of the cache covers both.
+  */
+  if (g_hProvider && g_keyCacheReady)
+  {
+    CODEC_MEMORY_BARRIER();
+    return TRUE;
+  }
+
+  sqlite3_randomness(sizeof(salt), salt);
+
+  MUTEX_LOGIC( pMaster = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER); )
+  sqlite3_mutex_enter(pMaster);
+
+  if (!g_hProvider && !CryptAcquireContext(&g_hProvider, NULL, MS_ENHANCED_PROV, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
+  {
+    sqlite3_mutex_leave(pMaster);
+    return FALSE;
+  }
+
+  AesInitTables();
+  InitializeKeyCache(salt);
+  ZeroMemory(salt, sizeof(salt));
+
+  sqlite3_mutex_leave(pMaster);
+  return TRUE;
+}
+
+/* Derive the RC4 key of the legacy format.  Only databases in that format need
+** it, so this is put off until such a database is read.
+*/
+static void DeriveLegacyKey(LPCODECKEY pKey)
+{
+  HCRYPTHASH hHash = 0;
+  MUTEX_LOGIC( sqlite3_mutex *pMaster = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER); )
+  sqlite3_mutex_enter(pMaster);
+
+  if (!pKey->hLegacyKey && CryptCreateHash(g_hProvider, CALG_SHA1, 0, 0, &hHash))
+  {
+    if (CryptHashData(hHash, pKey->pPassword, pKey->nPassword, 0))
+    {
+      CryptDeriveKey(g_hProvider, CALG_RC4, hHash, 0, &pKey->hLegacyKey);
+    }
+    CryptDestroyHash(hHash);
+  }
 
-/* Extra padding before and after the cryptographic buffer */
-#define CRYPT_OFFSET 8
+  sqlite3_mutex_leave(pMaster);
+}
 
-typedef struct _CRYPTBLOCK
+/* Remove a key from the list of keys being rekeyed to, if it is there */
+static void UnregisterRekeyKey(LPCODECKEY pKey)
 {
-  Pager    *pPager;       /* Pager this cryptblock belongs to */
-  HCRYPTKEY hReadKey;     /* Key used to read from the database and write to the journal */
-  HCRYPTKEY hWriteKey;    /* Key used to write to the database */
-  DWORD     dwPageSize;   /* Size of pages */
-  LPVOID    pvCrypt;      /* A buffer for encrypting/decrypting (if necessary) */
-  DWORD     dwCryptSize;  /* Equal to or greater than dwPageSize.  If larger, pvCrypt is valid and this is its size */
-} CRYPTBLOCK, *LPCRYPTBLOCK;
+  MUTEX_LOGIC( sqlite3_mutex *pMaster; )
+  LPCODECKEY *ppKey;
 
-HCRYPTPROV g_hProvider = 0; /* Global instance of the cryptographic provider */
+  /* A registered key keeps the list from being empty, so closing connections
+  ** does not need the master mutex while no rekey is going on.
+  */
+  if (!g_pRekeyKeys) return;
 
-#define SQLITECRYPTERROR_PROVIDER "Cryptographic provider not available"
+  MUTEX_LOGIC( pMaster = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER); )
+  sqlite3_mutex_enter(pMaster);
+  for (ppKey = &g_pRekeyKeys; *ppKey; ppKey = &(*ppKey)->pNext)
+  {
+    if (*ppKey == pKey)
+    {
+      *ppKey = pKey->pNext;
+      break;
+    }
+  }
+  sqlite3_mutex_leave(pMaster);
+}
 
-/* Needed for re-keying */
-static void * sqlite3pager_get_codecarg(Pager *pPager)
+/* Destroy a key, wiping the password and the round keys it holds */
+static void DestroyKey(LPCODECKEY pKey)
 {
-  return (pPager->xCodec) ? pPager->pCodec: NULL;
+  if (!pKey) return;
+
+  UnregisterRekeyKey(pKey);
+
+  if (pKey->hLegacyKey)
+    CryptDestroyKey(pKey->hLegacyKey);
+
+  if (pKey->pPassword)
+  {
+    ZeroMemory(pKey->pPassword, pKey->nPassword);
+    sqlite3_free(pKey->pPassword);
+  }
+
+  ZeroMemory(pKey, sizeof(CODECKEY));
+  sqlite3_free(pKey);
 }
 
-void sqlite3_activate_see(const char *info)
+/* Make a copy of a key, for use by another connection */
+static LPCODECKEY DuplicateKey(LPCODECKEY pKey)
+{
+  LPCODECKEY pNew = sqlite3_malloc(sizeof(CODECKEY));
+  if (!pNew) return NULL;
+
+  CopyMemory(pNew, pKey, sizeof(CODECKEY));
+  pNew->hLegacyKey = 0;
+  pNew->pNext = NULL;
+
+  pNew->pPassword = sqlite3_malloc(pKey->nPassword);
+  if (!pNew->pPassword)
+  {
+    ZeroMemory(pNew, sizeof(CODECKEY));
+    sqlite3_free(pNew);
+    return NULL;
+  }
+  CopyMemory(pNew->pPassword, pKey->pPassword, pKey->nPassword);
+
+  if (pKey->hLegacyKey)
+    CryptDuplicateKey(pKey->hLegacyKey, NULL, 0, &pNew->hLegacyKey);
+
+  return pNew;
+}
+
+/* Returns a value that tells whether a key is the one a rekey record was made
+** for without revealing anything about the key.  This is an encrypted block of
+** zeros of a page that does not exist.
+*/
+static unsigned int CodecKeyCheck(LPCODECKEY pKey)
 {
+  unsigned char block[CODEC_AES_BLOCK_SIZE];
+
+  ZeroMemory(block, sizeof(block));
+  AesXts(pKey, 0, 0, block, block, 1, FALSE);
+  return AES_LOAD32(block);
 }
 
-/* Create a cryptographic context.  Use the enhanced provider because it is available on
-** most platforms
+/* Returns non-zero if the key is the new key of the specified rekey record */
+static BOOL IsRekeyKey(LPCODECKEY pKey, const unsigned char *pRecord)
+{
+  return pKey && pKey->nFormat == CODEC_FORMAT_AES && pKey->bDerived &&
+         pKey->nIterations == (int)AES_LOAD32(pRecord + 11) &&
+         CodecKeyCheck(pKey) == AES_LOAD32(pRecord + 7);
+}
+
+/* Returns a copy of the key another connection in this process is rekeying a
+** database to, if there is one for the specified rekey record
 */
-static BOOL InitializeProvider()
+static LPCODECKEY FindRekeyKey(const unsigned char *pRecord)
+{
+  MUTEX_LOGIC( sqlite3_mutex *pMaster = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER); )
+  LPCODECKEY pKey;
+  LPCODECKEY pFound = NULL;
+
+  sqlite3_mutex_enter(pMaster);
+  for (pKey = g_pRekeyKeys; pKey; pKey = pKey->pNext)
+  {
+    if (IsRekeyKey(pKey, pRecord))
+    {
+      pFound = DuplicateKey(pKey);
+      break;
+    }
+  }
+  sqlite3_mutex_leave(pMaster);
+
+  return pFound;
+}
+
+static void RegisterRekeyKey(LPCODECKEY pKey)
 {
   MUTEX_LOGIC( sqlite3_mutex *pMaster = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER); )
+
   sqlite3_mutex_enter(pMaster);
+  pKey->pNext = g_pRekeyKeys;
+  g_pRekeyKeys = pKey;
+  sqlite3_mutex_leave(pMaster);
+}
+
+/* Write the rekey record into page 1, or clear it if nRekeyPage is zero */
+static void WriteRekeyRecord(LPCODECKEY pNewKey, unsigned char *pPage1, Pgno nRekeyPage)
+{
+  unsigned char *pRecord = pPage1 + CODEC_REKEY_OFFSET;
 
-  if (g_hProvider)
+  ZeroMemory(pRecord, CODEC_REKEY_SIZE);
+  if (!nRekeyPage) return;
+
+  CopyMemory(pRecord, codecRekeyMagic, sizeof(codecRekeyMagic));
+  pRecord[2] = (unsigned char)(pNewKey ? CODEC_FORMAT_AES : CODEC_FORMAT_UNKNOWN);
+  AES_STORE32(pRecord + 3, nRekeyPage);
+
+  if (pNewKey)
   {
-    sqlite3_mutex_leave(pMaster);
-    return TRUE;
+    AES_STORE32(pRecord + 7, CodecKeyCheck(pNewKey));
+    AES_STORE32(pRecord + 11, (unsigned int)pNewKey->nIterations);
   }
+}
+
+/* Called with the encrypted page 1, before it is decrypted.  If another
+** connection finished rekeying the database to the key this connection got
+** from it, the new key becomes the only key.
+*/
+static void PromoteRekeyKey(LPCRYPTBLOCK pBlock, const unsigned char *pPage1)
+{
+  LPCODECKEY pKey = pBlock->pWriteKey;
 
-  if (!CryptAcquireContext(&g_hProvider, NULL, MS_ENHANCED_PROV, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
+  if (pBlock->bRekeying || pKey == pBlock->pReadKey) return;
+
+  if (pKey)
   {
-    sqlite3_mutex_leave(pMaster);
-    return FALSE;
+    if (pKey->nFormat != CODEC_FORMAT_AES) return;
+    if (memcmp(pPage1, codecMagic, CODEC_MAGIC_SIZE) != 0) return;
+    if (AES_LOAD32(pPage1 + CODEC_ITERATIONS_OFFSET) != (unsigned int)pKey->nIterations) return;
+    if (memcmp(pPage1 + CODEC_SALT_OFFSET, pKey->salt, CODEC_SALT_SIZE) != 0) return;
+  }
+  else if (memcmp(pPage1, codecSqliteHeader, sizeof(codecSqliteHeader)) != 0)
+  {
+    return;
   }
 
-  sqlite3_mutex_leave(pMaster);
-  return TRUE;
+  DestroyKey(pBlock->pReadKey);
+  pBlock->pReadKey = pKey;
+  pBlock->nRekeyPage = 0;
+  pBlock->nRekeyLimit = 0;
+}
+
+/* Called with the decrypted page 1 to pick up the progress of a rekey.  The
+** pages already rewritten by an interrupted rekey cannot be used until the rekey
+** is resumed, unless another connection in this process is doing that.  Such a
+** rekey is said to be pending and the database cannot be used at all, see
+** sqlite3Codec().
+*/
+static void LoadRekeyRecord(LPCRYPTBLOCK pBlock, const unsigned char *pPage1)
+{
+  const unsigned char *pRecord = pPage1 + CODEC_REKEY_OFFSET;
+  LPCODECKEY pKey;
+
+  if (memcmp(pRecord, codecRekeyMagic, sizeof(codecRekeyMagic)) != 0)
+  {
+    pBlock->nRekeyPage = 0;
+    pBlock->bRekeyPending = FALSE;
+    if (pBlock->bRekeying) return;
+
+    /* Any rekey this connection knew about never happened */
+    pBlock->nRekeyLimit = 0;
+    if (pBlock->pWriteKey != pBlock->pReadKey)
+    {
+      DestroyKey(pBlock->pWriteKey);
+      pBlock->pWriteKey = pBlock->pReadKey;
+    }
+    return;
+  }
+
+  pBlock->nRekeyPage = AES_LOAD32(pRecord + 3);
+  if (pBlock->bRekeying) return;
+
+  pBlock->nRekeyLimit = pBlock->nRekeyPage;
+  pBlock->bRekeyPending = FALSE;
+
+  if (pRecord[2] == CODEC_FORMAT_UNKNOWN) /* The database is being decrypted */
+  {
+    if (pBlock->pWriteKey != pBlock->pReadKey)
+      DestroyKey(pBlock->pWriteKey);
+    pBlock->pWriteKey = NULL;
+    return;
+  }
+
+  if (pBlock->pWriteKey != pBlock->pReadKey && IsRekeyKey(pBlock->pWriteKey, pRecord))
+    return;
+
+  pKey = FindRekeyKey(pRecord);
+  if (!pKey)
+  {
+    pBlock->bRekeyPending = TRUE;
+    return;
+  }
+
+  if (pBlock->pWriteKey != pBlock->pReadKey)
+    DestroyKey(pBlock->pWriteKey);
+  pBlock->pWriteKey = pKey;
+}
+
+/* Returns the key a page is currently stored with */
+static LPCODECKEY StoredKey(LPCRYPTBLOCK pBlock, Pgno nPageNum)
+{
+  if (nPageNum != 1 && nPageNum < pBlock->nRekeyPage)
+    return pBlock->pWriteKey;
+
+  return pBlock->pReadKey;
+}
+
+/* Returns the key a page is to be written with */
+static LPCODECKEY TargetKey(LPCRYPTBLOCK pBlock, Pgno nPageNum)
+{
+  if (nPageNum < pBlock->nRekeyLimit && (nPageNum != 1 || pBlock->nRekeyLimit == CODEC_REKEY_ALL))
+    return pBlock->pWriteKey;
+
+  return pBlock->pReadKey;
 }
 
 /* Create or update a cryptographic context for a pager.
@@ -67,7 +1584,7 @@ static BOOL InitializeProvider()
 ** extra padding, and if it does, will create a temp buffer big enough to provide
 ** space to hold it.
 */
-static LPCRYPTBLOCK CreateCryptBlock(HCRYPTKEY hKey, Pager *pager, int pageSize, LPCRYPTBLOCK pExisting)
+static LPCRYPTBLOCK CreateCryptBlock(LPCODECKEY pKey, Pager *pager, int pageSize, LPCRYPTBLOCK pExisting)
 {
   LPCRYPTBLOCK pBlock;
 
@@ -77,8 +1594,8 @@ static LPCRYPTBLOCK CreateCryptBlock(HCRYPTKEY hKey, Pager *pager, int pageSize,
     if (!pBlock) return NULL;
 
     ZeroMemory(pBlock, sizeof(CRYPTBLOCK));
-    pBlock->hReadKey = hKey;
-    pBlock->hWriteKey = hKey;
+    pBlock->pReadKey = pKey;
+    pBlock->pWriteKey = pKey;
   }
   else /* Updating an existing cryptblock */
   {
@@ -99,9 +1616,20 @@ static LPCRYPTBLOCK CreateCryptBlock(HCRYPTKEY hKey, Pager *pager, int pageSize,
     pBlock->pvCrypt = NULL;
   }
 
-  /* Figure out how big to make our spare crypt block */
-  CryptEncrypt(hKey, 0, TRUE, 0, NULL, &pBlock->dwCryptSize, pBlock->dwCryptSize * 2);
-  pBlock->pvCrypt = sqlite3_malloc(pBlock->dwCryptSize + (CRYPT_OFFSET * 2));
+  /* Figure out how big to make our spare crypt block.  The AES format never needs
+  ** padding, but the legacy cipher is asked just in case.
+  */
+  if (pKey && pKey->hLegacyKey)
+    CryptEncrypt(pKey->hLegacyKey, 0, TRUE, 0, NULL, &pBlock->dwCryptSize, pBlock->dwCryptSize * 2);
+
+  /* Length-preserving ciphers decrypt pages where they are and only need a page
+  ** sized buffer to encrypt into.  Others also need room for the padding.
+  */
+  if (pBlock->dwCryptSize == pBlock->dwPageSize)
+    pBlock->pvCrypt = sqlite3_malloc(pBlock->dwPageSize);
+  else
+    pBlock->pvCrypt = sqlite3_malloc(pBlock->dwCryptSize + (CRYPT_OFFSET * 2));
+
   if (!pBlock->pvCrypt)
   {
     /* We created a new block in here, so free it.  Otherwise leave the original intact */
@@ -111,6 +1639,10 @@ static LPCRYPTBLOCK CreateCryptBlock(HCRYPTKEY hKey, Pager *pager, int pageSize,
     return NULL;
   }
 
+  pBlock->pbOutput = (LPBYTE)pBlock->pvCrypt;
+  if (pBlock->dwCryptSize != pBlock->dwPageSize)
+    pBlock->pbOutput += CRYPT_OFFSET;
+
   return pBlock;
 }
 
@@ -119,15 +1651,15 @@ static void sqlite3CodecFree(LPVOID pv)
 {
   LPCRYPTBLOCK pBlock = (LPCRYPTBLOCK)pv;
   /* Destroy the read key if there is one */
-  if (pBlock->hReadKey)
+  if (pBlock->pReadKey)
   {
-    CryptDestroyKey(pBlock->hReadKey);
+    DestroyKey(pBlock->pReadKey);
   }
 
   /* If there's a writekey and its not equal to the readkey, destroy it */
-  if (pBlock->hWriteKey && pBlock->hWriteKey != pBlock->hReadKey)
+  if (pBlock->pWriteKey && pBlock->pWriteKey != pBlock->pReadKey)
   {
-    CryptDestroyKey(pBlock->hWriteKey);
+    DestroyKey(pBlock->pWriteKey);
   }
 
   /* If there's extra buffer space allocated, free it as well */
@@ -146,17 +1678,90 @@ void sqlite3CodecSizeChange(void *pArg, int pageSize, int reservedSize)
 
   if (pBlock->dwPageSize != pageSize)
   {
-    CreateCryptBlock(pBlock->hReadKey, pBlock->pPager, pageSize, pBlock);
+    CreateCryptBlock(pBlock->pReadKey, pBlock->pPager, pageSize, pBlock);
     /* If this fails, pvCrypt will be NULL, and the next time sqlite3Codec() is called, it will result in an error */
   }
 }
 
+/* Encrypt a page with the specified key into the output buffer and return a
+** pointer to it.  The page itself must not be modified because the pager keeps
+** using it.  The AES format reads the page and writes the output buffer in a single
+** pass.  The legacy cipher only works in place, so it still needs a copy.
+*/
+static void * EncryptPage(LPCRYPTBLOCK pBlock, LPCODECKEY pKey, void *data, Pgno nPageNum)
+{
+  LPBYTE pOut = pBlock->pbOutput;
+  DWORD dwPageSize;
+
+  if (pKey->nFormat == CODEC_FORMAT_UNKNOWN)
+    CodecInitAesKey(pKey);
+
+  if (pKey->nFormat == CODEC_FORMAT_AES)
+  {
+    CodecEncryptAes(pKey, nPageNum, (const unsigned char *)data, pOut, pBlock->dwPageSize);
+    return pOut;
+  }
+
+  if (!pKey->hLegacyKey)
+    DeriveLegacyKey(pKey);
+
+  CopyMemory(pOut, data, pBlock->dwPageSize);
+
+  dwPageSize = pBlock->dwPageSize;
+  CryptEncrypt(pKey->hLegacyKey, 0, TRUE, 0, pOut, &dwPageSize, pBlock->dwCryptSize);
+  return pOut;
+}
+
+/* Decrypt a page with the specified key and return a pointer to it */
+static void * DecryptPage(LPCRYPTBLOCK pBlock, LPCODECKEY pKey, void *data, Pgno nPageNum)
+{
+  DWORD dwPageSize;
+  LPVOID pvTemp = NULL;
+
+  /* The AES format never needs padding, so decrypt the page where it is */
+  if (pKey->nFormat == CODEC_FORMAT_AES)
+  {
+    CodecDecryptAes(pKey, nPageNum, (unsigned char *)data, pBlock->dwPageSize);
+    return data;
+  }
+
+  if (!pKey->hLegacyKey)
+    DeriveLegacyKey(pKey);
+
+  /* Block ciphers often need to write extra padding beyond the
+  data block.  We don't have that luxury for a given page of data so
+  we must copy the page data to a buffer that IS large enough to hold
+  the padding.  We then encrypt the block and write the buffer back to
+  the page without the unnecessary padding.
+  We only use the special block of memory if its absolutely necessary. */
+  if (pBlock->dwCryptSize != pBlock->dwPageSize)
+  {
+    CopyMemory(pBlock->pbOutput, data, pBlock->dwPageSize);
+    pvTemp = data;
+    data = pBlock->pbOutput;
+  }
+
+  dwPageSize = pBlock->dwCryptSize;
+  CryptDecrypt(pKey->hLegacyKey, 0, TRUE, 0, (LPBYTE)data, &dwPageSize);
+
+  /* If the encryption algorithm required extra padding and we were forced to encrypt or
+  ** decrypt a copy of the page data to a temp buffer, then write the contents of the temp
+  ** buffer back to the page data minus any padding applied.
+  */
+  if (pBlock->dwCryptSize != pBlock->dwPageSize)
+  {
+    CopyMemory(pvTemp, data, pBlock->dwPageSize);
+    data = pvTemp;
+  }
+
+  return data;
+}
+
 /* Encrypt/Decrypt functionality, called by pager.c */
 void * sqlite3Codec(void *pArg, void *data, Pgno nPageNum, int nMode)
 {
   LPCRYPTBLOCK pBlock = (LPCRYPTBLOCK)pArg;
-  DWORD dwPageSize;
-  LPVOID pvTemp = NULL;
+  LPCODECKEY pKey;
 
   if (!pBlock) return data;
   if (pBlock->pvCrypt == NULL) return NULL; /* This only happens if CreateCryptBlock() failed to make scratch space */
@@ -166,42 +1771,47 @@ void * sqlite3Codec(void *pArg, void *data, Pgno nPageNum, int nMode)
   case 0: /* Undo a "case 7" journal file encryption */
   case 2: /* Reload a page */
   case 3: /* Load a page */
-    if (!pBlock->hReadKey) break;
-
-    /* Block ciphers often need to write extra padding beyond the
-    data block.  We don't have that luxury for a given page of data so
-    we must copy the page data to a buffer that IS large enough to hold
-    the padding.  We then encrypt the block and write the buffer back to
-    the page without the unnecessary padding.
-    We only use the special block of memory if its absolutely necessary. */
-    if (pBlock->dwCryptSize != pBlock->dwPageSize)
+    /* The format of the database and the progress of any rekey are determined
+    ** by page 1, which is always the first page read.
+    */
+    if (nPageNum == 1)
     {
-      CopyMemory(((LPBYTE)pBlock->pvCrypt) + CRYPT_OFFSET, data, pBlock->dwPageSize);
-      pvTemp = data;
-      data = ((LPBYTE)pBlock->pvCrypt) + CRYPT_OFFSET;
-    }
+      PromoteRekeyKey(pBlock, (const unsigned char *)data);
 
-    dwPageSize = pBlock->dwCryptSize;
-    CryptDecrypt(pBlock->hReadKey, 0, TRUE, 0, (LPBYTE)data, &dwPageSize);
+      if (pBlock->pReadKey)
+      {
+        CodecDetectFormat(pBlock->pReadKey, (const unsigned char *)data);
+        data = DecryptPage(pBlock, pBlock->pReadKey, data, nPageNum);
+      }
 
-    /* If the encryption algorithm required extra padding and we were forced to encrypt or
-    ** decrypt a copy of the page data to a temp buffer, then write the contents of the temp
-    ** buffer back to the page data minus any padding applied.
-    */
-    if (pBlock->dwCryptSize != pBlock->dwPageSize)
-    {
-      CopyMemory(pvTemp, data, pBlock->dwPageSize);
-      data = pvTemp;
+      LoadRekeyRecord(pBlock, (const unsigned char *)data);
+
+      /* While a rekey is pending, no page can be trusted to be readable and no
+      ** page may be written, so page 1 is left without the SQLite header.  The
+      ** database then fails to open with SQLITE_NOTADB, which tells the caller
+      ** what is wrong, rather than with an error on whichever page comes next.
+      ** The pager reloads page 1 once the database changes.
+      */
+      if (pBlock->bRekeyPending && !pBlock->bRekeyResume)
+        CopyMemory(data, codecMagic, CODEC_MAGIC_SIZE);
+      break;
     }
+
+    if (pBlock->bRekeyPending && nPageNum < pBlock->nRekeyPage) return NULL;
+
+    pKey = StoredKey(pBlock, nPageNum);
+    if (!pKey) break;
+    if (pKey->nFormat == CODEC_FORMAT_UNKNOWN) return NULL;
+
+    data = DecryptPage(pBlock, pKey, data, nPageNum);
     break;
   case 6: /* Encrypt a page for the main database file */
-    if (!pBlock->hWriteKey) break;
+    if (pBlock->bRekeyPending) return NULL;
 
-    CopyMemory(((LPBYTE)pBlock->pvCrypt) + CRYPT_OFFSET, data, pBlock->dwPageSize);
-    data = ((LPBYTE)pBlock->pvCrypt) + CRYPT_OFFSET;
+    pKey = TargetKey(pBlock, nPageNum);
+    if (!pKey) break;
 
-    dwPageSize = pBlock->dwPageSize;
-    CryptEncrypt(pBlock->hWriteKey, 0, TRUE, 0, ((LPBYTE)pBlock->pvCrypt) + CRYPT_OFFSET, &dwPageSize, pBlock->dwCryptSize);
+    data = EncryptPage(pBlock, pKey, data, nPageNum);
     break;
   case 7: /* Encrypt a page for the journal file */
     /* Under normal circumstances, the readkey is the same as the writekey.  However,
@@ -209,59 +1819,59 @@ void * sqlite3Codec(void *pArg, void *data, Pgno nPageNum, int nMode)
     The rollback journal must be written using the original key for the
     database file because it is, by nature, a rollback journal.
     Therefore, for case 7, when the rollback is being written, always encrypt using
-    the database's readkey, which is guaranteed to be the same key that was used to
-    read the original data.
+    the key the page is currently stored with, which is guaranteed to be the same
+    key that was used to read the original data.
     */
-    if (!pBlock->hReadKey) break;
+    if (pBlock->bRekeyPending) return NULL;
 
-    CopyMemory(((LPBYTE)pBlock->pvCrypt) + CRYPT_OFFSET, data, pBlock->dwPageSize);
-    data = ((LPBYTE)pBlock->pvCrypt) + CRYPT_OFFSET;
+    pKey = StoredKey(pBlock, nPageNum);
+    if (!pKey) break;
 
-    dwPageSize = pBlock->dwPageSize;
-    CryptEncrypt(pBlock->hReadKey, 0, TRUE, 0, ((LPBYTE)pBlock->pvCrypt) + CRYPT_OFFSET, &dwPageSize, pBlock->dwCryptSize);
+    data = EncryptPage(pBlock, pKey, data, nPageNum);
     break;
   }
 
   return data;
 }
 
-/* Derive an encryption key from a user-supplied buffer */
-static HCRYPTKEY DeriveKey(const void *pKey, int nKey)
+/* Derive an encryption key from a user-supplied buffer.  The AES key cannot be
+** derived until the salt is known, so the password is kept in the key until
+** then.
+*/
+static int DeriveKey(const void *pKey, int nKey, LPCODECKEY *ppKey)
 {
-  HCRYPTHASH hHash = 0;
-  HCRYPTKEY  hKey;
+  LPCODECKEY pNew;
 
-  if (!pKey || !nKey) return 0;
+  *ppKey = NULL;
+  if (!pKey || !nKey) return SQLITE_OK;
 
   if (!InitializeProvider())
   {
-    return MAXDWORD;
+    return SQLITE_ERROR;
   }
 
-  {
-    MUTEX_LOGIC( sqlite3_mutex *pMaster = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER); )
-    sqlite3_mutex_enter(pMaster);
-
-    if (CryptCreateHash(g_hProvider, CALG_SHA1, 0, 0, &hHash))
-    {
-      if (CryptHashData(hHash, (LPBYTE)pKey, nKey, 0))
-      {
-        CryptDeriveKey(g_hProvider, CALG_RC4, hHash, 0, &hKey);
-      }
-      CryptDestroyHash(hHash);
-    }
+  pNew = sqlite3_malloc(sizeof(CODECKEY));
+  if (!pNew) return SQLITE_NOMEM;
+  ZeroMemory(pNew, sizeof(CODECKEY));
 
-    sqlite3_mutex_leave(pMaster);
+  pNew->pPassword = sqlite3_malloc(nKey);
+  if (!pNew->pPassword)
+  {
+    sqlite3_free(pNew);
+    return SQLITE_NOMEM;
   }
+  CopyMemory(pNew->pPassword, pKey, nKey);
+  pNew->nPassword = nKey;
 
-  return hKey;
+  *ppKey = pNew;
+  return SQLITE_OK;
 }
 
 /* Called by sqlite and sqlite3_key_interop to attach a key to a database. */
 int sqlite3CodecAttach(sqlite3 *db, int nDb, const void *pKey, int nKeyLen)
 {
   int rc = SQLITE_ERROR;
-  HCRYPTKEY hKey = 0;
+  LPCODECKEY pNewKey = NULL;
 
   /* No key specified, could mean either use the main db's encryption or no encryption */
   if (!pKey || !nKeyLen)
@@ -272,35 +1882,38 @@ int sqlite3CodecAttach(sqlite3 *db, int nDb, const void *pKey, int nKeyLen)
     }
     else /* Attached database, use the main database's key */
     {
-      /* Get the encryption block for the main database and attempt to duplicate the key
-      ** for use by the attached database
+      /* Get the encryption block for the main database and derive a new key from
+      ** its password for use by the attached database, which has its own salt
       */
       Pager *p = sqlite3BtreePager(db->aDb[0].pBt);
       LPCRYPTBLOCK pBlock = (LPCRYPTBLOCK)sqlite3pager_get_codecarg(p);
 
       if (!pBlock) return SQLITE_OK; /* Main database is not encrypted so neither will be any attached database */
-      if (!pBlock->hReadKey) return SQLITE_OK; /* Not encrypted */
+      if (!pBlock->pReadKey) return SQLITE_OK; /* Not encrypted */
 
-      if (!CryptDuplicateKey(pBlock->hReadKey, NULL, 0, &hKey))
-        return rc; /* Unable to duplicate the key */
+      pKey = pBlock->pReadKey->pPassword;
+      nKeyLen = pBlock->pReadKey->nPassword;
     }
   }
-  else /* User-supplied passphrase, so create a cryptographic key out of it */
+
+  rc = DeriveKey(pKey, nKeyLen, &pNewKey);
+  if (rc == SQLITE_ERROR)
   {
-    hKey = DeriveKey(pKey, nKeyLen);
-    if (hKey == MAXDWORD)
-    {
-      sqlite3Error(db, rc, SQLITECRYPTERROR_PROVIDER);
-      return rc;
-    }
+    sqlite3Error(db, rc, SQLITECRYPTERROR_PROVIDER);
+    return rc;
   }
+  if (rc) return rc;
 
   /* Create a new encryption block and assign the codec to the new attached database */
-  if (hKey)
+  if (pNewKey)
   {
     Pager *p = sqlite3BtreePager(db->aDb[nDb].pBt);
-    LPCRYPTBLOCK pBlock = CreateCryptBlock(hKey, p, -1, NULL);
-    if (!pBlock) return SQLITE_NOMEM;
+    LPCRYPTBLOCK pBlock = CreateCryptBlock(pNewKey, p, -1, NULL);
+    if (!pBlock)
+    {
+      DestroyKey(pNewKey);
+      return SQLITE_NOMEM;
+    }
 
     sqlite3PagerSetCodec(p, sqlite3Codec, sqlite3CodecSizeChange, sqlite3CodecFree, pBlock);
 
@@ -309,7 +1922,7 @@ int sqlite3CodecAttach(sqlite3 *db, int nDb, const void *pKey, int nKeyLen)
   return rc;
 }
 
-/* Once a password has been supplied and a key created, we don't keep the
+/* Once a password has been supplied and a key created, we don't hand out the
 ** original password for security purposes.  Therefore return NULL.
 */
 void sqlite3CodecGetKey(sqlite3 *db, int nDb, void **ppKey, int *pnKeyLen)
@@ -333,58 +1946,177 @@ SQLITE_API int sqlite3_key(sqlite3 *db, const void *pKey, int nKey)
   return sqlite3_key_v2(db, 0, pKey, nKey);
 }
 
-/* Changes the encryption key for an existing database. */
-SQLITE_API int sqlite3_rekey_v2(sqlite3 *db, const char *zDbName, const void *pKey, int nKey)
+/* Changes the encryption key for an existing database.  The new key always uses
+** the current format, so this also converts databases in the legacy format.
+**
+** When nBatch is positive, the pages are rewritten nBatch at a time, each batch
+** in its own transaction, so other connections are only ever blocked for one
+** batch.  The progress is recorded in page 1 after each batch and the optional
+** progress callback is invoked, which may stop the rekey by returning non-zero,
+** in which case SQLITE_INTERRUPT is returned.  A rekey that was stopped or
+** interrupted continues where it left off the next time the database is rekeyed
+** using the same key.
+**
+** Only connections in this process can use the database between two batches,
+** because only they can find the new key, see FindRekeyKey().  Connections in
+** other processes get SQLITE_NOTADB until the rekey is finished.  Connections
+** without a key would see nothing wrong with the rewritten pages of a database
+** that was not encrypted, so such a database cannot be rekeyed in batches.  Nor
+** can a database in the legacy format, which has no salt to derive the salt of
+** the new key from.
+*/
+static int RekeyDatabase(sqlite3 *db, const void *pKey, int nKey, int nBatch, SQLITEREKEYPROGRESS xProgress, void *pArg)
 {
   Btree *pbt = db->aDb[0].pBt;
   Pager *p = sqlite3BtreePager(pbt);
   LPCRYPTBLOCK pBlock = (LPCRYPTBLOCK)sqlite3pager_get_codecarg(p);
-  HCRYPTKEY hKey = DeriveKey(pKey, nKey);
-  int rc = SQLITE_ERROR;
-
-  if (hKey == MAXDWORD)
+  LPCODECKEY pNewKey = NULL;
+  unsigned char record[CODEC_REKEY_SIZE];
+  Pgno nStart = CODEC_REKEY_FIRST;
+  Pgno nSkip = PAGER_MJ_PGNO(p);
+  DbPage *pPage;
+  int count;
+  int rc = DeriveKey(pKey, nKey, &pNewKey);
+
+  if (rc == SQLITE_ERROR)
   {
     sqlite3Error(db, rc, SQLITECRYPTERROR_PROVIDER);
     return rc;
   }
+  if (rc) return rc;
+
+  if (!pBlock && !pNewKey) return SQLITE_OK; /* Wasn't encrypted to begin with */
+
+  if (nBatch > 0 && (!pBlock || !pBlock->pReadKey))
+  {
+    DestroyKey(pNewKey);
+    sqlite3Error(db, SQLITE_ERROR, SQLITECRYPTERROR_BATCH);
+    return SQLITE_ERROR;
+  }
+
+  sqlite3_mutex_enter(db->mutex);
+
+  /* Look for the record of an interrupted rekey in page 1.  A pending rekey
+  ** keeps page 1 from being read, so the copy of it read that way is dropped
+  ** first.
+  */
+  ZeroMemory(record, sizeof(record));
+  if (pBlock)
+  {
+    if (pBlock->bRekeyPending && sqlite3PagerRefcount(p) == 0)
+      sqlite3PagerClearCache(p);
+    pBlock->bRekeyResume = TRUE;
+  }
+  rc = sqlite3BtreeBeginTrans(pbt, 0);
+  if (!rc)
+  {
+    sqlite3PagerPagecount(p, &count);
+    if (count > 0 && !(rc = sqlite3PagerGet(p, 1, &pPage)))
+    {
+      CopyMemory(record, ((LPBYTE)sqlite3PagerGetData(pPage)) + CODEC_REKEY_OFFSET, CODEC_REKEY_SIZE);
+      sqlite3PagerUnref(pPage);
+    }
+    sqlite3BtreeCommit(pbt);
+  }
+
+  if (!rc && memcmp(record, codecRekeyMagic, sizeof(codecRekeyMagic)) == 0)
+  {
+    /* Resume using the same salt, after making sure the key is the same */
+    if (pNewKey && record[2] == CODEC_FORMAT_AES && CODEC_KDF_VALID(AES_LOAD32(record + 11)) &&
+        pBlock && pBlock->pReadKey && pBlock->pReadKey->nFormat == CODEC_FORMAT_AES)
+    {
+      CodecInitRekeyKey(pNewKey, pBlock->pReadKey, (int)AES_LOAD32(record + 11));
+    }
+
+    if (pNewKey ? !IsRekeyKey(pNewKey, record) : record[2] != CODEC_FORMAT_UNKNOWN)
+    {
+      sqlite3Error(db, SQLITE_ERROR, SQLITECRYPTERROR_RESUME);
+      rc = SQLITE_ERROR;
+    }
+
+    nStart = AES_LOAD32(record + 3);
+  }
+  else if (!rc && pNewKey)
+  {
+    if (nBatch <= 0 || pBlock->pReadKey->nFormat == CODEC_FORMAT_UNKNOWN)
+    {
+      CodecInitAesKey(pNewKey);
+    }
+    else if (pBlock->pReadKey->nFormat == CODEC_FORMAT_AES)
+    {
+      CodecInitRekeyKey(pNewKey, pBlock->pReadKey, CODEC_KDF_ITERATIONS);
+    }
+    else
+    {
+      sqlite3Error(db, SQLITE_ERROR, SQLITECRYPTERROR_LEGACY);
+      rc = SQLITE_ERROR;
+    }
+  }
 
-  if (!pBlock && !hKey) return SQLITE_OK; /* Wasn't encrypted to begin with */
+  if (rc)
+  {
+    /* The copy of page 1 just read must not be used while the rekey stays pending */
+    if (pBlock)
+    {
+      pBlock->bRekeyResume = FALSE;
+      if (pBlock->bRekeyPending && sqlite3PagerRefcount(p) == 0)
+        sqlite3PagerClearCache(p);
+    }
+    DestroyKey(pNewKey);
+    sqlite3_mutex_leave(db->mutex);
+    return rc;
+  }
 
   /* To rekey a database, we change the writekey for the pager.  The readkey remains
   ** the same
   */
   if (!pBlock) /* Encrypt an unencrypted database */
   {
-    pBlock = CreateCryptBlock(hKey, p, -1, NULL);
+    pBlock = CreateCryptBlock(pNewKey, p, -1, NULL);
     if (!pBlock)
+    {
+      DestroyKey(pNewKey);
+      sqlite3_mutex_leave(db->mutex);
       return SQLITE_NOMEM;
+    }
 
-    pBlock->hReadKey = 0; /* Original database is not encrypted */
+    pBlock->pReadKey = NULL; /* Original database is not encrypted */
     sqlite3PagerSetCodec(sqlite3BtreePager(pbt), sqlite3Codec, sqlite3CodecSizeChange, sqlite3CodecFree, pBlock);
   }
   else /* Change the writekey for an already-encrypted database */
   {
-    pBlock->hWriteKey = hKey;
+    if (pBlock->pWriteKey != pBlock->pReadKey)
+      DestroyKey(pBlock->pWriteKey);
+    pBlock->pWriteKey = pNewKey;
   }
 
-  sqlite3_mutex_enter(db->mutex);
+  pBlock->bRekeying = TRUE;
+  pBlock->bRekeyPending = FALSE;
+  pBlock->bRekeyResume = FALSE;
+  pBlock->nRekeyPage = nStart;
+  pBlock->nRekeyLimit = nStart;
 
-  /* Start a transaction */
-  rc = sqlite3BtreeBeginTrans(pbt, 1);
+  if (pNewKey) RegisterRekeyKey(pNewKey);
 
-  if (!rc)
+  for (;;)
   {
-    /* Rewrite all the pages in the database using the new encryption key */
     Pgno nPage;
-    Pgno nSkip = PAGER_MJ_PGNO(p);
-    DbPage *pPage;
+    Pgno nEnd;
     Pgno n;
-    int count;
+    BOOL bLast;
+
+    /* Start a transaction */
+    rc = sqlite3BtreeBeginTrans(pbt, 1);
+    if (rc) break;
 
     sqlite3PagerPagecount(p, &count);
     nPage = (Pgno)count;
+    bLast = (nBatch <= 0 || nStart + (Pgno)nBatch > nPage);
+    nEnd = bLast ? nPage + 1 : nStart + (Pgno)nBatch;
+    pBlock->nRekeyLimit = bLast ? CODEC_REKEY_ALL : nEnd;
 
-    for(n = 1; n <= nPage; n ++)
+    /* Rewrite the pages of this batch using the new encryption key */
+    for(n = nStart; !rc && n < nEnd; n ++)
     {
       if (n == nSkip) continue;
       rc = sqlite3PagerGet(p, n, &pPage);
@@ -394,47 +2126,87 @@ SQLITE_API int sqlite3_rekey_v2(sqlite3 *db, const char *zDbName, const void *pK
         sqlite3PagerUnref(pPage);
       }
     }
-  }
 
-  /* If we succeeded, try and commit the transaction */
-  if (!rc)
-  {
-    rc = sqlite3BtreeCommit(pbt);
-  }
+    /* Record the progress in page 1, which is rewritten using the new key by the
+    ** last batch only
+    */
+    if (!rc && nPage > 0)
+    {
+      rc = sqlite3PagerGet(p, 1, &pPage);
+      if (!rc)
+      {
+        rc = sqlite3PagerWrite(pPage);
+        if (!rc) WriteRekeyRecord(pNewKey, (unsigned char *)sqlite3PagerGetData(pPage), bLast ? 0 : nEnd);
+        sqlite3PagerUnref(pPage);
+      }
+    }
 
-  // If we failed, rollback */
-  if (rc)
-  {
-    sqlite3BtreeRollback(pbt, SQLITE_OK);
+    /* If we succeeded, try and commit the transaction */
+    if (!rc)
+    {
+      rc = sqlite3BtreeCommit(pbt);
+    }
+
+    // If we failed, rollback */
+    if (rc)
+    {
+      sqlite3BtreeRollback(pbt, SQLITE_OK);
+      pBlock->nRekeyLimit = pBlock->nRekeyPage;
+      break;
+    }
+
+    if (!bLast)
+    {
+      pBlock->nRekeyPage = nEnd;
+      pBlock->nRekeyLimit = nEnd;
+      nStart = nEnd;
+    }
+
+    if (xProgress && xProgress(pArg, (int)(nEnd - 1), (int)nPage) && !bLast)
+    {
+      rc = SQLITE_INTERRUPT;
+      sqlite3Error(db, rc, 0);
+      break;
+    }
+
+    if (bLast) break;
   }
 
+  pBlock->bRekeying = FALSE;
+
   /* If we succeeded, destroy any previous read key this database used
   ** and make the readkey equal to the writekey
   */
   if (!rc)
   {
-    if (pBlock->hReadKey)
+    UnregisterRekeyKey(pBlock->pWriteKey);
+    if (pBlock->pReadKey)
     {
-      CryptDestroyKey(pBlock->hReadKey);
+      DestroyKey(pBlock->pReadKey);
     }
-    pBlock->hReadKey = pBlock->hWriteKey;
+    pBlock->pReadKey = pBlock->pWriteKey;
+    pBlock->nRekeyPage = 0;
+    pBlock->nRekeyLimit = 0;
   }
-  /* We failed.  Destroy the new writekey (if there was one) and revert it back to
-  ** the original readkey
+  /* We failed before any batch was committed.  Destroy the new writekey (if there
+  ** was one) and revert it back to the original readkey.  Otherwise part of the
+  ** database uses the new key, so both keys are kept until the rekey is resumed.
   */
-  else
+  else if (pBlock->nRekeyPage <= CODEC_REKEY_FIRST)
   {
-    if (pBlock->hWriteKey)
+    if (pBlock->pWriteKey)
     {
-      CryptDestroyKey(pBlock->hWriteKey);
+      DestroyKey(pBlock->pWriteKey);
     }
-    pBlock->hWriteKey = pBlock->hReadKey;
+    pBlock->pWriteKey = pBlock->pReadKey;
+    pBlock->nRekeyPage = 0;
+    pBlock->nRekeyLimit = 0;
   }
 
   /* If the readkey and writekey are both empty, there's no need for a codec on this
   ** pager anymore.  Destroy the crypt block and remove the codec from the pager.
   */
-  if (!pBlock->hReadKey && !pBlock->hWriteKey)
+  if (!pBlock->pReadKey && !pBlock->pWriteKey)
   {
     sqlite3PagerSetCodec(p, NULL, NULL, NULL, NULL);
   }
@@ -444,6 +2216,11 @@ SQLITE_API int sqlite3_rekey_v2(sqlite3 *db, const char *zDbName, const void *pK
   return rc;
 }
 
+SQLITE_API int sqlite3_rekey_v2(sqlite3 *db, const char *zDbName, const void *pKey, int nKey)
+{
+  return RekeyDatabase(db, pKey, nKey, 0, NULL, NULL);
+}
+
 SQLITE_API int sqlite3_rekey(sqlite3 *db, const void *pKey, int nKey)
 {
   return sqlite3_rekey_v2(db, 0, pKey, nKey);
@@ -5,7 +5,13 @@
  * Released to the public domain, use at your own risk!
  ********************************************************/
 
+#ifndef SQLITE_API
+#if defined(_WIN32)
 #define SQLITE_API __declspec(dllexport)
+#else
+#define SQLITE_API __attribute__((visibility("default")))
+#endif
+#endif
 
 #include "../core/sqlite3.c"
 
@@ -13,6 +19,29 @@
 #include "../ext/vtshim.c"
 #endif
 
+#if defined(INTEROP_EXTENSION_FUNCTIONS) || \
+    defined(INTEROP_PERCENTILE_EXTENSION) || \
+    defined(INTEROP_TOTYPE_EXTENSION) || defined(INTEROP_REGEXP_EXTENSION)
+#define INTEROP_BUNDLED_FUNCTIONS
+#endif
+
+#if defined(INTEROP_BUNDLED_FUNCTIONS)
+/*
+** The bundled SQL functions are created via these wrappers, which skip the
+** functions the application has already created.  See below for details.
+*/
+static int sqlite3InteropCreateFunction(sqlite3 *, const char *, int, int,
+    void *, void (*)(sqlite3_context *, int, sqlite3_value **),
+    void (*)(sqlite3_context *, int, sqlite3_value **),
+    void (*)(sqlite3_context *));
+static int sqlite3InteropCreateFunctionV2(sqlite3 *, const char *, int, int,
+    void *, void (*)(sqlite3_context *, int, sqlite3_value **),
+    void (*)(sqlite3_context *, int, sqlite3_value **),
+    void (*)(sqlite3_context *), void (*)(void *));
+#define sqlite3_create_function sqlite3InteropCreateFunction
+#define sqlite3_create_function_v2 sqlite3InteropCreateFunctionV2
+#endif
+
 #if defined(INTEROP_PERCENTILE_EXTENSION)
 #include "../ext/percentile.c"
 #endif
@@ -30,11 +59,24 @@
 extern int RegisterExtensionFunctions(sqlite3 *db);
 #endif
 
-#ifdef SQLITE_OS_WIN
+#if defined(INTEROP_BUNDLED_FUNCTIONS)
+#undef sqlite3_create_function
+#undef sqlite3_create_function_v2
+#endif
+
 #if defined(INTEROP_CODEC)
 #include "crypt.c"
 #endif
 
+/*
+** The calling convention used by the exported functions is only meaningful on
+** Windows.  Elsewhere, the standard calling convention for the platform is
+** used.
+*/
+#ifndef WINAPI
+#define WINAPI
+#endif
+
 #include "interop.h"
 
 #define INTEROP_DEBUG_NONE           (0x0000)
@@ -69,7 +111,9 @@ SQLITE_PRIVATE void sqlite3InteropDebug(const char *zFormat, ...){
   acc.useMalloc = 0;
   sqlite3VXPrintf(&acc, 0, zFormat, ap);
   va_end(ap);
-#if SQLITE_VERSION_NUMBER >= 3007013
+#if !SQLITE_OS_WIN
+  fprintf(stderr, "%s", sqlite3StrAccumFinish(&acc));
+#elif SQLITE_VERSION_NUMBER >= 3007013
   sqlite3_win32_write_debug(sqlite3StrAccumFinish(&acc), -1);
 #elif defined(SQLITE_WIN32_HAS_ANSI)
   OutputDebugStringA(sqlite3StrAccumFinish(&acc));
@@ -95,6 +139,19 @@ SQLITE_PRIVATE void sqlite3InteropLogCallback(void *pArg, int iCode, const char
 }
 #endif
 
+/*
+** Returns the number of bytes used by a UTF-16 string, not including its
+** terminator.  This cannot use wcslen() because wchar_t is not 16 bits wide
+** on all platforms.
+*/
+SQLITE_PRIVATE int sqlite3InteropUtf16Bytes(const void *p){
+  const u16 *z = (const u16 *)p;
+  int n = 0;
+  if( !z ) return 0;
+  while( z[n] ) n++;
+  return n * sizeof(u16);
+}
+
 SQLITE_API int WINAPI sqlite3_malloc_size_interop(void *p){
   return sqlite3MallocSize(p);
 }
@@ -128,6 +185,792 @@ SQLITE_PRIVATE void sqlite3DbFree_interop(sqlite3 *db, void *p)
 }
 #endif
 
+#if SQLITE_OS_WIN
+# define interopAtomicCas(p, v, c)  InterlockedCompareExchange((p), (v), (c))
+# define interopAtomicIncrement(p)  InterlockedIncrement(p)
+# define interopAtomicAdd(p, n)     InterlockedExchangeAdd((p), (n))
+# define interopMemoryBarrier()     MemoryBarrier()
+typedef LONG interop_atomic_t;
+#else
+# define interopAtomicCas(p, v, c)  __sync_val_compare_and_swap((p), (c), (v))
+# define interopAtomicIncrement(p)  __sync_add_and_fetch((p), 1)
+# define interopAtomicAdd(p, n)     __sync_fetch_and_add((p), (n))
+# define interopMemoryBarrier()     __sync_synchronize()
+typedef int interop_atomic_t;
+#endif
+
+/*
+** The state kept by the interop assembly for a database connection, e.g. its
+** statement cache and busy handler, is found via a hash table of these records
+** keyed on the database connection.  The hash table has its own fast mutex, so
+** finding a record never takes the static master mutex, which is only used to
+** create that mutex once.  A record is created on demand and is only freed by
+** sqlite3_close_interop(), so that nothing it owns can leak when SQLite itself
+** forgets about it (e.g. when the busy handler is replaced by PRAGMA
+** busy_timeout).  The database connection mutex must always be acquired first
+** and must be held while the state in a record is being used.
+*/
+typedef struct InteropStmtCache InteropStmtCache;
+typedef struct InteropBusy InteropBusy;
+
+typedef struct InteropUserFunc InteropUserFunc;
+struct InteropUserFunc {
+  char *zName;                  /* Name of a function created by the application */
+  int nArg;                     /* Its number of arguments, -1 for any */
+  InteropUserFunc *pNext;       /* Next function in the list */
+};
+
+typedef struct InteropDb InteropDb;
+struct InteropDb {
+  sqlite3 *db;                  /* Database connection that owns the record */
+  InteropStmtCache *pCache;     /* Statement cache, if enabled */
+  InteropBusy *pBusy;           /* Busy handler, if it was ever installed */
+  int bFunctionsPending;        /* Bundled SQL functions not registered yet */
+  InteropUserFunc *pUserFunc;   /* Functions created while they were pending */
+  InteropDb *pHashNext;         /* Next record in the same hash bucket */
+};
+
+static sqlite3_mutex *volatile interopDbMutex = 0;
+static InteropDb **interopDbHash = 0;   /* Hash buckets, protected by interopDbMutex */
+static int interopDbHashSize = 0;       /* Number of buckets, a power of two */
+static int interopDbCount = 0;          /* Number of records, protected by interopDbMutex */
+
+/*
+** Returns the mutex that protects the hash table of records, creating it the
+** first time.  Returns zero only if it could not be created, in which case
+** SQLite is not thread-safe or out of memory; the next call tries again.
+*/
+SQLITE_PRIVATE sqlite3_mutex *sqlite3InteropDbMutex(void)
+{
+  sqlite3_mutex *mutex = interopDbMutex;
+
+  if (!mutex)
+  {
+    sqlite3_mutex *master = sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_MASTER);
+
+    sqlite3_mutex_enter(master);
+    mutex = interopDbMutex;
+    if (!mutex)
+    {
+      mutex = sqlite3MutexAlloc(SQLITE_MUTEX_FAST);
+      interopMemoryBarrier();
+      interopDbMutex = mutex;
+    }
+    sqlite3_mutex_leave(master);
+  }
+  else
+  {
+    interopMemoryBarrier();
+  }
+  return mutex;
+}
+
+SQLITE_PRIVATE unsigned int sqlite3InteropDbHash(sqlite3 *db)
+{
+  sqlite_uint64 h = (sqlite_uint64)(size_t)db;
+
+  h ^= h >> 29;
+  h *= 0x9e3779b97f4a7c15ULL;
+  return (unsigned int)(h >> 32);
+}
+
+/*
+** Makes sure the hash table has at least one bucket per record, plus the one
+** about to be added.  Returns zero if it could not be allocated.  This must be
+** called with the hash table mutex held.
+*/
+SQLITE_PRIVATE int sqlite3InteropDbRehash(void)
+{
+  InteropDb **apNew;
+  int nNew, i;
+
+  if (interopDbCount < interopDbHashSize) return 1;
+  nNew = interopDbHashSize ? interopDbHashSize * 2 : 64;
+  apNew = (InteropDb **)sqlite3_malloc(nNew * (int)sizeof(InteropDb *));
+  if (!apNew) return 0;
+  memset(apNew, 0, nNew * sizeof(InteropDb *));
+  for (i = 0; i < interopDbHashSize; i++)
+  {
+    while (interopDbHash[i])
+    {
+      InteropDb *p = interopDbHash[i];
+      InteropDb **pp = &apNew[sqlite3InteropDbHash(p->db) & (nNew - 1)];
+      interopDbHash[i] = p->pHashNext;
+      p->pHashNext = *pp;
+      *pp = p;
+    }
+  }
+  sqlite3_free(interopDbHash);
+  interopDbHash = apNew;
+  interopDbHashSize = nNew;
+  return 1;
+}
+
+/*
+** Returns the record for the specified database connection.  If there is
+** none, a new one is created if bCreate is non-zero; otherwise, or if it could
+** not be allocated, zero is returned.
+*/
+SQLITE_PRIVATE InteropDb *sqlite3InteropDbFind(sqlite3 *db, int bCreate)
+{
+  InteropDb *p = 0;
+  sqlite3_mutex *mutex;
+  unsigned int h;
+
+  if (!db) return 0;
+  mutex = sqlite3InteropDbMutex();
+  h = sqlite3InteropDbHash(db);
+  sqlite3_mutex_enter(mutex);
+  if (interopDbHashSize)
+  {
+    for (p = interopDbHash[h & (interopDbHashSize - 1)]; p; p = p->pHashNext)
+    {
+      if (p->db == db) break;
+    }
+  }
+  if (!p && bCreate && sqlite3InteropDbRehash())
+  {
+    p = (InteropDb *)sqlite3_malloc(sizeof(InteropDb));
+    if (p)
+    {
+      InteropDb **pp = &interopDbHash[h & (interopDbHashSize - 1)];
+
+      memset(p, 0, sizeof(InteropDb));
+      p->db = db;
+      p->pHashNext = *pp;
+      *pp = p;
+      interopDbCount++;
+    }
+  }
+  sqlite3_mutex_leave(mutex);
+  return p;
+}
+
+/*
+** Removes the record for the specified database connection from the hash
+** table and returns it, or returns zero if there is none.
+*/
+SQLITE_PRIVATE InteropDb *sqlite3InteropDbUnlink(sqlite3 *db)
+{
+  InteropDb *p = 0;
+  InteropDb **pp;
+  sqlite3_mutex *mutex;
+
+  if (!db) return 0;
+  mutex = sqlite3InteropDbMutex();
+  sqlite3_mutex_enter(mutex);
+  if (interopDbHashSize)
+  {
+    for (pp = &interopDbHash[sqlite3InteropDbHash(db) & (interopDbHashSize - 1)]; *pp; pp = &(*pp)->pHashNext)
+    {
+      if ((*pp)->db == db)
+      {
+        p = *pp;
+        *pp = p->pHashNext;
+        interopDbCount--;
+        break;
+      }
+    }
+  }
+  sqlite3_mutex_leave(mutex);
+  return p;
+}
+
+/*
+** The number of functions in all the InteropDb.pUserFunc lists, which allows
+** skipping the search for them when there are none.  It is only changed via
+** the atomic operations, so it may be read without holding any mutex.
+*/
+static volatile interop_atomic_t interopUserFuncCount = 0;
+
+SQLITE_PRIVATE void sqlite3InteropUserFunctionsFree(InteropDb *p)
+{
+  int nFree = 0;
+
+  while (p->pUserFunc)
+  {
+    InteropUserFunc *pFunc = p->pUserFunc;
+    p->pUserFunc = pFunc->pNext;
+    sqlite3_free(pFunc->zName);
+    sqlite3_free(pFunc);
+    nFree++;
+  }
+  if (nFree) interopAtomicAdd(&interopUserFuncCount, -nFree);
+}
+
+/*
+** The statement cache keeps finalized statements for a database connection so
+** that preparing the same SQL text again does not have to parse and compile
+** it.  It is disabled by default and enabled per connection by calling the
+** sqlite3_statement_cache_interop() function.  The statements are found via a
+** hash table keyed on their SQL text and are also kept in LRU order, bounded by
+** a number of statements and an (estimated) number of bytes.  Statements that
+** were invalidated by a schema change are never handed out again.  Statements
+** prepared from SQL text containing more than one statement are never cached.
+*/
+typedef struct InteropStmtEntry InteropStmtEntry;
+struct InteropStmtEntry {
+  sqlite3_stmt *pStmt;          /* The cached statement */
+  const char *zSql;             /* SQL text, owned by the statement */
+  int nSql;                     /* Bytes in zSql, without trailing spaces */
+  unsigned int h;               /* Hash of the SQL text */
+  int nBytes;                   /* Estimated memory used by the statement */
+  unsigned int iSchema;         /* Schema generation when it was cached */
+  InteropStmtEntry *pPrev;      /* Previous (more recently used) entry */
+  InteropStmtEntry *pNext;      /* Next (less recently used) entry */
+  InteropStmtEntry *pHashNext;  /* Next entry in the same hash bucket */
+};
+
+struct InteropStmtCache {
+  int nMaxEntry;                /* Maximum number of cached statements */
+  int nMaxBytes;                /* Maximum number of estimated bytes */
+  int nEntry;                   /* Current number of cached statements */
+  int nBytes;                   /* Current number of estimated bytes */
+  sqlite_int64 nHit;            /* Number of prepares satisfied by the cache */
+  sqlite_int64 nMiss;           /* Number of prepares not satisfied */
+  InteropStmtEntry *pFirst;     /* Most recently used entry */
+  InteropStmtEntry *pLast;      /* Least recently used entry */
+  int nHash;                    /* Number of hash buckets, a power of two */
+  InteropStmtEntry **apHash;    /* Hash buckets, keyed on the SQL text */
+  int nSkip;                    /* Number of statements in apSkip */
+  int nSkipAlloc;               /* Number of slots allocated for apSkip */
+  sqlite3_stmt **apSkip;        /* Live statements that must not be cached */
+};
+
+/*
+** The number of enabled statement caches, which allows skipping the search for
+** a cache when there are none.  It is only changed via the atomic operations,
+** so it may be read without holding any mutex.
+*/
+static volatile interop_atomic_t interopStmtCacheCount = 0;
+
+SQLITE_PRIVATE unsigned int sqlite3InteropStmtCacheHash(const char *zSql, int nSql)
+{
+  unsigned int h = 2166136261U;
+  int i;
+  for (i = 0; i < nSql; i++)
+  {
+    h ^= (unsigned char)zSql[i];
+    h *= 16777619U;
+  }
+  return h;
+}
+
+/*
+** Returns a value that changes whenever the schema of any database attached
+** to the connection changes, either via this connection or after a change
+** made by another connection has been detected.  Statements cached with a
+** different value are never handed out, because their result columns may be
+** stale until they are stepped.
+*/
+SQLITE_PRIVATE unsigned int sqlite3InteropStmtCacheSchema(sqlite3 *db)
+{
+  unsigned int iSchema = (unsigned int)db->nDb;
+  int i;
+  for (i = 0; i < db->nDb; i++)
+  {
+    Schema *pSchema = db->aDb[i].pSchema;
+    iSchema = iSchema * 31 + (pSchema ? (unsigned int)pSchema->schema_cookie : 0);
+    iSchema = iSchema * 31 + (DbHasProperty(db, i, DB_SchemaLoaded) ? 1 : 0);
+  }
+  return iSchema;
+}
+
+SQLITE_PRIVATE int sqlite3InteropStmtCacheLength(const char *zSql, int nSql)
+{
+  if (nSql < 0) nSql = (int)strlen(zSql);
+  while (nSql > 0 && sqlite3Isspace(zSql[nSql - 1])) nSql--;
+  return nSql;
+}
+
+SQLITE_PRIVATE InteropStmtCache *sqlite3InteropStmtCacheFind(sqlite3 *db)
+{
+  InteropDb *p;
+
+  if (!db || !interopStmtCacheCount) return 0;
+  p = sqlite3InteropDbFind(db, 0);
+  return p ? p->pCache : 0;
+}
+
+SQLITE_PRIVATE void sqlite3InteropStmtCacheUnlink(InteropStmtCache *pCache, InteropStmtEntry *p)
+{
+  InteropStmtEntry **pp = &pCache->apHash[p->h & (pCache->nHash - 1)];
+
+  while (*pp != p) pp = &(*pp)->pHashNext;
+  *pp = p->pHashNext;
+  if (p->pPrev) p->pPrev->pNext = p->pNext; else pCache->pFirst = p->pNext;
+  if (p->pNext) p->pNext->pPrev = p->pPrev; else pCache->pLast = p->pPrev;
+  pCache->nEntry--;
+  pCache->nBytes -= p->nBytes;
+}
+
+SQLITE_PRIVATE void sqlite3InteropStmtCacheEvict(InteropStmtCache *pCache, int nMaxEntry, int nMaxBytes)
+{
+  while (pCache->pLast && (pCache->nEntry > nMaxEntry || pCache->nBytes > nMaxBytes))
+  {
+    InteropStmtEntry *p = pCache->pLast;
+    sqlite3InteropStmtCacheUnlink(pCache, p);
+    sqlite3_finalize(p->pStmt);
+    sqlite3_free(p);
+  }
+}
+
+/*
+** Makes sure the hash table has at least one bucket per cached statement,
+** plus the one about to be added.  Returns zero if it could not be allocated,
+** in which case the statement must not be cached.
+*/
+SQLITE_PRIVATE int sqlite3InteropStmtCacheRehash(InteropStmtCache *pCache)
+{
+  InteropStmtEntry **apNew;
+  InteropStmtEntry *p;
+  int nNew;
+
+  if (pCache->nEntry < pCache->nHash) return 1;
+  nNew = pCache->nHash ? pCache->nHash * 2 : 64;
+  apNew = (InteropStmtEntry **)sqlite3_malloc(nNew * (int)sizeof(InteropStmtEntry *));
+  if (!apNew) return 0;
+  memset(apNew, 0, nNew * sizeof(InteropStmtEntry *));
+  for (p = pCache->pFirst; p; p = p->pNext)
+  {
+    InteropStmtEntry **pp = &apNew[p->h & (nNew - 1)];
+    p->pHashNext = *pp;
+    *pp = p;
+  }
+  sqlite3_free(pCache->apHash);
+  pCache->apHash = apNew;
+  pCache->nHash = nNew;
+  return 1;
+}
+
+/*
+** Removes the statement from the list of statements that must not be cached.
+** Returns non-zero if it was found there.
+*/
+SQLITE_PRIVATE int sqlite3InteropStmtCacheUnskip(InteropStmtCache *pCache, sqlite3_stmt *stmt)
+{
+  int i;
+
+  for (i = 0; i < pCache->nSkip; i++)
+  {
+    if (pCache->apSkip[i] == stmt)
+    {
+      pCache->apSkip[i] = pCache->apSkip[--pCache->nSkip];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+** Called after a statement was prepared from SQL text that contains more than
+** one statement.  Its own SQL text is only the first statement, so it would be
+** cached under a key that preparing the same SQL text again would never find.
+** Such statements are remembered until they are finalized, so that they are
+** not cached.  Returns zero if the statement could not be remembered, in which
+** case it will be cached.
+*/
+SQLITE_PRIVATE int sqlite3InteropStmtCacheSkip(sqlite3 *db, sqlite3_stmt *stmt)
+{
+  InteropStmtCache *pCache;
+  int rc = 0;
+
+  if (!db || !stmt || !interopStmtCacheCount) return 0;
+  sqlite3_mutex_enter(db->mutex);
+  pCache = sqlite3InteropStmtCacheFind(db);
+  if (pCache)
+  {
+    if (pCache->nSkip == pCache->nSkipAlloc)
+    {
+      int nNew = pCache->nSkipAlloc ? pCache->nSkipAlloc * 2 : 8;
+      sqlite3_stmt **apNew = (sqlite3_stmt **)sqlite3_realloc(pCache->apSkip, nNew * (int)sizeof(sqlite3_stmt *));
+      if (apNew)
+      {
+        pCache->apSkip = apNew;
+        pCache->nSkipAlloc = nNew;
+      }
+    }
+    if (pCache->nSkip < pCache->nSkipAlloc)
+    {
+      pCache->apSkip[pCache->nSkip++] = stmt;
+      rc = 1;
+    }
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+/*
+** Removes the cache for the specified database connection, if any, finalizing
+** all of its statements.
+*/
+SQLITE_PRIVATE void sqlite3InteropStmtCacheRemove(sqlite3 *db)
+{
+  InteropDb *p;
+  InteropStmtCache *pCache;
+
+  if (!db || !interopStmtCacheCount) return;
+  sqlite3_mutex_enter(db->mutex);
+  p = sqlite3InteropDbFind(db, 0);
+  pCache = p ? p->pCache : 0;
+  if (pCache)
+  {
+    p->pCache = 0;
+    interopAtomicAdd(&interopStmtCacheCount, -1);
+    sqlite3InteropStmtCacheEvict(pCache, 0, 0);
+    sqlite3_free(pCache->apHash);
+    sqlite3_free(pCache->apSkip);
+    sqlite3_free(pCache);
+  }
+  sqlite3_mutex_leave(db->mutex);
+}
+
+/*
+** Attempts to satisfy a prepare from the statement cache.  Only SQL text that
+** consists of exactly one statement can be found in the cache, because only the
+** statements prepared from such SQL text are cached and the whole SQL text must
+** match.  Returns non-zero if a statement was found.
+*/
+SQLITE_PRIVATE int sqlite3InteropStmtCacheGet(sqlite3 *db, const char *zSql, int nSql, sqlite3_stmt **ppStmt, const char **pzTail)
+{
+  InteropStmtCache *pCache;
+  int rc = 0;
+
+  if (!db || !zSql || !interopStmtCacheCount) return 0;
+  nSql = sqlite3InteropStmtCacheLength(zSql, nSql);
+  sqlite3_mutex_enter(db->mutex);
+  pCache = sqlite3InteropStmtCacheFind(db);
+  if (pCache)
+  {
+    unsigned int h = sqlite3InteropStmtCacheHash(zSql, nSql);
+    InteropStmtEntry *p = pCache->nHash ? pCache->apHash[h & (pCache->nHash - 1)] : 0;
+
+    for (; p; p = p->pHashNext)
+    {
+      if (p->h == h && p->nSql == nSql && memcmp(p->zSql, zSql, nSql) == 0) break;
+    }
+    if (p)
+    {
+      sqlite3InteropStmtCacheUnlink(pCache, p);
+      if (((Vdbe *)p->pStmt)->expired || p->iSchema != sqlite3InteropStmtCacheSchema(db))
+      {
+        /* The schema has changed since the statement was cached. */
+        sqlite3_finalize(p->pStmt);
+      }
+      else
+      {
+        *ppStmt = p->pStmt;
+        *pzTail = zSql + nSql;
+        rc = 1;
+      }
+      sqlite3_free(p);
+    }
+    if (rc) pCache->nHit++; else pCache->nMiss++;
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+/*
+** Attempts to return a statement that is being finalized to the statement
+** cache.  Returns non-zero if the statement was cached, in which case it must
+** not be finalized.
+*/
+SQLITE_PRIVATE int sqlite3InteropStmtCachePut(sqlite3_stmt *stmt)
+{
+  Vdbe *v = (Vdbe *)stmt;
+  sqlite3 *db;
+  InteropStmtCache *pCache;
+  const char *zSql;
+  int rc = 0;
+
+  if (!stmt || !interopStmtCacheCount) return 0;
+  db = sqlite3_db_handle(stmt);
+  zSql = sqlite3_sql(stmt);
+  if (!db || !zSql) return 0;
+  sqlite3_mutex_enter(db->mutex);
+  pCache = sqlite3InteropStmtCacheFind(db);
+  if (pCache && !sqlite3InteropStmtCacheUnskip(pCache, stmt) && v->rc == SQLITE_OK && !v->expired)
+  {
+    InteropStmtEntry *p;
+    int nSql = sqlite3InteropStmtCacheLength(zSql, -1);
+    int nBytes = (int)sizeof(Vdbe) + v->nOp * (int)sizeof(Op) + nSql;
+
+    if (nBytes <= pCache->nMaxBytes && sqlite3InteropStmtCacheRehash(pCache) && sqlite3_reset(stmt) == SQLITE_OK)
+    {
+      p = (InteropStmtEntry *)sqlite3_malloc(sizeof(InteropStmtEntry));
+      if (p)
+      {
+        InteropStmtEntry **pp;
+
+        sqlite3_clear_bindings(stmt);
+        p->pStmt = stmt;
+        p->zSql = zSql;
+        p->nSql = nSql;
+        p->h = sqlite3InteropStmtCacheHash(zSql, nSql);
+        p->nBytes = nBytes;
+        p->iSchema = sqlite3InteropStmtCacheSchema(db);
+        p->pPrev = 0;
+        p->pNext = pCache->pFirst;
+        if (pCache->pFirst) pCache->pFirst->pPrev = p; else pCache->pLast = p;
+        pCache->pFirst = p;
+        pp = &pCache->apHash[p->h & (pCache->nHash - 1)];
+        p->pHashNext = *pp;
+        *pp = p;
+        pCache->nEntry++;
+        pCache->nBytes += nBytes;
+        sqlite3InteropStmtCacheEvict(pCache, pCache->nMaxEntry, pCache->nMaxBytes);
+        rc = 1;
+      }
+    }
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+/*
+** Enables, reconfigures, or (if either limit is not positive) disables the
+** statement cache for the specified database connection.
+*/
+SQLITE_API int WINAPI sqlite3_statement_cache_interop(sqlite3 *db, int nMaxEntry, int nMaxBytes)
+{
+  InteropDb *p;
+  InteropStmtCache *pCache;
+
+  if (!db) return SQLITE_MISUSE;
+  if (nMaxEntry <= 0 || nMaxBytes <= 0)
+  {
+    sqlite3InteropStmtCacheRemove(db);
+    return SQLITE_OK;
+  }
+  sqlite3_mutex_enter(db->mutex);
+  p = sqlite3InteropDbFind(db, 1);
+  pCache = p ? p->pCache : 0;
+  if (!pCache)
+  {
+    if (p) pCache = (InteropStmtCache *)sqlite3_malloc(sizeof(InteropStmtCache));
+    if (!pCache)
+    {
+      sqlite3_mutex_leave(db->mutex);
+      return SQLITE_NOMEM;
+    }
+    memset(pCache, 0, sizeof(InteropStmtCache));
+    p->pCache = pCache;
+    interopAtomicIncrement(&interopStmtCacheCount);
+  }
+  pCache->nMaxEntry = nMaxEntry;
+  pCache->nMaxBytes = nMaxBytes;
+  sqlite3InteropStmtCacheEvict(pCache, nMaxEntry, nMaxBytes);
+  sqlite3_mutex_leave(db->mutex);
+  return SQLITE_OK;
+}
+
+SQLITE_API int WINAPI sqlite3_statement_cache_status_interop(sqlite3 *db, int *pnEntry, int *pnBytes, sqlite_int64 *pnHit, sqlite_int64 *pnMiss)
+{
+  InteropStmtCache *pCache;
+
+  if (!db || !pnEntry || !pnBytes || !pnHit || !pnMiss) return SQLITE_MISUSE;
+  sqlite3_mutex_enter(db->mutex);
+  pCache = sqlite3InteropStmtCacheFind(db);
+  *pnEntry = pCache ? pCache->nEntry : 0;
+  *pnBytes = pCache ? pCache->nBytes : 0;
+  *pnHit = pCache ? pCache->nHit : 0;
+  *pnMiss = pCache ? pCache->nMiss : 0;
+  sqlite3_mutex_leave(db->mutex);
+  return SQLITE_OK;
+}
+
+/*
+** The busy handler waits for locks held by other connections natively, using
+** an exponential backoff with jitter between the configured minimum and
+** maximum delays, until the configured timeout has elapsed.  It is installed
+** by sqlite3_busy_backoff_interop() and keeps counters that can be queried via
+** sqlite3_busy_backoff_status_interop().  A command may also limit the total
+** time spent waiting via sqlite3_busy_deadline_interop(), without changing the
+** configured timeout, and must remove that limit again when it finishes.
+** All fields are protected by the
+** database connection mutex, which SQLite holds while invoking the handler.
+** The structure is owned by the per-connection record, not by the handler,
+** because the handler may be replaced via sqlite3_busy_timeout() or PRAGMA
+** busy_timeout at any time.
+*/
+struct InteropBusy {
+  sqlite3 *db;                  /* Database connection that owns the handler */
+  int nTimeout;                 /* Maximum milliseconds to wait for a lock */
+  int nMinDelay;                /* Delay before the first retry */
+  int nMaxDelay;                /* Maximum delay between retries */
+  unsigned int iRandom;         /* State of the jitter generator */
+  sqlite_int64 iStart;          /* Time the current wait started, in ms */
+  sqlite_int64 iDeadline;       /* Time the current command gives up, or 0 */
+  sqlite_int64 nBusy;           /* Number of times a lock was waited for */
+  sqlite_int64 nRetry;          /* Number of retries after waiting */
+  sqlite_int64 nWait;           /* Total milliseconds spent waiting */
+  sqlite_int64 nGiveUp;         /* Number of waits that timed out */
+};
+
+SQLITE_PRIVATE int sqlite3InteropBusyHandler(void *pArg, int nCount)
+{
+  InteropBusy *p = (InteropBusy *)pArg;
+  sqlite3_vfs *pVfs = p->db->pVfs;
+  sqlite_int64 iNow = 0;
+  sqlite_int64 iAfter = 0;
+  sqlite_int64 nRemain;
+  int nDelay = p->nMinDelay;
+  int i;
+
+  sqlite3OsCurrentTimeInt64(pVfs, &iNow);
+  if (nCount == 0)
+  {
+    p->iStart = iNow;
+    p->nBusy++;
+  }
+  nRemain = p->nTimeout - (iNow - p->iStart);
+  if (p->iDeadline && p->iDeadline - iNow < nRemain) nRemain = p->iDeadline - iNow;
+  if (nRemain <= 0)
+  {
+    p->nGiveUp++;
+    return 0;
+  }
+
+  /* Double the delay for every retry, then pick a random delay between half
+  ** of it and all of it so that waiting connections do not retry in step. */
+  for (i = 0; i < nCount && nDelay < p->nMaxDelay; i++) nDelay *= 2;
+  if (nDelay > p->nMaxDelay) nDelay = p->nMaxDelay;
+  p->iRandom ^= p->iRandom << 13;
+  p->iRandom ^= p->iRandom >> 17;
+  p->iRandom ^= p->iRandom << 5;
+  nDelay = nDelay / 2 + (int)(p->iRandom % (unsigned int)(nDelay - nDelay / 2 + 1));
+  if (nDelay > nRemain) nDelay = (int)nRemain;
+  if (nDelay < 1) nDelay = 1;
+
+  sqlite3OsSleep(pVfs, nDelay * 1000);
+  sqlite3OsCurrentTimeInt64(pVfs, &iAfter);
+  p->nRetry++;
+  p->nWait += (iAfter > iNow) ? iAfter - iNow : 0;
+  return 1;
+}
+
+SQLITE_PRIVATE InteropBusy *sqlite3InteropBusyFind(sqlite3 *db)
+{
+  InteropDb *p = sqlite3InteropDbFind(db, 0);
+  return p ? p->pBusy : 0;
+}
+
+/*
+** Removes the record for the specified database connection, if any, along
+** with its statement cache and busy handler.  The busy handler is only
+** uninstalled if it has not been replaced since.
+*/
+SQLITE_PRIVATE void sqlite3InteropDbRemove(sqlite3 *db)
+{
+  InteropDb *p;
+
+  if (!db) return;
+  sqlite3InteropStmtCacheRemove(db);
+  sqlite3_mutex_enter(db->mutex);
+  p = sqlite3InteropDbUnlink(db);
+  if (p)
+  {
+    if (p->pBusy && db->busyHandler.xFunc == sqlite3InteropBusyHandler && db->busyHandler.pArg == p->pBusy)
+      sqlite3_busy_handler(db, 0, 0);
+    sqlite3_free(p->pBusy);
+    sqlite3InteropUserFunctionsFree(p);
+    sqlite3_free(p);
+  }
+  sqlite3_mutex_leave(db->mutex);
+}
+
+/*
+** Installs (or reconfigures) the busy handler for the specified database
+** connection.  A timeout of zero makes locks fail immediately.  The delays are
+** in milliseconds.  If the handler was replaced since it was installed, it is
+** installed again, keeping its counters.
+*/
+SQLITE_API int WINAPI sqlite3_busy_backoff_interop(sqlite3 *db, int nTimeout, int nMinDelay, int nMaxDelay)
+{
+  InteropDb *pDb;
+  InteropBusy *p = 0;
+  int ret = SQLITE_OK;
+
+  if (!db) return SQLITE_MISUSE;
+  if (nTimeout < 0) nTimeout = 0;
+  if (nMinDelay < 1) nMinDelay = 1;
+  if (nMaxDelay < nMinDelay) nMaxDelay = nMinDelay;
+  sqlite3_mutex_enter(db->mutex);
+  pDb = sqlite3InteropDbFind(db, 1);
+  if (pDb)
+  {
+    p = pDb->pBusy;
+    if (!p)
+    {
+      p = (InteropBusy *)sqlite3_malloc(sizeof(InteropBusy));
+      if (p)
+      {
+        memset(p, 0, sizeof(InteropBusy));
+        p->db = db;
+        sqlite3_randomness(sizeof(p->iRandom), &p->iRandom);
+        if (!p->iRandom) p->iRandom = 2463534242U;
+        pDb->pBusy = p;
+      }
+    }
+  }
+  if (p)
+  {
+    p->nTimeout = nTimeout;
+    p->nMinDelay = nMinDelay;
+    p->nMaxDelay = nMaxDelay;
+    if (db->busyHandler.xFunc != sqlite3InteropBusyHandler || db->busyHandler.pArg != p)
+      ret = sqlite3_busy_handler(db, sqlite3InteropBusyHandler, p);
+  }
+  else
+  {
+    ret = SQLITE_NOMEM;
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return ret;
+}
+
+/*
+** Limits the total time the busy handler may wait for locks to the specified
+** number of milliseconds from now, e.g. the time remaining before a command
+** times out.  A negative number removes the limit.  This has no effect if the
+** busy handler was never installed.
+*/
+SQLITE_API int WINAPI sqlite3_busy_deadline_interop(sqlite3 *db, int nRemain)
+{
+  InteropBusy *p;
+
+  if (!db) return SQLITE_MISUSE;
+  sqlite3_mutex_enter(db->mutex);
+  p = sqlite3InteropBusyFind(db);
+  if (p)
+  {
+    p->iDeadline = 0;
+    if (nRemain >= 0)
+    {
+      sqlite3OsCurrentTimeInt64(db->pVfs, &p->iDeadline);
+      p->iDeadline += nRemain;
+    }
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return SQLITE_OK;
+}
+
+SQLITE_API int WINAPI sqlite3_busy_backoff_status_interop(sqlite3 *db, sqlite_int64 *pnBusy, sqlite_int64 *pnRetry, sqlite_int64 *pnWait, sqlite_int64 *pnGiveUp)
+{
+  InteropBusy *p;
+
+  if (!db || !pnBusy || !pnRetry || !pnWait || !pnGiveUp) return SQLITE_MISUSE;
+  sqlite3_mutex_enter(db->mutex);
+  p = sqlite3InteropBusyFind(db);
+  *pnBusy = p ? p->nBusy : 0;
+  *pnRetry = p ? p->nRetry : 0;
+  *pnWait = p ? p->nWait : 0;
+  *pnGiveUp = p ? p->nGiveUp : 0;
+  sqlite3_mutex_leave(db->mutex);
+  return SQLITE_OK;
+}
+
 /*
     The goal of this version of close is different than that of sqlite3_close(), and is designed to lend itself better to .NET's non-deterministic finalizers and
     the GC thread.  SQLite will not close a database if statements are open on it -- but for our purposes, we'd rather finalize all active statements
@@ -144,6 +987,9 @@ SQLITE_PRIVATE void sqlite3DbFree_interop(sqlite3 *db, void *p)
 SQLITE_API int WINAPI sqlite3_close_interop(sqlite3 *db)
 {
   int ret;
+
+  sqlite3InteropDbRemove(db);
+
 #if !defined(INTEROP_LEGACY_CLOSE) && SQLITE_VERSION_NUMBER >= 3007014
 
 #if defined(INTEROP_DEBUG) && (INTEROP_DEBUG & INTEROP_DEBUG_CLOSE)
@@ -213,6 +1059,123 @@ SQLITE_API int WINAPI sqlite3_close_interop(sqlite3 *db)
 #endif
 }
 
+/*
+** The log ring is a bounded, lock-free, multiple-producer, single-consumer
+** queue that receives the messages logged by the SQLite core library when it
+** is configured via sqlite3_config_log_ring_interop().  Producers (i.e. any
+** thread logging a message) never block; when the ring is full, the message is
+** dropped and counted.  The consumer (i.e. the managed code) reads messages via
+** sqlite3_log_ring_read_interop(), which must never be called by more than one
+** thread at a time.  The ring is statically allocated because it must be ready
+** before the SQLite core library (and its memory allocator) is initialized.
+**
+** Each slot has a sequence number.  A slot at position P (modulo the size of
+** the ring) may be written when its sequence number equals P and may be read
+** when it equals P + 1.  After being read, it becomes P + INTEROP_LOG_RING_SIZE
+** so that it can be written again during the next lap around the ring.  The
+** positions and sequence numbers wrap around, so all the arithmetic on them is
+** done using unsigned integers; only their differences are treated as signed.
+*/
+#ifndef INTEROP_LOG_RING_SIZE
+# define INTEROP_LOG_RING_SIZE 256         /* Must be a power of two */
+#endif
+#ifndef INTEROP_LOG_RING_MESSAGE
+# define INTEROP_LOG_RING_MESSAGE 256      /* Maximum bytes per message */
+#endif
+
+#define interopLogSeqDiff(a, b) ((int)((unsigned int)(a) - (unsigned int)(b)))
+
+typedef struct InteropLogSlot InteropLogSlot;
+struct InteropLogSlot {
+  volatile interop_atomic_t iSeq;          /* Sequence number, see above */
+  int iCode;                               /* Error code of the message */
+  int nMsg;                                /* Bytes used in zMsg */
+  char zMsg[INTEROP_LOG_RING_MESSAGE];     /* Message, not terminated */
+};
+
+static InteropLogSlot interopLogRing[INTEROP_LOG_RING_SIZE];
+static volatile interop_atomic_t interopLogWrite = 0;
+static volatile interop_atomic_t interopLogRead = 0;
+static volatile interop_atomic_t interopLogWritten = 0;
+static volatile interop_atomic_t interopLogDropped = 0;
+static int interopLogRingReady = 0;
+
+SQLITE_PRIVATE void sqlite3InteropLogRingCallback(void *pArg, int iCode, const char *zMsg){
+  unsigned int iPos = (unsigned int)interopLogWrite;
+  InteropLogSlot *pSlot;
+  int nMsg;
+
+  for(;;){
+    int iDiff;
+    pSlot = &interopLogRing[iPos & (INTEROP_LOG_RING_SIZE - 1)];
+    iDiff = interopLogSeqDiff(pSlot->iSeq, iPos);
+    if( iDiff==0 ){
+      unsigned int iPrior = (unsigned int)interopAtomicCas(&interopLogWrite,
+          (interop_atomic_t)(iPos + 1), (interop_atomic_t)iPos);
+      if( iPrior==iPos ) break;
+      iPos = iPrior;
+    }else if( iDiff<0 ){
+      interopAtomicIncrement(&interopLogDropped);
+      return;
+    }else{
+      iPos = (unsigned int)interopLogWrite;
+    }
+  }
+
+  nMsg = zMsg ? (int)strlen(zMsg) : 0;
+  if( nMsg>INTEROP_LOG_RING_MESSAGE ) nMsg = INTEROP_LOG_RING_MESSAGE;
+  if( nMsg>0 ) memcpy(pSlot->zMsg, zMsg, nMsg);
+  pSlot->iCode = iCode;
+  pSlot->nMsg = nMsg;
+  interopMemoryBarrier();
+  pSlot->iSeq = (interop_atomic_t)(iPos + 1);
+  interopAtomicIncrement(&interopLogWritten);
+}
+
+/*
+** Configures the SQLite core library to log into the ring.  This must be done
+** before the SQLite core library is initialized.
+*/
+SQLITE_API int WINAPI sqlite3_config_log_ring_interop()
+{
+  int ret;
+  if( !interopLogRingReady ){
+    int i;
+    for(i=0; i<INTEROP_LOG_RING_SIZE; i++) interopLogRing[i].iSeq = i;
+    interopLogRingReady = 1;
+  }
+  ret = sqlite3_config(SQLITE_CONFIG_LOG, sqlite3InteropLogRingCallback, 0);
+  return ret;
+}
+
+/*
+** Reads the oldest message from the ring into the specified buffer, which is
+** not terminated.  Returns the number of bytes read or -1 if the ring is empty.
+*/
+SQLITE_API int WINAPI sqlite3_log_ring_read_interop(int *piCode, char *zBuf, int nBuf)
+{
+  unsigned int iPos = (unsigned int)interopLogRead;
+  InteropLogSlot *pSlot = &interopLogRing[iPos & (INTEROP_LOG_RING_SIZE - 1)];
+  int nMsg;
+
+  if( !piCode || !zBuf || nBuf<0 ) return -1;
+  if( !interopLogRingReady || interopLogSeqDiff(pSlot->iSeq, iPos + 1)<0 ) return -1;
+  interopMemoryBarrier();
+  nMsg = (pSlot->nMsg<nBuf) ? pSlot->nMsg : nBuf;
+  memcpy(zBuf, pSlot->zMsg, nMsg);
+  *piCode = pSlot->iCode;
+  interopMemoryBarrier();
+  pSlot->iSeq = (interop_atomic_t)(iPos + INTEROP_LOG_RING_SIZE);
+  interopLogRead = (interop_atomic_t)(iPos + 1);
+  return nMsg;
+}
+
+SQLITE_API void WINAPI sqlite3_log_ring_status_interop(sqlite_int64 *pnWritten, sqlite_int64 *pnDropped)
+{
+  if( pnWritten ) *pnWritten = (unsigned int)interopLogWritten;
+  if( pnDropped ) *pnDropped = (unsigned int)interopLogDropped;
+}
+
 #if defined(INTEROP_LOG)
 SQLITE_API int WINAPI sqlite3_config_log_interop()
 {
@@ -241,10 +1204,224 @@ SQLITE_API const char *sqlite3_sourceid_interop(void)
   return INTEROP_SOURCE_ID " " INTEROP_SOURCE_TIMESTAMP;
 }
 
+#if defined(INTEROP_BUNDLED_FUNCTIONS)
+/*
+** The bundled SQL functions (i.e. the contrib extension functions and the
+** percentile, totype and regexp extensions) are registered with every new
+** database connection by a single automatic extension, which is installed
+** once per process initialization.  When lazy registration is enabled, the
+** automatic extension only marks them as pending for the connection and they
+** are registered by the first statement that fails to prepare because it uses
+** a function that does not exist yet, which is then prepared again.  This
+** saves connections that never use any of these functions from creating all
+** of them while opening.
+**
+** They are registered at most once per connection.  While they are pending,
+** the functions created by the application via sqlite3_create_function_interop()
+** are remembered and the bundled functions with the same names are skipped, so
+** that registering them later never replaces a function of the application.
+** Since no existing function is ever replaced, registering them does not fail
+** while statements are active and does not expire any prepared statements.
+*/
+static int interopFunctionsLazy = 0;
+
+/*
+** Returns non-zero if the application created a function while the bundled
+** SQL functions were pending that the bundled function with the specified
+** name and number of arguments would replace (or hide).
+*/
+SQLITE_PRIVATE int sqlite3InteropUserFunction(sqlite3 *db, const char *zName, int nArg)
+{
+  InteropDb *p;
+  InteropUserFunc *pFunc;
+
+  if (!interopUserFuncCount || !zName) return 0;
+  p = sqlite3InteropDbFind(db, 0);
+  for (pFunc = p ? p->pUserFunc : 0; pFunc; pFunc = pFunc->pNext)
+  {
+    if (sqlite3StrICmp(pFunc->zName, zName) == 0 &&
+        (pFunc->nArg == nArg || pFunc->nArg < 0 || nArg < 0))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+** Remembers a function created by the application, if the bundled SQL
+** functions are pending for the connection.
+*/
+SQLITE_PRIVATE void sqlite3InteropUserFunctionAdd(sqlite3 *db, const char *zName, int nArg)
+{
+  InteropDb *p = sqlite3InteropDbFind(db, 0);
+  InteropUserFunc *pFunc;
+
+  if (!p || !p->bFunctionsPending || !zName) return;
+  for (pFunc = p->pUserFunc; pFunc; pFunc = pFunc->pNext)
+  {
+    if (pFunc->nArg == nArg && sqlite3StrICmp(pFunc->zName, zName) == 0) return;
+  }
+  pFunc = (InteropUserFunc *)sqlite3_malloc(sizeof(InteropUserFunc));
+  if (!pFunc) return;
+  pFunc->zName = sqlite3_mprintf("%s", zName);
+  if (!pFunc->zName)
+  {
+    sqlite3_free(pFunc);
+    return;
+  }
+  pFunc->nArg = nArg;
+  pFunc->pNext = p->pUserFunc;
+  p->pUserFunc = pFunc;
+  interopAtomicIncrement(&interopUserFuncCount);
+}
+
+static int sqlite3InteropCreateFunction(
+  sqlite3 *db,
+  const char *zFunctionName,
+  int nArg,
+  int eTextRep,
+  void *pApp,
+  void (*xFunc)(sqlite3_context *, int, sqlite3_value **),
+  void (*xStep)(sqlite3_context *, int, sqlite3_value **),
+  void (*xFinal)(sqlite3_context *)
+){
+  if (sqlite3InteropUserFunction(db, zFunctionName, nArg)) return SQLITE_OK;
+  return sqlite3_create_function(db, zFunctionName, nArg, eTextRep, pApp,
+      xFunc, xStep, xFinal);
+}
+
+static int sqlite3InteropCreateFunctionV2(
+  sqlite3 *db,
+  const char *zFunctionName,
+  int nArg,
+  int eTextRep,
+  void *pApp,
+  void (*xFunc)(sqlite3_context *, int, sqlite3_value **),
+  void (*xStep)(sqlite3_context *, int, sqlite3_value **),
+  void (*xFinal)(sqlite3_context *),
+  void (*xDestroy)(void *)
+){
+  if (sqlite3InteropUserFunction(db, zFunctionName, nArg))
+  {
+    if (xDestroy) xDestroy(pApp);
+    return SQLITE_OK;
+  }
+  return sqlite3_create_function_v2(db, zFunctionName, nArg, eTextRep, pApp,
+      xFunc, xStep, xFinal, xDestroy);
+}
+
+SQLITE_PRIVATE int sqlite3InteropRegisterFunctions(sqlite3 *db, char **pzErrMsg, const sqlite3_api_routines *pApi)
+{
+  int rc = SQLITE_OK;
+
+#if defined(INTEROP_EXTENSION_FUNCTIONS)
+  if (rc == SQLITE_OK) rc = RegisterExtensionFunctions(db);
+#endif
+#if defined(INTEROP_PERCENTILE_EXTENSION)
+  if (rc == SQLITE_OK) rc = sqlite3_percentile_init(db, pzErrMsg, pApi);
+#endif
+#if defined(INTEROP_TOTYPE_EXTENSION)
+  if (rc == SQLITE_OK) rc = sqlite3_totype_init(db, pzErrMsg, pApi);
+#endif
+#if defined(INTEROP_REGEXP_EXTENSION)
+  if (rc == SQLITE_OK) rc = sqlite3_regexp_init(db, pzErrMsg, pApi);
+#endif
+
+  return rc;
+}
+
+SQLITE_PRIVATE int sqlite3InteropFunctionsInit(sqlite3 *db, char **pzErrMsg, const sqlite3_api_routines *pApi)
+{
+  if (interopFunctionsLazy)
+  {
+    InteropDb *p = sqlite3InteropDbFind(db, 1);
+
+    if (p)
+    {
+      p->bFunctionsPending = 1;
+      return SQLITE_OK;
+    }
+  }
+  return sqlite3InteropRegisterFunctions(db, pzErrMsg, pApi);
+}
+
+/*
+** Returns non-zero if the bundled SQL functions were just registered with the
+** database connection because the last statement it tried to prepare failed
+** due to an unknown function.
+*/
+SQLITE_PRIVATE int sqlite3InteropFunctionsMissing(sqlite3 *db, int rc)
+{
+  InteropDb *p;
+  const char *zErr;
+
+  if (rc != SQLITE_ERROR || !db) return 0;
+  sqlite3_mutex_enter(db->mutex);
+  p = sqlite3InteropDbFind(db, 0);
+  if (p && p->bFunctionsPending)
+  {
+    zErr = sqlite3_errmsg(db);
+    if (zErr && strncmp(zErr, "no such function: ", 18) == 0)
+    {
+      p->bFunctionsPending = 0;
+      rc = sqlite3InteropRegisterFunctions(db, 0, 0);
+      sqlite3InteropUserFunctionsFree(p);
+      sqlite3_mutex_leave(db->mutex);
+      return rc == SQLITE_OK;
+    }
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return 0;
+}
+
+/*
+** Enables or disables lazy registration of the bundled SQL functions for the
+** database connections opened after this call.
+*/
+SQLITE_API int WINAPI sqlite3_config_functions_interop(int lazy)
+{
+  interopFunctionsLazy = lazy;
+  return SQLITE_OK;
+}
+#endif
+
+#if defined(INTEROP_CODEC)
+/*
+** Changes the key of the main database, rewriting nBatch pages per transaction
+** or the whole database in one transaction if nBatch is not positive.  See the
+** RekeyDatabase() function in crypt.c for details.
+*/
+SQLITE_API int WINAPI sqlite3_rekey_interop(sqlite3 *db, const void *pKey, int nKey, int nBatch, SQLITEREKEYPROGRESS xProgress, void *pArg)
+{
+  return RekeyDatabase(db, pKey, nKey, nBatch, xProgress, pArg);
+}
+
+/*
+** Wipes the derived keys cached by the codec and then shuts down SQLite.  The
+** cache is set up again the next time a key is used.
+*/
+SQLITE_API int WINAPI sqlite3_shutdown_interop(void)
+{
+  ShutdownKeyCache();
+  return sqlite3_shutdown();
+}
+#endif
+
 SQLITE_API int WINAPI sqlite3_open_interop(const char *filename, int flags, sqlite3 **ppdb)
 {
   int ret;
 
+#if defined(INTEROP_BUNDLED_FUNCTIONS)
+  /*
+  ** NOTE: This is a no-op when the automatic extension is already installed;
+  **       however, it must be checked every time because shutting down the
+  **       SQLite core library removes all automatic extensions.
+  */
+  ret = sqlite3_auto_extension((void (*)(void))sqlite3InteropFunctionsInit);
+  if (ret != SQLITE_OK) return ret;
+#endif
+
 #if defined(INTEROP_DEBUG) && (INTEROP_DEBUG & INTEROP_DEBUG_OPEN)
   sqlite3InteropDebug("sqlite3_open_interop(): calling sqlite3_open_v2(\"%s\", %d, %p)...\n", filename, flags, ppdb);
 #endif
@@ -255,11 +1432,6 @@ SQLITE_API int WINAPI sqlite3_open_interop(const char *filename, int flags, sqli
   sqlite3InteropDebug("sqlite3_open_interop(): sqlite3_open_v2(\"%s\", %d, %p) returned %d.\n", filename, flags, ppdb, ret);
 #endif
 
-#if defined(INTEROP_EXTENSION_FUNCTIONS)
-  if (ret == SQLITE_OK)
-    RegisterExtensionFunctions(*ppdb);
-#endif
-
   return ret;
 }
 
@@ -312,10 +1484,116 @@ SQLITE_API int WINAPI sqlite3_changes_interop(sqlite3 *db)
   return result;
 }
 
+/*
+** The sqlite3_interop_profile structure accumulates the execution statistics
+** of a statement.  It is owned by the caller, which passes it to the stepping
+** functions below (or NULL if the statement is not being profiled).  Times are
+** in nanoseconds, measured using a high-resolution clock.  The counters from
+** sqlite3_stmt_status() are never reset, because other code may be reading
+** them too.  Instead, the values seen by the previous step are kept in the
+** structure and only the differences are added to it, so that it contains
+** just the activity that took place while profiling.
+*/
+typedef struct sqlite3_interop_profile sqlite3_interop_profile;
+struct sqlite3_interop_profile {
+  sqlite_int64 nPrepareTime;   /* Time spent preparing the statement */
+  sqlite_int64 nStepTime;      /* Time spent stepping the statement */
+  sqlite_int64 nStep;          /* Number of calls to sqlite3_step() */
+  sqlite_int64 nRow;           /* Number of rows returned */
+  sqlite_int64 nFullscanStep;  /* SQLITE_STMTSTATUS_FULLSCAN_STEP */
+  sqlite_int64 nSort;          /* SQLITE_STMTSTATUS_SORT */
+  sqlite_int64 nAutoindex;     /* SQLITE_STMTSTATUS_AUTOINDEX */
+  sqlite_int64 nVmStep;        /* SQLITE_STMTSTATUS_VM_STEP */
+  unsigned int iFullscanStep;  /* Last value of SQLITE_STMTSTATUS_FULLSCAN_STEP */
+  unsigned int iSort;          /* Last value of SQLITE_STMTSTATUS_SORT */
+  unsigned int iAutoindex;     /* Last value of SQLITE_STMTSTATUS_AUTOINDEX */
+  unsigned int iVmStep;        /* Last value of SQLITE_STMTSTATUS_VM_STEP */
+};
+
+SQLITE_PRIVATE sqlite_int64 sqlite3InteropClock(void)
+{
+#if SQLITE_OS_WIN
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+
+  if (!frequency.QuadPart && !QueryPerformanceFrequency(&frequency))
+    return 0;
+  QueryPerformanceCounter(&counter);
+  return (counter.QuadPart / frequency.QuadPart) * 1000000000 +
+         (counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (sqlite_int64)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/*
+** Returns the amount a statement counter has grown since its value was last
+** seen and remembers its current value.  The counters are 32-bit unsigned and
+** wrap around.  If a counter appears to have shrunk by less than half of its
+** range, it was reset by other code since and has grown from zero.
+*/
+SQLITE_PRIVATE sqlite_int64 sqlite3InteropProfileDelta(sqlite3_stmt *stmt, int op, unsigned int *piLast)
+{
+  unsigned int iNow = (unsigned int)sqlite3_stmt_status(stmt, op, 0);
+  unsigned int nDelta = iNow - *piLast;
+
+  if (nDelta > 0x7fffffff) nDelta = iNow;
+  *piLast = iNow;
+  return nDelta;
+}
+
+/*
+** Remembers the current values of the statement counters, without adding
+** anything to the profile.
+*/
+SQLITE_PRIVATE void sqlite3InteropProfileMark(sqlite3_stmt *stmt, sqlite3_interop_profile *pProfile)
+{
+  pProfile->iFullscanStep = (unsigned int)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+  pProfile->iSort = (unsigned int)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 0);
+  pProfile->iAutoindex = (unsigned int)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 0);
+#ifdef SQLITE_STMTSTATUS_VM_STEP
+  pProfile->iVmStep = (unsigned int)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 0);
+#endif
+}
+
+SQLITE_PRIVATE int sqlite3InteropProfileStep(sqlite3_stmt *stmt, sqlite3_interop_profile *pProfile)
+{
+  sqlite_int64 iStart;
+  int ret;
+
+  if (!pProfile) return sqlite3_step(stmt);
+  iStart = sqlite3InteropClock();
+  ret = sqlite3_step(stmt);
+  pProfile->nStepTime += sqlite3InteropClock() - iStart;
+  pProfile->nStep++;
+  if (ret == SQLITE_ROW) pProfile->nRow++;
+  pProfile->nFullscanStep += sqlite3InteropProfileDelta(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, &pProfile->iFullscanStep);
+  pProfile->nSort += sqlite3InteropProfileDelta(stmt, SQLITE_STMTSTATUS_SORT, &pProfile->iSort);
+  pProfile->nAutoindex += sqlite3InteropProfileDelta(stmt, SQLITE_STMTSTATUS_AUTOINDEX, &pProfile->iAutoindex);
+#ifdef SQLITE_STMTSTATUS_VM_STEP
+  pProfile->nVmStep += sqlite3InteropProfileDelta(stmt, SQLITE_STMTSTATUS_VM_STEP, &pProfile->iVmStep);
+#endif
+  return ret;
+}
+
+SQLITE_API int WINAPI sqlite3_step_profile_interop(sqlite3_stmt *stmt, sqlite3_interop_profile *pProfile)
+{
+  return sqlite3InteropProfileStep(stmt, pProfile);
+}
+
 SQLITE_API int WINAPI sqlite3_prepare_interop(sqlite3 *db, const char *sql, int nbytes, sqlite3_stmt **ppstmt, const char **pztail, int *plen)
 {
   int n;
 
+  if (sqlite3InteropStmtCacheGet(db, sql, nbytes, ppstmt, pztail))
+  {
+    *plen = (*pztail != 0) ? strlen(*pztail) : 0;
+    return SQLITE_OK;
+  }
+
 #if defined(INTEROP_DEBUG) && (INTEROP_DEBUG & INTEROP_DEBUG_PREPARE)
   sqlite3InteropDebug("sqlite3_prepare_interop(): calling sqlite3_prepare(%p, \"%s\", %d, %p)...\n", db, sql, nbytes, ppstmt);
 #endif
@@ -326,12 +1604,39 @@ SQLITE_API int WINAPI sqlite3_prepare_interop(sqlite3 *db, const char *sql, int
   n = sqlite3_prepare(db, sql, nbytes, ppstmt, pztail);
 #endif
 
+#if defined(INTEROP_BUNDLED_FUNCTIONS)
+  if (sqlite3InteropFunctionsMissing(db, n))
+    n = sqlite3_prepare_v2(db, sql, nbytes, ppstmt, pztail);
+#endif
+
 #if defined(INTEROP_DEBUG) && (INTEROP_DEBUG & INTEROP_DEBUG_PREPARE)
   sqlite3InteropDebug("sqlite3_prepare_interop(): sqlite3_prepare(%p, \"%s\", %d, %p) returned %d.\n", db, sql, nbytes, ppstmt, n);
 #endif
 
   *plen = (*pztail != 0) ? strlen(*pztail) : 0;
 
+  if (n == SQLITE_OK && *ppstmt && *plen > 0 && sqlite3InteropStmtCacheLength(*pztail, *plen) > 0)
+    sqlite3InteropStmtCacheSkip(db, *ppstmt);
+
+  return n;
+}
+
+/*
+** Prepares a statement just like sqlite3_prepare_interop() and adds the time
+** spent doing so to the specified sqlite3_interop_profile structure.
+*/
+SQLITE_API int WINAPI sqlite3_prepare_profile_interop(sqlite3 *db, const char *sql, int nbytes, sqlite3_stmt **ppstmt, const char **pztail, int *plen, sqlite3_interop_profile *pProfile)
+{
+  sqlite_int64 iStart = sqlite3InteropClock();
+  int n = sqlite3_prepare_interop(db, sql, nbytes, ppstmt, pztail, plen);
+
+  if (pProfile)
+  {
+    pProfile->nPrepareTime += sqlite3InteropClock() - iStart;
+
+    /* A statement from the statement cache has been stepped before. */
+    if (n == SQLITE_OK && *ppstmt) sqlite3InteropProfileMark(*ppstmt, pProfile);
+  }
   return n;
 }
 
@@ -344,16 +1649,31 @@ SQLITE_API int WINAPI sqlite3_prepare16_interop(sqlite3 *db, const void *sql, in
 #endif
 
 #if SQLITE_VERSION_NUMBER >= 3003009
-  n = sqlite3_prepare16_v2(db, sql, nchars * sizeof(wchar_t), ppstmt, pztail);
+  n = sqlite3_prepare16_v2(db, sql, nchars * sizeof(u16), ppstmt, pztail);
 #else
-  n = sqlite3_prepare16(db, sql, nchars * sizeof(wchar_t), ppstmt, pztail);
+  n = sqlite3_prepare16(db, sql, nchars * sizeof(u16), ppstmt, pztail);
+#endif
+
+#if defined(INTEROP_BUNDLED_FUNCTIONS)
+  if (sqlite3InteropFunctionsMissing(db, n))
+    n = sqlite3_prepare16_v2(db, sql, nchars * sizeof(u16), ppstmt, pztail);
 #endif
 
 #if defined(INTEROP_DEBUG) && (INTEROP_DEBUG & INTEROP_DEBUG_PREPARE16)
   sqlite3InteropDebug("sqlite3_prepare_interop(): sqlite3_prepare16(%p, \"%s\", %d, %p) returned %d.\n", db, sql, nchars, ppstmt, n);
 #endif
 
-  *plen = (*pztail != 0) ? wcslen((wchar_t *)*pztail) * sizeof(wchar_t) : 0;
+  *plen = sqlite3InteropUtf16Bytes(*pztail);
+
+  if (n == SQLITE_OK && *ppstmt && *plen > 0)
+  {
+    const u16 *zTail = (const u16 *)*pztail;
+    int nTail = *plen / (int)sizeof(u16);
+    int i;
+
+    for (i = 0; i < nTail && zTail[i] < 0x80 && sqlite3Isspace(zTail[i]); i++) {}
+    if (i < nTail) sqlite3InteropStmtCacheSkip(db, *ppstmt);
+  }
 
   return n;
 }
@@ -444,7 +1764,7 @@ SQLITE_API const char * WINAPI sqlite3_column_name_interop(sqlite3_stmt *stmt, i
 SQLITE_API const void * WINAPI sqlite3_column_name16_interop(sqlite3_stmt *stmt, int iCol, int *plen)
 {
   const void *pval = sqlite3_column_name16(stmt, iCol);
-  *plen = (pval != 0) ? wcslen((wchar_t *)pval) * sizeof(wchar_t) : 0;
+  *plen = sqlite3InteropUtf16Bytes(pval);
   return pval;
 }
 
@@ -458,7 +1778,7 @@ SQLITE_API const char * WINAPI sqlite3_column_decltype_interop(sqlite3_stmt *stm
 SQLITE_API const void * WINAPI sqlite3_column_decltype16_interop(sqlite3_stmt *stmt, int iCol, int *plen)
 {
   const void *pval = sqlite3_column_decltype16(stmt, iCol);
-  *plen = (pval != 0) ? wcslen((wchar_t *)pval) * sizeof(wchar_t) : 0;
+  *plen = sqlite3InteropUtf16Bytes(pval);
   return pval;
 }
 
@@ -501,9 +1821,345 @@ SQLITE_API const void * WINAPI sqlite3_column_text16_interop(sqlite3_stmt *stmt,
   return pval;
 }
 
+/*
+** The sqlite3_step_row_interop() function steps the specified statement and,
+** if a row is available, fills in one sqlite3_interop_column structure for
+** each of the first nCol columns of that row.  This allows the managed code
+** to fetch all the column values of a row using only one native call, rather
+** than one (or more) per column.  The text and blob pointers are owned by the
+** SQLite core library and are only valid until the statement is stepped
+** again, reset, or finalized.
+*/
+typedef struct sqlite3_interop_column sqlite3_interop_column;
+struct sqlite3_interop_column {
+  int type;              /* SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, etc. */
+  int nBytes;            /* Number of bytes for SQLITE_TEXT and SQLITE_BLOB */
+  union {
+    sqlite_int64 i;      /* Value for SQLITE_INTEGER */
+    double r;            /* Value for SQLITE_FLOAT */
+    const void *p;       /* Value for SQLITE_TEXT and SQLITE_BLOB */
+  } u;
+};
+
+SQLITE_API int WINAPI sqlite3_step_row_interop(sqlite3_stmt *stmt, sqlite3_interop_column *aCol, int nCol, int bText16, sqlite3_interop_profile *pProfile)
+{
+  sqlite3_mutex *mutex;
+  int ret;
+  int n;
+
+  if (!stmt) return SQLITE_MISUSE;
+  mutex = sqlite3_db_mutex(sqlite3_db_handle(stmt));
+  sqlite3_mutex_enter(mutex);
+
+  ret = sqlite3InteropProfileStep(stmt, pProfile);
+
+  if (ret == SQLITE_ROW && aCol)
+  {
+    int nColumn = sqlite3_column_count(stmt);
+    for (n = 0; n < nCol; n++)
+    {
+      sqlite3_interop_column *pCol = &aCol[n];
+      if (n >= nColumn)
+      {
+        /* Zero means the value is not available. */
+        memset(pCol, 0, sizeof(*pCol));
+        continue;
+      }
+      pCol->type = sqlite3_column_type(stmt, n);
+      pCol->nBytes = 0;
+      switch (pCol->type)
+      {
+        case SQLITE_INTEGER:
+          pCol->u.i = sqlite3_column_int64(stmt, n);
+          break;
+        case SQLITE_FLOAT:
+          pCol->u.r = sqlite3_column_double(stmt, n);
+          break;
+        case SQLITE_TEXT:
+          if (bText16)
+          {
+            pCol->u.p = sqlite3_column_text16(stmt, n);
+            pCol->nBytes = sqlite3_column_bytes16(stmt, n);
+          }
+          else
+          {
+            pCol->u.p = sqlite3_column_text(stmt, n);
+            pCol->nBytes = sqlite3_column_bytes(stmt, n);
+          }
+          break;
+        case SQLITE_BLOB:
+          pCol->u.p = sqlite3_column_blob(stmt, n);
+          pCol->nBytes = sqlite3_column_bytes(stmt, n);
+          break;
+        default:
+          pCol->u.p = 0;
+          break;
+      }
+    }
+  }
+
+  sqlite3_mutex_leave(mutex);
+  return ret;
+}
+
+/*
+** The sqlite3_step_batch_interop() function steps the specified statement up
+** to nRowMax times, copying the first nCol column values of each row into the
+** caller supplied columnar buffers.  Each buffer has nCol * nRowMax elements,
+** stored column-major (i.e. the value for column C of row R is located at the
+** index C * nRowMax + R).  For SQLITE_INTEGER and SQLITE_FLOAT values, the
+** aInt64 and aDouble buffers are used, respectively.  For SQLITE_TEXT (always
+** UTF-8) and SQLITE_BLOB values, the bytes are appended to the arena and the
+** aOffset and aBytes buffers receive their location within it.  Unlike the
+** sqlite3_step_row_interop() function, no pointers owned by the SQLite core
+** library are returned; therefore, the results remain valid after the
+** statement has been stepped again.
+**
+** If bCurrent is non-zero, the statement is assumed to already be positioned
+** on a row that has not been consumed yet, which will be the first row of the
+** batch.  Upon return, *pnRow contains the number of rows copied and the
+** return value is one of:
+**
+**   SQLITE_ROW    - The statement is positioned on a row that has not been
+**                   consumed yet, because the batch (or the arena) is full.
+**                   The next call must pass a non-zero value for bCurrent.
+**   SQLITE_DONE   - There are no more rows.
+**   SQLITE_TOOBIG - No rows were copied because the current row does not fit
+**                   in the arena.  *pnArena contains the number of arena bytes
+**                   required by the row, or 2147483647 if that is more than an
+**                   int can hold.  The statement is still positioned on that
+**                   row.
+**
+** Any other return value is an error returned by sqlite3_step(), in which
+** case *pnRow contains the number of rows successfully copied prior to it.
+*/
+SQLITE_API int WINAPI sqlite3_step_batch_interop(
+  sqlite3_stmt *stmt,
+  int bCurrent,
+  int nCol,
+  int nRowMax,
+  unsigned char *aType,
+  sqlite_int64 *aInt64,
+  double *aDouble,
+  int *aOffset,
+  int *aBytes,
+  unsigned char *aArena,
+  int nArena,
+  int *pnArena,
+  int *pnRow,
+  sqlite3_interop_profile *pProfile
+){
+  sqlite3_mutex *mutex;
+  int ret;
+  int nRow = 0;
+  int nUsed = 0;
+  int nColumn;
+  int n;
+
+  if (!stmt || nCol < 0 || nRowMax <= 0 || nArena < 0) return SQLITE_MISUSE;
+  if (!aType || !aInt64 || !aDouble || !aOffset || !aBytes) return SQLITE_MISUSE;
+  if (!pnArena || !pnRow) return SQLITE_MISUSE;
+  mutex = sqlite3_db_mutex(sqlite3_db_handle(stmt));
+  sqlite3_mutex_enter(mutex);
+
+  nColumn = sqlite3_column_count(stmt);
+  ret = bCurrent ? SQLITE_ROW : sqlite3InteropProfileStep(stmt, pProfile);
+
+  while (ret == SQLITE_ROW && nRow < nRowMax)
+  {
+    int nStart = nUsed;
+    sqlite3_int64 nNeed = 0;
+
+    for (n = 0; n < nCol; n++)
+    {
+      int i = n * nRowMax + nRow;
+      const void *p = 0;
+      int type = (n < nColumn) ? sqlite3_column_type(stmt, n) : 0;
+
+      aType[i] = (unsigned char)type;
+      aInt64[i] = 0;
+      aDouble[i] = 0.0;
+      aOffset[i] = 0;
+      aBytes[i] = 0;
+
+      switch (type)
+      {
+        case SQLITE_INTEGER:
+          aInt64[i] = sqlite3_column_int64(stmt, n);
+          break;
+        case SQLITE_FLOAT:
+          aDouble[i] = sqlite3_column_double(stmt, n);
+          break;
+        case SQLITE_TEXT:
+          p = sqlite3_column_text(stmt, n);
+          aBytes[i] = sqlite3_column_bytes(stmt, n);
+          break;
+        case SQLITE_BLOB:
+          p = sqlite3_column_blob(stmt, n);
+          aBytes[i] = sqlite3_column_bytes(stmt, n);
+          break;
+      }
+
+      if (aBytes[i] > 0)
+      {
+        nNeed += aBytes[i];
+        if (nNeed <= nArena - nStart)
+        {
+          aOffset[i] = nUsed;
+          memcpy(aArena + nUsed, p, aBytes[i]);
+          nUsed += aBytes[i];
+        }
+      }
+    }
+
+    if (nNeed > nArena - nStart)
+    {
+      /* The row does not fit, leave it for the next batch. */
+      nUsed = nStart;
+      if (nRow == 0)
+      {
+        *pnArena = (nNeed > 0x7fffffff) ? 0x7fffffff : (int)nNeed;
+        *pnRow = 0;
+        sqlite3_mutex_leave(mutex);
+        return SQLITE_TOOBIG;
+      }
+      break;
+    }
+
+    nRow++;
+    ret = sqlite3InteropProfileStep(stmt, pProfile);
+  }
+
+  *pnArena = nUsed;
+  *pnRow = nRow;
+  sqlite3_mutex_leave(mutex);
+  return ret;
+}
+
+/*
+** The sqlite3_execute_many_interop() function executes the specified statement
+** once for each of the rows iRow through nRow-1 of a packed, column-major block
+** of parameter values, binding, stepping, and resetting the statement without
+** returning to the managed code in between.  There is one sqlite3_interop_param
+** structure for each of the first nParam parameters of the statement.  Its
+** iNulls field is the offset within the block of a bitmap with one bit per row
+** (bit R%8 of byte R/8 is set if the value for row R is NULL) or -1 if there is
+** no such bitmap.  Its iValues field is the offset within the block of an array
+** of nRow values, either 64-bit integers or doubles.  For SQLITE_TEXT (always
+** UTF-8) and SQLITE_BLOB parameters, it is the offset of an array of nRow + 1
+** integers instead, where the bytes for row R are located within the block
+** starting at element R, up to (but not including) element R + 1.  The values
+** are bound using SQLITE_STATIC; therefore, all the bindings are cleared before
+** returning.
+**
+** If aChanges is not NULL, it receives the number of rows changed by each row
+** of parameter values.  Upon return, *piRow contains the index of the first row
+** that was not executed successfully, or nRow if they all were.  If that row
+** failed while stepping, the statement has not been reset, so the caller can
+** obtain the actual error code by doing so.
+*/
+typedef struct sqlite3_interop_param sqlite3_interop_param;
+struct sqlite3_interop_param {
+  int type;              /* SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, etc. */
+  int iNulls;            /* Offset of the null bitmap or -1 for none */
+  int iValues;           /* Offset of the values (or value offsets) */
+};
+
+SQLITE_API int WINAPI sqlite3_execute_many_interop(
+  sqlite3_stmt *stmt,
+  const sqlite3_interop_param *aParam,
+  int nParam,
+  const unsigned char *pBlock,
+  int nRow,
+  int iRow,
+  int *aChanges,
+  int *piRow,
+  sqlite3_interop_profile *pProfile
+){
+  sqlite3 *db;
+  sqlite3_mutex *mutex;
+  int ret = SQLITE_OK;
+  int n;
+
+  if (!stmt || nParam < 0 || nRow < 0 || iRow < 0 || !piRow) return SQLITE_MISUSE;
+  if (nParam > 0 && (!aParam || !pBlock)) return SQLITE_MISUSE;
+  db = sqlite3_db_handle(stmt);
+  mutex = sqlite3_db_mutex(db);
+  sqlite3_mutex_enter(mutex);
+
+  for (; iRow < nRow; iRow++)
+  {
+    for (n = 0; n < nParam && ret == SQLITE_OK; n++)
+    {
+      const sqlite3_interop_param *pParam = &aParam[n];
+      const unsigned char *pValue = pBlock + pParam->iValues;
+
+      if (pParam->type == SQLITE_NULL || (pParam->iNulls >= 0 &&
+          (pBlock[pParam->iNulls + (iRow >> 3)] & (1 << (iRow & 7)))))
+      {
+        ret = sqlite3_bind_null(stmt, n + 1);
+        continue;
+      }
+
+      switch (pParam->type)
+      {
+        case SQLITE_INTEGER:
+        {
+          sqlite_int64 i;
+          memcpy(&i, pValue + iRow * sizeof(i), sizeof(i));
+          ret = sqlite3_bind_int64(stmt, n + 1, i);
+          break;
+        }
+        case SQLITE_FLOAT:
+        {
+          double r;
+          memcpy(&r, pValue + iRow * sizeof(r), sizeof(r));
+          ret = sqlite3_bind_double(stmt, n + 1, r);
+          break;
+        }
+        case SQLITE_TEXT:
+        case SQLITE_BLOB:
+        {
+          int aOffset[2];
+          memcpy(aOffset, pValue + iRow * sizeof(int), sizeof(aOffset));
+          if (pParam->type == SQLITE_TEXT)
+            ret = sqlite3_bind_text(stmt, n + 1, (const char *)pBlock + aOffset[0], aOffset[1] - aOffset[0], SQLITE_STATIC);
+          else
+            ret = sqlite3_bind_blob(stmt, n + 1, pBlock + aOffset[0], aOffset[1] - aOffset[0], SQLITE_STATIC);
+          break;
+        }
+        default:
+          ret = SQLITE_MISUSE;
+          break;
+      }
+    }
+
+    if (ret != SQLITE_OK) break;
+
+    do
+    {
+      ret = sqlite3InteropProfileStep(stmt, pProfile);
+    } while (ret == SQLITE_ROW);
+
+    if (ret != SQLITE_DONE) break;
+    if (aChanges) aChanges[iRow] = sqlite3_changes(db);
+    sqlite3_reset(stmt);
+    ret = SQLITE_OK;
+  }
+
+  *piRow = iRow;
+  sqlite3_clear_bindings(stmt);
+  sqlite3_mutex_leave(mutex);
+  return ret;
+}
+
 SQLITE_API int WINAPI sqlite3_finalize_interop(sqlite3_stmt *stmt)
 {
   int ret;
+
+  if (sqlite3InteropStmtCachePut(stmt))
+    return SQLITE_OK;
+
 #if !defined(INTEROP_LEGACY_CLOSE) && SQLITE_VERSION_NUMBER >= 3007014
 
 #if defined(INTEROP_DEBUG) && (INTEROP_DEBUG & INTEROP_DEBUG_FINALIZE)
@@ -600,6 +2256,11 @@ SQLITE_API int WINAPI sqlite3_create_function_interop(sqlite3 *psql, const char
   n = sqlite3_create_function(psql, zFunctionName, nArg, eTextRep, 0, func, funcstep, funcfinal);
   if (n == SQLITE_OK)
   {
+#if defined(INTEROP_BUNDLED_FUNCTIONS)
+    sqlite3_mutex_enter(psql->mutex);
+    sqlite3InteropUserFunctionAdd(psql, zFunctionName, nArg);
+    sqlite3_mutex_leave(psql->mutex);
+#endif
     if (needCollSeq)
     {
       FuncDef *pFunc = sqlite3FindFunction(psql, zFunctionName, strlen(zFunctionName), nArg, eTextRep, 0);
@@ -697,7 +2358,7 @@ SQLITE_API const char * WINAPI sqlite3_column_database_name_interop(sqlite3_stmt
 SQLITE_API const void * WINAPI sqlite3_column_database_name16_interop(sqlite3_stmt *stmt, int iCol, int *plen)
 {
   const void *pval = sqlite3_column_database_name16(stmt, iCol);
-  *plen = (pval != 0) ? wcslen((wchar_t *)pval) * sizeof(wchar_t) : 0;
+  *plen = sqlite3InteropUtf16Bytes(pval);
   return pval;
 }
 
@@ -711,7 +2372,7 @@ SQLITE_API const char * WINAPI sqlite3_column_table_name_interop(sqlite3_stmt *s
 SQLITE_API const void * WINAPI sqlite3_column_table_name16_interop(sqlite3_stmt *stmt, int iCol, int *plen)
 {
   const void *pval = sqlite3_column_table_name16(stmt, iCol);
-  *plen = (pval != 0) ? wcslen((wchar_t *)pval) * sizeof(wchar_t) : 0;
+  *plen = sqlite3InteropUtf16Bytes(pval);
   return pval;
 }
 
@@ -725,7 +2386,7 @@ SQLITE_API const char * WINAPI sqlite3_column_origin_name_interop(sqlite3_stmt *
 SQLITE_API const void * WINAPI sqlite3_column_origin_name16_interop(sqlite3_stmt *stmt, int iCol, int *plen)
 {
   const void *pval = sqlite3_column_origin_name16(stmt, iCol);
-  *plen = (pval != 0) ? wcslen((wchar_t *)pval) * sizeof(wchar_t) : 0;
+  *plen = sqlite3InteropUtf16Bytes(pval);
   return pval;
 }
 
@@ -853,7 +2514,6 @@ SQLITE_API int WINAPI sqlite3_cursor_rowid_interop(sqlite3_stmt *pstmt, int curs
 
   return ret;
 }
-#endif /* SQLITE_OS_WIN */
 
 /*****************************************************************************/
 
@@ -907,8 +2567,11 @@ SQLITE_PRIVATE void interopSleepFunc(
 #if SQLITE_OS_WINCE
   Sleep(m);
   sqlite3_result_int(context, WAIT_OBJECT_0);
-#else
+#elif SQLITE_OS_WIN
   sqlite3_result_int(context, SleepEx(m, TRUE));
+#else
+  sqlite3_sleep(m);
+  sqlite3_result_int(context, 0);
 #endif
 }
 
@@ -0,0 +1,39 @@
+#!/bin/bash
+#
+# compile-codec-benchmark.sh --
+#
+# Released to the public domain, use at your own risk!
+#
+# Builds the native benchmark that measures the cost of the page codec (see
+# "SQLite.Interop/src/bench/codecbench.c").  The SQLite core library and the
+# interop layer are compiled into it, using the same defines as the release
+# build of the interop library.
+#
+# Usage: codecbench ?file? ?rows? ?lookups?
+#
+
+scriptdir=`dirname "$BASH_SOURCE"`
+
+# The amalgamation is not kept in the source tree.  It must be the version
+# the interop layer is built against (3.8.2), because the codec uses internal
+# pager and btree interfaces.
+if [ ! -f "$scriptdir/../SQLite.Interop/src/core/sqlite3.c" ]; then
+  echo "SQLite.Interop/src/core/sqlite3.c not found: copy the SQLite 3.8.2 amalgamation there first." >&2
+  exit 1
+fi
+
+outdir="$scriptdir/../bin/2012/Release/bin"
+mkdir -p "$outdir"
+
+gcc -O2 -o "$outdir/codecbench" \
+    -I"$scriptdir/../SQLite.Interop/src/core" \
+    -DNDEBUG -DSQLITE_THREADSAFE=1 -DSQLITE_USE_URI=1 \
+    -DSQLITE_ENABLE_COLUMN_METADATA=1 -DSQLITE_ENABLE_STAT4=1 \
+    -DSQLITE_ENABLE_FTS3=1 -DSQLITE_ENABLE_LOAD_EXTENSION=1 \
+    -DSQLITE_ENABLE_RTREE=1 -DSQLITE_SOUNDEX=1 \
+    -DSQLITE_ENABLE_MEMORY_MANAGEMENT=1 -DSQLITE_HAS_CODEC=1 \
+    -DINTEROP_EXTENSION_FUNCTIONS=1 -DINTEROP_CODEC=1 \
+    -DINTEROP_VIRTUAL_TABLE=1 -DINTEROP_PERCENTILE_EXTENSION=1 \
+    -DINTEROP_TOTYPE_EXTENSION=1 -DINTEROP_REGEXP_EXTENSION=1 \
+    "$scriptdir/../SQLite.Interop/src/bench/codecbench.c" \
+    -lpthread -ldl -lm
@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# compile-interop-assembly-debug.sh --
+#
+# Released to the public domain, use at your own risk!
+#
+# Builds the SQLite.Interop native library (i.e. the SQLite core library, the
+# interop layer, the codec and the bundled extensions) as a shared library for
+# Linux and other POSIX platforms.  The defines match those used by the Visual
+# Studio projects (see "SQLite.Interop/props/*.props").
+#
+
+scriptdir=`dirname "$BASH_SOURCE"`
+
+if [[ "$OSTYPE" == "darwin"* ]]; then
+  libname=libSQLite.Interop.dylib
+else
+  libname=libSQLite.Interop.so
+fi
+
+outdir="$scriptdir/../bin/2012/Debug/bin"
+mkdir -p "$outdir"
+
+gcc -g -O0 -fPIC -shared -o "$outdir/$libname" \
+    -I"$scriptdir/../SQLite.Interop/src/core" \
+    -DSQLITE_DEBUG=1 -DSQLITE_MEMDEBUG=1 \
+    -DSQLITE_THREADSAFE=1 -DSQLITE_USE_URI=1 \
+    -DSQLITE_ENABLE_COLUMN_METADATA=1 -DSQLITE_ENABLE_STAT4=1 \
+    -DSQLITE_ENABLE_FTS3=1 -DSQLITE_ENABLE_LOAD_EXTENSION=1 \
+    -DSQLITE_ENABLE_RTREE=1 -DSQLITE_SOUNDEX=1 \
+    -DSQLITE_ENABLE_MEMORY_MANAGEMENT=1 -DSQLITE_HAS_CODEC=1 \
+    -DINTEROP_EXTENSION_FUNCTIONS=1 -DINTEROP_CODEC=1 \
+    -DINTEROP_VIRTUAL_TABLE=1 -DINTEROP_PERCENTILE_EXTENSION=1 \
+    -DINTEROP_TOTYPE_EXTENSION=1 -DINTEROP_REGEXP_EXTENSION=1 \
+    -DINTEROP_DEBUG=0x31F -DINTEROP_LOG=1 -DINTEROP_TEST_EXTENSION=1 \
+    "$scriptdir/../SQLite.Interop/src/win/interop.c" \
+    -lpthread -ldl -lm
@@ -68,6 +68,30 @@ namespace System.Data.SQLite
     protected bool _usePool;
     protected int _poolVersion;
 
+#if !SQLITE_STANDARD
+    /// <summary>
+    /// The timeout, in milliseconds, configured for the native busy handler,
+    /// or -1 if it has not been installed yet.
+    /// </summary>
+    private int _busyTimeout = -1;
+    /// <summary>
+    /// Non-zero if the native busy handler is limited to the time remaining
+    /// for the command currently being executed.
+    /// </summary>
+    private bool _busyDeadline;
+    /// <summary>
+    /// The minimum and maximum delays, in milliseconds, used by the native
+    /// busy handler between attempts to acquire a lock.
+    /// </summary>
+    private int _busyMinimumDelay = 1;
+    private int _busyMaximumDelay = 150;
+
+    /// <summary>
+    /// The log used to record slow statement executions, if any.
+    /// </summary>
+    private SQLiteSlowQueryLog _slowQueryLog;
+#endif
+
 #if (NET_35 || NET_40 || NET_45 || NET_451) && !PLATFORM_COMPACTFRAMEWORK
     private bool _buildingSchema;
 #endif
@@ -501,6 +525,21 @@ namespace System.Data.SQLite
         return rc;
     }
 
+    /// <summary>
+    /// Enables or disables lazy registration of the SQL functions bundled with
+    /// the interop assembly.  This is global to the process.
+    /// </summary>
+    /// <param name="value">Non-zero to enable lazy registration, zero otherwise.</param>
+    /// <returns>A standard SQLite return code (i.e. zero for success and non-zero for failure).</returns>
+    internal static SQLiteErrorCode StaticSetLazyExtensionFunctions(bool value)
+    {
+#if !SQLITE_STANDARD && INTEROP_EXTENSION_FUNCTIONS
+        return UnsafeNativeMethods.sqlite3_config_functions_interop(value ? 1 : 0);
+#else
+        return SQLiteErrorCode.Error;
+#endif
+    }
+
     /// <summary>
     /// Attempts to free as much heap memory as possible for the database connection.
     /// </summary>
@@ -622,8 +661,18 @@ namespace System.Data.SQLite
 #endif
         }
 
+        //
+        // NOTE: The interop assembly also wipes the keys cached by the codec
+        //       when shutting down.
+        //
         if (rc == SQLiteErrorCode.Ok)
+        {
+#if !SQLITE_STANDARD && INTEROP_CODEC
+            rc = UnsafeNativeMethods.sqlite3_shutdown_interop();
+#else
             rc = UnsafeNativeMethods.sqlite3_shutdown();
+#endif
+        }
 
         return rc;
     }
@@ -742,10 +791,78 @@ namespace System.Data.SQLite
     {
       IntPtr db = _sql;
       if (db == IntPtr.Zero) throw new SQLiteException("no connection handle available");
+#if !SQLITE_STANDARD
+      SQLiteErrorCode n = UnsafeNativeMethods.sqlite3_busy_backoff_interop(
+          db, nTimeoutMS, _busyMinimumDelay, _busyMaximumDelay);
+      if (n != SQLiteErrorCode.Ok) throw new SQLiteException(n, GetLastError());
+      _busyTimeout = nTimeoutMS;
+#else
       SQLiteErrorCode n = UnsafeNativeMethods.sqlite3_busy_timeout(db, nTimeoutMS);
       if (n != SQLiteErrorCode.Ok) throw new SQLiteException(n, GetLastError());
+#endif
+    }
+
+    internal override void SetBusyBackoff(int minimumDelay, int maximumDelay)
+    {
+#if !SQLITE_STANDARD
+      _busyMinimumDelay = minimumDelay;
+      _busyMaximumDelay = maximumDelay;
+      SetTimeout((_busyTimeout >= 0) ? _busyTimeout : 0);
+#endif
+    }
+
+    internal override void GetBusyStatistics(out long busy, out long retries, out long waitMilliseconds, out long timeouts)
+    {
+#if !SQLITE_STANDARD
+      SQLiteErrorCode n = UnsafeNativeMethods.sqlite3_busy_backoff_status_interop(
+          _sql, out busy, out retries, out waitMilliseconds, out timeouts);
+      if (n != SQLiteErrorCode.Ok) throw new SQLiteException(n, GetLastError());
+#else
+      busy = 0;
+      retries = 0;
+      waitMilliseconds = 0;
+      timeouts = 0;
+#endif
+    }
+
+#if !SQLITE_STANDARD
+    /// <summary>
+    /// Limits the time the native busy handler may wait for locks to the time
+    /// remaining before the command timeout expires, if that is less than the
+    /// configured busy timeout.  Lock waits then happen inside the native busy
+    /// handler rather than in the managed retry loops.  The configured busy
+    /// timeout is left alone; the limit is removed by ClearBusyDeadline.
+    /// </summary>
+    /// <param name="starttick">The tick count when the command started waiting</param>
+    /// <param name="timeout">The command timeout, in milliseconds</param>
+    private void SetBusyDeadline(uint starttick, uint timeout)
+    {
+      uint elapsed = (uint)Environment.TickCount - starttick;
+      int remaining = (elapsed < timeout) ? (int)Math.Min(timeout - elapsed, int.MaxValue) : 0;
+
+      if (_busyTimeout < 0 || (remaining >= _busyTimeout && !_busyDeadline))
+        return;
+
+      SQLiteErrorCode n = UnsafeNativeMethods.sqlite3_busy_deadline_interop(_sql, remaining);
+      if (n != SQLiteErrorCode.Ok) throw new SQLiteException(n, GetLastError());
+      _busyDeadline = true;
     }
 
+    /// <summary>
+    /// Removes the limit set by SetBusyDeadline, if any, so that the native
+    /// busy handler uses the configured busy timeout again.  This must be
+    /// called when the command that set the limit finishes.
+    /// </summary>
+    private void ClearBusyDeadline()
+    {
+      if (!_busyDeadline)
+        return;
+
+      _busyDeadline = false;
+      UnsafeNativeMethods.sqlite3_busy_deadline_interop(_sql, -1);
+    }
+#endif
+
     internal override bool Step(SQLiteStatement stmt)
     {
       SQLiteErrorCode n;
@@ -753,51 +870,196 @@ namespace System.Data.SQLite
       uint starttick = (uint)Environment.TickCount;
       uint timeout = (uint)(stmt._command._commandTimeout * 1000);
 
-      while (true)
-      {
-        n = UnsafeNativeMethods.sqlite3_step(stmt._sqlite_stmt);
-
-        if (n == SQLiteErrorCode.Row) return true;
-        if (n == SQLiteErrorCode.Done) return false;
+#if !SQLITE_STANDARD
+      SetBusyDeadline(starttick, timeout);
+#endif
 
-        if (n != SQLiteErrorCode.Ok)
+#if !SQLITE_STANDARD
+      try
+      {
+#endif
+        while (true)
         {
-          SQLiteErrorCode r;
+#if !SQLITE_STANDARD
+          if (stmt._columnValues != null)
+          {
+            n = UnsafeNativeMethods.sqlite3_step_row_interop(stmt._sqlite_stmt,
+              stmt._columnValues, stmt._columnValues.Length, StepRowText16, stmt._profile);
 
-          // An error occurred, attempt to reset the statement.  If the reset worked because the
-          // schema has changed, re-try the step again.  If it errored our because the database
-          // is locked, then keep retrying until the command timeout occurs.
-          r = Reset(stmt);
+            stmt._columnValuesValid = (n == SQLiteErrorCode.Row);
+          }
+          else if (stmt._profile != null)
+          {
+            n = UnsafeNativeMethods.sqlite3_step_profile_interop(stmt._sqlite_stmt, stmt._profile);
+          }
+          else
+#endif
+          {
+            n = UnsafeNativeMethods.sqlite3_step(stmt._sqlite_stmt);
+          }
 
-          if (r == SQLiteErrorCode.Ok)
-            throw new SQLiteException(n, GetLastError());
+          if (n == SQLiteErrorCode.Row) return true;
+          if (n == SQLiteErrorCode.Done) return false;
 
-          else if ((r == SQLiteErrorCode.Locked || r == SQLiteErrorCode.Busy) && stmt._command != null)
+          if (n != SQLiteErrorCode.Ok)
           {
-            // Keep trying
-            if (rnd == null) // First time we've encountered the lock
-              rnd = new Random();
+            SQLiteErrorCode r;
 
-            // If we've exceeded the command's timeout, give up and throw an error
-            if ((uint)Environment.TickCount - starttick > timeout)
+            // An error occurred, attempt to reset the statement.  If the reset worked because the
+            // schema has changed, re-try the step again.  If it errored our because the database
+            // is locked, then keep retrying until the command timeout occurs.
+            r = Reset(stmt);
+
+            if (r == SQLiteErrorCode.Ok)
+              throw new SQLiteException(n, GetLastError());
+
+            else if ((r == SQLiteErrorCode.Locked || r == SQLiteErrorCode.Busy) && stmt._command != null)
             {
-              throw new SQLiteException(r, GetLastError());
+              // Keep trying
+              if (rnd == null) // First time we've encountered the lock
+                rnd = new Random();
+
+              // If we've exceeded the command's timeout, give up and throw an error
+              if ((uint)Environment.TickCount - starttick > timeout)
+              {
+                throw new SQLiteException(r, GetLastError());
+              }
+              else
+              {
+                // Otherwise sleep for a random amount of time up to 150ms
+                System.Threading.Thread.Sleep(rnd.Next(1, 150));
+#if !SQLITE_STANDARD
+                SetBusyDeadline(starttick, timeout);
+#endif
+              }
             }
-            else
+          }
+        }
+#if !SQLITE_STANDARD
+      }
+      finally
+      {
+        ClearBusyDeadline();
+      }
+#endif
+    }
+
+#if !SQLITE_STANDARD
+    internal override bool StepBatch(SQLiteStatement stmt, SQLiteStatementBatch batch, ref bool current, bool rowsReturned)
+    {
+      SQLiteErrorCode n;
+      Random rnd = null;
+      uint starttick = (uint)Environment.TickCount;
+      uint timeout = (uint)(stmt._command._commandTimeout * 1000);
+
+      SetBusyDeadline(starttick, timeout);
+
+      // The native call steps the statement without updating the cached column values
+      stmt._columnValuesValid = false;
+
+      try
+      {
+        while (true)
+        {
+          int arenaUsed;
+
+          n = UnsafeNativeMethods.sqlite3_step_batch_interop(stmt._sqlite_stmt, current ? 1 : 0,
+            batch._columns, batch._rows, batch._types, batch._int64s, batch._doubles, batch._offsets,
+            batch._bytes, batch._arena, batch._arena.Length, out arenaUsed, out batch._count,
+            stmt._profile);
+
+          if (n == SQLiteErrorCode.Row)
+          {
+            current = true;
+            return true;
+          }
+
+          if (n == SQLiteErrorCode.Done)
+          {
+            current = false;
+            return false;
+          }
+
+          if (n == SQLiteErrorCode.TooBig)
+          {
+            // The current row does not fit in the arena, make room for it and try again
+            batch.GrowArena(arenaUsed);
+            current = true;
+            continue;
+          }
+
+          if (n != SQLiteErrorCode.Ok)
+          {
+            SQLiteErrorCode r;
+
+            // An error occurred, any rows fetched so far are discarded.  Attempt to reset the
+            // statement, using the same rules as the Step method.
+            batch._count = 0;
+            current = false;
+            r = Reset(stmt);
+
+            if (r == SQLiteErrorCode.Ok)
+              throw new SQLiteException(n, GetLastError());
+
+            else if ((r == SQLiteErrorCode.Locked || r == SQLiteErrorCode.Busy) && stmt._command != null)
             {
-              // Otherwise sleep for a random amount of time up to 150ms
-              System.Threading.Thread.Sleep(rnd.Next(1, 150));
+              // Retrying restarts the statement from its first row, which is only safe if none of
+              // the rows from this execution have been returned to the caller yet.
+              if (rowsReturned)
+                throw new SQLiteException(r, GetLastError());
+
+              // Keep trying
+              if (rnd == null) // First time we've encountered the lock
+                rnd = new Random();
+
+              // If we've exceeded the command's timeout, give up and throw an error
+              if ((uint)Environment.TickCount - starttick > timeout)
+              {
+                throw new SQLiteException(r, GetLastError());
+              }
+              else
+              {
+                // Otherwise sleep for a random amount of time up to 150ms
+                System.Threading.Thread.Sleep(rnd.Next(1, 150));
+                SetBusyDeadline(starttick, timeout);
+              }
             }
           }
         }
       }
+      finally
+      {
+        ClearBusyDeadline();
+      }
     }
 
+    /// <summary>
+    /// Non-zero if the text column values fetched while stepping a statement
+    /// should be encoded as UTF-16 instead of UTF-8.
+    /// </summary>
+    protected virtual int StepRowText16
+    {
+      get { return 0; }
+    }
+#endif
+
     internal override SQLiteErrorCode Reset(SQLiteStatement stmt)
     {
       SQLiteErrorCode n;
 
 #if !SQLITE_STANDARD
+      long stepTime = 0;
+      long rows = 0;
+
+      // The query plan of a slow statement is captured before the reset, so
+      // that the error the reset reports is not replaced by its own.
+      if ((_slowQueryLog != null) && (stmt._profile != null) &&
+          CheckSlowQuery(stmt, ref stepTime, ref rows))
+      {
+        LogSlowQuery(stmt, stepTime, rows);
+      }
+
+      stmt._columnValuesValid = false;
       n = UnsafeNativeMethods.sqlite3_reset_interop(stmt._sqlite_stmt);
 #else
       n = UnsafeNativeMethods.sqlite3_reset(stmt._sqlite_stmt);
@@ -830,6 +1092,234 @@ namespace System.Data.SQLite
       return n; // We reset OK, no schema changes
     }
 
+#if !SQLITE_STANDARD
+    /// <summary>
+    /// Determines if the execution of a statement that is about to be reset
+    /// took longer than the slow query threshold.  The statistics for its next
+    /// execution start from this point.
+    /// </summary>
+    /// <param name="stmt">The statement being reset</param>
+    /// <param name="stepTime">The nanoseconds spent stepping the statement</param>
+    /// <param name="rows">The number of rows returned by the statement</param>
+    /// <returns>Non-zero if the execution was slow</returns>
+    private bool CheckSlowQuery(SQLiteStatement stmt, ref long stepTime, ref long rows)
+    {
+      UnsafeNativeMethods.sqlite3_interop_profile profile = stmt._profile[0];
+
+      stepTime = profile.nStepTime - stmt._profileMark.nStepTime;
+      rows = profile.nRow - stmt._profileMark.nRow;
+      stmt._profileMark = profile;
+
+      return (stepTime > 0) && (stepTime / 100 >= _slowQueryLog.Threshold.Ticks);
+    }
+
+    /// <summary>
+    /// Records a slow execution of a statement, along with its query plan.  The
+    /// plan is captured now, on the thread executing the statement, so that it
+    /// reflects the schema and the statistics the statement actually ran with.
+    /// It is not cached by SQL text, because a cached plan would not follow later
+    /// schema changes or ANALYZE runs either.
+    /// </summary>
+    /// <param name="stmt">The statement that was slow</param>
+    /// <param name="stepTime">The nanoseconds spent stepping the statement</param>
+    /// <param name="rows">The number of rows returned by the statement</param>
+    private void LogSlowQuery(SQLiteStatement stmt, long stepTime, long rows)
+    {
+      string plan;
+
+      try
+      {
+        plan = GetQueryPlan(stmt._sqlStatement);
+      }
+      catch (Exception e)
+      {
+        plan = e.Message;
+      }
+
+      _slowQueryLog.Add(new SQLiteSlowQuery(DateTime.UtcNow, stmt._sqlStatement,
+        stmt.GetParameterShapes(), new TimeSpan(stepTime / 100), rows, plan));
+    }
+#endif
+
+    /// <summary>
+    /// Returns the output of EXPLAIN QUERY PLAN for a statement, one line per row.
+    /// The statement is prepared directly, rather than via Prepare(), so that the
+    /// busy timeout of the connection is left alone.  If the statement cannot be
+    /// explained, the error message is returned instead.
+    /// </summary>
+    /// <param name="strSql">The SQL text of the statement to explain</param>
+    /// <returns>The query plan, or the error message</returns>
+    internal override string GetQueryPlan(string strSql)
+    {
+      StringBuilder builder = new StringBuilder();
+      byte[] b = ToUTF8("EXPLAIN QUERY PLAN " + strSql);
+      GCHandle handle = GCHandle.Alloc(b, GCHandleType.Pinned);
+      SQLiteStatementHandle statementHandle = null;
+      SQLiteErrorCode n;
+
+      try
+      {
+        IntPtr stmt = IntPtr.Zero;
+        IntPtr ptr;
+#if !SQLITE_STANDARD
+        int len;
+#endif
+
+        try
+        {
+          // do nothing.
+        }
+        finally /* NOTE: Thread.Abort() protection. */
+        {
+#if !SQLITE_STANDARD
+          n = UnsafeNativeMethods.sqlite3_prepare_interop(_sql, handle.AddrOfPinnedObject(), b.Length - 1, out stmt, out ptr, out len);
+#else
+          n = UnsafeNativeMethods.sqlite3_prepare_v2(_sql, handle.AddrOfPinnedObject(), b.Length - 1, out stmt, out ptr);
+#endif
+
+          if ((n == SQLiteErrorCode.Ok) && (stmt != IntPtr.Zero))
+            statementHandle = new SQLiteStatementHandle(_sql, stmt);
+        }
+
+        if (n != SQLiteErrorCode.Ok) return GetLastError(n.ToString());
+        if (statementHandle == null) return String.Empty;
+
+        while ((n = UnsafeNativeMethods.sqlite3_step(statementHandle)) == SQLiteErrorCode.Row)
+        {
+          string detail;
+
+          if (builder.Length > 0) builder.Append(Environment.NewLine);
+
+#if !SQLITE_STANDARD
+          detail = UTF8ToString(UnsafeNativeMethods.sqlite3_column_text_interop(statementHandle, 3, out len), len);
+#else
+          detail = UTF8ToString(UnsafeNativeMethods.sqlite3_column_text(statementHandle, 3),
+            UnsafeNativeMethods.sqlite3_column_bytes(statementHandle, 3));
+#endif
+
+          builder.AppendFormat(CultureInfo.InvariantCulture, "{0} {1} {2} {3}",
+            UnsafeNativeMethods.sqlite3_column_int(statementHandle, 0),
+            UnsafeNativeMethods.sqlite3_column_int(statementHandle, 1),
+            UnsafeNativeMethods.sqlite3_column_int(statementHandle, 2), detail);
+        }
+
+        if (n != SQLiteErrorCode.Done) return GetLastError(n.ToString());
+      }
+      finally
+      {
+        if (statementHandle != null) statementHandle.Dispose();
+        handle.Free();
+      }
+
+      return builder.ToString();
+    }
+
+    internal override int[] ExecuteMany(SQLiteStatement stmt, object[][] parameterSets)
+    {
+      int[] indexes = stmt.GetParameterIndexes();
+      int[] changes = new int[parameterSets.Length];
+
+#if !SQLITE_STANDARD
+      UnsafeNativeMethods.sqlite3_interop_param[] parameters;
+      byte[] block;
+
+      // Whenever possible, bind, step, and reset the statement for all the sets of parameter values
+      // using only one native call.
+      if (stmt.TryPackParameters(parameterSets, indexes, out parameters, out block))
+      {
+        SQLiteErrorCode n;
+        Random rnd = null;
+        uint starttick = (uint)Environment.TickCount;
+        uint timeout = (uint)(stmt._command._commandTimeout * 1000);
+        int row = 0;
+
+        stmt._columnValuesValid = false;
+        SetBusyDeadline(starttick, timeout);
+
+        try
+        {
+          while (true)
+          {
+            n = UnsafeNativeMethods.sqlite3_execute_many_interop(stmt._sqlite_stmt, parameters,
+              parameters.Length, block, parameterSets.Length, row, changes, out row, stmt._profile);
+
+            if (n == SQLiteErrorCode.Ok)
+              return changes;
+
+            SQLiteErrorCode r;
+
+            // An error occurred, attempt to reset the statement using the same rules as the Step
+            // method.  The remaining sets of parameter values are retried from the failed one.
+            try
+            {
+              r = Reset(stmt);
+            }
+            catch (SQLiteException e)
+            {
+              throw new SQLiteException(e.ResultCode, GetExecuteManyError(row));
+            }
+
+            if (r == SQLiteErrorCode.Ok)
+              throw new SQLiteException(n, GetExecuteManyError(row));
+
+            else if ((r == SQLiteErrorCode.Locked || r == SQLiteErrorCode.Busy) && stmt._command != null)
+            {
+              // Keep trying
+              if (rnd == null) // First time we've encountered the lock
+                rnd = new Random();
+
+              // If we've exceeded the command's timeout, give up and throw an error
+              if ((uint)Environment.TickCount - starttick > timeout)
+              {
+                throw new SQLiteException(r, GetExecuteManyError(row));
+              }
+              else
+              {
+                // Otherwise sleep for a random amount of time up to 150ms
+                System.Threading.Thread.Sleep(rnd.Next(1, 150));
+                SetBusyDeadline(starttick, timeout);
+              }
+            }
+          }
+        }
+        finally
+        {
+          ClearBusyDeadline();
+        }
+      }
+#endif
+
+      for (int row = 0; row < parameterSets.Length; row++)
+      {
+        stmt.BindParameters(parameterSets[row], indexes);
+
+        try
+        {
+          while (Step(stmt)) ;
+        }
+        catch (SQLiteException e)
+        {
+          // The statement has already been reset by the Step method
+          throw new SQLiteException(e.ResultCode, GetExecuteManyError(row));
+        }
+
+        stmt.TryGetChanges(ref changes[row]);
+        Reset(stmt);
+      }
+
+      return changes;
+    }
+
+    /// <summary>
+    /// Returns the error message for a failed set of parameter values passed to ExecuteMany.
+    /// </summary>
+    /// <param name="row">The index of the failed set of parameter values</param>
+    private string GetExecuteManyError(int row)
+    {
+      return String.Format(CultureInfo.CurrentCulture,
+        "parameter set #{0}: {1}", row, GetLastError());
+    }
+
     internal override string GetLastError()
     {
         return GetLastError(null);
@@ -889,6 +1379,18 @@ namespace System.Data.SQLite
       Random rnd = null;
       uint starttick = (uint)Environment.TickCount;
 
+#if !SQLITE_STANDARD
+      UnsafeNativeMethods.sqlite3_interop_profile[] profile = null;
+
+      if (((flags & SQLiteConnectionFlags.ProfileStatements) == SQLiteConnectionFlags.ProfileStatements) ||
+          ((_slowQueryLog != null) && (cnn != null)))
+      {
+        profile = new UnsafeNativeMethods.sqlite3_interop_profile[1];
+      }
+
+      SetBusyDeadline(starttick, timeoutMS);
+#endif
+
       GCHandle handle = GCHandle.Alloc(b, GCHandleType.Pinned);
       IntPtr psql = handle.AddrOfPinnedObject();
       SQLiteStatementHandle statementHandle = null;
@@ -903,7 +1405,10 @@ namespace System.Data.SQLite
           finally /* NOTE: Thread.Abort() protection. */
           {
 #if !SQLITE_STANDARD
-            n = UnsafeNativeMethods.sqlite3_prepare_interop(_sql, psql, b.Length - 1, out stmt, out ptr, out len);
+            if (profile != null)
+              n = UnsafeNativeMethods.sqlite3_prepare_profile_interop(_sql, psql, b.Length - 1, out stmt, out ptr, out len, profile);
+            else
+              n = UnsafeNativeMethods.sqlite3_prepare_interop(_sql, psql, b.Length - 1, out stmt, out ptr, out len);
 #else
 #if USE_PREPARE_V2
             n = UnsafeNativeMethods.sqlite3_prepare_v2(_sql, psql, b.Length - 1, out stmt, out ptr);
@@ -999,6 +1504,9 @@ namespace System.Data.SQLite
             {
               // Otherwise sleep for a random amount of time up to 150ms
               System.Threading.Thread.Sleep(rnd.Next(1, 150));
+#if !SQLITE_STANDARD
+              SetBusyDeadline(starttick, timeoutMS);
+#endif
             }
           }
         }
@@ -1009,10 +1517,17 @@ namespace System.Data.SQLite
 
         if (statementHandle != null) cmd = new SQLiteStatement(this, flags, statementHandle, strSql.Substring(0, strSql.Length - strRemain.Length), previous);
 
+#if !SQLITE_STANDARD
+        if (cmd != null) cmd._profile = profile;
+#endif
+
         return cmd;
       }
       finally
       {
+#if !SQLITE_STANDARD
+        ClearBusyDeadline();
+#endif
         handle.Free();
       }
     }
@@ -1422,6 +1937,11 @@ namespace System.Data.SQLite
 
     internal override TypeAffinity ColumnAffinity(SQLiteStatement stmt, int index)
     {
+#if !SQLITE_STANDARD
+      UnsafeNativeMethods.sqlite3_interop_column column;
+      if (stmt.TryGetColumnValue(index, TypeAffinity.Uninitialized, out column))
+        return column.type;
+#endif
       return UnsafeNativeMethods.sqlite3_column_type(stmt._sqlite_stmt, index);
     }
 
@@ -1535,6 +2055,11 @@ namespace System.Data.SQLite
     internal override double GetDouble(SQLiteStatement stmt, int index)
     {
       double value;
+#if !SQLITE_STANDARD
+      UnsafeNativeMethods.sqlite3_interop_column column;
+      if (stmt.TryGetColumnValue(index, TypeAffinity.Double, out column))
+        return column.r;
+#endif
 #if !PLATFORM_COMPACTFRAMEWORK
       value = UnsafeNativeMethods.sqlite3_column_double(stmt._sqlite_stmt, index);
 #elif !SQLITE_STANDARD
@@ -1567,6 +2092,11 @@ namespace System.Data.SQLite
 
     internal override int GetInt32(SQLiteStatement stmt, int index)
     {
+#if !SQLITE_STANDARD
+      UnsafeNativeMethods.sqlite3_interop_column column;
+      if (stmt.TryGetColumnValue(index, TypeAffinity.Int64, out column))
+        return unchecked((int)column.i);
+#endif
       return UnsafeNativeMethods.sqlite3_column_int(stmt._sqlite_stmt, index);
     }
 
@@ -1578,6 +2108,11 @@ namespace System.Data.SQLite
     internal override long GetInt64(SQLiteStatement stmt, int index)
     {
       long value;
+#if !SQLITE_STANDARD
+      UnsafeNativeMethods.sqlite3_interop_column column;
+      if (stmt.TryGetColumnValue(index, TypeAffinity.Int64, out column))
+        return column.i;
+#endif
 #if !PLATFORM_COMPACTFRAMEWORK
       value = UnsafeNativeMethods.sqlite3_column_int64(stmt._sqlite_stmt, index);
 #elif !SQLITE_STANDARD
@@ -1596,6 +2131,10 @@ namespace System.Data.SQLite
     internal override string GetText(SQLiteStatement stmt, int index)
     {
 #if !SQLITE_STANDARD
+      UnsafeNativeMethods.sqlite3_interop_column column;
+      if (stmt.TryGetColumnValue(index, TypeAffinity.Text, out column))
+        return UTF8ToString(column.p, column.nBytes);
+
       int len;
       return UTF8ToString(UnsafeNativeMethods.sqlite3_column_text_interop(stmt._sqlite_stmt, index, out len), len);
 #else
@@ -1614,6 +2153,10 @@ namespace System.Data.SQLite
         return ToDateTime(GetInt32(stmt, index), _datetimeKind);
 
 #if !SQLITE_STANDARD
+      UnsafeNativeMethods.sqlite3_interop_column column;
+      if (stmt.TryGetColumnValue(index, TypeAffinity.Text, out column))
+        return ToDateTime(column.p, column.nBytes);
+
       int len;
       return ToDateTime(UnsafeNativeMethods.sqlite3_column_text_interop(stmt._sqlite_stmt, index, out len), len);
 #else
@@ -1624,7 +2167,21 @@ namespace System.Data.SQLite
 
     internal override long GetBytes(SQLiteStatement stmt, int index, int nDataOffset, byte[] bDest, int nStart, int nLength)
     {
-      int nlen = UnsafeNativeMethods.sqlite3_column_bytes(stmt._sqlite_stmt, index);
+      IntPtr ptr = IntPtr.Zero;
+      int nlen;
+
+#if !SQLITE_STANDARD
+      UnsafeNativeMethods.sqlite3_interop_column column;
+      if (stmt.TryGetColumnValue(index, TypeAffinity.Blob, out column))
+      {
+        ptr = column.p;
+        nlen = column.nBytes;
+      }
+      else
+#endif
+      {
+        nlen = UnsafeNativeMethods.sqlite3_column_bytes(stmt._sqlite_stmt, index);
+      }
 
       // If no destination buffer, return the size needed.
       if (bDest == null) return nlen;
@@ -1636,7 +2193,8 @@ namespace System.Data.SQLite
 
       if (nCopied > 0)
       {
-        IntPtr ptr = UnsafeNativeMethods.sqlite3_column_blob(stmt._sqlite_stmt, index);
+        if (ptr == IntPtr.Zero)
+          ptr = UnsafeNativeMethods.sqlite3_column_blob(stmt._sqlite_stmt, index);
 
         Marshal.Copy((IntPtr)(ptr.ToInt64() + nDataOffset), bDest, nStart, nCopied);
       }
@@ -2154,6 +2712,57 @@ namespace System.Data.SQLite
 
       if (n != SQLiteErrorCode.Ok) throw new SQLiteException(n, GetLastError());
     }
+
+    /// <summary>
+    /// Sets the log used to record the executions of statements that take longer
+    /// than its threshold.  Detecting them requires the interop assembly.
+    /// </summary>
+    /// <param name="log">The slow query log, or null to stop recording.</param>
+    internal override void SetSlowQueryLog(SQLiteSlowQueryLog log)
+    {
+#if !SQLITE_STANDARD
+      _slowQueryLog = log;
+#endif
+    }
+
+    /// <summary>
+    /// Configures the cache of prepared statements kept for reuse by the
+    /// connection.  The cache requires the interop assembly.
+    /// </summary>
+    /// <param name="maximumCount">The maximum number of cached statements.  Zero disables the cache.</param>
+    /// <param name="maximumBytes">The estimated maximum number of bytes used by the cached statements.</param>
+    internal override void SetStatementCache(int maximumCount, int maximumBytes)
+    {
+#if !SQLITE_STANDARD
+      SQLiteErrorCode n = UnsafeNativeMethods.sqlite3_statement_cache_interop(
+          _sql, maximumCount, maximumBytes);
+
+      if (n != SQLiteErrorCode.Ok) throw new SQLiteException(n, GetLastError());
+#endif
+    }
+
+    /// <summary>
+    /// Returns the current state of the prepared statement cache.  Without the
+    /// interop assembly, all of the values are zero.
+    /// </summary>
+    /// <param name="count">The number of cached statements.</param>
+    /// <param name="bytes">The estimated number of bytes used by the cached statements.</param>
+    /// <param name="hits">The number of prepares satisfied by the cache.</param>
+    /// <param name="misses">The number of prepares not satisfied by the cache.</param>
+    internal override void GetStatementCacheStatus(out int count, out int bytes, out long hits, out long misses)
+    {
+#if !SQLITE_STANDARD
+      SQLiteErrorCode n = UnsafeNativeMethods.sqlite3_statement_cache_status_interop(
+          _sql, out count, out bytes, out hits, out misses);
+
+      if (n != SQLiteErrorCode.Ok) throw new SQLiteException(n, GetLastError());
+#else
+      count = 0;
+      bytes = 0;
+      hits = 0;
+      misses = 0;
+#endif
+    }
     /// Gets the last SQLite error code
     internal override SQLiteErrorCode ResultCode()
     {
@@ -2189,6 +2798,17 @@ namespace System.Data.SQLite
       SQLiteErrorCode n = UnsafeNativeMethods.sqlite3_rekey(_sql, newPasswordBytes, (newPasswordBytes == null) ? 0 : newPasswordBytes.Length);
       if (n != SQLiteErrorCode.Ok) throw new SQLiteException(n, GetLastError());
     }
+
+    internal override void ChangePassword(byte[] newPasswordBytes, int pagesPerBatch, SQLiteRekeyCallback callback)
+    {
+#if !SQLITE_STANDARD
+      SQLiteErrorCode n = UnsafeNativeMethods.sqlite3_rekey_interop(_sql, newPasswordBytes, (newPasswordBytes == null) ? 0 : newPasswordBytes.Length, pagesPerBatch, callback, IntPtr.Zero);
+      GC.KeepAlive(callback);
+      if (n != SQLiteErrorCode.Ok) throw new SQLiteException(n, GetLastError());
+#else
+      ChangePassword(newPasswordBytes);
+#endif
+    }
 #endif
 
     internal override void SetAuthorizerHook(SQLiteAuthorizerCallback func)
@@ -2231,6 +2851,42 @@ namespace System.Data.SQLite
         return rc;
     }
 
+    internal override SQLiteErrorCode SetLogRing()
+    {
+#if !SQLITE_STANDARD
+        return UnsafeNativeMethods.sqlite3_config_log_ring_interop();
+#else
+        return SQLiteErrorCode.Error;
+#endif
+    }
+
+    internal override bool ReadLogRing(byte[] buffer, out int errorCode, out string message)
+    {
+#if !SQLITE_STANDARD
+        int n = UnsafeNativeMethods.sqlite3_log_ring_read_interop(
+            out errorCode, buffer, buffer.Length);
+
+        if (n >= 0)
+        {
+            message = Encoding.UTF8.GetString(buffer, 0, n);
+            return true;
+        }
+#endif
+        errorCode = 0;
+        message = null;
+        return false;
+    }
+
+    internal override void GetLogRingStatistics(out long written, out long dropped)
+    {
+#if !SQLITE_STANDARD
+        UnsafeNativeMethods.sqlite3_log_ring_status_interop(out written, out dropped);
+#else
+        written = 0;
+        dropped = 0;
+#endif
+    }
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
     /// <summary>
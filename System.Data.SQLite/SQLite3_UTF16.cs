@@ -290,9 +290,24 @@ namespace System.Data.SQLite
 #endif
     }
 
+#if !SQLITE_STANDARD
+    /// <summary>
+    /// The text column values fetched while stepping a statement are always
+    /// encoded as UTF-16 for this class.
+    /// </summary>
+    protected override int StepRowText16
+    {
+      get { return 1; }
+    }
+#endif
+
     internal override string GetText(SQLiteStatement stmt, int index)
     {
 #if !SQLITE_STANDARD
+      UnsafeNativeMethods.sqlite3_interop_column column;
+      if (stmt.TryGetColumnValue(index, TypeAffinity.Text, out column))
+        return UTF16ToString(column.p, column.nBytes);
+
       int len;
       return UTF16ToString(UnsafeNativeMethods.sqlite3_column_text16_interop(stmt._sqlite_stmt, index, out len), len);
 #else
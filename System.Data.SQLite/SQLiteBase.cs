@@ -115,6 +115,21 @@ namespace System.Data.SQLite
     /// <param name="nTimeoutMS">The number of milliseconds to wait before returning SQLITE_BUSY</param>
     internal abstract void SetTimeout(int nTimeoutMS);
     /// <summary>
+    /// Sets the delays used between attempts to acquire a lock held by another
+    /// connection.  The delay doubles after every attempt, within these bounds.
+    /// </summary>
+    /// <param name="minimumDelay">The delay before the first retry, in milliseconds</param>
+    /// <param name="maximumDelay">The maximum delay between retries, in milliseconds</param>
+    internal abstract void SetBusyBackoff(int minimumDelay, int maximumDelay);
+    /// <summary>
+    /// Returns the counters kept while waiting for locks held by other connections.
+    /// </summary>
+    /// <param name="busy">The number of times a lock had to be waited for</param>
+    /// <param name="retries">The number of retries after waiting</param>
+    /// <param name="waitMilliseconds">The total number of milliseconds spent waiting</param>
+    /// <param name="timeouts">The number of waits that timed out</param>
+    internal abstract void GetBusyStatistics(out long busy, out long retries, out long waitMilliseconds, out long timeouts);
+    /// <summary>
     /// Returns the text of the last error issued by SQLite
     /// </summary>
     /// <returns></returns>
@@ -161,6 +176,24 @@ namespace System.Data.SQLite
     /// <param name="stmt">The SQLiteStatement to step through</param>
     /// <returns>True if a row was returned, False if not.</returns>
     internal abstract bool Step(SQLiteStatement stmt);
+#if !SQLITE_STANDARD
+    /// <summary>
+    /// Steps through a prepared statement, fetching as many rows as will fit in the specified batch.
+    /// </summary>
+    /// <param name="stmt">The SQLiteStatement to step through</param>
+    /// <param name="batch">The batch that receives the column values of the rows</param>
+    /// <param name="current">
+    /// On input, true if the statement is positioned on a row that has not been consumed yet.  On output, true
+    /// if the statement is positioned on a row that did not fit in the batch.
+    /// </param>
+    /// <param name="rowsReturned">
+    /// True if rows from the current execution of the statement have already been returned to the caller.  In
+    /// that case, the statement cannot be restarted when the database is busy or locked, because doing so
+    /// would return those rows again.
+    /// </param>
+    /// <returns>True if more rows may be available, False if not.</returns>
+    internal abstract bool StepBatch(SQLiteStatement stmt, SQLiteStatementBatch batch, ref bool current, bool rowsReturned);
+#endif
     /// <summary>
     /// Resets a prepared statement so it can be executed again.  If the error returned is SQLITE_SCHEMA,
     /// transparently attempt to rebuild the SQL statement and throw an error if that was not possible.
@@ -168,6 +201,13 @@ namespace System.Data.SQLite
     /// <param name="stmt">The statement to reset</param>
     /// <returns>Returns -1 if the schema changed while resetting, 0 if the reset was sucessful or 6 (SQLITE_LOCKED) if the reset failed due to a lock</returns>
     internal abstract SQLiteErrorCode Reset(SQLiteStatement stmt);
+    /// <summary>
+    /// Executes a prepared statement once for each of the specified sets of parameter values.
+    /// </summary>
+    /// <param name="stmt">The statement to execute</param>
+    /// <param name="parameterSets">The sets of parameter values, in the same order as the parameter collection of the command</param>
+    /// <returns>The number of rows changed by each set of parameter values.</returns>
+    internal abstract int[] ExecuteMany(SQLiteStatement stmt, object[][] parameterSets);
 
     /// <summary>
     /// Attempts to interrupt the query currently executing on the associated
@@ -353,6 +393,37 @@ namespace System.Data.SQLite
     /// <returns></returns>
     internal abstract void SetExtendedResultCodes(bool bOnOff);
     /// <summary>
+    /// Configures the cache of prepared statements kept for reuse by the
+    /// database connection.
+    /// </summary>
+    /// <param name="maximumCount">
+    /// The maximum number of cached statements.  Zero disables the cache.
+    /// </param>
+    /// <param name="maximumBytes">
+    /// The estimated maximum number of bytes used by the cached statements.
+    /// </param>
+    internal abstract void SetStatementCache(int maximumCount, int maximumBytes);
+    /// <summary>
+    /// Sets the log used to record the executions of statements that take
+    /// longer than its threshold.
+    /// </summary>
+    /// <param name="log">The slow query log, or null to stop recording.</param>
+    internal abstract void SetSlowQueryLog(SQLiteSlowQueryLog log);
+    /// <summary>
+    /// Returns the output of EXPLAIN QUERY PLAN for a statement, one line per row.
+    /// </summary>
+    /// <param name="strSql">The SQL text of the statement to explain.</param>
+    /// <returns>The query plan, or the error message if the statement cannot be explained.</returns>
+    internal abstract string GetQueryPlan(string strSql);
+    /// <summary>
+    /// Returns the current state of the prepared statement cache.
+    /// </summary>
+    /// <param name="count">The number of cached statements.</param>
+    /// <param name="bytes">The estimated number of bytes used by the cached statements.</param>
+    /// <param name="hits">The number of prepares satisfied by the cache.</param>
+    /// <param name="misses">The number of prepares not satisfied by the cache.</param>
+    internal abstract void GetStatementCacheStatus(out int count, out int bytes, out long hits, out long misses);
+    /// <summary>
     /// Returns the numeric result code for the most recent failed SQLite API call
     /// associated with the database connection.
     /// </summary>
@@ -378,6 +449,14 @@ namespace System.Data.SQLite
 #if INTEROP_CODEC
     internal abstract void SetPassword(byte[] passwordBytes);
     internal abstract void ChangePassword(byte[] newPasswordBytes);
+    /// <summary>
+    /// Changes the password of the database, rewriting the pages in batches,
+    /// each in its own transaction.
+    /// </summary>
+    /// <param name="newPasswordBytes">The new password, or null to decrypt the database</param>
+    /// <param name="pagesPerBatch">The number of pages rewritten by each transaction, or zero to rewrite them all in one transaction</param>
+    /// <param name="callback">The callback invoked after each batch, or null</param>
+    internal abstract void ChangePassword(byte[] newPasswordBytes, int pagesPerBatch, SQLiteRekeyCallback callback);
 #endif
 
     internal abstract void SetAuthorizerHook(SQLiteAuthorizerCallback func);
@@ -386,6 +465,26 @@ namespace System.Data.SQLite
     internal abstract void SetTraceCallback(SQLiteTraceCallback func);
     internal abstract void SetRollbackHook(SQLiteRollbackCallback func);
     internal abstract SQLiteErrorCode SetLogCallback(SQLiteLogCallback func);
+    /// <summary>
+    /// Directs the messages logged by the SQLite core library into the native log ring buffer,
+    /// where they wait to be read, instead of calling back into managed code.
+    /// </summary>
+    /// <returns>A standard SQLite return code.</returns>
+    internal abstract SQLiteErrorCode SetLogRing();
+    /// <summary>
+    /// Reads the oldest message waiting in the native log ring buffer.
+    /// </summary>
+    /// <param name="buffer">The scratch buffer used to receive the message text</param>
+    /// <param name="errorCode">The error code associated with the message</param>
+    /// <param name="message">The message text</param>
+    /// <returns>Non-zero if a message was read; zero if the ring buffer is empty</returns>
+    internal abstract bool ReadLogRing(byte[] buffer, out int errorCode, out string message);
+    /// <summary>
+    /// Returns the number of messages written to, and dropped by, the native log ring buffer.
+    /// </summary>
+    /// <param name="written">The number of messages written</param>
+    /// <param name="dropped">The number of messages dropped because the ring buffer was full</param>
+    internal abstract void GetLogRingStatistics(out long written, out long dropped);
 
     /// <summary>
     /// Checks if the SQLite core library has been initialized in the current process.
@@ -983,6 +1082,23 @@ namespace System.Data.SQLite
       /// </summary>
       TraceWarning = 0x8000,
 
+      /// <summary>
+      /// When stepping a statement for a data reader, fetch the values of all
+      /// the columns of each row using one call into the native interop
+      /// assembly, instead of one call per column value.  This flag has no
+      /// effect when the standard SQLite library is being used.
+      /// </summary>
+      FetchRowOnStep = 0x10000,
+
+      /// <summary>
+      /// Collect execution statistics (e.g. the time spent preparing and
+      /// stepping, the number of rows returned, full scans, and sorts) for all
+      /// statements, which can then be queried via the
+      /// <see cref="SQLiteCommand.GetProfile" /> method.  This flag has no
+      /// effect when the standard SQLite library is being used.
+      /// </summary>
+      ProfileStatements = 0x20000,
+
       /// <summary>
       /// When binding and returning column values, always treat them as though
       /// they were plain text (i.e. no numeric, date/time, or other conversions
@@ -13,6 +13,7 @@ namespace System.Data.SQLite
   using System.Diagnostics;
   using System.Collections.Generic;
   using System.ComponentModel;
+  using System.Globalization;
 
   /// <summary>
   /// SQLite implementation of DbCommand.
@@ -854,6 +855,68 @@ namespace System.Data.SQLite
       }
     }
 
+    /// <summary>
+    /// Executes the command once for each of the specified sets of parameter values.  The command text must
+    /// contain exactly one SQL statement.  Each set of values must be in the same order as the parameter
+    /// collection, which is still used to match the values to the statement parameters and to determine how
+    /// each value is bound.  When possible, all the sets of values are bound and executed using only one
+    /// native call.
+    /// </summary>
+    /// <param name="parameterSets">The sets of parameter values.</param>
+    /// <returns>The number of rows inserted/updated affected by each set of parameter values.</returns>
+    public int[] ExecuteMany(
+        object[][] parameterSets
+        )
+    {
+      CheckDisposed();
+      SQLiteConnection.Check(_cnn);
+
+      if (parameterSets == null)
+        throw new ArgumentNullException("parameterSets");
+
+      int count = _parameterCollection.Count;
+
+      for (int index = 0; index < parameterSets.Length; index++)
+      {
+        if ((parameterSets[index] == null) || (parameterSets[index].Length < count))
+        {
+          throw new ArgumentException(String.Format(CultureInfo.CurrentCulture,
+            "Parameter set #{0} does not contain a value for each parameter.", index), "parameterSets");
+        }
+      }
+
+      InitializeForReader();
+
+      SQLiteStatement stmt = GetStatement(0);
+
+      if ((stmt == null) || (GetStatement(1) != null))
+        throw new InvalidOperationException("Command text must contain exactly one SQL statement");
+
+      return _cnn._sql.ExecuteMany(stmt, parameterSets);
+    }
+
+    /// <summary>
+    /// Returns the execution statistics collected for the statements of this
+    /// command since they were last prepared.  The statistics are only
+    /// collected when the <see cref="SQLiteConnectionFlags.ProfileStatements" />
+    /// connection flag is in use; otherwise, all of them will be zero.
+    /// </summary>
+    /// <returns>The execution statistics for this command.</returns>
+    public SQLiteStatementProfile GetProfile()
+    {
+      CheckDisposed();
+
+      SQLiteStatementProfile profile = new SQLiteStatementProfile();
+
+      if (_statementList != null)
+      {
+        foreach (SQLiteStatement stmt in _statementList)
+          stmt.AddProfile(profile);
+      }
+
+      return profile;
+    }
+
     /// <summary>
     /// Execute the command and return the first column of the first row of the resultset
     /// (if present), or null if no resultset was returned.
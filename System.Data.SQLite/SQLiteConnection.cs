@@ -202,6 +202,42 @@ namespace System.Data.SQLite
   /// <description>2000</description>
   /// </item>
   /// <item>
+  /// <description>Statement Cache Size</description>
+  /// <description>{number of statements}<br/>The maximum number of prepared statements kept by the interop assembly for reuse by subsequent commands with the same SQL text.  Zero disables the cache.</description>
+  /// <description>N</description>
+  /// <description>0</description>
+  /// </item>
+  /// <item>
+  /// <description>Statement Cache Bytes</description>
+  /// <description>{size in bytes}<br/>The estimated amount of memory the statement cache may use.</description>
+  /// <description>N</description>
+  /// <description>1048576</description>
+  /// </item>
+  /// <item>
+  /// <description>Busy Min Delay</description>
+  /// <description>{time in milliseconds}<br/>The delay before retrying to acquire a lock held by another connection.  The delay is doubled, with some random jitter, after every retry until the command timeout expires.</description>
+  /// <description>N</description>
+  /// <description>1</description>
+  /// </item>
+  /// <item>
+  /// <description>Busy Max Delay</description>
+  /// <description>{time in milliseconds}<br/>The maximum delay between retries to acquire a lock held by another connection.</description>
+  /// <description>N</description>
+  /// <description>150</description>
+  /// </item>
+  /// <item>
+  /// <description>Slow Query Threshold</description>
+  /// <description>{time in milliseconds}<br/>When greater than zero, the executions of statements that spend at least this long stepping are recorded, along with their query plans, in the <see cref="SlowQueryLog" /> of the connection.</description>
+  /// <description>N</description>
+  /// <description>0</description>
+  /// </item>
+  /// <item>
+  /// <description>Slow Query Log Size</description>
+  /// <description>{number of entries}<br/>The maximum number of slow queries kept by the connection.</description>
+  /// <description>N</description>
+  /// <description>100</description>
+  /// </item>
+  /// <item>
   /// <description>Synchronous</description>
   /// <description><b>Normal</b> - Normal file flushing behavior<br/><b>Full</b> - Full flushing after all writes<br/><b>Off</b> - Underlying OS flushes I/O's</description>
   /// <description>N</description>
@@ -354,6 +390,12 @@ namespace System.Data.SQLite
     private const int DefaultPageSize = 1024;
     private const int DefaultMaxPageCount = 0;
     private const int DefaultCacheSize = 2000;
+    private const int DefaultStatementCacheSize = 0;
+    private const int DefaultStatementCacheBytes = 1048576;
+    private const int DefaultBusyMinDelay = 1;
+    private const int DefaultBusyMaxDelay = 150;
+    private const int DefaultSlowQueryThreshold = 0;
+    private const int DefaultSlowQueryLogSize = 100;
     private const int DefaultMaxPoolSize = 100;
     private const int DefaultConnectionTimeout = 30;
     private const bool DefaultFailIfMissing = false;
@@ -483,11 +525,19 @@ namespace System.Data.SQLite
     private event SQLiteCommitHandler _commitHandler;
     private event SQLiteTraceEventHandler _traceHandler;
     private event EventHandler _rollbackHandler;
+#if INTEROP_CODEC
+    private SQLiteRekeyProgressHandler _rekeyProgressHandler;
+#endif
 
     private SQLiteAuthorizerCallback _authorizerCallback;
     private SQLiteUpdateCallback _updateCallback;
     private SQLiteCommitCallback _commitCallback;
     private SQLiteTraceCallback _traceCallback;
+
+    /// <summary>
+    /// The log of slow queries for this connection, if enabled.
+    /// </summary>
+    private SQLiteSlowQueryLog _slowQueryLog;
     private SQLiteRollbackCallback _rollbackCallback;
     #endregion
 
@@ -1399,6 +1449,42 @@ namespace System.Data.SQLite
     /// <description>2000</description>
     /// </item>
     /// <item>
+    /// <description>Statement Cache Size</description>
+    /// <description>{number of statements}<br/>The maximum number of prepared statements kept by the interop assembly for reuse by subsequent commands with the same SQL text.  Zero disables the cache.</description>
+    /// <description>N</description>
+    /// <description>0</description>
+    /// </item>
+    /// <item>
+    /// <description>Statement Cache Bytes</description>
+    /// <description>{size in bytes}<br/>The estimated amount of memory the statement cache may use.</description>
+    /// <description>N</description>
+    /// <description>1048576</description>
+    /// </item>
+    /// <item>
+    /// <description>Busy Min Delay</description>
+    /// <description>{time in milliseconds}<br/>The delay before retrying to acquire a lock held by another connection.  The delay is doubled, with some random jitter, after every retry until the command timeout expires.</description>
+    /// <description>N</description>
+    /// <description>1</description>
+    /// </item>
+    /// <item>
+    /// <description>Busy Max Delay</description>
+    /// <description>{time in milliseconds}<br/>The maximum delay between retries to acquire a lock held by another connection.</description>
+    /// <description>N</description>
+    /// <description>150</description>
+    /// </item>
+    /// <item>
+    /// <description>Slow Query Threshold</description>
+    /// <description>{time in milliseconds}<br/>When greater than zero, the executions of statements that spend at least this long stepping are recorded, along with their query plans, in the <see cref="SlowQueryLog" /> of the connection.</description>
+    /// <description>N</description>
+    /// <description>0</description>
+    /// </item>
+    /// <item>
+    /// <description>Slow Query Log Size</description>
+    /// <description>{number of entries}<br/>The maximum number of slow queries kept by the connection.</description>
+    /// <description>N</description>
+    /// <description>100</description>
+    /// </item>
+    /// <item>
     /// <description>Synchronous</description>
     /// <description><b>Normal</b> - Normal file flushing behavior<br/><b>Full</b> - Full flushing after all writes<br/><b>Off</b> - Underlying OS flushes I/O's</description>
     /// <description>N</description>
@@ -2138,6 +2224,28 @@ namespace System.Data.SQLite
 
         _binaryGuid = SQLiteConvert.ToBoolean(FindKey(opts, "BinaryGUID", DefaultBinaryGUID.ToString()));
 
+        _sql.SetStatementCache(
+            Convert.ToInt32(FindKey(opts, "Statement Cache Size", DefaultStatementCacheSize.ToString()), CultureInfo.InvariantCulture),
+            Convert.ToInt32(FindKey(opts, "Statement Cache Bytes", DefaultStatementCacheBytes.ToString()), CultureInfo.InvariantCulture));
+
+        _sql.SetBusyBackoff(
+            Convert.ToInt32(FindKey(opts, "Busy Min Delay", DefaultBusyMinDelay.ToString()), CultureInfo.InvariantCulture),
+            Convert.ToInt32(FindKey(opts, "Busy Max Delay", DefaultBusyMaxDelay.ToString()), CultureInfo.InvariantCulture));
+
+        int slowQueryThreshold = Convert.ToInt32(FindKey(opts, "Slow Query Threshold", DefaultSlowQueryThreshold.ToString()), CultureInfo.InvariantCulture);
+
+        if (slowQueryThreshold > 0)
+        {
+          _slowQueryLog = new SQLiteSlowQueryLog(TimeSpan.FromMilliseconds(slowQueryThreshold),
+            Convert.ToInt32(FindKey(opts, "Slow Query Log Size", DefaultSlowQueryLogSize.ToString()), CultureInfo.InvariantCulture));
+        }
+        else
+        {
+          _slowQueryLog = null;
+        }
+
+        _sql.SetSlowQueryLog(_slowQueryLog);
+
 #if INTEROP_CODEC
         string hexPassword = FindKey(opts, "HexPassword", DefaultHexPassword);
 
@@ -2474,6 +2582,61 @@ namespace System.Data.SQLite
       }
     }
 
+    /// <summary>
+    /// Returns the current state of the prepared statement cache for this
+    /// connection, as configured by the "Statement Cache Size" and
+    /// "Statement Cache Bytes" connection string properties.
+    /// </summary>
+    /// <param name="count">The number of statements currently cached.</param>
+    /// <param name="bytes">The estimated number of bytes used by the cached statements.</param>
+    /// <param name="hits">The number of prepares satisfied by the cache.</param>
+    /// <param name="misses">The number of prepares not satisfied by the cache.</param>
+    public void GetStatementCacheStatistics(out int count, out int bytes, out long hits, out long misses)
+    {
+      CheckDisposed();
+
+      if (_sql == null)
+        throw new InvalidOperationException("Database connection not valid for getting statement cache statistics.");
+
+      _sql.GetStatementCacheStatus(out count, out bytes, out hits, out misses);
+    }
+
+    /// <summary>
+    /// Returns the counters kept by this connection while waiting for locks
+    /// held by other connections.
+    /// </summary>
+    /// <param name="busy">The number of times a lock had to be waited for.</param>
+    /// <param name="retries">The number of retries after waiting.</param>
+    /// <param name="waitMilliseconds">The total number of milliseconds spent waiting.</param>
+    /// <param name="timeouts">The number of waits that timed out.</param>
+    public void GetBusyStatistics(out long busy, out long retries, out long waitMilliseconds, out long timeouts)
+    {
+      CheckDisposed();
+
+      if (_sql == null)
+        throw new InvalidOperationException("Database connection not valid for getting busy statistics.");
+
+      _sql.GetBusyStatistics(out busy, out retries, out waitMilliseconds, out timeouts);
+    }
+
+    /// <summary>
+    /// Returns the log of the slow queries executed by this connection, or null
+    /// if the "Slow Query Threshold" connection string property was not used
+    /// when the connection was opened.  Slow queries can only be detected when
+    /// the interop assembly is being used.
+    /// </summary>
+#if !PLATFORM_COMPACTFRAMEWORK
+    [Browsable(false), DesignerSerializationVisibility(DesignerSerializationVisibility.Hidden)]
+#endif
+    public SQLiteSlowQueryLog SlowQueryLog
+    {
+      get
+      {
+        CheckDisposed();
+        return _slowQueryLog;
+      }
+    }
+
     /// <summary>
     /// Returns the maximum amount of memory (in bytes) used by the SQLite core library since the high-water mark was last reset.
     /// </summary>
@@ -2590,6 +2753,20 @@ namespace System.Data.SQLite
         return SQLite3.StaticSetMemoryStatus(value);
     }
 
+    /// <summary>
+    /// Sets how the SQL functions bundled with the interop assembly (e.g. the extension functions, percentile, totype
+    /// and regexp) are registered with new connections.  By default, all of them are created while each connection is
+    /// being opened.  If lazy registration is enabled, they will only be created, all at once, for connections that
+    /// prepare a statement using a function that does not exist yet.  This is not really a per-connection value, it is
+    /// global to the process.
+    /// </summary>
+    /// <param name="value">Non-zero to enable lazy registration, zero otherwise.</param>
+    /// <returns>A standard SQLite return code (i.e. zero for success and non-zero for failure).</returns>
+    public static SQLiteErrorCode SetLazyExtensionFunctions(bool value)
+    {
+        return SQLite3.StaticSetLazyExtensionFunctions(value);
+    }
+
     /// <summary>
     /// Returns a string containing the define constants (i.e. compile-time
     /// options) used to compile the core managed assembly, delimited with
@@ -2861,6 +3038,86 @@ namespace System.Data.SQLite
       _sql.ChangePassword(newPassword);
     }
 
+    /// <summary>
+    /// Change the password (or assign a password) to an open database, rewriting the pages of the
+    /// database in batches.  Each batch is rewritten by its own transaction, so other connections are
+    /// only ever blocked for one batch.
+    /// </summary>
+    /// <remarks>
+    /// The progress is recorded in the database after each batch.  If the change is cancelled or
+    /// interrupted, it continues where it left off when this method is called again with the same
+    /// password.  Until the change is finished, only connections in this process can use the database;
+    /// connections in other processes fail with <see cref="SQLiteErrorCode.NotADb" />.  A database
+    /// that is not encrypted yet cannot be encrypted in batches, because connections without a
+    /// password could not tell which pages were already encrypted; use a <paramref name="pagesPerBatch" />
+    /// of zero for such a database.  The same applies to a database encrypted using the format of
+    /// versions before 1.0.91.0, which is converted to the current format by the change.
+    /// </remarks>
+    /// <param name="newPassword">The new password to assign to the database</param>
+    /// <param name="pagesPerBatch">The number of pages rewritten by each transaction, or zero to
+    /// rewrite all of them using a single transaction</param>
+    /// <param name="progress">Invoked after each batch; may be null</param>
+    /// <exception cref="SQLiteException">The change failed or, with a result code of
+    /// <see cref="SQLiteErrorCode.Interrupt" />, was cancelled by <paramref name="progress" /> via
+    /// <see cref="RekeyProgressEventArgs.Cancel" />.  The pages rewritten so far keep the new
+    /// password.</exception>
+    public void ChangePassword(string newPassword, int pagesPerBatch, SQLiteRekeyProgressHandler progress)
+    {
+      CheckDisposed();
+
+      ChangePassword(String.IsNullOrEmpty(newPassword) ? null : UTF8Encoding.UTF8.GetBytes(newPassword), pagesPerBatch, progress);
+    }
+
+    /// <summary>
+    /// Change the password (or assign a password) to an open database, rewriting the pages of the
+    /// database in batches.  Each batch is rewritten by its own transaction, so other connections are
+    /// only ever blocked for one batch.
+    /// </summary>
+    /// <remarks>
+    /// The progress is recorded in the database after each batch.  If the change is cancelled or
+    /// interrupted, it continues where it left off when this method is called again with the same
+    /// password.  Until the change is finished, only connections in this process can use the database;
+    /// connections in other processes fail with <see cref="SQLiteErrorCode.NotADb" />.  A database
+    /// that is not encrypted yet cannot be encrypted in batches, because connections without a
+    /// password could not tell which pages were already encrypted; use a <paramref name="pagesPerBatch" />
+    /// of zero for such a database.  The same applies to a database encrypted using the format of
+    /// versions before 1.0.91.0, which is converted to the current format by the change.
+    /// </remarks>
+    /// <param name="newPassword">The new password to assign to the database</param>
+    /// <param name="pagesPerBatch">The number of pages rewritten by each transaction, or zero to
+    /// rewrite all of them using a single transaction</param>
+    /// <param name="progress">Invoked after each batch; may be null</param>
+    /// <exception cref="SQLiteException">The change failed or, with a result code of
+    /// <see cref="SQLiteErrorCode.Interrupt" />, was cancelled by <paramref name="progress" /> via
+    /// <see cref="RekeyProgressEventArgs.Cancel" />.  The pages rewritten so far keep the new
+    /// password.</exception>
+    public void ChangePassword(byte[] newPassword, int pagesPerBatch, SQLiteRekeyProgressHandler progress)
+    {
+      CheckDisposed();
+
+      if (_connectionState != ConnectionState.Open)
+        throw new InvalidOperationException("Database must be opened before changing the password.");
+
+      _rekeyProgressHandler = progress;
+
+      try
+      {
+        _sql.ChangePassword(newPassword, pagesPerBatch,
+            (progress != null) ? new SQLiteRekeyCallback(RekeyCallback) : null);
+      }
+      finally
+      {
+        _rekeyProgressHandler = null;
+      }
+    }
+
+    private int RekeyCallback(IntPtr puser, int pagesDone, int pagesTotal)
+    {
+      RekeyProgressEventArgs e = new RekeyProgressEventArgs(pagesDone, pagesTotal);
+      _rekeyProgressHandler(this, e);
+      return e.Cancel ? 1 : 0;
+    }
+
     /// <summary>
     /// Sets the password for a password-protected database.  A password-protected database is
     /// unusable for any operation until the password has been set.
@@ -4370,6 +4627,13 @@ namespace System.Data.SQLite
 #endif
   internal delegate void SQLiteRollbackCallback(IntPtr puser);
 
+#if INTEROP_CODEC
+#if !PLATFORM_COMPACTFRAMEWORK
+  [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+#endif
+  internal delegate int SQLiteRekeyCallback(IntPtr puser, int pagesDone, int pagesTotal);
+#endif
+
   /// <summary>
   /// Raised when authorization is required to perform an action contained
   /// within a SQL query.
@@ -4401,6 +4665,18 @@ namespace System.Data.SQLite
   /// <param name="e">Event arguments of the trace</param>
   public delegate void SQLiteTraceEventHandler(object sender, TraceEventArgs e);
 
+#if INTEROP_CODEC
+  /// <summary>
+  /// Raised after each batch of pages is rewritten while the password of a database is changed.
+  /// To stop changing the password, set the Cancel boolean value to true, which makes
+  /// ChangePassword throw a <see cref="SQLiteException" /> with a result code of
+  /// <see cref="SQLiteErrorCode.Interrupt" />.
+  /// </summary>
+  /// <param name="sender">The connection changing the password</param>
+  /// <param name="e">Event arguments on the progress</param>
+  public delegate void SQLiteRekeyProgressHandler(object sender, RekeyProgressEventArgs e);
+#endif
+
   ///////////////////////////////////////////////////////////////////////////////////////////////
 
   #region Backup API Members
@@ -4653,4 +4929,36 @@ namespace System.Data.SQLite
     }
   }
 
+#if INTEROP_CODEC
+  /// <summary>
+  /// Event arguments raised after each batch of pages is rewritten while the password of a database is changed
+  /// </summary>
+  public class RekeyProgressEventArgs : EventArgs
+  {
+    /// <summary>
+    /// The number of pages rewritten so far, including those rewritten before the change was interrupted
+    /// </summary>
+    public readonly int PagesDone;
+
+    /// <summary>
+    /// The number of pages in the database
+    /// </summary>
+    public readonly int PagesTotal;
+
+    /// <summary>
+    /// Set to true to stop changing the password.  ChangePassword then throws a
+    /// <see cref="SQLiteException" /> with a result code of <see cref="SQLiteErrorCode.Interrupt" />.
+    /// The change continues where it left off the next time the password is changed to the same
+    /// password.  Setting this after the last batch has no effect.
+    /// </summary>
+    public bool Cancel;
+
+    internal RekeyProgressEventArgs(int pagesDone, int pagesTotal)
+    {
+      PagesDone = pagesDone;
+      PagesTotal = pagesTotal;
+    }
+  }
+#endif
+
 }
@@ -435,6 +435,132 @@ namespace System.Data.SQLite
       }
     }
 
+    /// <summary>
+    /// Gets/Sets the maximum number of prepared statements cached for reuse by
+    /// the connection.  Zero disables the statement cache.
+    /// </summary>
+    [DisplayName("Statement Cache Size")]
+    [Browsable(true)]
+    [DefaultValue(0)]
+    public int StatementCacheSize
+    {
+      get
+      {
+        object value;
+        TryGetValue("statement cache size", out value);
+        return Convert.ToInt32(value, CultureInfo.CurrentCulture);
+      }
+      set
+      {
+        this["statement cache size"] = value;
+      }
+    }
+
+    /// <summary>
+    /// Gets/Sets the estimated maximum number of bytes used by the prepared
+    /// statement cache for the connection.
+    /// </summary>
+    [DisplayName("Statement Cache Bytes")]
+    [Browsable(true)]
+    [DefaultValue(1048576)]
+    public int StatementCacheBytes
+    {
+      get
+      {
+        object value;
+        TryGetValue("statement cache bytes", out value);
+        return Convert.ToInt32(value, CultureInfo.CurrentCulture);
+      }
+      set
+      {
+        this["statement cache bytes"] = value;
+      }
+    }
+
+    /// <summary>
+    /// Gets/Sets the delay, in milliseconds, before retrying to acquire a lock
+    /// held by another connection.
+    /// </summary>
+    [DisplayName("Busy Min Delay")]
+    [Browsable(true)]
+    [DefaultValue(1)]
+    public int BusyMinDelay
+    {
+      get
+      {
+        object value;
+        TryGetValue("busy min delay", out value);
+        return Convert.ToInt32(value, CultureInfo.CurrentCulture);
+      }
+      set
+      {
+        this["busy min delay"] = value;
+      }
+    }
+
+    /// <summary>
+    /// Gets/Sets the maximum delay, in milliseconds, between retries to acquire
+    /// a lock held by another connection.
+    /// </summary>
+    [DisplayName("Busy Max Delay")]
+    [Browsable(true)]
+    [DefaultValue(150)]
+    public int BusyMaxDelay
+    {
+      get
+      {
+        object value;
+        TryGetValue("busy max delay", out value);
+        return Convert.ToInt32(value, CultureInfo.CurrentCulture);
+      }
+      set
+      {
+        this["busy max delay"] = value;
+      }
+    }
+
+    /// <summary>
+    /// Gets/Sets the minimum time, in milliseconds, spent stepping a statement
+    /// for its execution to be recorded in the slow query log.  Zero disables
+    /// the slow query log.
+    /// </summary>
+    [DisplayName("Slow Query Threshold")]
+    [Browsable(true)]
+    [DefaultValue(0)]
+    public int SlowQueryThreshold
+    {
+      get
+      {
+        object value;
+        TryGetValue("slow query threshold", out value);
+        return Convert.ToInt32(value, CultureInfo.CurrentCulture);
+      }
+      set
+      {
+        this["slow query threshold"] = value;
+      }
+    }
+
+    /// <summary>
+    /// Gets/Sets the maximum number of slow queries kept by the connection.
+    /// </summary>
+    [DisplayName("Slow Query Log Size")]
+    [Browsable(true)]
+    [DefaultValue(100)]
+    public int SlowQueryLogSize
+    {
+      get
+      {
+        object value;
+        TryGetValue("slow query log size", out value);
+        return Convert.ToInt32(value, CultureInfo.CurrentCulture);
+      }
+      set
+      {
+        this["slow query log size"] = value;
+      }
+    }
+
     /// <summary>
     /// Gets/Sets the DateTime format for the connection.
     /// </summary>
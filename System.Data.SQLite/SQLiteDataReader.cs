@@ -76,6 +76,17 @@ namespace System.Data.SQLite
     /// </summary>
     private SQLiteKeyReader _keyInfo;
 
+#if !SQLITE_STANDARD
+    /// <summary>
+    /// The columnar buffers used by the ReadBatch method, if any.
+    /// </summary>
+    private SQLiteStatementBatch _batch;
+    /// <summary>
+    /// Set if the ReadBatch method has returned any rows from the current resultset.
+    /// </summary>
+    private bool _batchRowsReturned;
+#endif
+
     /// <summary>
     /// Matches the version of the connection.
     /// </summary>
@@ -1258,6 +1269,17 @@ namespace System.Data.SQLite
 
         fieldCount = stmt._sql.ColumnCount(stmt);
 
+#if !SQLITE_STANDARD
+        _batchRowsReturned = false;
+
+        // If requested, fetch all the column values for each row while stepping the statement
+        if (!schemaOnly && (fieldCount > 0) &&
+            ((SQLiteCommand.GetFlags(_command) & SQLiteConnectionFlags.FetchRowOnStep) == SQLiteConnectionFlags.FetchRowOnStep))
+        {
+          stmt.EnableColumnValues(fieldCount);
+        }
+#endif
+
         // If the statement is not a select statement or we're not retrieving schema only, then perform the initial step
         if (!schemaOnly || (fieldCount == 0))
         {
@@ -1394,6 +1416,123 @@ namespace System.Data.SQLite
       return false;
     }
 
+    /// <summary>
+    /// Returns the execution statistics collected for the statements of the
+    /// command associated with this data reader.  See the
+    /// <see cref="SQLiteCommand.GetProfile" /> method for details.
+    /// </summary>
+    /// <returns>The execution statistics for the command.</returns>
+    public SQLiteStatementProfile GetProfile()
+    {
+      CheckDisposed();
+      CheckClosed();
+
+      return _command.GetProfile();
+    }
+
+    /// <summary>
+    /// Reads up to the specified number of rows from the resultset at once.  When possible, the rows are
+    /// fetched using only one native call per batch, instead of one (or more) per column of each row.
+    /// Unlike the GetValue method, the column values are returned based solely on their storage class
+    /// (i.e. Int64, Double, String, byte[], or DBNull), without regard to the declared column types.
+    /// The Read method and this method may be freely intermixed; however, after this method returns, the
+    /// current row, if any, is no longer valid.
+    /// </summary>
+    /// <param name="values">
+    /// The array of rows to fill.  Its length is the maximum number of rows to read.  Each element that is
+    /// null or too small to hold the visible columns of the resultset will be replaced with a new array.
+    /// </param>
+    /// <returns>The number of rows read, zero if there are no more rows.</returns>
+    public int ReadBatch(object[][] values)
+    {
+      CheckDisposed();
+      CheckClosed();
+      if (_throwOnDisposed) SQLiteCommand.Check(_command);
+
+      if (values == null)
+        throw new ArgumentNullException("values");
+
+      if ((_commandBehavior & CommandBehavior.SchemaOnly) != 0)
+        return 0;
+
+      if ((_readingState == 1) || (values.Length == 0))
+        return 0;
+
+      int maxRows = values.Length;
+
+      // Don't read past the first row if the command behavior dictates SingleRow.
+      if ((_commandBehavior & CommandBehavior.SingleRow) != 0)
+      {
+        if (_readingState != -1)
+        {
+          _readingState = 1;
+          return 0;
+        }
+
+        maxRows = 1;
+      }
+
+      int count = 0;
+
+#if !SQLITE_STANDARD
+      if ((_batch == null) || (_batch._columns != _fieldCount) || (_batch._rows != maxRows))
+        _batch = new SQLiteStatementBatch(_fieldCount, maxRows);
+
+      bool current = (_readingState == -1);
+      bool rowsReturned = (_readingState == 0) || _batchRowsReturned;
+
+      if (_activeStatement._sql.StepBatch(_activeStatement, _batch, ref current, rowsReturned))
+        _readingState = current ? -1 : 0;
+      else
+        _readingState = 1;
+
+      count = _batch._count;
+
+      if (count > 0)
+        _batchRowsReturned = true;
+
+      for (int row = 0; row < count; row++)
+      {
+        object[] rowValues = values[row];
+
+        if ((rowValues == null) || (rowValues.Length < _fieldCount))
+          values[row] = rowValues = new object[_fieldCount];
+
+        for (int n = 0; n < _fieldCount; n++)
+          rowValues[n] = _batch.GetValue(n, row);
+      }
+#else
+      while ((count < maxRows) && Read())
+      {
+        object[] rowValues = values[count];
+
+        if ((rowValues == null) || (rowValues.Length < _fieldCount))
+          values[count] = rowValues = new object[_fieldCount];
+
+        for (int n = 0; n < _fieldCount; n++)
+        {
+          SQLiteType typ = new SQLiteType();
+
+          typ.Affinity = _activeStatement._sql.ColumnAffinity(_activeStatement, n);
+          typ.Type = DbType.Object;
+
+          rowValues[n] = _activeStatement._sql.GetValue(
+              _activeStatement, SQLiteConnectionFlags.Default, n, typ);
+        }
+
+        count++;
+      }
+#endif
+
+      if ((_commandBehavior & CommandBehavior.SingleRow) != 0)
+        _readingState = 1;
+
+      if (_keyInfo != null)
+        _keyInfo.Reset();
+
+      return count;
+    }
+
     /// <summary>
     /// Retrieve the count of records affected by an update/insert command.  Only valid once the data reader is closed!
     /// </summary>
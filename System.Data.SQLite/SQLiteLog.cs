@@ -11,6 +11,7 @@ namespace System.Data.SQLite
     using System.Data.Common;
     using System.Diagnostics;
     using System.Globalization;
+    using System.IO;
 
     /// <summary>
     /// Event data for logging event handlers.
@@ -128,9 +129,74 @@ namespace System.Data.SQLite
         ///////////////////////////////////////////////////////////////////////
 
         /// <summary>
-        /// Initializes the SQLite logging facilities.
+        /// This will be non-zero if the messages logged by the SQLite core
+        /// library are being written into the native log ring buffer instead
+        /// of being delivered via the native callback.
+        /// </summary>
+        private static bool _ring;
+
+        ///////////////////////////////////////////////////////////////////////
+
+        /// <summary>
+        /// The maximum number of bytes kept for each message in the native
+        /// log ring buffer.  This must match the value used by the native
+        /// code.
+        /// </summary>
+        private const int RingMessageSize = 256;
+
+        ///////////////////////////////////////////////////////////////////////
+
+        /// <summary>
+        /// Object used to make sure that only one thread at a time reads from
+        /// the native log ring buffer.
+        /// </summary>
+        private static object drainSyncRoot = new object();
+
+        ///////////////////////////////////////////////////////////////////////
+
+        /// <summary>
+        /// The scratch buffer used when reading messages from the native log
+        /// ring buffer.  Access to this is protected by the drainSyncRoot
+        /// object.
+        /// </summary>
+        private static byte[] _ringBuffer;
+
+        ///////////////////////////////////////////////////////////////////////
+
+        /// <summary>
+        /// Initializes the SQLite logging facilities.  The messages logged by
+        /// the SQLite core library continue to be delivered in the same way
+        /// as before, i.e. via the native callback unless the native log ring
+        /// buffer was previously selected.
         /// </summary>
         public static void Initialize()
+        {
+            bool useRing;
+
+            lock (syncRoot)
+            {
+                useRing = _ring;
+            }
+
+            Initialize(useRing);
+        }
+
+        ///////////////////////////////////////////////////////////////////////
+
+        /// <summary>
+        /// Initializes the SQLite logging facilities.
+        /// </summary>
+        /// <param name="useRing">
+        /// Non-zero to have the SQLite core library write the messages it logs
+        /// into the native log ring buffer, where they wait until the
+        /// <see cref="Drain" /> method is called.  This prevents any thread
+        /// that raises an error from being blocked by the log event handlers.
+        /// Zero to have the messages delivered to the log event handlers, via
+        /// the native callback, on the thread that raises them.
+        /// </param>
+        public static void Initialize(
+            bool useRing
+            )
         {
             //
             // BUFXIX: We cannot initialize the logging interface if the SQLite
@@ -191,17 +257,34 @@ namespace System.Data.SQLite
                 // NOTE: Create a single "global" (i.e. per-process) callback
                 //       to register with SQLite.  This callback will pass the
                 //       event on to any registered handler.  We only want to
-                //       do this once.
+                //       do this once, unless the native log ring buffer was
+                //       being used instead.
                 //
-                if (_callback == null)
+                if (useRing)
                 {
-                    _callback = new SQLiteLogCallback(LogCallback);
+                    if (!_ring)
+                    {
+                        SQLiteErrorCode rc = _sql.SetLogRing();
+
+                        if (rc != SQLiteErrorCode.Ok)
+                            throw new SQLiteException(rc,
+                                "Failed to initialize log ring buffer.");
+
+                        _ring = true;
+                    }
+                }
+                else if (_ring || (_callback == null))
+                {
+                    if (_callback == null)
+                        _callback = new SQLiteLogCallback(LogCallback);
 
                     SQLiteErrorCode rc = _sql.SetLogCallback(_callback);
 
                     if (rc != SQLiteErrorCode.Ok)
                         throw new SQLiteException(rc,
                             "Failed to initialize logging.");
+
+                    _ring = false;
                 }
 
                 //
@@ -274,6 +357,8 @@ namespace System.Data.SQLite
                     _callback = null;
                 }
 
+                _ring = false;
+
                 //
                 // NOTE: Remove the event handler for the DomainUnload event
                 //       that we added earlier.
@@ -289,6 +374,90 @@ namespace System.Data.SQLite
 
         ///////////////////////////////////////////////////////////////////////
 
+        /// <summary>
+        /// Reads all the messages waiting in the native log ring buffer and
+        /// raises the <see cref="Log" /> event for each of them, on the
+        /// calling thread.  This method does nothing unless the native log
+        /// ring buffer was selected via the <see cref="Initialize(bool)" />
+        /// method.
+        /// </summary>
+        /// <returns>
+        /// The number of messages read from the native log ring buffer.
+        /// </returns>
+        public static int Drain()
+        {
+            SQLiteBase sql;
+
+            lock (syncRoot)
+            {
+                if (!_ring || (_sql == null))
+                    return 0;
+
+                sql = _sql;
+            }
+
+            int count = 0;
+
+            lock (drainSyncRoot)
+            {
+                if (_ringBuffer == null)
+                    _ringBuffer = new byte[RingMessageSize];
+
+                int errorCode;
+                string message;
+
+                while (sql.ReadLogRing(_ringBuffer, out errorCode, out message))
+                {
+                    LogMessage(errorCode, message);
+                    count++;
+                }
+            }
+
+            return count;
+        }
+
+        ///////////////////////////////////////////////////////////////////////
+
+        /// <summary>
+        /// Returns the number of messages written into, and dropped by, the
+        /// native log ring buffer since the process started.  Messages are
+        /// dropped, rather than blocking the thread that raised them, when
+        /// the ring buffer is full because it has not been drained recently
+        /// enough.
+        /// </summary>
+        /// <param name="written">
+        /// Upon return, the number of messages written into the native log
+        /// ring buffer.
+        /// </param>
+        /// <param name="dropped">
+        /// Upon return, the number of messages dropped because the native log
+        /// ring buffer was full.
+        /// </param>
+        public static void GetRingStatistics(
+            out long written,
+            out long dropped
+            )
+        {
+            SQLiteBase sql;
+
+            lock (syncRoot)
+            {
+                sql = _sql;
+            }
+
+            if (sql != null)
+            {
+                sql.GetLogRingStatistics(out written, out dropped);
+            }
+            else
+            {
+                written = 0;
+                dropped = 0;
+            }
+        }
+
+        ///////////////////////////////////////////////////////////////////////
+
         /// <summary>
         /// This event is raised whenever SQLite raises a logging event.
         /// Note that this should be set as one of the first things in the
@@ -553,4 +722,213 @@ namespace System.Data.SQLite
 #endif
         }
     }
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// <summary>
+    /// Describes one execution of a statement that took longer than the slow
+    /// query threshold of its connection.
+    /// </summary>
+    public sealed class SQLiteSlowQuery
+    {
+        /// <summary>
+        /// The time, in UTC, when the execution ended.
+        /// </summary>
+        public readonly DateTime Time;
+
+        /// <summary>
+        /// The SQL text of the statement.
+        /// </summary>
+        public readonly string Sql;
+
+        /// <summary>
+        /// The names and shapes (i.e. the types and sizes, but not the values)
+        /// of the parameters bound to the statement.
+        /// </summary>
+        public readonly string Parameters;
+
+        /// <summary>
+        /// The time spent stepping the statement.
+        /// </summary>
+        public readonly TimeSpan Duration;
+
+        /// <summary>
+        /// The number of rows returned by the statement.
+        /// </summary>
+        public readonly long Rows;
+
+        /// <summary>
+        /// The output of EXPLAIN QUERY PLAN for the statement, one line per
+        /// row.  It is captured when the execution ends, by the thread that
+        /// executed the statement, so it reflects the schema and statistics
+        /// the statement ran with.  If the statement cannot be explained,
+        /// this is the error message.
+        /// </summary>
+        public readonly string Plan;
+
+        internal SQLiteSlowQuery(
+            DateTime time,
+            string sql,
+            string parameters,
+            TimeSpan duration,
+            long rows,
+            string plan
+            )
+        {
+            Time = time;
+            Sql = sql;
+            Parameters = parameters;
+            Duration = duration;
+            Rows = rows;
+            Plan = plan;
+        }
+
+        /// <summary>
+        /// Returns the text used to describe this slow query in a file.
+        /// </summary>
+        /// <returns>The description of this slow query.</returns>
+        public override string ToString()
+        {
+            return String.Format(CultureInfo.InvariantCulture,
+                "{0:yyyy-MM-dd HH:mm:ss.fff} {1:F3}ms {2} row(s): {3}{4}" +
+                "parameters: {5}{4}{6}", Time, Duration.TotalMilliseconds,
+                Rows, Sql, Environment.NewLine, Parameters, Plan);
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// <summary>
+    /// Keeps the most recent slow queries for a connection in a bounded ring,
+    /// from which they can be drained or written to a file.  When the ring is
+    /// full, the oldest slow query is dropped.  All the members of this class
+    /// are thread-safe.
+    /// </summary>
+    public sealed class SQLiteSlowQueryLog
+    {
+        private object syncRoot = new object();
+        private TimeSpan _threshold;
+        private SQLiteSlowQuery[] _entries;
+        private int _first;
+        private int _count;
+        private long _dropped;
+
+        internal SQLiteSlowQueryLog(
+            TimeSpan threshold,
+            int capacity
+            )
+        {
+            _threshold = threshold;
+            _entries = new SQLiteSlowQuery[(capacity > 0) ? capacity : 1];
+        }
+
+        /// <summary>
+        /// The minimum time spent stepping a statement for its execution to be
+        /// recorded.
+        /// </summary>
+        public TimeSpan Threshold
+        {
+            get { return _threshold; }
+        }
+
+        /// <summary>
+        /// The maximum number of slow queries kept.
+        /// </summary>
+        public int Capacity
+        {
+            get { return _entries.Length; }
+        }
+
+        /// <summary>
+        /// The number of slow queries currently kept.
+        /// </summary>
+        public int Count
+        {
+            get { lock (syncRoot) { return _count; } }
+        }
+
+        /// <summary>
+        /// The number of slow queries dropped because the ring was full.
+        /// </summary>
+        public long Dropped
+        {
+            get { lock (syncRoot) { return _dropped; } }
+        }
+
+        internal void Add(
+            SQLiteSlowQuery entry
+            )
+        {
+            lock (syncRoot)
+            {
+                if (_count == _entries.Length)
+                {
+                    _entries[_first] = entry;
+                    _first = (_first + 1) % _entries.Length;
+                    _dropped++;
+                }
+                else
+                {
+                    _entries[(_first + _count) % _entries.Length] = entry;
+                    _count++;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Removes and returns all the slow queries currently kept, oldest
+        /// first.
+        /// </summary>
+        /// <returns>The slow queries removed from the ring.</returns>
+        public SQLiteSlowQuery[] Drain()
+        {
+            lock (syncRoot)
+            {
+                SQLiteSlowQuery[] result = new SQLiteSlowQuery[_count];
+
+                for (int index = 0; index < _count; index++)
+                {
+                    int position = (_first + index) % _entries.Length;
+
+                    result[index] = _entries[position];
+                    _entries[position] = null;
+                }
+
+                _first = 0;
+                _count = 0;
+
+                return result;
+            }
+        }
+
+        /// <summary>
+        /// Removes all the slow queries currently kept and appends them to the
+        /// specified file, oldest first.
+        /// </summary>
+        /// <param name="fileName">The name of the file to append to.</param>
+        /// <returns>The number of slow queries written.</returns>
+        public int WriteTo(
+            string fileName
+            )
+        {
+            if (fileName == null)
+                throw new ArgumentNullException("fileName");
+
+            SQLiteSlowQuery[] entries = Drain();
+
+            if (entries.Length == 0)
+                return 0;
+
+            using (StreamWriter writer = new StreamWriter(fileName, true))
+            {
+                foreach (SQLiteSlowQuery entry in entries)
+                {
+                    writer.WriteLine(entry.ToString());
+                    writer.WriteLine();
+                }
+            }
+
+            return entries.Length;
+        }
+    }
 }
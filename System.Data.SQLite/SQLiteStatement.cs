@@ -10,6 +10,10 @@ namespace System.Data.SQLite
   using System;
   using System.Globalization;
 
+#if !SQLITE_STANDARD
+  using System.Text;
+#endif
+
   /// <summary>
   /// Represents a single SQL statement in SQLite.
   /// </summary>
@@ -51,6 +55,39 @@ namespace System.Data.SQLite
 
     private string[] _types;
 
+#if !SQLITE_STANDARD
+    private static Encoding _utf8 = new UTF8Encoding();
+
+    /// <summary>
+    /// The column values for the current row, as fetched by the native interop
+    /// assembly while stepping the statement.  This will be null unless the
+    /// <see cref="SQLiteConnectionFlags.FetchRowOnStep" /> connection flag is
+    /// in use.
+    /// </summary>
+    internal UnsafeNativeMethods.sqlite3_interop_column[] _columnValues;
+
+    /// <summary>
+    /// Non-zero if the <see cref="_columnValues" /> array contains the values
+    /// for the current row of this statement.
+    /// </summary>
+    internal bool _columnValuesValid;
+
+    /// <summary>
+    /// The execution statistics accumulated by the native interop assembly for
+    /// this statement.  This will be null unless the
+    /// <see cref="SQLiteConnectionFlags.ProfileStatements" /> connection flag
+    /// is in use.
+    /// </summary>
+    internal UnsafeNativeMethods.sqlite3_interop_profile[] _profile;
+
+    /// <summary>
+    /// The contents of <see cref="_profile" /> when the current execution of
+    /// this statement began.  This is used to find the statements that are
+    /// slow to execute.
+    /// </summary>
+    internal UnsafeNativeMethods.sqlite3_interop_profile _profileMark;
+#endif
+
     /// <summary>
     /// Initializes the statement and attempts to get all information about parameters in the statement
     /// </summary>
@@ -182,7 +219,128 @@ namespace System.Data.SQLite
         }
 
         return false;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    /// <summary>
+    /// Adds the execution statistics for this statement, if any, to the
+    /// specified profile.
+    /// </summary>
+    /// <param name="profile">The profile to add the statistics to.</param>
+    internal void AddProfile(SQLiteStatementProfile profile)
+    {
+#if !SQLITE_STANDARD
+        if (_profile != null)
+            profile.Add(_profile[0]);
+#endif
     }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+#if !SQLITE_STANDARD
+    /// <summary>
+    /// Describes the names and shapes (i.e. the types and sizes, but not the
+    /// values) of the parameters bound to this statement.
+    /// </summary>
+    /// <returns>The description of the bound parameters.</returns>
+    internal string GetParameterShapes()
+    {
+      if (_paramValues == null) return String.Empty;
+
+      StringBuilder builder = new StringBuilder();
+
+      for (int n = 0; n < _paramValues.Length; n++)
+      {
+        SQLiteParameter param = _paramValues[n];
+        object value = (param != null) ? param.Value : null;
+
+        if (n > 0) builder.Append(", ");
+
+        if (String.IsNullOrEmpty(_paramNames[n]) || (_paramNames[n][0] == ';'))
+          builder.AppendFormat(CultureInfo.InvariantCulture, "?{0}", n + 1);
+        else
+          builder.Append(_paramNames[n]);
+
+        builder.Append(' ');
+
+        if (param == null)
+          builder.Append("Unbound");
+        else if ((value == null) || (value is DBNull))
+          builder.Append("Null");
+        else if (value is string)
+          builder.AppendFormat(CultureInfo.InvariantCulture, "String({0})", ((string)value).Length);
+        else if (value is byte[])
+          builder.AppendFormat(CultureInfo.InvariantCulture, "Binary({0})", ((byte[])value).Length);
+        else
+          builder.Append(value.GetType().Name);
+      }
+
+      return builder.ToString();
+    }
+
+    /// <summary>
+    /// Causes the values of the first <paramref name="count" /> columns to be
+    /// fetched by the native interop assembly each time this statement is
+    /// stepped, using only one native call per row.
+    /// </summary>
+    /// <param name="count">The number of columns to fetch for each row.</param>
+    internal void EnableColumnValues(int count)
+    {
+        if ((_columnValues == null) || (_columnValues.Length != count))
+            _columnValues = new UnsafeNativeMethods.sqlite3_interop_column[count];
+
+        _columnValuesValid = false;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    /// <summary>
+    /// Attempts to fetch the value of a column from the current row, as it was
+    /// returned by the native interop assembly when this statement was stepped.
+    /// </summary>
+    /// <param name="index">The index of the column to fetch.</param>
+    /// <param name="affinity">
+    /// The type the value of the column must have for it to be returned.
+    /// </param>
+    /// <param name="column">
+    /// Upon success, the native column value structure; otherwise, undefined.
+    /// </param>
+    /// <returns>
+    /// Non-zero if the column value was available and of the requested type.
+    /// </returns>
+    internal bool TryGetColumnValue(
+        int index,
+        TypeAffinity affinity,
+        out UnsafeNativeMethods.sqlite3_interop_column column
+        )
+    {
+        if (_columnValuesValid && (index >= 0) && (index < _columnValues.Length))
+        {
+            column = _columnValues[index];
+
+            if (column.type != TypeAffinity.Uninitialized)
+            {
+                if ((affinity == TypeAffinity.Uninitialized) || (column.type == affinity))
+                    return true;
+
+                //
+                // NOTE: The caller is going to fetch this value via the SQLite
+                //       core library as some other type, which may invalidate
+                //       the text or blob pointer; therefore, stop using it.
+                //
+                if ((column.type == TypeAffinity.Text) || (column.type == TypeAffinity.Blob))
+                    _columnValues[index].type = TypeAffinity.Uninitialized;
+            }
+        }
+        else
+        {
+            column = new UnsafeNativeMethods.sqlite3_interop_column();
+        }
+
+        return false;
+    }
+#endif
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -229,6 +387,284 @@ namespace System.Data.SQLite
       }
     }
 
+    /// <summary>
+    /// Returns, for each parameter of this statement, the index of its parameter object within the
+    /// parameter collection of the command.  An index of -1 means the parameter was not supplied.
+    /// </summary>
+    internal int[] GetParameterIndexes()
+    {
+      int x = (_paramNames != null) ? _paramNames.Length : 0;
+      int[] indexes = new int[x];
+
+      for (int n = 0; n < x; n++)
+      {
+        indexes[n] = (_paramValues[n] != null) ? _command.Parameters.IndexOf(_paramValues[n]) : -1;
+      }
+      return indexes;
+    }
+
+    /// <summary>
+    /// Bind all parameters using one set of values instead of the values of the parameter objects.  The
+    /// data types of the parameter objects are still used to determine how each value is bound.
+    /// </summary>
+    /// <param name="values">The parameter values, in the same order as the parameter collection</param>
+    /// <param name="indexes">The parameter indexes, as returned by GetParameterIndexes</param>
+    internal void BindParameters(object[] values, int[] indexes)
+    {
+      int x = indexes.Length;
+      for (int n = 0; n < x; n++)
+      {
+        SQLiteParameter param = _paramValues[n];
+
+        if (param != null)
+          param = new SQLiteParameter(param.DbType, values[indexes[n]]);
+
+        BindParameter(n + 1, param);
+      }
+    }
+
+#if !SQLITE_STANDARD
+    /// <summary>
+    /// Attempts to pack multiple sets of parameter values into the column-major block used by the native
+    /// interop assembly to execute this statement once for each set.  This is only possible when all of the
+    /// values would be bound as an integer, double, text, or blob value by the BindParameter method, using
+    /// the same data type for all the values of a given parameter.  Otherwise, the caller must bind each
+    /// set of values in turn.
+    /// </summary>
+    /// <param name="parameterSets">The sets of parameter values, in the same order as the parameter collection</param>
+    /// <param name="indexes">The parameter indexes, as returned by GetParameterIndexes</param>
+    /// <param name="parameters">Upon success, the native parameter descriptors</param>
+    /// <param name="block">Upon success, the packed parameter values</param>
+    /// <returns>Non-zero if the parameter values were packed.</returns>
+    internal bool TryPackParameters(
+        object[][] parameterSets,
+        int[] indexes,
+        out UnsafeNativeMethods.sqlite3_interop_param[] parameters,
+        out byte[] block
+        )
+    {
+      parameters = null;
+      block = null;
+
+      if ((_flags & (SQLiteConnectionFlags.LogPreBind | SQLiteConnectionFlags.LogBind |
+          SQLiteConnectionFlags.BindAllAsText)) != SQLiteConnectionFlags.None)
+      {
+        return false;
+      }
+
+      int x = indexes.Length;
+      int rows = parameterSets.Length;
+      DbType[] types = new DbType[x];
+      UnsafeNativeMethods.sqlite3_interop_param[] packed = new UnsafeNativeMethods.sqlite3_interop_param[x];
+      int size = 0;
+      int dataSize = 0;
+
+      // First, determine the type of each parameter, the layout of the block, and the number of bytes
+      // needed for the text and blob values.
+      for (int n = 0; n < x; n++)
+      {
+        if (indexes[n] < 0) return false;
+
+        DbType type = _paramValues[n].DbType;
+        TypeAffinity affinity = TypeAffinity.Null;
+        bool hasNulls = false;
+
+        for (int row = 0; row < rows; row++)
+        {
+          object obj = parameterSets[row][indexes[n]];
+
+          if ((obj == null) || Convert.IsDBNull(obj))
+          {
+            hasNulls = true;
+            continue;
+          }
+
+          if (_paramValues[n].DbType == DbType.Object)
+          {
+            DbType objType = SQLiteConvert.TypeToDbType(obj.GetType());
+
+            if (type == DbType.Object)
+              type = objType;
+            else if (objType != type)
+              return false;
+          }
+
+          if (affinity == TypeAffinity.Null)
+          {
+            affinity = GetPackedAffinity(type);
+            if (affinity == TypeAffinity.Uninitialized) return false;
+          }
+
+          if (affinity == TypeAffinity.Text)
+          {
+            dataSize += _utf8.GetByteCount(obj.ToString());
+          }
+          else if (affinity == TypeAffinity.Blob)
+          {
+            byte[] bytes = obj as byte[];
+            if (bytes == null) return false;
+
+            dataSize += bytes.Length;
+          }
+        }
+
+        types[n] = type;
+        packed[n].type = affinity;
+        packed[n].iNulls = -1;
+
+        if (hasNulls && (affinity != TypeAffinity.Null))
+        {
+          packed[n].iNulls = size;
+          size += AlignPacked((rows + 7) / 8);
+        }
+
+        packed[n].iValues = size;
+
+        if ((affinity == TypeAffinity.Int64) || (affinity == TypeAffinity.Double))
+          size += AlignPacked(rows * sizeof(long));
+        else if ((affinity == TypeAffinity.Text) || (affinity == TypeAffinity.Blob))
+          size += AlignPacked((rows + 1) * sizeof(int));
+      }
+
+      byte[] packedBlock = new byte[size + dataSize];
+      int dataOffset = size;
+
+      // Next, copy the values into the block.
+      for (int n = 0; n < x; n++)
+      {
+        TypeAffinity affinity = packed[n].type;
+
+        if (affinity == TypeAffinity.Null)
+          continue;
+
+        long[] int64s = (affinity == TypeAffinity.Int64) ? new long[rows] : null;
+        double[] doubles = (affinity == TypeAffinity.Double) ? new double[rows] : null;
+        int[] offsets = ((affinity == TypeAffinity.Text) || (affinity == TypeAffinity.Blob)) ? new int[rows + 1] : null;
+
+        for (int row = 0; row < rows; row++)
+        {
+          object obj = parameterSets[row][indexes[n]];
+
+          if (offsets != null)
+            offsets[row] = dataOffset;
+
+          if ((obj == null) || Convert.IsDBNull(obj))
+          {
+            packedBlock[packed[n].iNulls + (row >> 3)] |= (byte)(1 << (row & 7));
+            continue;
+          }
+
+          switch (affinity)
+          {
+            case TypeAffinity.Int64:
+              int64s[row] = ToPackedInt64(obj, types[n]);
+              break;
+            case TypeAffinity.Double:
+              doubles[row] = Convert.ToDouble(obj, CultureInfo.CurrentCulture);
+              break;
+            case TypeAffinity.Text:
+              {
+                string text = obj.ToString();
+                dataOffset += _utf8.GetBytes(text, 0, text.Length, packedBlock, dataOffset);
+                break;
+              }
+            case TypeAffinity.Blob:
+              {
+                byte[] bytes = (byte[])obj;
+                Buffer.BlockCopy(bytes, 0, packedBlock, dataOffset, bytes.Length);
+                dataOffset += bytes.Length;
+                break;
+              }
+          }
+        }
+
+        if (int64s != null)
+          Buffer.BlockCopy(int64s, 0, packedBlock, packed[n].iValues, rows * sizeof(long));
+        else if (doubles != null)
+          Buffer.BlockCopy(doubles, 0, packedBlock, packed[n].iValues, rows * sizeof(double));
+        else
+        {
+          offsets[rows] = dataOffset;
+          Buffer.BlockCopy(offsets, 0, packedBlock, packed[n].iValues, (rows + 1) * sizeof(int));
+        }
+      }
+
+      parameters = packed;
+      block = packedBlock;
+      return true;
+    }
+
+    /// <summary>
+    /// Returns the type of native value the BindParameter method would bind for the specified data type,
+    /// or TypeAffinity.Uninitialized if it cannot be packed.
+    /// </summary>
+    private TypeAffinity GetPackedAffinity(DbType type)
+    {
+      switch (type)
+      {
+        case DbType.Boolean:
+        case DbType.SByte:
+        case DbType.Int16:
+        case DbType.Int32:
+        case DbType.Int64:
+        case DbType.Byte:
+        case DbType.UInt16:
+          return TypeAffinity.Int64;
+        case DbType.UInt32:
+          if ((_flags & SQLiteConnectionFlags.BindUInt32AsInt64) == SQLiteConnectionFlags.BindUInt32AsInt64)
+            return TypeAffinity.Int64;
+          return TypeAffinity.Uninitialized;
+        case DbType.Single:
+        case DbType.Double:
+        case DbType.Currency:
+          return TypeAffinity.Double;
+        case DbType.Binary:
+          return TypeAffinity.Blob;
+        case DbType.String:
+        case DbType.StringFixedLength:
+        case DbType.AnsiString:
+        case DbType.AnsiStringFixedLength:
+          return TypeAffinity.Text;
+        default:
+          return TypeAffinity.Uninitialized;
+      }
+    }
+
+    /// <summary>
+    /// Converts a value to a 64-bit integer in the same way the BindParameter method does.
+    /// </summary>
+    private static long ToPackedInt64(object obj, DbType type)
+    {
+      switch (type)
+      {
+        case DbType.Boolean:
+          return ToBoolean(obj, CultureInfo.CurrentCulture) ? 1 : 0;
+        case DbType.SByte:
+          return Convert.ToSByte(obj, CultureInfo.CurrentCulture);
+        case DbType.Int16:
+          return Convert.ToInt16(obj, CultureInfo.CurrentCulture);
+        case DbType.Int32:
+          return Convert.ToInt32(obj, CultureInfo.CurrentCulture);
+        case DbType.Byte:
+          return Convert.ToByte(obj, CultureInfo.CurrentCulture);
+        case DbType.UInt16:
+          return Convert.ToUInt16(obj, CultureInfo.CurrentCulture);
+        case DbType.UInt32:
+          return Convert.ToUInt32(obj, CultureInfo.CurrentCulture);
+        default:
+          return Convert.ToInt64(obj, CultureInfo.CurrentCulture);
+      }
+    }
+
+    /// <summary>
+    /// Rounds a size within the packed parameter block up to a multiple of eight bytes.
+    /// </summary>
+    private static int AlignPacked(int size)
+    {
+      return (size + 7) & ~7;
+    }
+#endif
+
     /// <summary>
     /// Attempts to convert an arbitrary object to the Boolean data type.
     /// Null object values are converted to false.  Throws a SQLiteException
@@ -411,4 +847,233 @@ namespace System.Data.SQLite
       _types = types;
     }
   }
+
+  /// <summary>
+  /// This class contains the execution statistics collected for the statements
+  /// of a command when the <see cref="SQLiteConnectionFlags.ProfileStatements" />
+  /// connection flag is in use.  The statistics are cumulative over all the
+  /// executions of the command since its statements were last prepared.
+  /// </summary>
+  public sealed class SQLiteStatementProfile
+  {
+    private long _prepareTime;
+    private long _stepTime;
+    private long _steps;
+    private long _rows;
+    private long _fullScanSteps;
+    private long _sorts;
+    private long _autoIndexes;
+    private long _virtualMachineSteps;
+
+    internal SQLiteStatementProfile()
+    {
+    }
+
+#if !SQLITE_STANDARD
+    internal void Add(UnsafeNativeMethods.sqlite3_interop_profile profile)
+    {
+      _prepareTime += profile.nPrepareTime;
+      _stepTime += profile.nStepTime;
+      _steps += profile.nStep;
+      _rows += profile.nRow;
+      _fullScanSteps += profile.nFullscanStep;
+      _sorts += profile.nSort;
+      _autoIndexes += profile.nAutoindex;
+      _virtualMachineSteps += profile.nVmStep;
+    }
+#endif
+
+    /// <summary>
+    /// The time spent preparing the statements.
+    /// </summary>
+    public TimeSpan PrepareTime
+    {
+      get { return new TimeSpan(_prepareTime / 100); }
+    }
+
+    /// <summary>
+    /// The time spent stepping the statements, i.e. executing them and
+    /// fetching their rows.
+    /// </summary>
+    public TimeSpan StepTime
+    {
+      get { return new TimeSpan(_stepTime / 100); }
+    }
+
+    /// <summary>
+    /// The number of times the statements were stepped.
+    /// </summary>
+    public long Steps
+    {
+      get { return _steps; }
+    }
+
+    /// <summary>
+    /// The number of rows returned by the statements.
+    /// </summary>
+    public long Rows
+    {
+      get { return _rows; }
+    }
+
+    /// <summary>
+    /// The number of times a table or index was stepped forward as part of a
+    /// full scan.  Large values may indicate missing indexes.
+    /// </summary>
+    public long FullScanSteps
+    {
+      get { return _fullScanSteps; }
+    }
+
+    /// <summary>
+    /// The number of sort operations.  Non-zero values may indicate that an
+    /// index could be used to avoid the sorting.
+    /// </summary>
+    public long Sorts
+    {
+      get { return _sorts; }
+    }
+
+    /// <summary>
+    /// The number of rows inserted into transient indexes that were created
+    /// automatically to help joins run faster.
+    /// </summary>
+    public long AutoIndexes
+    {
+      get { return _autoIndexes; }
+    }
+
+    /// <summary>
+    /// The number of virtual machine operations executed.
+    /// </summary>
+    public long VirtualMachineSteps
+    {
+      get { return _virtualMachineSteps; }
+    }
+  }
+
+#if !SQLITE_STANDARD
+  /// <summary>
+  /// This internal class holds the columnar buffers used to fetch multiple
+  /// rows from a statement using only one native call.  The values for each
+  /// column are stored contiguously, i.e. the value for column C of row R is
+  /// located at the index C * Rows + R of each buffer.
+  /// </summary>
+  internal sealed class SQLiteStatementBatch
+  {
+    /// <summary>
+    /// The initial size, in bytes, of the arena used to hold the text and blob
+    /// values.  It will be grown as necessary to hold at least one row.
+    /// </summary>
+    private const int DefaultArenaSize = 65536;
+
+    /// <summary>
+    /// The largest possible arena, in bytes, which is the maximum length of a
+    /// byte array.
+    /// </summary>
+    private const int MaximumArenaSize = 0x7FFFFFC7;
+
+    private static Encoding _utf8 = new UTF8Encoding();
+
+    /// <summary>
+    /// The number of columns fetched for each row.
+    /// </summary>
+    internal int _columns;
+    /// <summary>
+    /// The maximum number of rows that can be fetched at once.
+    /// </summary>
+    internal int _rows;
+    /// <summary>
+    /// The number of rows fetched by the last native call.
+    /// </summary>
+    internal int _count;
+
+    internal byte[] _types;
+    internal long[] _int64s;
+    internal double[] _doubles;
+    internal int[] _offsets;
+    internal int[] _bytes;
+    internal byte[] _arena;
+
+    /// <summary>
+    /// Constructs the columnar buffers for a batch.
+    /// </summary>
+    /// <param name="columns">The number of columns fetched for each row.</param>
+    /// <param name="rows">The maximum number of rows to fetch at once.</param>
+    internal SQLiteStatementBatch(int columns, int rows)
+    {
+      if (columns < 0)
+        throw new ArgumentOutOfRangeException("columns");
+
+      if (rows <= 0)
+        throw new ArgumentOutOfRangeException("rows");
+
+      int size = columns * rows;
+
+      _columns = columns;
+      _rows = rows;
+      _types = new byte[size];
+      _int64s = new long[size];
+      _doubles = new double[size];
+      _offsets = new int[size];
+      _bytes = new int[size];
+      _arena = new byte[DefaultArenaSize];
+    }
+
+    /// <summary>
+    /// Makes sure the arena can hold at least the specified number of bytes.
+    /// </summary>
+    /// <param name="size">The minimum size of the arena, in bytes.</param>
+    /// <exception cref="SQLiteException">No array can hold that many bytes.</exception>
+    internal void GrowArena(int size)
+    {
+      long newSize = Math.Max(_arena.Length, 1);
+
+      if (size > MaximumArenaSize)
+        throw new SQLiteException(SQLiteErrorCode.TooBig, String.Format(
+            CultureInfo.CurrentCulture,
+            "Row needs {0} bytes for its text and blob values, more than the {1} bytes a batch can hold",
+            size, MaximumArenaSize));
+
+      while (newSize < size)
+        newSize *= 2;
+
+      if (newSize > MaximumArenaSize)
+        newSize = MaximumArenaSize;
+
+      if (newSize != _arena.Length)
+        _arena = new byte[newSize];
+    }
+
+    /// <summary>
+    /// Returns the value of a column in one of the fetched rows, based on its
+    /// storage class (i.e. Int64, Double, String, byte[], or DBNull).
+    /// </summary>
+    /// <param name="column">The index of the column.</param>
+    /// <param name="row">The index of the row within the batch.</param>
+    /// <returns>The value of the column.</returns>
+    internal object GetValue(int column, int row)
+    {
+      int index = (column * _rows) + row;
+
+      switch ((TypeAffinity)_types[index])
+      {
+        case TypeAffinity.Int64:
+          return _int64s[index];
+        case TypeAffinity.Double:
+          return _doubles[index];
+        case TypeAffinity.Text:
+          return _utf8.GetString(_arena, _offsets[index], _bytes[index]);
+        case TypeAffinity.Blob:
+          {
+            byte[] value = new byte[_bytes[index]];
+            Array.Copy(_arena, _offsets[index], value, 0, value.Length);
+            return value;
+          }
+        default:
+          return DBNull.Value;
+      }
+    }
+  }
+#endif
 }
@@ -800,6 +800,58 @@ namespace System.Data.SQLite
 
     [DllImport(SQLITE_DLL)]
     internal static extern int sqlite3_changes_interop(IntPtr db);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_step_row_interop(IntPtr stmt, [Out] sqlite3_interop_column[] columns, int count, int text16, [In, Out] sqlite3_interop_profile[] profile);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_step_profile_interop(IntPtr stmt, [In, Out] sqlite3_interop_profile[] profile);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_prepare_profile_interop(IntPtr db, IntPtr pSql, int nBytes, out IntPtr stmt, out IntPtr ptrRemain, out int nRemain, [In, Out] sqlite3_interop_profile[] profile);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_execute_many_interop(IntPtr stmt, sqlite3_interop_param[] parameters, int count, byte[] block, int rows, int row, [Out] int[] changes, out int failedRow, [In, Out] sqlite3_interop_profile[] profile);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_config_log_ring_interop();
+
+#if INTEROP_EXTENSION_FUNCTIONS
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_config_functions_interop(int lazy);
+#endif
+
+#if INTEROP_CODEC
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_rekey_interop(IntPtr db, byte[] key, int keylen, int pagesPerBatch, SQLiteRekeyCallback callback, IntPtr pvUser);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_shutdown_interop();
+#endif
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern int sqlite3_log_ring_read_interop(out int errorCode, [Out] byte[] buffer, int bufferSize);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern void sqlite3_log_ring_status_interop(out long written, out long dropped);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_busy_backoff_interop(IntPtr db, int timeout, int minimumDelay, int maximumDelay);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_busy_deadline_interop(IntPtr db, int remaining);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_busy_backoff_status_interop(IntPtr db, out long busy, out long retries, out long waitMilliseconds, out long timeouts);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_statement_cache_interop(IntPtr db, int maximumCount, int maximumBytes);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_statement_cache_status_interop(IntPtr db, out int count, out int bytes, out long hits, out long misses);
+
+    [DllImport(SQLITE_DLL)]
+    internal static extern SQLiteErrorCode sqlite3_step_batch_interop(IntPtr stmt, int current, int columns, int rows, [Out] byte[] types, [Out] long[] int64s, [Out] double[] doubles, [Out] int[] offsets, [Out] int[] bytes, [Out] byte[] arena, int arenaSize, out int arenaUsed, out int count, [In, Out] sqlite3_interop_profile[] profile);
 #endif
 // !SQLITE_STANDARD
 
@@ -2157,6 +2209,54 @@ namespace System.Data.SQLite
         public double estimatedCost; /* Estimated cost of using this index */
     }
 #endif
+
+    ///////////////////////////////////////////////////////////////////////////
+
+#if !SQLITE_STANDARD
+    [StructLayout(LayoutKind.Explicit)]
+    internal struct sqlite3_interop_column
+    {
+        [FieldOffset(0)]
+        public TypeAffinity type; /* SQLITE_INTEGER, SQLITE_FLOAT, etc. */
+        [FieldOffset(4)]
+        public int nBytes;        /* Number of bytes for text and blob */
+        [FieldOffset(8)]
+        public long i;            /* Value for SQLITE_INTEGER */
+        [FieldOffset(8)]
+        public double r;          /* Value for SQLITE_FLOAT */
+        [FieldOffset(8)]
+        public IntPtr p;          /* Value for SQLITE_TEXT and SQLITE_BLOB */
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct sqlite3_interop_param
+    {
+        public TypeAffinity type; /* SQLITE_INTEGER, SQLITE_FLOAT, etc. */
+        public int iNulls;        /* Offset of the null bitmap or -1 for none */
+        public int iValues;       /* Offset of the values (or value offsets) */
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct sqlite3_interop_profile
+    {
+        public long nPrepareTime; /* Nanoseconds spent preparing */
+        public long nStepTime;    /* Nanoseconds spent stepping */
+        public long nStep;        /* Number of calls to sqlite3_step() */
+        public long nRow;         /* Number of rows returned */
+        public long nFullscanStep; /* SQLITE_STMTSTATUS_FULLSCAN_STEP */
+        public long nSort;        /* SQLITE_STMTSTATUS_SORT */
+        public long nAutoindex;   /* SQLITE_STMTSTATUS_AUTOINDEX */
+        public long nVmStep;      /* SQLITE_STMTSTATUS_VM_STEP */
+        public uint iFullscanStep; /* Last value of SQLITE_STMTSTATUS_FULLSCAN_STEP */
+        public uint iSort;        /* Last value of SQLITE_STMTSTATUS_SORT */
+        public uint iAutoindex;   /* Last value of SQLITE_STMTSTATUS_AUTOINDEX */
+        public uint iVmStep;      /* Last value of SQLITE_STMTSTATUS_VM_STEP */
+    }
+#endif
     #endregion
   }
 